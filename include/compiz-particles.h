@@ -0,0 +1,320 @@
+/*
+ * Compiz particle integrator
+ *
+ * compiz-particles.h
+ *
+ * Stepping of the flakes of the snow, fireflies and stars plugins.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef _COMPIZ_PARTICLES_H
+#define _COMPIZ_PARTICLES_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#include <compiz-core.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+/*
+ * The moving part of a set of particles, kept as one array per component
+ * so a step is a few passes over contiguous floats.  Anything else about
+ * a particle (texture, colour, ...) stays with the plugin, at the same
+ * index.
+ */
+typedef struct _ParticleSystem
+{
+    int numParticles;
+
+    float *x, *y, *z;     /* position */
+    float *xs, *ys, *zs;  /* speed, multiplied by the step scale */
+    float *ra, *rs;       /* rotation angle and speed */
+    float *age, *lifespan;
+
+    int *dead;            /* filled by particlesFindDead */
+} ParticleSystem;
+
+#define PARTICLE_ARRAYS 10
+
+/* particles die on or outside of these, FLT_MAX leaves a side open */
+typedef struct _ParticleBounds
+{
+    float x1, y1, z1;
+    float x2, y2, z2;
+} ParticleBounds;
+
+static inline void
+particlesInit (ParticleSystem *ps)
+{
+    memset (ps, 0, sizeof (ParticleSystem));
+}
+
+static inline void
+particlesFini (ParticleSystem *ps)
+{
+    if (ps->x)
+	free (ps->x);
+    if (ps->dead)
+	free (ps->dead);
+
+    particlesInit (ps);
+}
+
+/* contents are undefined after a resize, all particles must be respawned */
+static inline Bool
+particlesResize (ParticleSystem *ps,
+		 int            numParticles)
+{
+    float *data;
+    int   *dead;
+    int   n = numParticles;
+
+    if (n <= 0)
+    {
+	particlesFini (ps);
+	return TRUE;
+    }
+
+    /* on failure the system is left empty rather than half resized */
+    data = realloc (ps->x, n * PARTICLE_ARRAYS * sizeof (float));
+    if (!data)
+    {
+	particlesFini (ps);
+	return FALSE;
+    }
+    ps->x = data;
+
+    dead = realloc (ps->dead, n * sizeof (int));
+    if (!dead)
+    {
+	particlesFini (ps);
+	return FALSE;
+    }
+    ps->dead = dead;
+
+    ps->y        = data + n;
+    ps->z        = data + n * 2;
+    ps->xs       = data + n * 3;
+    ps->ys       = data + n * 4;
+    ps->zs       = data + n * 5;
+    ps->ra       = data + n * 6;
+    ps->rs       = data + n * 7;
+    ps->age      = data + n * 8;
+    ps->lifespan = data + n * 9;
+
+    ps->numParticles = n;
+
+    return TRUE;
+}
+
+/*
+ * Collect the particles that left the bounds or outlived their lifespan
+ * into ps->dead, without branching per particle.  Returns their number.
+ */
+static inline int
+particlesFindDead (ParticleSystem       *ps,
+		   const ParticleBounds *b)
+{
+    int i, nDead = 0;
+
+    for (i = 0; i < ps->numParticles; i++)
+    {
+	int out = (ps->x[i] <= b->x1) | (ps->x[i] >= b->x2) |
+		  (ps->y[i] <= b->y1) | (ps->y[i] >= b->y2) |
+		  (ps->z[i] <= b->z1) | (ps->z[i] >= b->z2) |
+		  (ps->age[i] > ps->lifespan[i]);
+
+	ps->dead[nDead] = i;
+	nDead += out;
+    }
+
+    return nDead;
+}
+
+static inline void
+particlesAdd (float       *v,
+	      const float *dv,
+	      float       scale,
+	      int         n)
+{
+    int i = 0;
+
+#ifdef __SSE__
+    __m128 s = _mm_set1_ps (scale);
+
+    for (; i + 4 <= n; i += 4)
+	_mm_storeu_ps (v + i, _mm_add_ps (_mm_loadu_ps (v + i),
+					  _mm_mul_ps (_mm_loadu_ps (dv + i),
+						      s)));
+#endif
+
+    for (; i < n; i++)
+	v[i] += dv[i] * scale;
+}
+
+/*
+ * Move every particle by its speed times scale, turn it by its rotation
+ * speed times rotScale and age it by ageStep.
+ */
+static inline void
+particlesIntegrate (ParticleSystem *ps,
+		    float          scale,
+		    float          rotScale,
+		    float          ageStep)
+{
+    int i, n = ps->numParticles;
+
+    particlesAdd (ps->x, ps->xs, scale, n);
+    particlesAdd (ps->y, ps->ys, scale, n);
+    particlesAdd (ps->z, ps->zs, scale, n);
+
+    if (rotScale != 0.0f)
+	particlesAdd (ps->ra, ps->rs, rotScale, n);
+
+    if (ageStep != 0.0f)
+	for (i = 0; i < n; i++)
+	    ps->age[i] += ageStep;
+}
+
+/*
+ * Cubic Bezier speed curves.  Their Bernstein weights depend only on the
+ * time along the curve, so they are looked up once per particle from a
+ * table of quantised times and shared by every axis.
+ */
+#define PARTICLE_BEZIER_STEPS 1024
+
+typedef struct _ParticleBezierTable
+{
+    float w[PARTICLE_BEZIER_STEPS + 1][4];
+} ParticleBezierTable;
+
+static inline void
+particleBezierWeights (float t,
+		       float *w)
+{
+    float e = 1.0f - t;
+
+    w[0] = e * e * e;
+    w[1] = 3.0f * e * e * t;
+    w[2] = 3.0f * e * t * t;
+    w[3] = t * t * t;
+}
+
+static inline void
+particlesInitBezierTable (ParticleBezierTable *table)
+{
+    int i;
+
+    for (i = 0; i <= PARTICLE_BEZIER_STEPS; i++)
+	particleBezierWeights ((float) i / PARTICLE_BEZIER_STEPS, table->w[i]);
+}
+
+/* weights of the nearest quantised time, t is clamped to [0, 1] */
+static inline const float *
+particlesBezierLookup (const ParticleBezierTable *table,
+		       float                     t)
+{
+    int i = t * PARTICLE_BEZIER_STEPS + 0.5f;
+
+    if (i < 0)
+	i = 0;
+    else if (i > PARTICLE_BEZIER_STEPS)
+	i = PARTICLE_BEZIER_STEPS;
+
+    return table->w[i];
+}
+
+/* control point k of the curve of axis a of particle i is p[a][k][i] */
+typedef struct _ParticleCurves
+{
+    float *p[3][4];
+    float *t;        /* time along the curves */
+} ParticleCurves;
+
+#define PARTICLE_CURVE_ARRAYS 13
+
+static inline void
+particleCurvesInit (ParticleCurves *pc)
+{
+    memset (pc, 0, sizeof (ParticleCurves));
+}
+
+static inline void
+particleCurvesFini (ParticleCurves *pc)
+{
+    if (pc->t)
+	free (pc->t);
+
+    particleCurvesInit (pc);
+}
+
+/* like particlesResize, contents are undefined afterwards */
+static inline Bool
+particleCurvesResize (ParticleCurves *pc,
+		      int            numParticles)
+{
+    float *data;
+    int   a, k, n = numParticles;
+
+    if (n <= 0)
+    {
+	particleCurvesFini (pc);
+	return TRUE;
+    }
+
+    data = realloc (pc->t, n * PARTICLE_CURVE_ARRAYS * sizeof (float));
+    if (!data)
+    {
+	particleCurvesFini (pc);
+	return FALSE;
+    }
+
+    pc->t = data;
+    for (a = 0; a < 3; a++)
+	for (k = 0; k < 4; k++)
+	    pc->p[a][k] = data + n * (1 + a * 4 + k);
+
+    return TRUE;
+}
+
+/*
+ * Set the speed of every particle to its curves at its time, in a single
+ * pass over all particles.
+ */
+static inline void
+particlesEvalCurves (ParticleSystem            *ps,
+		     const ParticleCurves      *pc,
+		     const ParticleBezierTable *table)
+{
+    float *speed[3];
+    int   i, a;
+
+    speed[0] = ps->xs;
+    speed[1] = ps->ys;
+    speed[2] = ps->zs;
+
+    for (i = 0; i < ps->numParticles; i++)
+    {
+	const float *w = particlesBezierLookup (table, pc->t[i]);
+
+	for (a = 0; a < 3; a++)
+	    speed[a][i] = w[0] * pc->p[a][0][i] + w[1] * pc->p[a][1][i] +
+			  w[2] * pc->p[a][2][i] + w[3] * pc->p[a][3][i];
+    }
+}
+
+#endif
@@ -0,0 +1,765 @@
+/*
+ * Compiz sprite atlas
+ *
+ * compiz-sprite-atlas.h
+ *
+ * Packing of the sprite images of the snow, fireflies, stars and elements
+ * plugins into a single texture, so a whole particle field can be drawn
+ * with one call.  The images are decoded one at a time from a timeout,
+ * so loading many of them does not stall painting, and kept for later
+ * loads.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef _COMPIZ_SPRITE_ATLAS_H
+#define _COMPIZ_SPRITE_ATLAS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include <compiz-core.h>
+
+/* transparent texels around every sprite, so filtering does not pick up
+   its neighbours */
+#define SPRITE_ATLAS_PADDING 2
+
+/* bytes of decoded images kept around for later loads */
+#define SPRITE_CACHE_SIZE (4 * 1024 * 1024)
+
+/* interval in ms between the images decoded by a running load */
+#define SPRITE_ATLAS_SLICE 10
+
+typedef struct _SpriteAtlasSprite
+{
+    Bool loaded;
+
+    unsigned int width;   /* of the image */
+    unsigned int height;
+
+    int x, y;             /* of the image in the atlas */
+
+    /* corners (0, 0), (0, height), (width, height) and (width, 0) of the
+       image, in the order spriteQuad emits them */
+    GLfloat texCoords[8];
+} SpriteAtlasSprite;
+
+/* a decoded image, found by the name and contents of its file */
+typedef struct _SpriteCacheEntry
+{
+    struct _SpriteCacheEntry *next;
+
+    char         *name;
+    unsigned int key;      /* see spriteFileKey */
+    int          width, height;
+    void         *image;
+    unsigned int lastUse;  /* serial of the last atlas using it */
+} SpriteCacheEntry;
+
+typedef struct _SpriteAtlasFile
+{
+    char             *name;
+    unsigned int     key;
+    SpriteCacheEntry *entry;   /* NULL while it still has to be decoded */
+
+    void *image;               /* decoded by spriteAtlasDecodeNext */
+    int  width, height;
+} SpriteAtlasFile;
+
+typedef struct _SpriteAtlasJob
+{
+    SpriteAtlasFile *files;
+    int             nFiles;
+    int             next;      /* file to decode next */
+} SpriteAtlasJob;
+
+/* called once a load has been uploaded */
+typedef void (*SpriteAtlasLoadedProc) (CompScreen *s);
+
+typedef struct _SpriteAtlas
+{
+    CompTexture texture;
+
+    SpriteAtlasSprite *sprites;  /* one per file, loaded or not */
+    int               nSprites;
+    int               nLoaded;
+
+    CompScreen            *s;
+    const char            *plugin;
+    SpriteAtlasLoadedProc loaded;
+
+    SpriteAtlasJob    *job;      /* being decoded */
+    SpriteAtlasJob    *pending;  /* requested while job was decoded */
+    CompTimeoutHandle timeoutHandle;
+
+    SpriteCacheEntry *cache;
+    size_t           cacheSize;
+    unsigned int     serial;
+} SpriteAtlas;
+
+static inline void
+spriteAtlasInit (CompScreen            *s,
+		 SpriteAtlas           *atlas,
+		 const char            *plugin,
+		 SpriteAtlasLoadedProc loaded)
+{
+    memset (atlas, 0, sizeof (SpriteAtlas));
+    initTexture (s, &atlas->texture);
+
+    atlas->s      = s;
+    atlas->plugin = plugin;
+    atlas->loaded = loaded;
+}
+
+/* drop the texture and sprites, the cache stays */
+static inline void
+spriteAtlasRelease (SpriteAtlas *atlas)
+{
+    finiTexture (atlas->s, &atlas->texture);
+    initTexture (atlas->s, &atlas->texture);
+
+    if (atlas->sprites)
+	free (atlas->sprites);
+
+    atlas->sprites  = NULL;
+    atlas->nSprites = 0;
+    atlas->nLoaded  = 0;
+}
+
+static inline void
+spriteAtlasFreeJob (SpriteAtlasJob *job)
+{
+    int i;
+
+    for (i = 0; i < job->nFiles; i++)
+    {
+	if (job->files[i].name)
+	    free (job->files[i].name);
+	if (job->files[i].image)
+	    free (job->files[i].image);
+    }
+
+    if (job->files)
+	free (job->files);
+    free (job);
+}
+
+static inline void
+spriteAtlasFini (CompScreen  *s,
+		 SpriteAtlas *atlas)
+{
+    SpriteCacheEntry *entry, *next;
+
+    if (atlas->timeoutHandle)
+	compRemoveTimeout (atlas->timeoutHandle);
+
+    if (atlas->job)
+	spriteAtlasFreeJob (atlas->job);
+
+    if (atlas->pending)
+	spriteAtlasFreeJob (atlas->pending);
+
+    finiTexture (s, &atlas->texture);
+
+    if (atlas->sprites)
+	free (atlas->sprites);
+
+    for (entry = atlas->cache; entry; entry = next)
+    {
+	next = entry->next;
+
+	free (entry->name);
+	free (entry->image);
+	free (entry);
+    }
+
+    memset (atlas, 0, sizeof (SpriteAtlas));
+}
+
+static inline unsigned int
+spriteHash (unsigned int hash,
+	    const void   *data,
+	    size_t       size)
+{
+    const unsigned char *p = data;
+
+    /* FNV-1a */
+    while (size--)
+	hash = (hash ^ *p++) * 16777619u;
+
+    return hash;
+}
+
+/*
+ * Identifies the contents of file name by its size and modification time,
+ * looked up in the places the image plugins search, so an edited image is
+ * decoded again while an unchanged one is reused.
+ */
+static inline unsigned int
+spriteFileKey (const char *name)
+{
+    struct stat  st;
+    unsigned int key;
+    const char   *home = getenv ("HOME");
+    char         *path = NULL;
+    Bool         found;
+
+    key = spriteHash (2166136261u, name, strlen (name));
+
+    found = stat (name, &st) == 0;
+
+    if (!found && home && name[0] != '/')
+    {
+	path = malloc (strlen (home) + strlen (name) + 18);
+	if (path)
+	{
+	    sprintf (path, "%s/.compiz/images/%s", home, name);
+	    found = stat (path, &st) == 0;
+	    free (path);
+	}
+    }
+
+#ifdef IMAGEDIR
+    if (!found && name[0] != '/')
+    {
+	path = malloc (strlen (IMAGEDIR) + strlen (name) + 2);
+	if (path)
+	{
+	    sprintf (path, "%s/%s", IMAGEDIR, name);
+	    found = stat (path, &st) == 0;
+	    free (path);
+	}
+    }
+#endif
+
+    if (found)
+    {
+	key = spriteHash (key, &st.st_size, sizeof (st.st_size));
+	key = spriteHash (key, &st.st_mtime, sizeof (st.st_mtime));
+    }
+
+    return key;
+}
+
+static inline SpriteCacheEntry *
+spriteCacheLookup (SpriteAtlas  *atlas,
+		   const char   *name,
+		   unsigned int key)
+{
+    SpriteCacheEntry *entry;
+
+    for (entry = atlas->cache; entry; entry = entry->next)
+	if (entry->key == key && strcmp (entry->name, name) == 0)
+	    return entry;
+
+    return NULL;
+}
+
+/* hand the images decoded for job over to the cache */
+static inline void
+spriteCacheAdd (SpriteAtlas    *atlas,
+		SpriteAtlasJob *job)
+{
+    int i;
+
+    for (i = 0; i < job->nFiles; i++)
+    {
+	SpriteAtlasFile  *file = &job->files[i];
+	SpriteCacheEntry *entry;
+
+	if (file->entry)
+	    continue;
+
+	if (!file->image)
+	{
+	    compLogMessage (atlas->plugin, CompLogLevelWarn,
+			    "Texture not found : %s", file->name);
+	    continue;
+	}
+
+	/* the same file may be listed more than once */
+	entry = spriteCacheLookup (atlas, file->name, file->key);
+	if (entry)
+	{
+	    file->entry = entry;
+	    continue;
+	}
+
+	entry = malloc (sizeof (SpriteCacheEntry));
+	if (!entry)
+	    continue;
+
+	entry->name = strdup (file->name);
+	if (!entry->name)
+	{
+	    free (entry);
+	    continue;
+	}
+
+	entry->key     = file->key;
+	entry->width   = file->width;
+	entry->height  = file->height;
+	entry->image   = file->image;
+	entry->lastUse = atlas->serial;
+	entry->next    = atlas->cache;
+
+	atlas->cache      = entry;
+	atlas->cacheSize += entry->width * entry->height * 4;
+
+	file->image = NULL;
+	file->entry = entry;
+    }
+}
+
+/* evict the images the atlas does not use, least recently used first */
+static inline void
+spriteCacheTrim (SpriteAtlas *atlas)
+{
+    while (atlas->cacheSize > SPRITE_CACHE_SIZE)
+    {
+	SpriteCacheEntry *entry, **prev, **oldest = NULL;
+
+	for (prev = &atlas->cache; (entry = *prev); prev = &entry->next)
+	{
+	    if (entry->lastUse == atlas->serial)
+		continue;
+
+	    if (!oldest || entry->lastUse < (*oldest)->lastUse)
+		oldest = prev;
+	}
+
+	if (!oldest)
+	    break;
+
+	entry   = *oldest;
+	*oldest = entry->next;
+
+	atlas->cacheSize -= entry->width * entry->height * 4;
+
+	free (entry->name);
+	free (entry->image);
+	free (entry);
+    }
+}
+
+/*
+ * Decode the next image of job that is not cached.  Returns FALSE once
+ * there is nothing left to decode.  readImageFromFile goes through the
+ * fileToImage wrap chain of the display, so this has to run on the main
+ * thread.
+ */
+static inline Bool
+spriteAtlasDecodeNext (CompDisplay    *d,
+		       SpriteAtlasJob *job)
+{
+    SpriteAtlasFile *file;
+
+    while (job->next < job->nFiles && job->files[job->next].entry)
+	job->next++;
+
+    if (job->next == job->nFiles)
+	return FALSE;
+
+    file = &job->files[job->next++];
+
+    if (!readImageFromFile (d, file->name,
+			    &file->width, &file->height, &file->image))
+	file->image = NULL;
+
+    return TRUE;
+}
+
+/*
+ * Pack the cached images of job into the atlas texture, in shelves of
+ * decreasing height.  Sprite i belongs to file i, files that could not be
+ * read or do not fit are left unloaded.
+ */
+static inline void
+spriteAtlasBuild (SpriteAtlas    *atlas,
+		  SpriteAtlasJob *job)
+{
+    CompScreen        *s = atlas->s;
+    SpriteAtlasSprite *sprites;
+    int               *order;
+    char              *buffer;
+    GLint             maxSize;
+    int               nFiles = job->nFiles;
+    int               i, j, x, y, shelf, area = 0, widest = 0;
+    int               width, height;
+
+    spriteAtlasRelease (atlas);
+    atlas->serial++;
+
+    if (nFiles <= 0)
+	return;
+
+    sprites = calloc (nFiles, sizeof (SpriteAtlasSprite));
+    order   = malloc (nFiles * sizeof (int));
+    if (!sprites || !order)
+    {
+	if (sprites)
+	    free (sprites);
+	if (order)
+	    free (order);
+
+	return;
+    }
+
+    atlas->sprites  = sprites;
+    atlas->nSprites = nFiles;
+
+    for (i = 0; i < nFiles; i++)
+    {
+	SpriteCacheEntry *entry = job->files[i].entry;
+	int              w, h;
+
+	if (!entry)
+	    continue;
+
+	entry->lastUse = atlas->serial;
+
+	w = entry->width;
+	h = entry->height;
+
+	sprites[i].loaded = TRUE;
+	sprites[i].width  = w;
+	sprites[i].height = h;
+
+	area  += (w + SPRITE_ATLAS_PADDING) * (h + SPRITE_ATLAS_PADDING);
+	widest = MAX (widest, w + SPRITE_ATLAS_PADDING);
+    }
+
+    glGetIntegerv (GL_MAX_TEXTURE_SIZE, &maxSize);
+    width = MIN (MAX (widest, (int) ceilf (sqrtf (area))), maxSize);
+
+    /* tallest first, there are only a few sprites */
+    for (i = 0; i < nFiles; i++)
+    {
+	for (j = i; j > 0 && sprites[order[j - 1]].height < sprites[i].height;
+	     j--)
+	    order[j] = order[j - 1];
+
+	order[j] = i;
+    }
+
+    x = y = shelf = 0;
+    for (i = 0; i < nFiles; i++)
+    {
+	SpriteAtlasSprite *sprite = &sprites[order[i]];
+	int               w = sprite->width + SPRITE_ATLAS_PADDING;
+	int               h = sprite->height + SPRITE_ATLAS_PADDING;
+
+	if (!sprite->loaded)
+	    continue;
+
+	if (x + w > width)
+	{
+	    x = 0;
+	    y += shelf;
+	    shelf = 0;
+	}
+
+	if (w > width || y + h > maxSize)
+	{
+	    compLogMessage (atlas->plugin, CompLogLevelWarn,
+			    "Texture does not fit into the atlas : %s",
+			    job->files[order[i]].name);
+	    sprite->loaded = FALSE;
+	    continue;
+	}
+
+	sprite->x = x;
+	sprite->y = y;
+
+	x += w;
+	shelf = MAX (shelf, h);
+    }
+
+    height = y + shelf;
+
+    buffer = NULL;
+    if (width > 0 && height > 0)
+	buffer = calloc (width * height, 4);
+
+    for (i = 0; i < nFiles; i++)
+    {
+	SpriteAtlasSprite *sprite = &sprites[i];
+
+	if (!sprite->loaded)
+	    continue;
+
+	if (buffer)
+	{
+	    for (j = 0; j < sprite->height; j++)
+		memcpy (buffer + ((sprite->y + j) * width + sprite->x) * 4,
+			(char *) job->files[i].entry->image +
+			j * sprite->width * 4,
+			sprite->width * 4);
+	}
+	else
+	{
+	    sprite->loaded = FALSE;
+	}
+    }
+
+    if (buffer &&
+	!imageBufferToTexture (s, &atlas->texture, buffer, width, height))
+    {
+	for (i = 0; i < nFiles; i++)
+	    sprites[i].loaded = FALSE;
+    }
+
+    for (i = 0; i < nFiles; i++)
+    {
+	SpriteAtlasSprite *sprite = &sprites[i];
+	CompMatrix        *mat = &atlas->texture.matrix;
+	int               x1 = sprite->x, x2 = sprite->x + sprite->width;
+	int               y1 = sprite->y, y2 = sprite->y + sprite->height;
+
+	if (!sprite->loaded)
+	    continue;
+
+	compLogMessage (atlas->plugin, CompLogLevelInfo,
+			"Loaded Texture %s", job->files[i].name);
+
+	sprite->texCoords[0] = COMP_TEX_COORD_X (mat, x1);
+	sprite->texCoords[1] = COMP_TEX_COORD_Y (mat, y1);
+	sprite->texCoords[2] = COMP_TEX_COORD_X (mat, x1);
+	sprite->texCoords[3] = COMP_TEX_COORD_Y (mat, y2);
+	sprite->texCoords[4] = COMP_TEX_COORD_X (mat, x2);
+	sprite->texCoords[5] = COMP_TEX_COORD_Y (mat, y2);
+	sprite->texCoords[6] = COMP_TEX_COORD_X (mat, x2);
+	sprite->texCoords[7] = COMP_TEX_COORD_Y (mat, y1);
+
+	atlas->nLoaded++;
+    }
+
+    if (buffer)
+	free (buffer);
+    free (order);
+}
+
+/* upload the decoded job and tell the plugin */
+static inline void
+spriteAtlasFinish (SpriteAtlas    *atlas,
+		   SpriteAtlasJob *job)
+{
+    spriteCacheAdd (atlas, job);
+    spriteAtlasBuild (atlas, job);
+    spriteCacheTrim (atlas);
+    spriteAtlasFreeJob (job);
+
+    if (atlas->loaded)
+	(*atlas->loaded) (atlas->s);
+}
+
+static inline void spriteAtlasStart (SpriteAtlas    *atlas,
+				     SpriteAtlasJob *job);
+
+static Bool
+spriteAtlasSlice (void *closure)
+{
+    SpriteAtlas    *atlas = closure;
+    SpriteAtlasJob *job = atlas->job;
+
+    if (spriteAtlasDecodeNext (atlas->s->display, job))
+	return TRUE;
+
+    atlas->job           = NULL;
+    atlas->timeoutHandle = 0;
+
+    if (atlas->pending)
+    {
+	int i;
+
+	/* superseded, but its images are worth keeping */
+	spriteCacheAdd (atlas, job);
+	spriteAtlasFreeJob (job);
+
+	job            = atlas->pending;
+	atlas->pending = NULL;
+
+	for (i = 0; i < job->nFiles; i++)
+	    if (!job->files[i].entry)
+		job->files[i].entry = spriteCacheLookup (atlas,
+							 job->files[i].name,
+							 job->files[i].key);
+
+	spriteAtlasStart (atlas, job);
+    }
+    else
+    {
+	spriteAtlasFinish (atlas, job);
+    }
+
+    return FALSE;
+}
+
+static inline void
+spriteAtlasStart (SpriteAtlas    *atlas,
+		  SpriteAtlasJob *job)
+{
+    int i;
+
+    for (i = 0; i < job->nFiles; i++)
+	if (!job->files[i].entry)
+	    break;
+
+    /* everything is cached already */
+    if (i == job->nFiles)
+    {
+	spriteAtlasFinish (atlas, job);
+	return;
+    }
+
+    job->next = 0;
+
+    atlas->job           = job;
+    atlas->timeoutHandle = compAddTimeout (SPRITE_ATLAS_SLICE,
+					   (float) SPRITE_ATLAS_SLICE * 1.2,
+					   spriteAtlasSlice, atlas);
+}
+
+/*
+ * Replace the sprites of the atlas by the images of files.  Images that
+ * are not cached yet are decoded one per timeout, the atlas keeps its
+ * current sprites until they are uploaded and the loaded callback of the
+ * atlas is called.
+ */
+static inline void
+spriteAtlasLoad (SpriteAtlas     *atlas,
+		 CompOptionValue *files,
+		 int             nFiles)
+{
+    SpriteAtlasJob *job;
+    int            i;
+
+    job = calloc (1, sizeof (SpriteAtlasJob));
+    if (!job)
+	return;
+
+    if (nFiles > 0)
+    {
+	job->files = calloc (nFiles, sizeof (SpriteAtlasFile));
+	if (!job->files)
+	{
+	    free (job);
+	    return;
+	}
+    }
+
+    job->nFiles = nFiles;
+
+    for (i = 0; i < nFiles; i++)
+    {
+	SpriteAtlasFile *file = &job->files[i];
+
+	file->name = strdup (files[i].s);
+	if (!file->name)
+	{
+	    spriteAtlasFreeJob (job);
+	    return;
+	}
+
+	file->key   = spriteFileKey (file->name);
+	file->entry = spriteCacheLookup (atlas, file->name, file->key);
+    }
+
+    /* only the latest request is uploaded once the running one is done */
+    if (atlas->job)
+    {
+	if (atlas->pending)
+	    spriteAtlasFreeJob (atlas->pending);
+
+	atlas->pending = job;
+	return;
+    }
+
+    spriteAtlasStart (atlas, job);
+}
+
+/* number of loaded sprites among sprites first to first + count - 1 */
+static inline int
+spriteAtlasCountLoaded (SpriteAtlas *atlas,
+			int         first,
+			int         count)
+{
+    int i, n = 0;
+
+    for (i = first; i < first + count && i < atlas->nSprites; i++)
+	n += atlas->sprites[i].loaded;
+
+    return n;
+}
+
+/* the n-th loaded sprite among sprites first to first + count - 1 */
+static inline SpriteAtlasSprite *
+spriteAtlasGetLoaded (SpriteAtlas *atlas,
+		      int         first,
+		      int         count,
+		      int         n)
+{
+    int i;
+
+    for (i = first; i < first + count && i < atlas->nSprites; i++)
+    {
+	if (!atlas->sprites[i].loaded)
+	    continue;
+
+	if (n-- == 0)
+	    return &atlas->sprites[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * Corners of a width x height sprite quad with a corner at (x, y, z),
+ * turned by angle degrees about that corner, as the old per sprite
+ * display lists drew it.
+ */
+static inline void
+spriteQuad (GLfloat *v,
+	    float   x,
+	    float   y,
+	    float   z,
+	    float   width,
+	    float   height,
+	    float   angle)
+{
+    static const float cx[4] = { 0, 0, 1, 1 };
+    static const float cy[4] = { 0, 1, 1, 0 };
+
+    float sinA = 0.0f, cosA = 1.0f;
+    int   i;
+
+    if (angle != 0.0f)
+    {
+	sinA = sinf (angle * M_PI / 180.0f);
+	cosA = cosf (angle * M_PI / 180.0f);
+    }
+
+    for (i = 0; i < 4; i++, v += 3)
+    {
+	float qx = cx[i] * width;
+	float qy = cy[i] * height;
+
+	v[0] = x + qx * cosA - qy * sinA;
+	v[1] = y + qx * sinA + qy * cosA;
+	v[2] = z;
+    }
+}
+
+#endif
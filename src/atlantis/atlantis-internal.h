@@ -156,6 +156,12 @@ extern int cubeDisplayPrivateIndex;
 */
 #define NUM_GROUPS 6
 
+/*
+ * maximum number of cells along each axis of the grid used to find
+ * neighbouring fish for boids
+ */
+#define FISH_GRID_MAX_DIM 32
+
 
 /* matching values from cubeaddon plugin */
 #define DeformationNone		0
@@ -214,21 +220,61 @@ typedef struct _Bubble
     float speed;
     float counter;
     float offset;
+    int   aerator; /* index of the aerator that emits it */
 }
 Bubble;
 
+#define BUBBLES_PER_AERATOR 20
+
 typedef struct _aeratorRec
 {
     float x, y, z;
     int size;
     int type;
     float color[4];
-    Bubble *bubbles;
+    Bubble *bubbles; /* part of the bubble pool of the screen */
 
     int numBubbles;
 }
 aeratorRec;
 
+/* vertex array version of a creature model, see model.c */
+#define MODEL_MAX_PARTS 4
+#define MODEL_MAX_BONES 16
+
+typedef struct _CreatureModelPart
+{
+    int  first;
+    int  count;
+    Bool depthTest;
+}
+CreatureModelPart;
+
+typedef struct _CreatureModelInfluence
+{
+    int   vertex;
+    int   bone;
+    float weight[3]; /* offset of the vertex for a bone value of one */
+}
+CreatureModelInfluence;
+
+typedef struct _CreatureModel
+{
+    int refCount;
+
+    int   nVertices;
+    float *vertices; /* interleaved normal and position */
+    float *rest;     /* position of each vertex with all bones at zero */
+
+    int               nParts;
+    CreatureModelPart parts[MODEL_MAX_PARTS];
+
+    int                    nBones;
+    int                    nInfluences;
+    CreatureModelInfluence *influences;
+}
+CreatureModel;
+
 typedef struct _Vertex
 {
     float v[3];
@@ -236,6 +282,9 @@ typedef struct _Vertex
 }
 Vertex;
 
+#define DEFORM_CACHE_STEPS 8 /* cached deformed meshes between 0 and 1 */
+#define HEIGHT_TABLE_SIZE  1024 /* samples of the ground height along x * z */
+
 typedef struct _Water
 {
     int size;
@@ -272,9 +321,180 @@ typedef struct _Water
 
     float wave1;
     float wave2;
+
+    float  *phase;     /* sin and cos of wf * x * z and swf * x * z */
+    float  phaseWf;
+    float  phaseSwf;
+    Vertex *phaseWall; /* wall vertices the phases were computed for */
+    Bool   phaseValid; /* cleared when the vertices are moved */
+
+    Bool   still;      /* heights and normals are set for still water */
+    float  stillBh;
+    Vertex *stillWall;
+
+    GLuint              vbo[2]; /* vertices and indices for the shader */
+    Bool                vboValid;
+    GLDeleteBuffersProc deleteBuffers;
+
+    float *deformKeys; /* x, z and normal of the moved vertices per step */
+    Bool  deformKeyValid[DEFORM_CACHE_STEPS + 1];
+    int   nDeformVertices;
+    int   deformType;
+    float deformBh;
+    float deformRadius;
+
+    float *heightTable; /* height against x * z, see bakeHeight */
+    float heightTableMax;
 }
 Water;
 
+typedef struct _FishGrid
+{
+    float cellSize;
+    float minX, minY, minZ;
+    int   nX, nY, nZ;
+
+    int   nCells;
+    int   maxCells;
+    int   *cellStart; /* first index into cellFish for each cell (nCells + 1) */
+    int   *cellFish;  /* fish indices sorted by cell */
+    int   *fishCell;  /* cell of each fish */
+}
+FishGrid;
+
+/* GLSL and instanced drawing entry points, see shader.c and school.c */
+typedef GLhandleARB (*GLCreateShaderObjectProc) (GLenum type);
+typedef void (*GLShaderSourceProc) (GLhandleARB shader,
+				    GLsizei     count,
+				    const GLcharARB **string,
+				    const GLint *length);
+typedef void (*GLCompileShaderProc) (GLhandleARB shader);
+typedef GLhandleARB (*GLCreateProgramObjectProc) (void);
+typedef void (*GLAttachObjectProc) (GLhandleARB program,
+				    GLhandleARB shader);
+typedef void (*GLLinkProgramProc) (GLhandleARB program);
+typedef void (*GLUseProgramObjectProc) (GLhandleARB program);
+typedef void (*GLGetObjectParameterivProc) (GLhandleARB object,
+					    GLenum      pname,
+					    GLint       *params);
+typedef void (*GLDeleteObjectProc) (GLhandleARB object);
+typedef GLint (*GLGetUniformLocationProc) (GLhandleARB     program,
+					   const GLcharARB *name);
+typedef GLint (*GLGetAttribLocationProc) (GLhandleARB     program,
+					  const GLcharARB *name);
+typedef void (*GLUniform3fvProc) (GLint         location,
+				  GLsizei       count,
+				  const GLfloat *value);
+typedef void (*GLUniform4fvProc) (GLint         location,
+				  GLsizei       count,
+				  const GLfloat *value);
+typedef void (*GLVertexAttribPointerProc) (GLuint       index,
+					   GLint        size,
+					   GLenum       type,
+					   GLboolean    normalized,
+					   GLsizei      stride,
+					   const GLvoid *pointer);
+typedef void (*GLEnableVertexAttribArrayProc) (GLuint index);
+typedef void (*GLDisableVertexAttribArrayProc) (GLuint index);
+typedef void (*GLDrawElementsInstancedProc) (GLenum       mode,
+					     GLsizei      count,
+					     GLenum       type,
+					     const GLvoid *indices,
+					     GLsizei      primcount);
+typedef void (*GLDrawArraysInstancedProc) (GLenum  mode,
+					   GLint   first,
+					   GLsizei count,
+					   GLsizei primcount);
+
+/* models of the small fish that can be drawn as instanced schools */
+#define SCHOOL_BFISH   0
+#define SCHOOL_CHROMIS 1
+#define SCHOOL_FISH    2
+#define SCHOOL_FISH2   3
+#define SCHOOL_MODELS  4
+
+#define SCHOOL_MAX_BATCH     64
+#define SCHOOL_INSTANCE_SIZE 20 /* floats of per fish data in a batch */
+
+typedef struct _GLSLFunctions
+{
+    Bool supported; /* GL_ARB_shader_objects and GL_ARB_vertex_shader */
+
+    GLCreateShaderObjectProc       createShaderObject;
+    GLShaderSourceProc             shaderSource;
+    GLCompileShaderProc            compileShader;
+    GLCreateProgramObjectProc      createProgramObject;
+    GLAttachObjectProc             attachObject;
+    GLLinkProgramProc              linkProgram;
+    GLUseProgramObjectProc         useProgramObject;
+    GLGetObjectParameterivProc     getObjectParameteriv;
+    GLDeleteObjectProc             deleteObject;
+    GLGetUniformLocationProc       getUniformLocation;
+    GLGetAttribLocationProc        getAttribLocation;
+    GLUniform3fvProc               uniform3fv;
+    GLUniform4fvProc               uniform4fv;
+    GLVertexAttribPointerProc      vertexAttribPointer;
+    GLEnableVertexAttribArrayProc  enableVertexAttribArray;
+    GLDisableVertexAttribArrayProc disableVertexAttribArray;
+}
+GLSLFunctions;
+
+typedef struct _FishSchool
+{
+    Bool supported; /* vertex shaders and instanced draws are available */
+
+    GLSLFunctions               *glsl;
+    GLDrawElementsInstancedProc drawElementsInstanced;
+
+    GLhandleARB shader;
+    GLhandleARB program;
+    GLint       instanceLoc;
+    GLint       tintLoc;
+    GLint       tailLoc;
+
+    int   batch;      /* fish per instanced draw */
+    int   nInstances; /* fish in the batch being drawn */
+    float instances[SCHOOL_MAX_BATCH * SCHOOL_INSTANCE_SIZE];
+
+    float *tail[SCHOOL_MODELS]; /* tail motion of each point of the models */
+}
+FishSchool;
+
+typedef struct _WaterShader
+{
+    Bool supported; /* vertex shaders and buffer objects are available */
+
+    GLhandleARB shader;
+    GLhandleARB program;
+    GLint       waveLoc;
+    GLint       amplitudeLoc;
+    GLint       modeLoc;
+    GLint       rippleLoc;
+}
+WaterShader;
+
+#define BUBBLE_MAX_BATCH     128
+#define BUBBLE_INSTANCE_SIZE 8 /* floats of per bubble data in a batch */
+
+typedef struct _BubbleBatch
+{
+    Bool supported; /* vertex shaders and instanced draws are available */
+
+    GLDrawArraysInstancedProc drawArraysInstanced;
+
+    GLhandleARB shader;
+    GLhandleARB program;
+    GLint       instanceLoc;
+
+    int   batch;      /* bubbles per instanced draw */
+    int   nInstances; /* bubbles in the batch being drawn */
+    float instances[BUBBLE_MAX_BATCH * BUBBLE_INSTANCE_SIZE];
+
+    float *vertices;  /* normal and position of the sphere triangles */
+    int   nVertices;
+}
+BubbleBatch;
+
 typedef struct _AtlantisDisplay
 {
     int screenPrivateIndex;
@@ -301,6 +521,11 @@ typedef struct _AtlantisScreen
     coralRec *coral;
     aeratorRec *aerator;
 
+    Bubble *bubbles;    /* bubbles of all aerators */
+    int    numBubbles;
+
+    FishGrid grid;
+
     Water *water;
     Water *ground;
 
@@ -315,12 +540,20 @@ typedef struct _AtlantisScreen
 
     float speedFactor;  /* multiply fish/crab speeds by this value */
 
+    float *wallCos;     /* direction of each side wall, */
+    float *wallSin;     /* rebuilt once per frame */
+    int   nWalls;
+
     float oldProgress;
 
+    GLSLFunctions glsl;
+    FishSchool    school;
+    WaterShader   waterShader;
+    BubbleBatch   bubbleBatch;
+
     GLuint crabDisplayList;
     GLuint coralDisplayList;
     GLuint coral2DisplayList;
-    GLuint bubbleDisplayList;
 }
 AtlantisScreen;
 
@@ -366,9 +599,15 @@ getHeight(Water *w, float x, float z);
 float
 getGroundHeight (CompScreen *s, float x, float z);
 
+void
+bakeHeight(Water *w);
+
 void
 FishTransform(fishRec *);
 
+Bool
+updateWallAngles(CompScreen *);
+
 void
 FishPilot(CompScreen *, int);
 
@@ -382,14 +621,123 @@ void
 BubbleTransform(Bubble *);
 
 void
-BubblePilot(CompScreen *, int, int);
+BubblePilot(CompScreen *);
 
 void
 BoidsAngle(CompScreen *, int);
 
+void
+initFishGrid(CompScreen *);
+
+void
+updateFishGrid(CompScreen *);
+
+void
+freeFishGrid(CompScreen *);
+
 void
 RenderWater(int, float, Bool, Bool);
 
+extern const char *atlantisLightShader;
+
+Bool
+hasGLExtension(const char *);
+
+void
+initGLSL(CompScreen *);
+
+Bool
+loadVertexShader(GLSLFunctions *, const char *, int, const GLcharARB **,
+                 GLhandleARB *, GLhandleARB *);
+
+void
+deleteVertexShader(GLSLFunctions *, GLhandleARB, GLhandleARB);
+
+void
+initWaterShader(CompScreen *);
+
+void
+finiWaterShader(CompScreen *);
+
+Bool
+useWaterShader(CompScreen *, int);
+
+void
+drawWaterShader(CompScreen *, Water *, Bool);
+
+void
+drawGroundShader(CompScreen *, Water *, Water *);
+
+void
+initFishSchool(CompScreen *);
+
+void
+finiFishSchool(CompScreen *);
+
+Bool
+isSchoolFish(int);
+
+void
+drawFishSchools(CompScreen *);
+
+void
+schoolDrawElements(GLenum, GLsizei, GLenum, const GLvoid *);
+
+void
+schoolMaterialfv(GLenum, GLenum, const GLfloat *);
+
+void
+schoolLightModelf(GLenum, GLfloat);
+
+void
+modelBegin(GLenum);
+
+void
+modelEnd(void);
+
+void
+modelNormal3fv(const float *);
+
+void
+modelVertex3fv(const float *);
+
+void
+modelEnable(GLenum);
+
+void
+modelDisable(GLenum);
+
+Bool
+buildCreatureModel(CreatureModel *, int, void (*) (void),
+                   void (*) (const float *));
+
+void
+freeCreatureModel(CreatureModel *);
+
+void
+animateCreatureModel(CreatureModel *, const float *);
+
+void
+drawCreatureModel(CreatureModel *, int);
+
+void
+loadWhaleModel(void);
+
+void
+freeWhaleModel(void);
+
+void
+loadSharkModel(void);
+
+void
+freeSharkModel(void);
+
+void
+loadDolphinModel(void);
+
+void
+freeDolphinModel(void);
+
 void
 DrawWhale(fishRec *, int);
 
@@ -411,6 +759,9 @@ initDrawBFish(float *);
 void
 finDrawBFish(void);
 
+float *
+GetBFishPoints(int *);
+
 void
 AnimateChromis(float);
 
@@ -429,6 +780,9 @@ initDrawChromis3(float *);
 void
 finDrawChromis(void);
 
+float *
+GetChromisPoints(int *);
+
 void
 DrawAnimatedFish(void);
 
@@ -441,6 +795,9 @@ initDrawFish(float *);
 void
 finDrawFish(void);
 
+float *
+GetFishPoints(int *);
+
 void
 DrawAnimatedFish2(void);
 
@@ -453,6 +810,9 @@ initDrawFish2(float *);
 void
 finDrawFish2(void);
 
+float *
+GetFish2Points(int *);
+
 void
 DrawCrab(int);
 
@@ -487,7 +847,19 @@ void
 finDrawCoral2(void);
 
 void
-DrawBubble(int, int);
+initBubbleBatch(CompScreen *);
+
+void
+finiBubbleBatch(CompScreen *);
+
+Bool
+loadBubbleModel(CompScreen *, int);
+
+void
+freeBubbleModel(CompScreen *);
+
+void
+drawBubbles(CompScreen *);
 
 
 /* utility methods */
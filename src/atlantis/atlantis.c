@@ -173,6 +173,8 @@ initAtlantis (CompScreen *s)
     as->fish = calloc (as->numFish,  sizeof(fishRec));
     as->crab = calloc (as->numCrabs, sizeof(crabRec));
 
+    initFishGrid (s);
+
     if (atlantisGetShowWater (s))
 	as->waterHeight = atlantisGetWaterHeight (s) * 100000 - 50000;
     else
@@ -303,13 +305,21 @@ initAtlantis (CompScreen *s)
     as->coral   = calloc (as->numCorals,   sizeof(coralRec));
     as->aerator = calloc (as->numAerators, sizeof(aeratorRec));
 
+    /* all bubbles are in one pool, split evenly between the aerators */
+    as->numBubbles = as->numAerators * BUBBLES_PER_AERATOR;
+    as->bubbles = calloc (as->numBubbles, sizeof (Bubble));
+    if (!as->bubbles)
+	as->numBubbles = 0;
+
     for (k = 0; k < as->numAerators; k++)
     {
-	as->aerator[k].numBubbles = 20;
-	as->aerator[k].bubbles = calloc (as->aerator[k].numBubbles,
-		sizeof (Bubble));
+	as->aerator[k].numBubbles = as->bubbles ? BUBBLES_PER_AERATOR : 0;
+	as->aerator[k].bubbles = as->bubbles + k * BUBBLES_PER_AERATOR;
     }
 
+    for (k = 0; k < as->numBubbles; k++)
+	as->bubbles[k].aerator = k / BUBBLES_PER_AERATOR;
+
     initWorldVariables(s);
 
     updateWater (s, 0); /* make sure normals are initialized */
@@ -338,10 +348,11 @@ loadModels (CompScreen *s)
     atlantisGetLowPoly (s) ? DrawCoral2Low (0) : DrawCoral2 (0);
     glEndList ();
 
-    as->bubbleDisplayList = glGenLists (1);
-    glNewList (as->bubbleDisplayList, GL_COMPILE);
-    atlantisGetLowPoly (s) ? DrawBubble (0, 6) : DrawBubble (0, 9);
-    glEndList ();
+    loadBubbleModel (s, atlantisGetLowPoly (s) ? 6 : 9);
+
+    loadDolphinModel ();
+    loadSharkModel ();
+    loadWhaleModel ();
 }
 
 static void
@@ -352,7 +363,11 @@ freeModels (CompScreen *s)
     glDeleteLists (as->crabDisplayList, 1);
     glDeleteLists (as->coralDisplayList, 1);
     glDeleteLists (as->coral2DisplayList, 1);
-    glDeleteLists (as->bubbleDisplayList, 1);
+    freeBubbleModel (s);
+
+    freeDolphinModel ();
+    freeSharkModel ();
+    freeWhaleModel ();
 }
 
 static float calculateScreenRatio (CompScreen *s)
@@ -501,8 +516,6 @@ freeAtlantis (CompScreen *s)
 {
     ATLANTIS_SCREEN (s);
 
-    int i;
-
     if (as->fish)
 	free (as->fish);
     if (as->crab)
@@ -511,15 +524,11 @@ freeAtlantis (CompScreen *s)
 	free (as->coral);
 
     if (as->aerator)
-    {
-	for (i = 0; i < as->numAerators; i++)
-	{
-	    if (as->aerator[i].bubbles)
-		free (as->aerator[i].bubbles);
-	}
-
 	free (as->aerator);
-    }
+    if (as->bubbles)
+	free (as->bubbles);
+
+    freeFishGrid (s);
 
     freeWater (as->water);
     freeWater (as->ground);
@@ -528,6 +537,8 @@ freeAtlantis (CompScreen *s)
     as->crab = NULL;
     as->coral= NULL;
     as->aerator = NULL;
+    as->bubbles = NULL;
+    as->numBubbles = 0;
 
     freeModels(s);
 }
@@ -621,10 +632,12 @@ atlantisPaintInside(CompScreen *s,
     ATLANTIS_SCREEN (s);
     CUBE_SCREEN (s);
 
-    int i, j;
+    int i;
 
     float scale, ratio;
 
+    Bool schools;
+
     static const float mat_shininess[] = { 60.0 };
     static const float mat_specular[] = { 0.6, 0.6, 0.6, 1.0 };
     static const float mat_diffuse[] = { 1.0, 1.0, 1.0, 1.0 };
@@ -642,6 +655,8 @@ atlantisPaintInside(CompScreen *s,
     int drawDeformation = (as->oldProgress == 0.0f ? getCurrentDeformation(s) :
 						     getDeformationMode (s));
 
+    Bool waterShader = useWaterShader (s, drawDeformation);
+
     if (atlantisGetShowWater(s))
 	as->waterHeight = atlantisGetWaterHeight(s) * 100000 - 50000;
     else
@@ -660,8 +675,11 @@ atlantisPaintInside(CompScreen *s,
 	atlantisGetShowGround (s))
     {
 	updateDeformation (s, drawDeformation);
-	updateHeight (as->water, atlantisGetShowGround (s) ? as->ground : NULL,
-	              atlantisGetWaveRipple(s), drawDeformation);
+
+	if (!waterShader)
+	    updateHeight (as->water,
+			  atlantisGetShowGround (s) ? as->ground : NULL,
+			  atlantisGetWaveRipple(s), drawDeformation);
     }
 
     sA.yRotate += cs->invert * (360.0f / size) * (cs->xRotations -
@@ -708,7 +726,10 @@ atlantisPaintInside(CompScreen *s,
 
 	glCullFace (~cull & (GL_FRONT | GL_BACK));
 	setWaterMaterial (atlantisGetWaterColor (s));
-	drawWater (as->water, TRUE, FALSE, drawDeformation);
+	if (waterShader)
+	    drawWaterShader (s, as->water, atlantisGetWaveRipple (s));
+	else
+	    drawWater (as->water, TRUE, FALSE, drawDeformation);
 	glCullFace (cull);
     }
 
@@ -718,7 +739,12 @@ atlantisPaintInside(CompScreen *s,
 
 	if (atlantisGetRenderWaves (s) && atlantisGetShowWater (s) &&
 	    !atlantisGetWaveRipple (s))
-	    drawGround (as->water, as->ground, drawDeformation);
+	{
+	    if (waterShader)
+		drawGroundShader (s, as->water, as->ground);
+	    else
+		drawGround (as->water, as->ground, drawDeformation);
+	}
 	else
 	    drawGround (NULL, as->ground, drawDeformation);
     }
@@ -791,8 +817,13 @@ atlantisPaintInside(CompScreen *s,
 	glPopMatrix ();
     }
 
+    schools = atlantisGetInstancedSchools (s) && as->school.supported;
+
     for (i = 0; i < as->numFish; i++)
     {
+	if (schools && isSchoolFish (as->fish[i].type))
+	    continue;
+
 	glPushMatrix ();
 	FishTransform (& (as->fish[i]));
 	scale = as->fish[i].size;
@@ -863,25 +894,12 @@ atlantisPaintInside(CompScreen *s,
 	glPopMatrix();
     }
 
-    glEnable(GL_CULL_FACE);
-
-    for (i = 0; i < as->numAerators; i++)
-    {
-	for (j = 0; j < as->aerator[i].numBubbles; j++)
-	{
-	    glPushMatrix ();
-
-	    BubbleTransform (&(as->aerator[i].bubbles[j]));
-	    scale = as->aerator[i].bubbles[j].size;
-
-	    glScalef (scale, scale, scale);
-	    glColor4fv (as->aerator[i].color);
+    if (schools)
+	drawFishSchools (s);
 
-	    glCallList (as->bubbleDisplayList);
+    glEnable(GL_CULL_FACE);
 
-	    glPopMatrix ();
-	}
-    }
+    drawBubbles (s);
 
     glPopMatrix ();
 
@@ -889,8 +907,11 @@ atlantisPaintInside(CompScreen *s,
     {
 	glEnable (GL_CULL_FACE);
 	setWaterMaterial (atlantisGetWaterColor (s));
-	drawWater (as->water, atlantisGetShowWater (s),
-		atlantisGetShowWaterWire (s), drawDeformation);
+	if (waterShader)
+	    drawWaterShader (s, as->water, atlantisGetWaveRipple (s));
+	else
+	    drawWater (as->water, atlantisGetShowWater (s),
+		       atlantisGetShowWaterWire (s), drawDeformation);
     }
 
 
@@ -958,46 +979,51 @@ atlantisPreparePaintScreen (CompScreen *s,
 
     }
 
-    for (i = 0; i < as->numFish; i++)
+    if (updateWallAngles (s))
     {
-	FishPilot (s, i);
+	updateFishGrid (s);
 
-	/* animate fish tails */
-	if (as->fish[i].type <= FISH2)
+	for (i = 0; i < as->numFish; i++)
 	{
-	    as->fish[i].htail = fmodf (as->fish[i].htail + 0.00025 *
-	                               as->fish[i].speed * as->speedFactor, 1);
-	}
-    }
+	    FishPilot (s, i);
 
-    for (i = 0; i < as->numCrabs; i++)
-    {
-	CrabPilot (s, i);
-    }
+	    /* animate fish tails */
+	    if (as->fish[i].type <= FISH2)
+	    {
+		as->fish[i].htail = fmodf (as->fish[i].htail + 0.00025 *
+					   as->fish[i].speed *
+					   as->speedFactor, 1);
+	    }
+	}
 
-    for (i = 0; i < as->numCorals; i++)
-    {
-	as->coral[i].z = getGroundHeight (s, as->coral[i].x, as->coral[i].y);
-    }
+	for (i = 0; i < as->numCrabs; i++)
+	{
+	    CrabPilot (s, i);
+	}
 
-    for (i = 0; i < as->numAerators; i++)
-    {
-	aeratorRec * aerator = &(as->aerator[i]);
-	float bottom = getGroundHeight (s, aerator->x, aerator->y);
+	for (i = 0; i < as->numCorals; i++)
+	{
+	    as->coral[i].z = getGroundHeight (s, as->coral[i].x,
+					      as->coral[i].y);
+	}
 
-	if (aerator->z < bottom)
+	for (i = 0; i < as->numAerators; i++)
 	{
-	    for (j = 0; j < aerator->numBubbles; j++)
+	    aeratorRec * aerator = &(as->aerator[i]);
+	    float bottom = getGroundHeight (s, aerator->x, aerator->y);
+
+	    if (aerator->z < bottom)
 	    {
-		if (aerator->bubbles[j].counter == 0)
-		    aerator->bubbles[j].z = bottom;
+		for (j = 0; j < aerator->numBubbles; j++)
+		{
+		    if (aerator->bubbles[j].counter == 0)
+			aerator->bubbles[j].z = bottom;
+		}
 	    }
+	    aerator->z = bottom;
 	}
-	aerator->z = bottom;
-	for (j = 0; j < aerator->numBubbles; j++)
-	{
-	    BubblePilot(s, i, j);
-	}
+
+	BubblePilot (s);
     }
 
     as->hsize = oldhsize;
@@ -1088,11 +1114,20 @@ atlantisInitScreen (CompPlugin *p,
 
     as->damage = FALSE;
 
+    as->wallCos = NULL;
+    as->wallSin = NULL;
+    as->nWalls  = 0;
+
     glLightfv (GL_LIGHT1, GL_AMBIENT, ambient);
     glLightfv (GL_LIGHT1, GL_DIFFUSE, diffuse);
     glLightfv (GL_LIGHT1, GL_SPECULAR, specular);
     atlantisInitLightPosition (s);
 
+    initGLSL (s);
+    initFishSchool (s);
+    initWaterShader (s);
+    initBubbleBatch (s);
+
     initAtlantis (s);
 
     atlantisSetSpeedFactorNotify  (s, atlantisSpeedFactorOptionChange);
@@ -1132,6 +1167,15 @@ atlantisFiniScreen (CompPlugin *p,
 
     freeAtlantis (s);
 
+    finiFishSchool (s);
+    finiWaterShader (s);
+    finiBubbleBatch (s);
+
+    if (as->wallCos)
+	free (as->wallCos);
+    if (as->wallSin)
+	free (as->wallSin);
+
     UNWRAP (as, s, donePaintScreen);
     UNWRAP (as, s, preparePaintScreen);
     UNWRAP (as, cs, clearTargetOutput);
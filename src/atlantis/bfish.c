@@ -34,6 +34,18 @@
 #include "atlantis-internal.h"
 #include "bfish.h"
 
+/* let school.c turn the draws into instanced draws of a whole school */
+#define glDrawElements schoolDrawElements
+#define glMaterialfv   schoolMaterialfv
+#define glLightModelf  schoolLightModelf
+
+float *
+GetBFishPoints (int *nPoints)
+{
+    *nPoints = ARRAY_SIZE (BFishPoints) / 3;
+    return BFishPoints;
+}
+
 void
 AnimateBFish(float t)
 {
@@ -25,50 +25,281 @@
  *
  */
 
+/*
+ * All bubbles share one sphere in a vertex array.  When vertex shaders
+ * and instanced draws are available the bubbles are drawn in batches
+ * with the position, size and colour of each bubble in a uniform array,
+ * otherwise the array is drawn once per bubble.
+ */
 
-#include "atlantis-internal.h"
+#include <stdio.h>
+#include <string.h>
 #include <math.h>
 
-void
-DrawBubble (int wire,
-            int nStrips)
+#include "atlantis-internal.h"
+
+/* uniforms kept free for the matrices, light and materials */
+#define BUBBLE_RESERVED_UNIFORMS 32
+
+static const char *bubbleVertexShader =
+    "uniform vec4 instance[BATCH * 2];\n"
+    "\n"
+    "void main ()\n"
+    "{\n"
+    "    int  i     = gl_InstanceIDARB * 2;\n"
+    "    vec4 p     = instance[i];\n"
+    "    vec4 color = instance[i + 1];\n"
+    "    vec3 n     = normalize (gl_NormalMatrix * gl_Normal);\n"
+    "\n"
+    "    gl_FrontColor = light (n, gl_FrontMaterial.emission, color, color,\n"
+    "                           gl_FrontMaterial.specular,\n"
+    "                           gl_FrontMaterial.shininess);\n"
+    "    gl_Position   = gl_ModelViewProjectionMatrix *\n"
+    "                    vec4 (gl_Vertex.xyz * p.w + p.xyz, 1.0);\n"
+    "}\n";
+
+/*
+ * Unit sphere standing on the origin, the triangles of nStrips quad
+ * strips around it from the top down.
+ */
+Bool
+loadBubbleModel (CompScreen *s,
+                 int        nStrips)
 {
-    int horizStrips = nStrips;
-    int vertStrips  = nStrips;
+    ATLANTIS_SCREEN (s);
 
-    float ang;
-    float topSinAng, topCosAng;
-    float bottomSinAng, bottomCosAng;
+    BubbleBatch *bubbles = &as->bubbleBatch;
 
-    int i, j;
+    float ang, x, y;
+    float sinAng[2], cosAng[2];
+    float quad[4][6], *v;
 
-    float x, y;
+    int i, j, k;
 
-    for (i = 0; i < horizStrips; i++)
+    bubbles->nVertices = nStrips * nStrips * 6;
+    bubbles->vertices  = malloc (bubbles->nVertices * 6 * sizeof (float));
+    if (!bubbles->vertices)
     {
-	ang = i * PI / horizStrips;
-	topSinAng = sinf (ang);
-	topCosAng = cosf (ang);
+	bubbles->nVertices = 0;
+	return FALSE;
+    }
 
-	ang -= PI / horizStrips;
-	bottomSinAng = sinf (ang);
-	bottomCosAng = cosf (ang);
+    v = bubbles->vertices;
 
-	glBegin (wire ? GL_LINE_LOOP : GL_QUAD_STRIP);
+    for (i = 0; i < nStrips; i++)
+    {
+	ang = i * PI / nStrips;
+	sinAng[1] = sinf (ang);
+	cosAng[1] = cosf (ang);
+
+	ang -= PI / nStrips;
+	sinAng[0] = sinf (ang);
+	cosAng[0] = cosf (ang);
 
-	for (j = -1; j < vertStrips; j++)
+	for (j = -1; j < nStrips; j++)
 	{
-	    ang = j * 2 * PI / vertStrips;
+	    ang = j * 2 * PI / nStrips;
 
 	    x = cosf (ang);
 	    y = sinf (ang);
 
-	    glNormal3f (y * bottomSinAng, bottomCosAng,     x * bottomSinAng);
-	    glVertex3f (y * bottomSinAng, bottomCosAng + 1, x * bottomSinAng);
-	    glNormal3f (y * topSinAng,    topCosAng,        x * topSinAng);
-	    glVertex3f (y * topSinAng,    topCosAng + 1,    x * topSinAng);
+	    /* bottom and top of this step around, after the last step */
+	    for (k = 0; k < 2; k++)
+	    {
+		if (j >= 0)
+		    memcpy (quad[k], quad[k + 2], sizeof (quad[k]));
+
+		quad[k + 2][0] = y * sinAng[k];
+		quad[k + 2][1] = cosAng[k];
+		quad[k + 2][2] = x * sinAng[k];
+		quad[k + 2][3] = y * sinAng[k];
+		quad[k + 2][4] = cosAng[k] + 1;
+		quad[k + 2][5] = x * sinAng[k];
+	    }
+
+	    if (j < 0)
+		continue;
+
+	    /* the two triangles of the quad strip */
+	    memcpy (v,      quad[0], sizeof (quad[0]));
+	    memcpy (v + 6,  quad[1], sizeof (quad[1]));
+	    memcpy (v + 12, quad[3], sizeof (quad[3]));
+	    memcpy (v + 18, quad[0], sizeof (quad[0]));
+	    memcpy (v + 24, quad[3], sizeof (quad[3]));
+	    memcpy (v + 30, quad[2], sizeof (quad[2]));
+	    v += 36;
 	}
+    }
+
+    return TRUE;
+}
+
+void
+freeBubbleModel (CompScreen *s)
+{
+    ATLANTIS_SCREEN (s);
 
-	glEnd();
+    BubbleBatch *bubbles = &as->bubbleBatch;
+
+    if (bubbles->vertices)
+	free (bubbles->vertices);
+
+    bubbles->vertices  = NULL;
+    bubbles->nVertices = 0;
+}
+
+void
+initBubbleBatch (CompScreen *s)
+{
+    GLint           components = 0;
+    const GLcharARB *source[3];
+    char            header[128];
+
+    ATLANTIS_SCREEN (s);
+
+    BubbleBatch   *bubbles = &as->bubbleBatch;
+    GLSLFunctions *glsl = &as->glsl;
+
+    bubbles->supported  = FALSE;
+    bubbles->shader     = 0;
+    bubbles->program    = 0;
+    bubbles->nInstances = 0;
+
+    if (!glsl->supported || !hasGLExtension ("GL_ARB_draw_instanced"))
+	return;
+
+    bubbles->drawArraysInstanced = (GLDrawArraysInstancedProc)
+	(*s->getProcAddress) ((GLubyte *) "glDrawArraysInstancedARB");
+    if (!bubbles->drawArraysInstanced)
+	return;
+
+    glGetIntegerv (GL_MAX_VERTEX_UNIFORM_COMPONENTS_ARB, &components);
+
+    bubbles->batch = (components / 4 - BUBBLE_RESERVED_UNIFORMS) / 2;
+    bubbles->batch = MIN (bubbles->batch, BUBBLE_MAX_BATCH);
+
+    if (bubbles->batch < 1)
+	return;
+
+    snprintf (header, sizeof (header),
+	      "#extension GL_ARB_draw_instanced : require\n"
+	      "#define BATCH %d\n", bubbles->batch);
+
+    source[0] = header;
+    source[1] = atlantisLightShader;
+    source[2] = bubbleVertexShader;
+
+    if (!loadVertexShader (glsl, "bubble", 3, source,
+			   &bubbles->shader, &bubbles->program))
+    {
+	finiBubbleBatch (s);
+	return;
+    }
+
+    bubbles->instanceLoc = (*glsl->getUniformLocation) (bubbles->program,
+							"instance");
+    if (bubbles->instanceLoc < 0)
+    {
+	finiBubbleBatch (s);
+	return;
     }
+
+    bubbles->supported = TRUE;
+}
+
+void
+finiBubbleBatch (CompScreen *s)
+{
+    ATLANTIS_SCREEN (s);
+
+    BubbleBatch *bubbles = &as->bubbleBatch;
+
+    deleteVertexShader (&as->glsl, bubbles->shader, bubbles->program);
+
+    bubbles->program   = 0;
+    bubbles->shader    = 0;
+    bubbles->supported = FALSE;
+}
+
+static void
+flushBubbles (CompScreen *s)
+{
+    ATLANTIS_SCREEN (s);
+
+    BubbleBatch *bubbles = &as->bubbleBatch;
+
+    if (!bubbles->nInstances)
+	return;
+
+    (*as->glsl.uniform4fv) (bubbles->instanceLoc,
+			    bubbles->nInstances * BUBBLE_INSTANCE_SIZE / 4,
+			    bubbles->instances);
+    (*bubbles->drawArraysInstanced) (GL_TRIANGLES, 0, bubbles->nVertices,
+				     bubbles->nInstances);
+
+    bubbles->nInstances = 0;
+}
+
+void
+drawBubbles (CompScreen *s)
+{
+    int i;
+
+    ATLANTIS_SCREEN (s);
+
+    BubbleBatch *bubbles = &as->bubbleBatch;
+
+    if (!bubbles->vertices || !as->numBubbles)
+	return;
+
+    glEnableClientState (GL_NORMAL_ARRAY);
+    glNormalPointer (GL_FLOAT, 6 * sizeof (float), bubbles->vertices);
+    glVertexPointer (3, GL_FLOAT, 6 * sizeof (float), bubbles->vertices + 3);
+
+    if (bubbles->supported)
+    {
+	(*as->glsl.useProgramObject) (bubbles->program);
+	bubbles->nInstances = 0;
+
+	for (i = 0; i < as->numBubbles; i++)
+	{
+	    Bubble *bubble = &as->bubbles[i];
+	    float  *d = bubbles->instances +
+			bubbles->nInstances * BUBBLE_INSTANCE_SIZE;
+
+	    /* BubbleTransform and the scale by the bubble size */
+	    d[0] = bubble->y;
+	    d[1] = bubble->z;
+	    d[2] = bubble->x;
+	    d[3] = bubble->size;
+	    memcpy (d + 4, as->aerator[bubble->aerator].color,
+		    4 * sizeof (float));
+
+	    if (++bubbles->nInstances == bubbles->batch)
+		flushBubbles (s);
+	}
+
+	flushBubbles (s);
+
+	(*as->glsl.useProgramObject) (0);
+    }
+    else
+    {
+	for (i = 0; i < as->numBubbles; i++)
+	{
+	    Bubble *bubble = &as->bubbles[i];
+
+	    glPushMatrix ();
+
+	    BubbleTransform (bubble);
+	    glScalef (bubble->size, bubble->size, bubble->size);
+	    glColor4fv (as->aerator[bubble->aerator].color);
+
+	    glDrawArrays (GL_TRIANGLES, 0, bubbles->nVertices);
+
+	    glPopMatrix ();
+	}
+    }
+
+    glDisableClientState (GL_NORMAL_ARRAY);
 }
@@ -34,6 +34,18 @@
 #include "atlantis-internal.h"
 #include "chromis.h"
 
+/* let school.c turn the draws into instanced draws of a whole school */
+#define glDrawElements schoolDrawElements
+#define glMaterialfv   schoolMaterialfv
+#define glLightModelf  schoolLightModelf
+
+float *
+GetChromisPoints (int *nPoints)
+{
+    *nPoints = ARRAY_SIZE (ChromisPoints) / 3;
+    return ChromisPoints;
+}
+
 void
 AnimateChromis(float t)
 {
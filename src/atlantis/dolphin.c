@@ -94,111 +94,170 @@
  */
 
 #include "atlantis-internal.h"
+
+/* record the generated model code, see model.c */
+#define glBegin(mode)   modelBegin(mode)
+#define glEnd()         modelEnd()
+#define glNormal3fv(n)  modelNormal3fv(n)
+#define glVertex3fv(v)  modelVertex3fv(v)
+#define glEnable(cap)   modelEnable(cap)
+#define glDisable(cap)  modelDisable(cap)
+
 #include "dolphin.h"
 
+#undef glBegin
+#undef glEnd
+#undef glNormal3fv
+#undef glVertex3fv
+#undef glEnable
+#undef glDisable
+
+/* segment offsets seg0 .. seg7 followed by chomp */
+#define DOLPHIN_BONES 9
+
+static CreatureModel dolphinModel;
+
+static void
+PoseDolphin(const float *seg)
+{
+    P012[1] = iP012[1] + seg[5];
+    P013[1] = iP013[1] + seg[5];
+    P014[1] = iP014[1] + seg[5];
+    P015[1] = iP015[1] + seg[5];
+    P016[1] = iP016[1] + seg[5];
+    P017[1] = iP017[1] + seg[5];
+    P018[1] = iP018[1] + seg[5];
+    P019[1] = iP019[1] + seg[5];
+
+    P020[1] = iP020[1] + seg[4];
+    P021[1] = iP021[1] + seg[4];
+    P022[1] = iP022[1] + seg[4];
+    P023[1] = iP023[1] + seg[4];
+    P024[1] = iP024[1] + seg[4];
+    P025[1] = iP025[1] + seg[4];
+    P026[1] = iP026[1] + seg[4];
+    P027[1] = iP027[1] + seg[4];
+
+    P028[1] = iP028[1] + seg[2];
+    P029[1] = iP029[1] + seg[2];
+    P030[1] = iP030[1] + seg[2];
+    P031[1] = iP031[1] + seg[2];
+    P032[1] = iP032[1] + seg[2];
+    P033[1] = iP033[1] + seg[2];
+    P034[1] = iP034[1] + seg[2];
+    P035[1] = iP035[1] + seg[2];
+
+    P036[1] = iP036[1] + seg[1];
+    P037[1] = iP037[1] + seg[1];
+    P038[1] = iP038[1] + seg[1];
+    P039[1] = iP039[1] + seg[1];
+    P040[1] = iP040[1] + seg[1];
+    P041[1] = iP041[1] + seg[1];
+    P042[1] = iP042[1] + seg[1];
+    P043[1] = iP043[1] + seg[1];
+
+    P044[1] = iP044[1] + seg[0];
+    P045[1] = iP045[1] + seg[0];
+    P046[1] = iP046[1] + seg[0];
+    P047[1] = iP047[1] + seg[0];
+    P048[1] = iP048[1] + seg[0];
+    P049[1] = iP049[1] + seg[0];
+    P050[1] = iP050[1] + seg[0];
+    P051[1] = iP051[1] + seg[0];
+
+    P009[1] = iP009[1] + seg[6];
+    P010[1] = iP010[1] + seg[6];
+    P075[1] = iP075[1] + seg[6];
+    P076[1] = iP076[1] + seg[6];
+
+    P001[1] = iP001[1] + seg[7];
+    P011[1] = iP011[1] + seg[7];
+    P068[1] = iP068[1] + seg[7];
+    P069[1] = iP069[1] + seg[7];
+    P070[1] = iP070[1] + seg[7];
+    P071[1] = iP071[1] + seg[7];
+    P072[1] = iP072[1] + seg[7];
+    P073[1] = iP073[1] + seg[7];
+    P074[1] = iP074[1] + seg[7];
+
+    P091[1] = iP091[1] + seg[3];
+    P092[1] = iP092[1] + seg[3];
+    P093[1] = iP093[1] + seg[3];
+    P094[1] = iP094[1] + seg[3];
+    P095[1] = iP095[1] + seg[3];
+    P122[1] = iP122[1] + seg[3] * 1.5;
+
+    P097[1] = iP097[1] + seg[8];
+    P098[1] = iP098[1] + seg[8];
+    P102[1] = iP102[1] + seg[8];
+    P110[1] = iP110[1] + seg[8];
+    P111[1] = iP111[1] + seg[8];
+    P121[1] = iP121[1] + seg[8];
+    P118[1] = iP118[1] + seg[8];
+    P119[1] = iP119[1] + seg[8];
+}
+
+static void
+DolphinGeometry(void)
+{
+    Dolphin014(GL_POLYGON);
+    Dolphin010(GL_POLYGON);
+    Dolphin009(GL_POLYGON);
+    Dolphin012(GL_POLYGON);
+    Dolphin013(GL_POLYGON);
+    Dolphin006(GL_POLYGON);
+    Dolphin002(GL_POLYGON);
+    Dolphin001(GL_POLYGON);
+    Dolphin003(GL_POLYGON);
+    Dolphin015(GL_POLYGON);
+    Dolphin004(GL_POLYGON);
+    Dolphin005(GL_POLYGON);
+    Dolphin007(GL_POLYGON);
+    Dolphin008(GL_POLYGON);
+    Dolphin011(GL_POLYGON);
+    Dolphin016(GL_POLYGON);
+}
+
+void
+loadDolphinModel(void)
+{
+    buildCreatureModel(&dolphinModel, DOLPHIN_BONES,
+                       DolphinGeometry, PoseDolphin);
+}
+
+void
+freeDolphinModel(void)
+{
+    freeCreatureModel(&dolphinModel);
+}
+
 void
 DrawDolphin(fishRec * fish, int wire)
 {
-    float seg0, seg1, seg2, seg3, seg4, seg5, seg6, seg7;
-    float pitch, thrash, chomp;
+    float seg[DOLPHIN_BONES];
+    float pitch, thrash;
     GLenum cap;
 
     fish->htail = (int) (fish->htail - (int) (10.0 * fish->v)) % 360;
 
     thrash = 70.0 * fish->v;
 
-    seg0 = 1.0 * thrash * sin((fish->htail) * RRAD);
-    seg3 = 1.0 * thrash * sin((fish->htail) * RRAD);
-    seg1 = 2.0 * thrash * sin((fish->htail + 4.0) * RRAD);
-    seg2 = 3.0 * thrash * sin((fish->htail + 6.0) * RRAD);
-    seg4 = 4.0 * thrash * sin((fish->htail + 10.0) * RRAD);
-    seg5 = 4.5 * thrash * sin((fish->htail + 15.0) * RRAD);
-    seg6 = 5.0 * thrash * sin((fish->htail + 20.0) * RRAD);
-    seg7 = 6.0 * thrash * sin((fish->htail + 30.0) * RRAD);
+    seg[0] = 1.0 * thrash * sin((fish->htail) * RRAD);
+    seg[3] = 1.0 * thrash * sin((fish->htail) * RRAD);
+    seg[1] = 2.0 * thrash * sin((fish->htail + 4.0) * RRAD);
+    seg[2] = 3.0 * thrash * sin((fish->htail + 6.0) * RRAD);
+    seg[4] = 4.0 * thrash * sin((fish->htail + 10.0) * RRAD);
+    seg[5] = 4.5 * thrash * sin((fish->htail + 15.0) * RRAD);
+    seg[6] = 5.0 * thrash * sin((fish->htail + 20.0) * RRAD);
+    seg[7] = 6.0 * thrash * sin((fish->htail + 30.0) * RRAD);
 
     pitch = fish->v * sin((fish->htail + 180.0) * RRAD);
 
     if (fish->v > 2.0)
     {
-	chomp = -(fish->v - 2.0) * 200.0;
+	seg[8] = -(fish->v - 2.0) * 200.0;
     }
-    chomp = 100.0;
-
-    P012[1] = iP012[1] + seg5;
-    P013[1] = iP013[1] + seg5;
-    P014[1] = iP014[1] + seg5;
-    P015[1] = iP015[1] + seg5;
-    P016[1] = iP016[1] + seg5;
-    P017[1] = iP017[1] + seg5;
-    P018[1] = iP018[1] + seg5;
-    P019[1] = iP019[1] + seg5;
-
-    P020[1] = iP020[1] + seg4;
-    P021[1] = iP021[1] + seg4;
-    P022[1] = iP022[1] + seg4;
-    P023[1] = iP023[1] + seg4;
-    P024[1] = iP024[1] + seg4;
-    P025[1] = iP025[1] + seg4;
-    P026[1] = iP026[1] + seg4;
-    P027[1] = iP027[1] + seg4;
-
-    P028[1] = iP028[1] + seg2;
-    P029[1] = iP029[1] + seg2;
-    P030[1] = iP030[1] + seg2;
-    P031[1] = iP031[1] + seg2;
-    P032[1] = iP032[1] + seg2;
-    P033[1] = iP033[1] + seg2;
-    P034[1] = iP034[1] + seg2;
-    P035[1] = iP035[1] + seg2;
-
-    P036[1] = iP036[1] + seg1;
-    P037[1] = iP037[1] + seg1;
-    P038[1] = iP038[1] + seg1;
-    P039[1] = iP039[1] + seg1;
-    P040[1] = iP040[1] + seg1;
-    P041[1] = iP041[1] + seg1;
-    P042[1] = iP042[1] + seg1;
-    P043[1] = iP043[1] + seg1;
-
-    P044[1] = iP044[1] + seg0;
-    P045[1] = iP045[1] + seg0;
-    P046[1] = iP046[1] + seg0;
-    P047[1] = iP047[1] + seg0;
-    P048[1] = iP048[1] + seg0;
-    P049[1] = iP049[1] + seg0;
-    P050[1] = iP050[1] + seg0;
-    P051[1] = iP051[1] + seg0;
-
-    P009[1] = iP009[1] + seg6;
-    P010[1] = iP010[1] + seg6;
-    P075[1] = iP075[1] + seg6;
-    P076[1] = iP076[1] + seg6;
-
-    P001[1] = iP001[1] + seg7;
-    P011[1] = iP011[1] + seg7;
-    P068[1] = iP068[1] + seg7;
-    P069[1] = iP069[1] + seg7;
-    P070[1] = iP070[1] + seg7;
-    P071[1] = iP071[1] + seg7;
-    P072[1] = iP072[1] + seg7;
-    P073[1] = iP073[1] + seg7;
-    P074[1] = iP074[1] + seg7;
-
-    P091[1] = iP091[1] + seg3;
-    P092[1] = iP092[1] + seg3;
-    P093[1] = iP093[1] + seg3;
-    P094[1] = iP094[1] + seg3;
-    P095[1] = iP095[1] + seg3;
-    P122[1] = iP122[1] + seg3 * 1.5;
-
-    P097[1] = iP097[1] + chomp;
-    P098[1] = iP098[1] + chomp;
-    P102[1] = iP102[1] + chomp;
-    P110[1] = iP110[1] + chomp;
-    P111[1] = iP111[1] + chomp;
-    P121[1] = iP121[1] + chomp;
-    P118[1] = iP118[1] + chomp;
-    P119[1] = iP119[1] + chomp;
+    seg[8] = 100.0;
 
     glPushMatrix();
 
@@ -209,23 +268,33 @@ DrawDolphin(fishRec * fish, int wire)
     glRotatef(180.0, 0.0, 1.0, 0.0);
 
     glEnable(GL_CULL_FACE);
-    cap = wire ? GL_LINE_LOOP : GL_POLYGON;
-    Dolphin014(cap);
-    Dolphin010(cap);
-    Dolphin009(cap);
-    Dolphin012(cap);
-    Dolphin013(cap);
-    Dolphin006(cap);
-    Dolphin002(cap);
-    Dolphin001(cap);
-    Dolphin003(cap);
-    Dolphin015(cap);
-    Dolphin004(cap);
-    Dolphin005(cap);
-    Dolphin007(cap);
-    Dolphin008(cap);
-    Dolphin011(cap);
-    Dolphin016(cap);
+    if (dolphinModel.vertices)
+    {
+	animateCreatureModel(&dolphinModel, seg);
+	drawCreatureModel(&dolphinModel, wire);
+    }
+    else
+    {
+	PoseDolphin(seg);
+
+	cap = wire ? GL_LINE_LOOP : GL_POLYGON;
+	Dolphin014(cap);
+	Dolphin010(cap);
+	Dolphin009(cap);
+	Dolphin012(cap);
+	Dolphin013(cap);
+	Dolphin006(cap);
+	Dolphin002(cap);
+	Dolphin001(cap);
+	Dolphin003(cap);
+	Dolphin015(cap);
+	Dolphin004(cap);
+	Dolphin005(cap);
+	Dolphin007(cap);
+	Dolphin008(cap);
+	Dolphin011(cap);
+	Dolphin016(cap);
+    }
     glDisable(GL_CULL_FACE);
 
     glPopMatrix();
@@ -34,6 +34,18 @@
 #include "atlantis-internal.h"
 #include "fish.h"
 
+/* let school.c turn the draws into instanced draws of a whole school */
+#define glDrawElements schoolDrawElements
+#define glMaterialfv   schoolMaterialfv
+#define glLightModelf  schoolLightModelf
+
+float *
+GetFishPoints (int *nPoints)
+{
+    *nPoints = ARRAY_SIZE (FishPoints) / 3;
+    return FishPoints;
+}
+
 void
 AnimateFish(float t)
 {
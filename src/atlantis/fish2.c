@@ -34,6 +34,18 @@
 #include "atlantis-internal.h"
 #include "fish2.h"
 
+/* let school.c turn the draws into instanced draws of a whole school */
+#define glDrawElements schoolDrawElements
+#define glMaterialfv   schoolMaterialfv
+#define glLightModelf  schoolLightModelf
+
+float *
+GetFish2Points (int *nPoints)
+{
+    *nPoints = ARRAY_SIZE (Fish2Points) / 3;
+    return Fish2Points;
+}
+
 void
 AnimateFish2(float t)
 {
@@ -40,71 +40,73 @@ BubbleTransform(Bubble * bubble)
     glTranslatef (bubble->y, bubble->z, bubble->x);
 }
 
+/* move every bubble of the pool in one pass */
 void
-BubblePilot(CompScreen * s,
-            int aeratorIndex,
-            int bubbleIndex)
+BubblePilot(CompScreen * s)
 {
     ATLANTIS_SCREEN (s);
 
-    int i;
+    int i, k;
 
-    Bubble * bubble = &(as->aerator[aeratorIndex].bubbles[bubbleIndex]);
+    Bool renderWaves = atlantisGetRenderWaves (s);
 
-    float x = bubble->x;
-    float y = bubble->y;
-    float z = bubble->z;
+    for (k = 0; k < as->numBubbles; k++)
+    {
+	Bubble * bubble = &(as->bubbles[k]);
+	aeratorRec * aerator = &(as->aerator[bubble->aerator]);
 
-    float top = (atlantisGetRenderWaves (s) ? 100000*
-		 getHeight(as->water, x / (100000 * as->ratio),
-		           y / (100000 * as->ratio)) : as->waterHeight);
+	float x = bubble->x;
+	float y = bubble->y;
+	float z = bubble->z;
 
-    float perpDist = (as->sideDistance - bubble->size);
-    float tempAng;
-    float dist;
+	float top = (renderWaves ? 100000*
+		     getHeight(as->water, x / (100000 * as->ratio),
+			       y / (100000 * as->ratio)) : as->waterHeight);
 
+	float perpDist = (as->sideDistance - bubble->size);
+	float tempAng;
+	float dist;
 
-    z += as->speedFactor * bubble->speed;
 
-    if (z > top - 2 * bubble->size)
-    {
-	x = as->aerator[aeratorIndex].x;
-	y = as->aerator[aeratorIndex].y;
-	z = as->aerator[aeratorIndex].z;
-	bubble->speed   = 100 + randf (150);
-	bubble->offset  = randf (2 * PI);
-	bubble->counter = 0;
-    }
-    bubble->counter++;
+	z += as->speedFactor * bubble->speed;
 
-    tempAng = fmodf (0.1 * bubble->counter * as->speedFactor + bubble->offset,
-                     2 * PI);
-    x += 50 * sinf (tempAng);
-    y += 50 * cosf (tempAng);
-
-    tempAng = atan2f (y, x);
-    dist    = hypotf (x, y);
+	if (z > top - 2 * bubble->size)
+	{
+	    x = aerator->x;
+	    y = aerator->y;
+	    z = aerator->z;
+	    bubble->speed   = 100 + randf (150);
+	    bubble->offset  = randf (2 * PI);
+	    bubble->counter = 0;
+	}
+	bubble->counter++;
 
-    for (i = 0; i < as->hsize; i++)
-    {
-	float directDist;
-	float cosAng = cosf (fmodf (i * as->arcAngle * toRadians - tempAng,
-	                            2 * PI));
-	if (cosAng <= 0)
-	    continue;
+	tempAng = fmodf (0.1 * bubble->counter * as->speedFactor +
+			 bubble->offset, 2 * PI);
+	x += 50 * sinf (tempAng);
+	y += 50 * cosf (tempAng);
 
-	directDist = perpDist / cosAng;
+	dist = hypotf (x, y);
 
-	if (dist > directDist)
+	for (i = 0; i < as->hsize && dist > 0; i++)
 	{
-	    x = directDist * cosf (tempAng);
-	    y = directDist * sinf (tempAng);
-	    tempAng = atan2f (y, x);
-	    dist    = hypotf (x, y);
+	    float directDist;
+	    float cosAng = (as->wallCos[i] * x + as->wallSin[i] * y) / dist;
+	    if (cosAng <= 0)
+		continue;
+
+	    directDist = perpDist / cosAng;
+
+	    if (dist > directDist)
+	    {
+		x *= directDist / dist;
+		y *= directDist / dist;
+		dist = hypotf (x, y);
+	    }
 	}
-    }
 
-    bubble->x = x;
-    bubble->y = y;
-    bubble->z = z;
+	bubble->x = x;
+	bubble->y = y;
+	bubble->z = z;
+    }
 }
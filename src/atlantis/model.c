@@ -0,0 +1,442 @@
+/*
+ * Compiz cube atlantis plugin
+ *
+ * model.c
+ *
+ * This plugin renders a fish tank inside of the transparent cube,
+ * replete with fish, crabs, sand, bubbles, and coral.
+ *
+ * Copyright : (C) 2007-2008 by David Mikos
+ * Email     : infiniteloopcounter@gmail.com
+ *
+ * Copyright : (C) 2007 by Dennis Kasprzyk
+ * E-mail    : onestone@compiz.org
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Vertex array models for the original atlantis creatures.
+ *
+ * The generated dolphin/shark/whale code draws each polygon in immediate
+ * mode from a set of point arrays, and animates by moving some of those
+ * points along one axis by a segment offset.  Here that code is run once
+ * with the gl calls redirected to a recorder, which turns the polygons
+ * into a triangle list.  Posing the model with each segment set to one in
+ * turn then gives the weight of every segment on every vertex, so the
+ * animation is a short loop over the moving vertices and a creature is
+ * drawn with a single glDrawArrays per part.
+ */
+
+#include <string.h>
+
+#include "atlantis-internal.h"
+
+#define MODEL_MAX_POLYGON 16
+
+static CreatureModel *recordModel = NULL;
+static int           recordSize;
+static const float   **recordSource; /* point array behind each vertex */
+static const float   *recordNormal;
+static Bool          recordDepthTest;
+
+static const float *polySource[MODEL_MAX_POLYGON];
+static const float *polyNormal[MODEL_MAX_POLYGON];
+static int         nPolyVertices;
+
+static void
+recordStartPart (void)
+{
+    CreatureModelPart *part;
+
+    if (recordModel->nParts &&
+	!recordModel->parts[recordModel->nParts - 1].count)
+	recordModel->nParts--;
+
+    if (recordModel->nParts >= MODEL_MAX_PARTS)
+	return;
+
+    part = &recordModel->parts[recordModel->nParts++];
+
+    part->first     = recordModel->nVertices;
+    part->count     = 0;
+    part->depthTest = recordDepthTest;
+}
+
+static Bool
+recordAddVertex (const float *source,
+                 const float *normal)
+{
+    CreatureModel *model = recordModel;
+    float         *v;
+
+    if (model->nVertices < 0)
+	return FALSE;
+
+    if (model->nVertices >= recordSize)
+    {
+	int         size = recordSize ? recordSize * 2 : 256;
+	float       *vertices;
+	const float **sources;
+
+	vertices = realloc (model->vertices, size * 6 * sizeof (float));
+	if (!vertices)
+	    return FALSE;
+	model->vertices = vertices;
+
+	sources = realloc (recordSource, size * sizeof (float *));
+	if (!sources)
+	    return FALSE;
+	recordSource = sources;
+
+	recordSize = size;
+    }
+
+    v = model->vertices + model->nVertices * 6;
+
+    if (normal)
+	memcpy (v, normal, 3 * sizeof (float));
+    else
+	memset (v, 0, 3 * sizeof (float));
+    memcpy (v + 3, source, 3 * sizeof (float));
+
+    recordSource[model->nVertices++] = source;
+    model->parts[model->nParts - 1].count++;
+
+    return TRUE;
+}
+
+void
+modelBegin (GLenum mode)
+{
+    if (!recordModel)
+    {
+	glBegin (mode);
+	return;
+    }
+
+    nPolyVertices = 0;
+}
+
+void
+modelEnd (void)
+{
+    int i;
+
+    if (!recordModel)
+    {
+	glEnd ();
+	return;
+    }
+
+    if (recordModel->nVertices < 0)
+	return;
+
+    /* polygons of the models are convex, so a fan gives the triangles */
+    for (i = 1; i < nPolyVertices - 1; i++)
+    {
+	if (!recordAddVertex (polySource[0], polyNormal[0]) ||
+	    !recordAddVertex (polySource[i], polyNormal[i]) ||
+	    !recordAddVertex (polySource[i + 1], polyNormal[i + 1]))
+	{
+	    recordModel->nVertices = -1;
+	    return;
+	}
+    }
+}
+
+void
+modelNormal3fv (const float *n)
+{
+    if (!recordModel)
+    {
+	glNormal3fv (n);
+	return;
+    }
+
+    recordNormal = n;
+}
+
+void
+modelVertex3fv (const float *v)
+{
+    if (!recordModel)
+    {
+	glVertex3fv (v);
+	return;
+    }
+
+    if (nPolyVertices >= MODEL_MAX_POLYGON)
+	return;
+
+    polySource[nPolyVertices] = v;
+    polyNormal[nPolyVertices] = recordNormal;
+    nPolyVertices++;
+}
+
+void
+modelEnable (GLenum cap)
+{
+    if (!recordModel)
+    {
+	glEnable (cap);
+	return;
+    }
+
+    if (cap == GL_DEPTH_TEST && !recordDepthTest)
+    {
+	recordDepthTest = TRUE;
+	recordStartPart ();
+    }
+}
+
+void
+modelDisable (GLenum cap)
+{
+    if (!recordModel)
+    {
+	glDisable (cap);
+	return;
+    }
+
+    if (cap == GL_DEPTH_TEST && recordDepthTest)
+    {
+	recordDepthTest = FALSE;
+	recordStartPart ();
+    }
+}
+
+static Bool
+addInfluence (CreatureModel *model,
+              int           vertex,
+              int           bone,
+              float         *delta)
+{
+    CreatureModelInfluence *influence;
+
+    if (model->nInfluences % 256 == 0)
+    {
+	CreatureModelInfluence *influences;
+
+	influences = realloc (model->influences,
+			      (model->nInfluences + 256) *
+			      sizeof (CreatureModelInfluence));
+	if (!influences)
+	    return FALSE;
+
+	model->influences = influences;
+    }
+
+    influence = &model->influences[model->nInfluences++];
+
+    influence->vertex = vertex;
+    influence->bone   = bone;
+    memcpy (influence->weight, delta, 3 * sizeof (float));
+
+    return TRUE;
+}
+
+/*
+ * Record the polygons drawn by geometry and find how each of the nBones
+ * offsets used by pose moves the vertices.
+ */
+Bool
+buildCreatureModel (CreatureModel *model,
+                    int           nBones,
+                    void          (*geometry) (void),
+                    void          (*pose) (const float *))
+{
+    float bones[MODEL_MAX_BONES];
+    float delta[3];
+    int   i, j, k;
+    Bool  status = TRUE;
+
+    if (model->refCount++)
+	return (model->vertices != NULL);
+
+    if (nBones > MODEL_MAX_BONES)
+	return FALSE;
+
+    model->nVertices   = 0;
+    model->vertices    = NULL;
+    model->rest        = NULL;
+    model->nParts      = 0;
+    model->nInfluences = 0;
+    model->influences  = NULL;
+    model->nBones      = nBones;
+
+    memset (bones, 0, sizeof (bones));
+    (*pose) (bones);
+
+    recordModel     = model;
+    recordSize      = 0;
+    recordSource    = NULL;
+    recordNormal    = NULL;
+    recordDepthTest = TRUE;
+    recordStartPart ();
+
+    (*geometry) ();
+
+    recordModel = NULL;
+
+    if (model->nParts && !model->parts[model->nParts - 1].count)
+	model->nParts--;
+
+    if (model->nVertices <= 0)
+	status = FALSE;
+
+    if (status)
+    {
+	model->rest = malloc (model->nVertices * 3 * sizeof (float));
+	if (!model->rest)
+	    status = FALSE;
+    }
+
+    if (status)
+    {
+	for (i = 0; i < model->nVertices; i++)
+	    memcpy (model->rest + i * 3, recordSource[i], 3 * sizeof (float));
+
+	for (j = 0; j < nBones && status; j++)
+	{
+	    bones[j] = 1.0f;
+	    (*pose) (bones);
+
+	    for (i = 0; i < model->nVertices && status; i++)
+	    {
+		Bool moved = FALSE;
+
+		for (k = 0; k < 3; k++)
+		{
+		    delta[k] = recordSource[i][k] - model->rest[i * 3 + k];
+		    if (delta[k] != 0.0f)
+			moved = TRUE;
+		}
+
+		if (moved)
+		    status = addInfluence (model, i, j, delta);
+	    }
+
+	    bones[j] = 0.0f;
+	}
+
+	(*pose) (bones);
+    }
+
+    if (recordSource)
+	free (recordSource);
+    recordSource = NULL;
+
+    if (!status)
+    { /* refCount stays raised, freeCreatureModel balances it */
+	if (model->vertices)
+	    free (model->vertices);
+	if (model->rest)
+	    free (model->rest);
+	if (model->influences)
+	    free (model->influences);
+
+	model->vertices   = NULL;
+	model->rest       = NULL;
+	model->influences = NULL;
+	model->nVertices  = 0;
+    }
+
+    return status;
+}
+
+void
+freeCreatureModel (CreatureModel *model)
+{
+    if (model->refCount <= 0 || --model->refCount)
+	return;
+
+    if (model->vertices)
+	free (model->vertices);
+    if (model->rest)
+	free (model->rest);
+    if (model->influences)
+	free (model->influences);
+
+    model->vertices   = NULL;
+    model->rest       = NULL;
+    model->influences = NULL;
+    model->nVertices  = 0;
+}
+
+void
+animateCreatureModel (CreatureModel *model,
+                      const float   *bones)
+{
+    CreatureModelInfluence *influence;
+    float                  *v;
+    int                    i;
+
+    /* reset the moving vertices first, as one can have several bones */
+    for (i = 0; i < model->nInfluences; i++)
+    {
+	influence = &model->influences[i];
+	v = model->vertices + influence->vertex * 6 + 3;
+
+	memcpy (v, model->rest + influence->vertex * 3, 3 * sizeof (float));
+    }
+
+    for (i = 0; i < model->nInfluences; i++)
+    {
+	influence = &model->influences[i];
+	v = model->vertices + influence->vertex * 6 + 3;
+
+	v[0] += bones[influence->bone] * influence->weight[0];
+	v[1] += bones[influence->bone] * influence->weight[1];
+	v[2] += bones[influence->bone] * influence->weight[2];
+    }
+}
+
+void
+drawCreatureModel (CreatureModel *model,
+                   int           wire)
+{
+    int i;
+
+    if (!model->vertices)
+	return;
+
+    if (wire)
+    {
+	glPushAttrib (GL_POLYGON_BIT);
+	glPolygonMode (GL_FRONT_AND_BACK, GL_LINE);
+    }
+
+    glEnableClientState (GL_NORMAL_ARRAY);
+    glEnableClientState (GL_VERTEX_ARRAY);
+    glNormalPointer (GL_FLOAT, 6 * sizeof (float), model->vertices);
+    glVertexPointer (3, GL_FLOAT, 6 * sizeof (float), model->vertices + 3);
+
+    for (i = 0; i < model->nParts; i++)
+    {
+	CreatureModelPart *part = &model->parts[i];
+
+	if (!part->depthTest)
+	    glDisable (GL_DEPTH_TEST);
+
+	glDrawArrays (GL_TRIANGLES, part->first, part->count);
+
+	if (!part->depthTest)
+	    glEnable (GL_DEPTH_TEST);
+    }
+
+    glDisableClientState (GL_NORMAL_ARRAY);
+
+    if (wire)
+	glPopAttrib ();
+}
@@ -113,6 +113,7 @@ public class ObjToC {
 	static String sourceIntro = "";
 	static float scaleFactor = 1;
 	static boolean numberedAnimation = false;
+	static boolean schoolDraw = false; //draws go through school.c
 	static int maxNumZeros = 0;
 	static int startFrame = 0;
 
@@ -183,6 +184,20 @@ public class ObjToC {
             out.print (sourceIntro);
             out.println ("#include \""+baseFilename+".h\"");
 
+            if (schoolDraw)
+            {
+                out.println ("\n/* let school.c turn the draws into instanced draws of a whole school */");
+                out.println ("#define glDrawElements schoolDrawElements");
+                out.println ("#define glMaterialfv   schoolMaterialfv");
+                out.println ("#define glLightModelf  schoolLightModelf");
+
+                //school.c builds its instanced mesh from the points
+                out.println ("\nfloat *\nGet"+methodName+"Points (int *nPoints)\n{");
+                out.println (indent+"*nPoints = ARRAY_SIZE ("+methodName+"Points) / 3;");
+                out.println (indent+"return "+methodName+"Points;");
+                out.println ("}");
+            }
+
 			animateObjFile();
 			vertexArrayObjFile();
 			initEndObjFile();
@@ -197,6 +212,7 @@ public class ObjToC {
 		filename = "";
 		outputFolder = "";
 		numberedAnimation = false;
+		schoolDraw = false;
 		methodName = "";
 		scaleFactor = 1;
 		headerIntro = "";
@@ -263,6 +279,17 @@ public class ObjToC {
 
 				numberedAnimation = Boolean.parseBoolean(st.nextToken());
 			}
+			else if (s.equals("@schoolDraw"))
+			{
+				if ((input = br.readLine()) == null)
+					break;
+
+				st = new StringTokenizer(input, " \t");
+				if (st.countTokens()!=1)
+					continue;
+
+				schoolDraw = Boolean.parseBoolean(st.nextToken());
+			}
 			else if (s.equals("@methodName"))
 			{
 				if ((input = br.readLine()) == null)
@@ -0,0 +1,481 @@
+/*
+ * Compiz cube atlantis plugin
+ *
+ * school.c
+ *
+ * This plugin renders a fish tank inside of the transparent cube,
+ * replete with fish, crabs, sand, bubbles, and coral.
+ *
+ * Copyright : (C) 2007-2008 by David Mikos
+ * Email     : infiniteloopcounter@gmail.com
+ *
+ * Copyright : (C) 2007 by Dennis Kasprzyk
+ * E-mail    : onestone@compiz.org
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Instanced drawing of fish schools.
+ *
+ * The tail of the small fish models moves every animated point along z
+ * by a + b * sin (w - c), where w is the tail phase.  Sampling the model at
+ * three phases rewrites this as a + C * sin (w) - S * cos (w), so the whole
+ * animation fits in one vertex attribute and a vertex shader can pose each
+ * fish itself.  All fish of one type are then drawn with the normal model
+ * code, but each glDrawElements becomes an instanced draw of a batch of
+ * fish with the transform, colour and tail phase of every fish in a
+ * uniform array.
+ *
+ * Materials that initDraw* copies from the fish colour are recognised by
+ * the alpha of the colour passed in and are multiplied by the colour of
+ * each fish in the shader, which lights them like the fixed function
+ * pipeline would.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "atlantis-internal.h"
+
+#define SCHOOL_TINT_ALPHA -1.0f
+
+/* uniforms kept free for the matrices, light and materials */
+#define SCHOOL_RESERVED_UNIFORMS 32
+
+typedef struct _SchoolType
+{
+    int  type;
+    int  model;
+    void (*init) (float *);
+    void (*draw) (void);
+    void (*fin) (void);
+}
+SchoolType;
+
+static const SchoolType schoolTypes[] = {
+    { BUTTERFLYFISH, SCHOOL_BFISH,
+      initDrawBFish, DrawAnimatedBFish, finDrawBFish },
+    { CHROMIS, SCHOOL_CHROMIS,
+      initDrawChromis, DrawAnimatedChromis, finDrawChromis },
+    { CHROMIS2, SCHOOL_CHROMIS,
+      initDrawChromis2, DrawAnimatedChromis, finDrawChromis },
+    { CHROMIS3, SCHOOL_CHROMIS,
+      initDrawChromis3, DrawAnimatedChromis, finDrawChromis },
+    { FISH, SCHOOL_FISH,
+      initDrawFish, DrawAnimatedFish, finDrawFish },
+    { FISH2, SCHOOL_FISH2,
+      initDrawFish2, DrawAnimatedFish2, finDrawFish2 }
+};
+
+static const struct
+{
+    float *(*points) (int *);
+    void  (*animate) (float);
+}
+schoolModels[SCHOOL_MODELS] = {
+    { GetBFishPoints,   AnimateBFish },
+    { GetChromisPoints, AnimateChromis },
+    { GetFishPoints,    AnimateFish },
+    { GetFish2Points,   AnimateFish2 }
+};
+
+static const char *schoolVertexShader =
+    "uniform vec4 instance[BATCH * 5];\n"
+    "uniform vec3 tint;\n"
+    "attribute vec3 tail;\n"
+    "\n"
+    "void main ()\n"
+    "{\n"
+    "    int  i     = gl_InstanceIDARB * 5;\n"
+    "    vec4 color = instance[i + 3];\n"
+    "    vec4 wave  = instance[i + 4];\n"
+    "    vec4 v     = vec4 (gl_Vertex.xy,\n"
+    "                       tail.x + tail.y * wave.x - tail.z * wave.y,\n"
+    "                       1.0);\n"
+    "    vec4 p     = vec4 (dot (instance[i], v),\n"
+    "                       dot (instance[i + 1], v),\n"
+    "                       dot (instance[i + 2], v), 1.0);\n"
+    "    vec3 n     = normalize (gl_NormalMatrix *\n"
+    "                            vec3 (dot (instance[i].xyz, gl_Normal),\n"
+    "                                  dot (instance[i + 1].xyz, gl_Normal),\n"
+    "                                  dot (instance[i + 2].xyz, gl_Normal)));\n"
+    "    vec4 a     = mix (vec4 (1.0), color, tint.x);\n"
+    "    vec4 d     = mix (vec4 (1.0), color, tint.y);\n"
+    "    vec4 s     = mix (vec4 (1.0), color, tint.z);\n"
+    "\n"
+    "    gl_FrontColor = light (n, gl_FrontMaterial.emission,\n"
+    "                           gl_FrontMaterial.ambient * a,\n"
+    "                           gl_FrontMaterial.diffuse * d,\n"
+    "                           gl_FrontMaterial.specular * s,\n"
+    "                           gl_FrontMaterial.shininess);\n"
+    "    gl_BackColor  = light (-n, gl_BackMaterial.emission,\n"
+    "                           gl_BackMaterial.ambient * a,\n"
+    "                           gl_BackMaterial.diffuse * d,\n"
+    "                           gl_BackMaterial.specular * s,\n"
+    "                           gl_BackMaterial.shininess);\n"
+    "    gl_Position   = gl_ModelViewProjectionMatrix * p;\n"
+    "}\n";
+
+/* school being drawn, the draw calls of the models are redirected to it */
+static FishSchool *drawSchool = NULL;
+
+/*
+ * Find a, C and S of a + C * sin (w) - S * cos (w) for the z of each point
+ * by running the animation at w = 0, pi / 2 and pi.
+ */
+static float *
+buildSchoolTail (float *(*getPoints) (int *),
+                 void  (*animate) (float))
+{
+    float *points, *tail;
+    int   nPoints, i;
+
+    points = (*getPoints) (&nPoints);
+
+    tail = malloc (nPoints * 3 * sizeof (float));
+    if (!tail)
+	return NULL;
+
+    (*animate) (0.0f);
+    for (i = 0; i < nPoints; i++)
+	tail[i * 3 + 2] = points[i * 3 + 2];
+
+    (*animate) (0.5f);
+    for (i = 0; i < nPoints; i++)
+    {
+	float z0 = tail[i * 3 + 2];
+
+	tail[i * 3]     = (z0 + points[i * 3 + 2]) / 2;
+	tail[i * 3 + 2] = (points[i * 3 + 2] - z0) / 2;
+    }
+
+    (*animate) (0.25f);
+    for (i = 0; i < nPoints; i++)
+	tail[i * 3 + 1] = points[i * 3 + 2] - tail[i * 3];
+
+    return tail;
+}
+
+static Bool
+loadSchoolProgram (FishSchool *school)
+{
+    GLSLFunctions   *glsl = school->glsl;
+    const GLcharARB *source[3];
+    char            header[128];
+
+    snprintf (header, sizeof (header),
+	      "#extension GL_ARB_draw_instanced : require\n"
+	      "#define BATCH %d\n", school->batch);
+
+    source[0] = header;
+    source[1] = atlantisLightShader;
+    source[2] = schoolVertexShader;
+
+    if (!loadVertexShader (glsl, "fish school", 3, source,
+			   &school->shader, &school->program))
+	return FALSE;
+
+    school->instanceLoc = (*glsl->getUniformLocation) (school->program,
+						      "instance");
+    school->tintLoc     = (*glsl->getUniformLocation) (school->program,
+						      "tint");
+    school->tailLoc     = (*glsl->getAttribLocation) (school->program,
+						     "tail");
+
+    return (school->instanceLoc >= 0 && school->tintLoc >= 0 &&
+	    school->tailLoc >= 0);
+}
+
+void
+initFishSchool (CompScreen *s)
+{
+    GLint components = 0;
+    int   i;
+
+    ATLANTIS_SCREEN (s);
+
+    FishSchool *school = &as->school;
+
+    school->supported  = FALSE;
+    school->shader     = 0;
+    school->program    = 0;
+    school->nInstances = 0;
+
+    for (i = 0; i < SCHOOL_MODELS; i++)
+	school->tail[i] = NULL;
+
+    school->glsl = &as->glsl;
+
+    if (!as->glsl.supported || !hasGLExtension ("GL_ARB_draw_instanced"))
+	return;
+
+    school->drawElementsInstanced = (GLDrawElementsInstancedProc)
+	(*s->getProcAddress) ((GLubyte *) "glDrawElementsInstancedARB");
+    if (!school->drawElementsInstanced)
+	return;
+
+    glGetIntegerv (GL_MAX_VERTEX_UNIFORM_COMPONENTS_ARB, &components);
+
+    school->batch = (components / 4 - SCHOOL_RESERVED_UNIFORMS) / 5;
+    school->batch = MIN (school->batch, SCHOOL_MAX_BATCH);
+
+    if (school->batch < 1)
+	return;
+
+    if (!loadSchoolProgram (school))
+    {
+	finiFishSchool (s);
+	return;
+    }
+
+    for (i = 0; i < SCHOOL_MODELS; i++)
+    {
+	school->tail[i] = buildSchoolTail (schoolModels[i].points,
+					   schoolModels[i].animate);
+	if (!school->tail[i])
+	{
+	    finiFishSchool (s);
+	    return;
+	}
+    }
+
+    school->supported = TRUE;
+}
+
+void
+finiFishSchool (CompScreen *s)
+{
+    int i;
+
+    ATLANTIS_SCREEN (s);
+
+    FishSchool *school = &as->school;
+
+    deleteVertexShader (school->glsl, school->shader, school->program);
+
+    for (i = 0; i < SCHOOL_MODELS; i++)
+    {
+	if (school->tail[i])
+	    free (school->tail[i]);
+	school->tail[i] = NULL;
+    }
+
+    school->program   = 0;
+    school->shader    = 0;
+    school->supported = FALSE;
+}
+
+Bool
+isSchoolFish (int type)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE (schoolTypes); i++)
+	if (schoolTypes[i].type == type)
+	    return TRUE;
+
+    return FALSE;
+}
+
+static void
+addSchoolInstance (FishSchool *school,
+                   fishRec    *fish)
+{
+    float *d = school->instances + school->nInstances * SCHOOL_INSTANCE_SIZE;
+    float scale = fish->size / 6000.0f;
+    float psi   = (fish->psi + 180) * toRadians;
+    float theta = fish->theta * toRadians;
+    float w     = 2 * PI * (fish->htail - (int) fish->htail);
+
+    float sinPsi   = sinf (psi) * scale;
+    float cosPsi   = cosf (psi) * scale;
+    float sinTheta = sinf (theta);
+    float cosTheta = cosf (theta);
+
+    /*
+     * rows of FishTransform, the fish scale and the turn of initDraw*
+     * (270 degrees about y) multiplied together
+     */
+    d[0]  = sinPsi * cosTheta;
+    d[1]  = sinPsi * sinTheta;
+    d[2]  = -cosPsi;
+    d[3]  = fish->y;
+
+    d[4]  = -sinTheta * scale;
+    d[5]  = cosTheta * scale;
+    d[6]  = 0.0f;
+    d[7]  = fish->z;
+
+    d[8]  = cosPsi * cosTheta;
+    d[9]  = cosPsi * sinTheta;
+    d[10] = sinPsi;
+    d[11] = fish->x;
+
+    memcpy (d + 12, fish->color, 4 * sizeof (float));
+
+    d[16] = sinf (w);
+    d[17] = cosf (w);
+    d[18] = 0.0f;
+    d[19] = 0.0f;
+
+    school->nInstances++;
+}
+
+static void
+flushSchool (FishSchool *school,
+             void       (*draw) (void))
+{
+    if (!school->nInstances)
+	return;
+
+    (*school->glsl->uniform4fv) (school->instanceLoc,
+			   school->nInstances * SCHOOL_INSTANCE_SIZE / 4,
+			   school->instances);
+    (*draw) ();
+
+    school->nInstances = 0;
+}
+
+/*
+ * Draw all fish that have a school model with one instanced draw per part
+ * of the model for every batch of fish of the same type.
+ */
+void
+drawFishSchools (CompScreen *s)
+{
+    static float tintColor[4] = { 1.0, 1.0, 1.0, SCHOOL_TINT_ALPHA };
+
+    int i, j;
+    Bool started;
+
+    ATLANTIS_SCREEN (s);
+
+    FishSchool    *school = &as->school;
+    GLSLFunctions *glsl = school->glsl;
+
+    if (!school->supported)
+	return;
+
+    (*glsl->useProgramObject) (school->program);
+    (*glsl->enableVertexAttribArray) (school->tailLoc);
+    glDisable (GL_VERTEX_PROGRAM_TWO_SIDE_ARB);
+
+    drawSchool = school;
+    school->nInstances = 0;
+
+    for (i = 0; i < ARRAY_SIZE (schoolTypes); i++)
+    {
+	const SchoolType *type = &schoolTypes[i];
+
+	started = FALSE;
+
+	for (j = 0; j < as->numFish; j++)
+	{
+	    if (as->fish[j].type != type->type)
+		continue;
+
+	    if (!started)
+	    {
+		/* the turn of initDraw* is part of the instance matrix */
+		glPushMatrix ();
+		(*type->init) (tintColor);
+		glPopMatrix ();
+
+		(*glsl->vertexAttribPointer) (school->tailLoc, 3, GL_FLOAT,
+					      GL_FALSE, 0,
+					      school->tail[type->model]);
+		started = TRUE;
+	    }
+
+	    addSchoolInstance (school, &as->fish[j]);
+
+	    if (school->nInstances == school->batch)
+		flushSchool (school, type->draw);
+	}
+
+	if (started)
+	{
+	    flushSchool (school, type->draw);
+	    (*type->fin) ();
+	}
+    }
+
+    drawSchool = NULL;
+
+    (*glsl->disableVertexAttribArray) (school->tailLoc);
+    (*glsl->useProgramObject) (0);
+}
+
+void
+schoolDrawElements (GLenum       mode,
+                    GLsizei      count,
+                    GLenum       type,
+                    const GLvoid *indices)
+{
+    if (!drawSchool)
+    {
+	glDrawElements (mode, count, type, indices);
+	return;
+    }
+
+    (*drawSchool->drawElementsInstanced) (mode, count, type, indices,
+					  drawSchool->nInstances);
+}
+
+void
+schoolMaterialfv (GLenum        face,
+                  GLenum        pname,
+                  const GLfloat *params)
+{
+    GLfloat color[4];
+    int     i;
+
+    if (drawSchool &&
+	(pname == GL_AMBIENT || pname == GL_DIFFUSE || pname == GL_SPECULAR))
+    {
+	static float tint[3] = { 0.0, 0.0, 0.0 };
+
+	i = (pname == GL_AMBIENT) ? 0 : (pname == GL_DIFFUSE) ? 1 : 2;
+
+	if (params[3] == SCHOOL_TINT_ALPHA)
+	{
+	    memcpy (color, params, 3 * sizeof (GLfloat));
+	    color[3] = 1.0f;
+	    params = color;
+
+	    tint[i] = 1.0f;
+	}
+	else
+	    tint[i] = 0.0f;
+
+	(*drawSchool->glsl->uniform3fv) (drawSchool->tintLoc, 1, tint);
+    }
+
+    glMaterialfv (face, pname, params);
+}
+
+void
+schoolLightModelf (GLenum  pname,
+                   GLfloat param)
+{
+    glLightModelf (pname, param);
+
+    if (drawSchool && pname == GL_LIGHT_MODEL_TWO_SIDE)
+    {
+	if (param)
+	    glEnable (GL_VERTEX_PROGRAM_TWO_SIDE_ARB);
+	else
+	    glDisable (GL_VERTEX_PROGRAM_TWO_SIDE_ARB);
+    }
+}
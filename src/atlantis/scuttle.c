@@ -83,7 +83,7 @@ CrabPilot (CompScreen *s, int index)
     if (!crab->isFalling && moveAmount <= 1)
     { /* walking along a surface */
 	float factor = as->speedFactor * (1 - moveAmount);
-	float ang, temp;
+	float dist, temp;
 
 	if (crab->scuttleAmount <= 0)
 	{
@@ -113,22 +113,22 @@ CrabPilot (CompScreen *s, int index)
 	     cosf (crab->theta *toRadians);
 	//crab->z += factor * sinf (crab->theta *toRadians);
 
-	ang = atan2f (y, x);
+	dist = hypotf (x, y);
 
-	for (i = 0; i < as->hsize; i++)
+	for (i = 0; i < as->hsize && dist > 0; i++)
 	{
-	    float cosAng = cosf (fmodf (i * as->arcAngle * toRadians - ang,
-	                                2 * PI));
+	    /* the direction of (x, y) does not change in this loop */
+	    float cosAng = (as->wallCos[i] * x + as->wallSin[i] * y) / dist;
 	    if (cosAng <= 0)
 		continue;
 
 	    float d = (as->sideDistance - 0.75 * crab->size) / cosAng;
-	    float d2 = hypotf (x, y);
 
-	    if (d2 > d)
+	    if (dist > d)
 	    {
-		x = d * cosf (ang);
-		y = d * sinf (ang);
+		x *= d / dist;
+		y *= d / dist;
+		dist = d;
 	    }
 
 	}
@@ -0,0 +1,202 @@
+/*
+ * Compiz cube atlantis plugin
+ *
+ * shader.c
+ *
+ * This plugin renders a fish tank inside of the transparent cube,
+ * replete with fish, crabs, sand, bubbles, and coral.
+ *
+ * Copyright : (C) 2007-2008 by David Mikos
+ * Email     : infiniteloopcounter@gmail.com
+ *
+ * Copyright : (C) 2007 by Dennis Kasprzyk
+ * E-mail    : onestone@compiz.org
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * GLSL vertex shader support shared by the fish schools and the water.
+ */
+
+#include <string.h>
+
+#include "atlantis-internal.h"
+
+/*
+ * Fixed function lighting of GL_LIGHT1 with a non-local viewer, which is
+ * how everything inside the cube is lit.
+ */
+const char *atlantisLightShader =
+    "vec4 light (vec3 n, vec4 emission, vec4 ambient, vec4 diffuse,\n"
+    "            vec4 specular, float shininess)\n"
+    "{\n"
+    "    float nl = dot (n, normalize (gl_LightSource[1].position.xyz));\n"
+    "    vec4  c  = emission + ambient * (gl_LightModel.ambient +\n"
+    "                                     gl_LightSource[1].ambient);\n"
+    "\n"
+    "    if (nl > 0.0)\n"
+    "    {\n"
+    "        float nh = max (dot (n, gl_LightSource[1].halfVector.xyz),\n"
+    "                        0.0);\n"
+    "\n"
+    "        c += nl * diffuse * gl_LightSource[1].diffuse;\n"
+    "        c += pow (nh, shininess) * specular *\n"
+    "             gl_LightSource[1].specular;\n"
+    "    }\n"
+    "\n"
+    "    c.a = diffuse.a;\n"
+    "    return clamp (c, 0.0, 1.0);\n"
+    "}\n";
+
+Bool
+hasGLExtension (const char *name)
+{
+    const char *extensions, *e;
+    int        len = strlen (name);
+
+    extensions = (const char *) glGetString (GL_EXTENSIONS);
+    if (!extensions)
+	return FALSE;
+
+    e = extensions;
+
+    while ((e = strstr (e, name)))
+    {
+	if ((e == extensions || e[-1] == ' ') &&
+	    (e[len] == ' ' || e[len] == '\0'))
+	    return TRUE;
+
+	e += len;
+    }
+
+    return FALSE;
+}
+
+void
+initGLSL (CompScreen *s)
+{
+    ATLANTIS_SCREEN (s);
+
+    GLSLFunctions *glsl = &as->glsl;
+
+    glsl->supported = FALSE;
+
+    if (!hasGLExtension ("GL_ARB_shader_objects") ||
+	!hasGLExtension ("GL_ARB_vertex_shader"))
+	return;
+
+    glsl->createShaderObject = (GLCreateShaderObjectProc)
+	(*s->getProcAddress) ((GLubyte *) "glCreateShaderObjectARB");
+    glsl->shaderSource = (GLShaderSourceProc)
+	(*s->getProcAddress) ((GLubyte *) "glShaderSourceARB");
+    glsl->compileShader = (GLCompileShaderProc)
+	(*s->getProcAddress) ((GLubyte *) "glCompileShaderARB");
+    glsl->createProgramObject = (GLCreateProgramObjectProc)
+	(*s->getProcAddress) ((GLubyte *) "glCreateProgramObjectARB");
+    glsl->attachObject = (GLAttachObjectProc)
+	(*s->getProcAddress) ((GLubyte *) "glAttachObjectARB");
+    glsl->linkProgram = (GLLinkProgramProc)
+	(*s->getProcAddress) ((GLubyte *) "glLinkProgramARB");
+    glsl->useProgramObject = (GLUseProgramObjectProc)
+	(*s->getProcAddress) ((GLubyte *) "glUseProgramObjectARB");
+    glsl->getObjectParameteriv = (GLGetObjectParameterivProc)
+	(*s->getProcAddress) ((GLubyte *) "glGetObjectParameterivARB");
+    glsl->deleteObject = (GLDeleteObjectProc)
+	(*s->getProcAddress) ((GLubyte *) "glDeleteObjectARB");
+    glsl->getUniformLocation = (GLGetUniformLocationProc)
+	(*s->getProcAddress) ((GLubyte *) "glGetUniformLocationARB");
+    glsl->getAttribLocation = (GLGetAttribLocationProc)
+	(*s->getProcAddress) ((GLubyte *) "glGetAttribLocationARB");
+    glsl->uniform3fv = (GLUniform3fvProc)
+	(*s->getProcAddress) ((GLubyte *) "glUniform3fvARB");
+    glsl->uniform4fv = (GLUniform4fvProc)
+	(*s->getProcAddress) ((GLubyte *) "glUniform4fvARB");
+    glsl->vertexAttribPointer = (GLVertexAttribPointerProc)
+	(*s->getProcAddress) ((GLubyte *) "glVertexAttribPointerARB");
+    glsl->enableVertexAttribArray = (GLEnableVertexAttribArrayProc)
+	(*s->getProcAddress) ((GLubyte *) "glEnableVertexAttribArrayARB");
+    glsl->disableVertexAttribArray = (GLDisableVertexAttribArrayProc)
+	(*s->getProcAddress) ((GLubyte *) "glDisableVertexAttribArrayARB");
+
+    glsl->supported = (glsl->createShaderObject && glsl->shaderSource &&
+		       glsl->compileShader && glsl->createProgramObject &&
+		       glsl->attachObject && glsl->linkProgram &&
+		       glsl->useProgramObject && glsl->getObjectParameteriv &&
+		       glsl->deleteObject && glsl->getUniformLocation &&
+		       glsl->getAttribLocation && glsl->uniform3fv &&
+		       glsl->uniform4fv && glsl->vertexAttribPointer &&
+		       glsl->enableVertexAttribArray &&
+		       glsl->disableVertexAttribArray);
+}
+
+/*
+ * Compile and link a program with a single vertex shader made of count
+ * source strings.  Returns FALSE on failure, whatever objects were
+ * created are still returned so they can be deleted.
+ */
+Bool
+loadVertexShader (GLSLFunctions   *glsl,
+                  const char      *name,
+                  int             count,
+                  const GLcharARB **source,
+                  GLhandleARB     *shader,
+                  GLhandleARB     *program)
+{
+    GLint status;
+
+    *shader  = 0;
+    *program = 0;
+
+    if (!glsl->supported)
+	return FALSE;
+
+    *shader = (*glsl->createShaderObject) (GL_VERTEX_SHADER_ARB);
+    (*glsl->shaderSource) (*shader, count, source, NULL);
+    (*glsl->compileShader) (*shader);
+
+    (*glsl->getObjectParameteriv) (*shader, GL_OBJECT_COMPILE_STATUS_ARB,
+				   &status);
+    if (!status)
+    {
+	compLogMessage ("atlantis", CompLogLevelWarn,
+			"Failed to compile %s vertex shader", name);
+	return FALSE;
+    }
+
+    *program = (*glsl->createProgramObject) ();
+    (*glsl->attachObject) (*program, *shader);
+    (*glsl->linkProgram) (*program);
+
+    (*glsl->getObjectParameteriv) (*program, GL_OBJECT_LINK_STATUS_ARB,
+				   &status);
+    if (!status)
+    {
+	compLogMessage ("atlantis", CompLogLevelWarn,
+			"Failed to link %s shader program", name);
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+void
+deleteVertexShader (GLSLFunctions *glsl,
+                    GLhandleARB   shader,
+                    GLhandleARB   program)
+{
+    if (program)
+	(*glsl->deleteObject) (program);
+    if (shader)
+	(*glsl->deleteObject) (shader);
+}
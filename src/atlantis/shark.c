@@ -94,70 +94,149 @@
  */
 
 #include "atlantis-internal.h"
+
+/* record the generated model code, see model.c */
+#define glBegin(mode)   modelBegin(mode)
+#define glEnd()         modelEnd()
+#define glNormal3fv(n)  modelNormal3fv(n)
+#define glVertex3fv(v)  modelVertex3fv(v)
+#define glEnable(cap)   modelEnable(cap)
+#define glDisable(cap)  modelDisable(cap)
+
 #include "shark.h"
 
+#undef glBegin
+#undef glEnd
+#undef glNormal3fv
+#undef glVertex3fv
+#undef glEnable
+#undef glDisable
+
+/* segment offsets seg1 .. seg4, segup and chomp */
+#define SHARK_BONES 6
+
+static CreatureModel sharkModel;
+
+static void
+PoseShark(const float *seg)
+{
+    P004[1] = iP004[1] + seg[5];
+    P007[1] = iP007[1] + seg[5];
+    P010[1] = iP010[1] + seg[5];
+    P011[1] = iP011[1] + seg[5];
+
+    P023[0] = iP023[0] + seg[0];
+    P024[0] = iP024[0] + seg[0];
+    P025[0] = iP025[0] + seg[0];
+    P026[0] = iP026[0] + seg[0];
+    P027[0] = iP027[0] + seg[0];
+    P028[0] = iP028[0] + seg[0];
+    P029[0] = iP029[0] + seg[0];
+    P030[0] = iP030[0] + seg[0];
+    P031[0] = iP031[0] + seg[0];
+    P032[0] = iP032[0] + seg[0];
+    P033[0] = iP033[0] + seg[1];
+    P034[0] = iP034[0] + seg[1];
+    P035[0] = iP035[0] + seg[1];
+    P036[0] = iP036[0] + seg[1];
+    P037[0] = iP037[0] + seg[1];
+    P038[0] = iP038[0] + seg[1];
+    P039[0] = iP039[0] + seg[1];
+    P040[0] = iP040[0] + seg[1];
+    P041[0] = iP041[0] + seg[1];
+    P042[0] = iP042[0] + seg[1];
+    P043[0] = iP043[0] + seg[2];
+    P044[0] = iP044[0] + seg[2];
+    P045[0] = iP045[0] + seg[2];
+    P046[0] = iP046[0] + seg[2];
+    P047[0] = iP047[0] + seg[2];
+    P048[0] = iP048[0] + seg[2];
+    P049[0] = iP049[0] + seg[2];
+    P050[0] = iP050[0] + seg[2];
+    P051[0] = iP051[0] + seg[2];
+    P052[0] = iP052[0] + seg[2];
+    P002[0] = iP002[0] + seg[3];
+    P061[0] = iP061[0] + seg[3];
+    P069[0] = iP069[0] + seg[3];
+    P070[0] = iP070[0] + seg[3];
+
+    P023[1] = iP023[1] + seg[4];
+    P024[1] = iP024[1] + seg[4];
+    P025[1] = iP025[1] + seg[4];
+    P026[1] = iP026[1] + seg[4];
+    P027[1] = iP027[1] + seg[4];
+    P028[1] = iP028[1] + seg[4];
+    P029[1] = iP029[1] + seg[4];
+    P030[1] = iP030[1] + seg[4];
+    P031[1] = iP031[1] + seg[4];
+    P032[1] = iP032[1] + seg[4];
+    P033[1] = iP033[1] + seg[4] * 5.0;
+    P034[1] = iP034[1] + seg[4] * 5.0;
+    P035[1] = iP035[1] + seg[4] * 5.0;
+    P036[1] = iP036[1] + seg[4] * 5.0;
+    P037[1] = iP037[1] + seg[4] * 5.0;
+    P038[1] = iP038[1] + seg[4] * 5.0;
+    P039[1] = iP039[1] + seg[4] * 5.0;
+    P040[1] = iP040[1] + seg[4] * 5.0;
+    P041[1] = iP041[1] + seg[4] * 5.0;
+    P042[1] = iP042[1] + seg[4] * 5.0;
+    P043[1] = iP043[1] + seg[4] * 12.0;
+    P044[1] = iP044[1] + seg[4] * 12.0;
+    P045[1] = iP045[1] + seg[4] * 12.0;
+    P046[1] = iP046[1] + seg[4] * 12.0;
+    P047[1] = iP047[1] + seg[4] * 12.0;
+    P048[1] = iP048[1] + seg[4] * 12.0;
+    P049[1] = iP049[1] + seg[4] * 12.0;
+    P050[1] = iP050[1] + seg[4] * 12.0;
+    P051[1] = iP051[1] + seg[4] * 12.0;
+    P052[1] = iP052[1] + seg[4] * 12.0;
+    P002[1] = iP002[1] + seg[4] * 17.0;
+    P061[1] = iP061[1] + seg[4] * 17.0;
+    P069[1] = iP069[1] + seg[4] * 17.0;
+    P070[1] = iP070[1] + seg[4] * 17.0;
+}
+
+static void
+SharkGeometry(void)
+{
+    Fish_1(GL_POLYGON);
+}
+
+void
+loadSharkModel(void)
+{
+    buildCreatureModel(&sharkModel, SHARK_BONES, SharkGeometry, PoseShark);
+}
+
+void
+freeSharkModel(void)
+{
+    freeCreatureModel(&sharkModel);
+}
+
 void
 DrawShark(fishRec * fish, int wire)
 {
     float mat[4][4];
     int n;
-    float seg1, seg2, seg3, seg4, segup;
-    float thrash, chomp;
+    float seg[SHARK_BONES];
+    float thrash;
     GLenum cap;
 
     fish->htail = (int) (fish->htail - (int) (5.0 * fish->v)) % 360;
 
     thrash = 50.0 * fish->v;
 
-    seg1 = 0.6 * thrash * sin(fish->htail * RRAD);
-    seg2 = 1.8 * thrash * sin((fish->htail + 45.0) * RRAD);
-    seg3 = 3.0 * thrash * sin((fish->htail + 90.0) * RRAD);
-    seg4 = 4.0 * thrash * sin((fish->htail + 110.0) * RRAD);
+    seg[0] = 0.6 * thrash * sin(fish->htail * RRAD);
+    seg[1] = 1.8 * thrash * sin((fish->htail + 45.0) * RRAD);
+    seg[2] = 3.0 * thrash * sin((fish->htail + 90.0) * RRAD);
+    seg[3] = 4.0 * thrash * sin((fish->htail + 110.0) * RRAD);
 
-    chomp = 0.0;
+    seg[5] = 0.0;
     if (fish->v > 2.0)
     {
-	chomp = -(fish->v - 2.0) * 200.0;
+	seg[5] = -(fish->v - 2.0) * 200.0;
     }
-    P004[1] = iP004[1] + chomp;
-    P007[1] = iP007[1] + chomp;
-    P010[1] = iP010[1] + chomp;
-    P011[1] = iP011[1] + chomp;
-
-    P023[0] = iP023[0] + seg1;
-    P024[0] = iP024[0] + seg1;
-    P025[0] = iP025[0] + seg1;
-    P026[0] = iP026[0] + seg1;
-    P027[0] = iP027[0] + seg1;
-    P028[0] = iP028[0] + seg1;
-    P029[0] = iP029[0] + seg1;
-    P030[0] = iP030[0] + seg1;
-    P031[0] = iP031[0] + seg1;
-    P032[0] = iP032[0] + seg1;
-    P033[0] = iP033[0] + seg2;
-    P034[0] = iP034[0] + seg2;
-    P035[0] = iP035[0] + seg2;
-    P036[0] = iP036[0] + seg2;
-    P037[0] = iP037[0] + seg2;
-    P038[0] = iP038[0] + seg2;
-    P039[0] = iP039[0] + seg2;
-    P040[0] = iP040[0] + seg2;
-    P041[0] = iP041[0] + seg2;
-    P042[0] = iP042[0] + seg2;
-    P043[0] = iP043[0] + seg3;
-    P044[0] = iP044[0] + seg3;
-    P045[0] = iP045[0] + seg3;
-    P046[0] = iP046[0] + seg3;
-    P047[0] = iP047[0] + seg3;
-    P048[0] = iP048[0] + seg3;
-    P049[0] = iP049[0] + seg3;
-    P050[0] = iP050[0] + seg3;
-    P051[0] = iP051[0] + seg3;
-    P052[0] = iP052[0] + seg3;
-    P002[0] = iP002[0] + seg4;
-    P061[0] = iP061[0] + seg4;
-    P069[0] = iP069[0] + seg4;
-    P070[0] = iP070[0] + seg4;
 
     fish->vtail += ((fish->dtheta - fish->vtail) * 0.1);
 
@@ -169,91 +248,69 @@ DrawShark(fishRec * fish, int wire)
     {
 	fish->vtail = -0.5;
     }
-    segup = thrash * fish->vtail;
-
-    P023[1] = iP023[1] + segup;
-    P024[1] = iP024[1] + segup;
-    P025[1] = iP025[1] + segup;
-    P026[1] = iP026[1] + segup;
-    P027[1] = iP027[1] + segup;
-    P028[1] = iP028[1] + segup;
-    P029[1] = iP029[1] + segup;
-    P030[1] = iP030[1] + segup;
-    P031[1] = iP031[1] + segup;
-    P032[1] = iP032[1] + segup;
-    P033[1] = iP033[1] + segup * 5.0;
-    P034[1] = iP034[1] + segup * 5.0;
-    P035[1] = iP035[1] + segup * 5.0;
-    P036[1] = iP036[1] + segup * 5.0;
-    P037[1] = iP037[1] + segup * 5.0;
-    P038[1] = iP038[1] + segup * 5.0;
-    P039[1] = iP039[1] + segup * 5.0;
-    P040[1] = iP040[1] + segup * 5.0;
-    P041[1] = iP041[1] + segup * 5.0;
-    P042[1] = iP042[1] + segup * 5.0;
-    P043[1] = iP043[1] + segup * 12.0;
-    P044[1] = iP044[1] + segup * 12.0;
-    P045[1] = iP045[1] + segup * 12.0;
-    P046[1] = iP046[1] + segup * 12.0;
-    P047[1] = iP047[1] + segup * 12.0;
-    P048[1] = iP048[1] + segup * 12.0;
-    P049[1] = iP049[1] + segup * 12.0;
-    P050[1] = iP050[1] + segup * 12.0;
-    P051[1] = iP051[1] + segup * 12.0;
-    P052[1] = iP052[1] + segup * 12.0;
-    P002[1] = iP002[1] + segup * 17.0;
-    P061[1] = iP061[1] + segup * 17.0;
-    P069[1] = iP069[1] + segup * 17.0;
-    P070[1] = iP070[1] + segup * 17.0;
+    seg[4] = thrash * fish->vtail;
 
     glPushMatrix();
 
     glTranslatef(0.0, 0.0, -3000.0);
 
-    glGetFloatv(GL_MODELVIEW_MATRIX, &mat[0][0]);
-    n = 0;
-    if (mat[0][2] >= 0.0)
-    {
-	n += 1;
-    }
-    if (mat[1][2] >= 0.0)
-    {
-	n += 2;
+    glEnable(GL_CULL_FACE);
+
+    if (sharkModel.vertices)
+    { /* depth tested, so the view dependent polygon order is not needed */
+	glScalef(2.0, 1.0, 1.0);
+
+	animateCreatureModel(&sharkModel, seg);
+	drawCreatureModel(&sharkModel, wire);
     }
-    if (mat[2][2] >= 0.0)
+    else
     {
-	n += 4;
-    }
-    glScalef(2.0, 1.0, 1.0);
+	PoseShark(seg);
 
-    glEnable(GL_CULL_FACE);
-    cap = wire ? GL_LINE_LOOP : GL_POLYGON;
-    switch (n)
-    {
-    case 0:
-	Fish_1(cap);
-	break;
-    case 1:
-	Fish_2(cap);
-	break;
-    case 2:
-	Fish_3(cap);
-	break;
-    case 3:
-	Fish_4(cap);
-	break;
-    case 4:
-	Fish_5(cap);
-	break;
-    case 5:
-	Fish_6(cap);
-	break;
-    case 6:
-	Fish_7(cap);
-	break;
-    case 7:
-	Fish_8(cap);
-	break;
+	glGetFloatv(GL_MODELVIEW_MATRIX, &mat[0][0]);
+	n = 0;
+	if (mat[0][2] >= 0.0)
+	{
+	    n += 1;
+	}
+	if (mat[1][2] >= 0.0)
+	{
+	    n += 2;
+	}
+	if (mat[2][2] >= 0.0)
+	{
+	    n += 4;
+	}
+	glScalef(2.0, 1.0, 1.0);
+
+	cap = wire ? GL_LINE_LOOP : GL_POLYGON;
+	switch (n)
+	{
+	case 0:
+	    Fish_1(cap);
+	    break;
+	case 1:
+	    Fish_2(cap);
+	    break;
+	case 2:
+	    Fish_3(cap);
+	    break;
+	case 3:
+	    Fish_4(cap);
+	    break;
+	case 4:
+	    Fish_5(cap);
+	    break;
+	case 5:
+	    Fish_6(cap);
+	    break;
+	case 6:
+	    Fish_7(cap);
+	    break;
+	case 7:
+	    Fish_8(cap);
+	    break;
+	}
     }
     glDisable(GL_CULL_FACE);
 
@@ -107,6 +107,7 @@
 
 #include "atlantis-internal.h"
 #include "atlantis_options.h"
+#include <string.h>
 #include <math.h>
 #include <float.h>
 
@@ -123,6 +124,43 @@ FishTransform (fishRec * fish)
     glRotatef (fish->theta,     1.0, 0.0, 0.0);
 }
 
+/*
+ * Cache the direction of each side wall for the current frame, these are
+ * the same for every fish, crab and bubble.
+ */
+Bool
+updateWallAngles (CompScreen *s)
+{
+    ATLANTIS_SCREEN (s);
+
+    int i;
+
+    if (as->hsize > as->nWalls)
+    {
+	float *wallCos = realloc (as->wallCos, as->hsize * sizeof (float));
+	float *wallSin;
+
+	if (!wallCos)
+	    return FALSE;
+	as->wallCos = wallCos;
+
+	wallSin = realloc (as->wallSin, as->hsize * sizeof (float));
+	if (!wallSin)
+	    return FALSE;
+	as->wallSin = wallSin;
+
+	as->nWalls = as->hsize;
+    }
+
+    for (i = 0; i < as->hsize; i++)
+    {
+	as->wallCos[i] = cosf (i * as->arcAngle * toRadians);
+	as->wallSin[i] = sinf (i * as->arcAngle * toRadians);
+    }
+
+    return TRUE;
+}
+
 void
 FishPilot (CompScreen *s,
            int index)
@@ -149,14 +187,14 @@ FishPilot (CompScreen *s,
 		  for each wall */
     float tTemp[as->hsize]; /* distance to wall when not changing angle */
 
-    float tempAng = atan2f(y, x);
     float dist = hypotf(x, y);
     float perpDist = (as->sideDistance - fish->size/2);
+    float cosPsi, sinPsi;
 
     float t = FLT_MAX;
     int iWall = 0; /* The number of the wall most in the way of the fish */
 
-    float distRem, cosAng;
+    float distRem;
     float mota; /* MIN opposite turn angle */
 
     float turnRem[2]; /* right/left */
@@ -184,28 +222,29 @@ FishPilot (CompScreen *s,
 	fish->z = bottomTank+fish->size/2;
     }
 
+    cosPsi = cosf (fish->psi * toRadians);
+    sinPsi = sinf (fish->psi * toRadians);
+
+    /* the per wall angles come from the tables built in updateWallAngles,
+       dist * cos (wall angle - fish angle) is the dot product of the fish
+       position with the wall direction */
     for (i=0; i<as->hsize; i++)
     {
-	float cosAng = cosf (fmodf (i * as->arcAngle * toRadians - tempAng,
-	                            2 * PI));
+	float wallDist = as->wallCos[i] * x + as->wallSin[i] * y;
 
-	tTemp[i] = (perpDist - dist * cosAng) / cosf (
-	           fmodf (fish->psi * toRadians - i * as->arcAngle * toRadians,
-	                  2*PI));
+	tTemp[i] = (perpDist - wallDist) /
+		   (cosPsi * as->wallCos[i] + sinPsi * as->wallSin[i]);
 
-	if (cosAng > 0)
+	if (wallDist > 0)
 	{
-	    float d = dist * cosAng - perpDist;
+	    float d = wallDist - perpDist;
 
 	    if (d > 0) {
-		x -= d * cosf (tempAng) *
-		     fabsf (cosf (i * as->arcAngle * toRadians));
-		y -= d * sinf (tempAng) *
-		     fabsf (sinf (i * as->arcAngle * toRadians));
+		x -= d * (x / dist) * fabsf (as->wallCos[i]);
+		y -= d * (y / dist) * fabsf (as->wallSin[i]);
 		fish->x = x;
 		fish->y = y;
 		tTemp[i] = 0.1;
-		tempAng = atan2f (y, x);
 		dist = hypotf (x, y);
 	    }
 	}
@@ -231,8 +270,8 @@ FishPilot (CompScreen *s,
 	float signAng = sign[j] * ang;
 	i = iWall;
 
-	cosAng = cosf (fmodf (iWall * as->arcAngle * toRadians - tempAng, 2 * PI));
-	distRem = fabsf (perpDist - dist * cosAng);
+	distRem = fabsf (perpDist - (as->wallCos[iWall] * x +
+				     as->wallSin[iWall] * y));
 
 	turnRem[j] = fmodf(90 - signAng, 360);
 	if (turnRem[j] < 0)
@@ -264,8 +303,8 @@ FishPilot (CompScreen *s,
 	else
 	    i = (iWall + as->hsize - 1) % as->hsize;
 
-	cosAng = cosf (fmodf (i * as->arcAngle * toRadians - tempAng, 2 * PI));
-	distRem = fabsf (perpDist - dist * cosAng);
+	distRem = fabsf (perpDist - (as->wallCos[i] * x +
+				     as->wallSin[i] * y));
 
 	top[j] = sinf ((signAng + turnRem[j]) * toRadians) - sinf (signAng * toRadians);
 	bottom[j] = 2 * distRem / maxVel + cosf (signAng * toRadians) -
@@ -399,6 +438,270 @@ FishPilot (CompScreen *s,
     fish->z += maxVel * sinf (fish->theta * toRadians);
 }
 
+static int
+fishGridCoord (float v,
+               float min,
+               float cellSize,
+               int   n)
+{
+    int c = (v - min) / cellSize;
+
+    return MAX (0, MIN (n - 1, c));
+}
+
+void
+initFishGrid (CompScreen *s)
+{
+    ATLANTIS_SCREEN (s);
+
+    FishGrid *grid = &as->grid;
+
+    grid->nCells   = 0;
+    grid->maxCells = 0;
+
+    grid->cellStart = NULL;
+    grid->cellFish  = NULL;
+    grid->fishCell  = NULL;
+
+    if (as->numFish <= 0)
+	return;
+
+    grid->cellFish = calloc (as->numFish, sizeof (int));
+    grid->fishCell = calloc (as->numFish, sizeof (int));
+}
+
+void
+freeFishGrid (CompScreen *s)
+{
+    ATLANTIS_SCREEN (s);
+
+    FishGrid *grid = &as->grid;
+
+    if (grid->cellStart)
+	free (grid->cellStart);
+    if (grid->cellFish)
+	free (grid->cellFish);
+    if (grid->fishCell)
+	free (grid->fishCell);
+
+    grid->cellStart = NULL;
+    grid->cellFish  = NULL;
+    grid->fishCell  = NULL;
+
+    grid->nCells   = 0;
+    grid->maxCells = 0;
+}
+
+/*
+ * Sort the fish into a uniform 3D grid (counting sort on the cell index)
+ * so that BoidsAngle only has to look at the cells around each fish.
+ * The cells are at least as large as the schooling radius.
+ */
+void
+updateFishGrid (CompScreen *s)
+{
+    ATLANTIS_SCREEN (s);
+
+    FishGrid *grid = &as->grid;
+    float    maxX, maxY, maxZ;
+    float    cellSize;
+    int      i, c;
+
+    grid->nCells = 0;
+
+    if (!atlantisGetSchoolGrid (s) || as->numFish <= 0 ||
+	!grid->cellFish || !grid->fishCell)
+	return;
+
+    grid->minX = maxX = as->fish[0].x;
+    grid->minY = maxY = as->fish[0].y;
+    grid->minZ = maxZ = as->fish[0].z;
+
+    for (i = 1; i < as->numFish; i++)
+    {
+	fishRec * fish = &(as->fish[i]);
+
+	grid->minX = MIN (grid->minX, fish->x);
+	grid->minY = MIN (grid->minY, fish->y);
+	grid->minZ = MIN (grid->minZ, fish->z);
+
+	maxX = MAX (maxX, fish->x);
+	maxY = MAX (maxY, fish->y);
+	maxZ = MAX (maxZ, fish->z);
+    }
+
+    cellSize = atlantisGetSchoolRadius (s) * 100000;
+    cellSize = MAX (cellSize, (maxX - grid->minX) / FISH_GRID_MAX_DIM);
+    cellSize = MAX (cellSize, (maxY - grid->minY) / FISH_GRID_MAX_DIM);
+    cellSize = MAX (cellSize, (maxZ - grid->minZ) / FISH_GRID_MAX_DIM);
+
+    grid->cellSize = cellSize;
+
+    grid->nX = MIN ((int) ((maxX - grid->minX) / cellSize) + 1,
+                    FISH_GRID_MAX_DIM);
+    grid->nY = MIN ((int) ((maxY - grid->minY) / cellSize) + 1,
+                    FISH_GRID_MAX_DIM);
+    grid->nZ = MIN ((int) ((maxZ - grid->minZ) / cellSize) + 1,
+                    FISH_GRID_MAX_DIM);
+
+    c = grid->nX * grid->nY * grid->nZ;
+
+    if (c > grid->maxCells)
+    {
+	int *cellStart = realloc (grid->cellStart, (c + 1) * sizeof (int));
+
+	if (!cellStart)
+	    return;
+
+	grid->cellStart = cellStart;
+	grid->maxCells  = c;
+    }
+
+    grid->nCells = c;
+
+    memset (grid->cellStart, 0, (grid->nCells + 1) * sizeof (int));
+
+    for (i = 0; i < as->numFish; i++)
+    {
+	fishRec * fish = &(as->fish[i]);
+
+	c = (fishGridCoord (fish->z, grid->minZ, cellSize, grid->nZ) *
+	     grid->nY +
+	     fishGridCoord (fish->y, grid->minY, cellSize, grid->nY)) *
+	    grid->nX +
+	    fishGridCoord (fish->x, grid->minX, cellSize, grid->nX);
+
+	grid->fishCell[i] = c;
+	grid->cellStart[c + 1]++;
+    }
+
+    for (c = 0; c < grid->nCells; c++)
+	grid->cellStart[c + 1] += grid->cellStart[c];
+
+    /* cellStart[c] temporarily becomes the end of cell c here */
+    for (i = 0; i < as->numFish; i++)
+	grid->cellFish[grid->cellStart[grid->fishCell[i]]++] = i;
+
+    for (c = grid->nCells; c > 0; c--)
+	grid->cellStart[c] = grid->cellStart[c - 1];
+    grid->cellStart[0] = 0;
+}
+
+static void
+BoidsAddFish (fishRec *fish,
+              fishRec *other,
+              Bool    schoolSimilarGroups,
+              float   *X,
+              float   *Y,
+              float   *Z)
+{
+    float x = fish->x;
+    float y = fish->y;
+    float z = fish->z;
+
+    float psi = fish->psi;
+    float theta = fish->theta;
+
+    int type = fish->type;
+
+    float factor = 1; /* positive means form group, negative means stay away.
+			 the amount is proportional to the relative
+			 importance of the pairs of fish.*/
+
+    if (type < other->type)
+    {
+	if (other->type <= FISH2)
+	    factor =-1; /* fish is coming up against different fish */
+	else
+	    factor = (float) (type - other->type) * 3;
+	    /* fish is coming against a shark, etc. */
+    }
+    else if (type == other->type)
+    {
+	if (fish->group != other->group && !schoolSimilarGroups)
+	    factor =-1; /* fish is coming up against different fish */
+    }
+    else
+	return; /* whales are not bothered,
+		   sharks are not bothered by fish, etc. */
+
+    if (schoolSimilarGroups)
+    {
+	if ( (type == CHROMIS  && (other->type == CHROMIS2 ||
+				   other->type == CHROMIS3)) ||
+	     (type == CHROMIS2 && (other->type == CHROMIS  ||
+				   other->type == CHROMIS3)) ||
+	     (type == CHROMIS3 && (other->type == CHROMIS  ||
+				   other->type == CHROMIS2)))
+	    factor = 1;
+    }
+
+    float xt = (other->x - x);
+    float yt = (other->y - y);
+    float zt = (other->z - z);
+    float d = sqrtf (xt * xt + yt * yt + zt * zt);
+
+    float th = fmodf (atan2f (yt, xt) * toDegrees - psi, 360);
+    if (th > 180)
+	th -= 360;
+    if (th <- 180)
+	th += 360;
+
+    if (fabsf (th) < 80 &&
+	fabsf (asinf (zt / d) * toDegrees - theta ) < 80)
+    { /* in field of view of fish */
+
+	th = fmodf(other->psi - psi, 360);
+	if (th <- 180)
+	    th += 360;
+	if (th > 180)
+	    th -= 360;
+
+	if (factor>0 && (fabsf (th) > 90 ||
+			 fabsf (other->theta - theta) < 90))
+	{
+	    /* other friendly fish heading in near opposite direction
+	       the idea is to turn to form a group by taking the lead
+	       or sneaking behind */
+
+	    if (d > 50000 / 2)
+	    { /* varies as distance to power [1,2] after
+		 this distance */
+		d = powf(d, 1 + (d - 50000 / 2) /
+			 (2 * 50000 - 50000 / 2));
+	    }
+
+	    factor /= d;
+	    *X += factor * cosf (other->psi * toRadians) *
+		  cosf (other->theta * toRadians);
+	    *Y += factor * sinf (other->psi * toRadians) *
+		  cosf (other->theta * toRadians);
+	    *Z += factor * sinf (other->theta * toRadians);
+	}
+	else
+	{
+	    if (d > 50000 / 2)
+	    { /* varies as distance to power [1,2] after
+		 this distance */
+		d = powf (d, 2 + (d - 50000 / 2) /
+			  (2 * 50000 - 50000 / 2));
+	    }
+	    else
+	    { /* varies as distance */
+		d *= d;
+	    }
+
+	    /* note an extra factor of d due to
+	       normalizing (xt, yt, zt) */
+
+	    factor /= d;
+	    *X += factor * xt;
+	    *Y += factor * yt;
+	    *Z += factor * zt;
+	}
+    }
+}
+
 void
 BoidsAngle(CompScreen *s,
            int i)
@@ -412,8 +715,6 @@ BoidsAngle(CompScreen *s,
     float psi = as->fish[i].psi;
     float theta = as->fish[i].theta;
 
-    int type = as->fish[i].type;
-
     float factor = 5+5*fabsf(symmDistr());
     float randPsi = 10*symmDistr();
     float randTh = 10*symmDistr();
@@ -425,20 +726,15 @@ BoidsAngle(CompScreen *s,
 	      cosf ((theta + randTh) * toRadians) / 50000;
     float Z = factor * sinf ((theta + randTh) * toRadians) / 50000;
 
-    float tempAng = atan2f (y, x);
-    float dist = hypotf (x, y);
-
     float perpDist;
     int j;
 
+    Bool schoolSimilarGroups;
+
     for (j = 0; j < as->hsize; j++)
     { /* consider side walls */
-	float wTheta = j * as->arcAngle*toRadians;
-
-	float cosAng = cosf (fmodf (j * as->arcAngle * toRadians - tempAng,
-	                            2 * PI));
 	perpDist = fabsf (as->sideDistance - as->fish[i].size / 2 -
-	                  dist * cosAng);
+	                  (as->wallCos[j] * x + as->wallSin[j] * y));
 
 	if (perpDist > 50000)
 	    continue;
@@ -450,8 +746,8 @@ BoidsAngle(CompScreen *s,
 	if (perpDist <= as->fish[i].size)
 	    factor *= as->fish[i].size / perpDist;
 
-	X -= factor * cosf (wTheta) / perpDist;
-	Y -= factor * sinf (wTheta) / perpDist;
+	X -= factor * as->wallCos[j] / perpDist;
+	Y -= factor * as->wallSin[j] / perpDist;
     }
 
     perpDist = as->waterHeight - z; /* top wall */
@@ -470,106 +766,53 @@ BoidsAngle(CompScreen *s,
 	factor = as->fish[i].size / perpDist;
     Z += factor / perpDist;
 
-    for (j = 0; j < as->numFish; j++)
-    { /* consider other fish */
-	if (j != i)
-	{
-	    factor = 1; /* positive means form group, negative means stay away.
-			   the amount is proportional to the relative
-			   importance of the pairs of fish.*/
-	    if (type < as->fish[j].type)
-	    {
-		if (as->fish[j].type <= FISH2)
-		    factor =-1; /* fish is coming up against different fish */
-		else
-		    factor = (float) (type - as->fish[j].type) * 3;
-		    /* fish is coming against a shark, etc. */
-	    }
-	    else if (type == as->fish[j].type)
-	    {
-		if (as->fish[i].group != as->fish[j].group &&
-		    !atlantisGetSchoolSimilarGroups(s))
-		    factor =-1; /* fish is coming up against different fish */
-	    }
-	    else
-		continue; /* whales are not bothered,
-			     sharks are not bothered by fish, etc. */
-
-	    if (atlantisGetSchoolSimilarGroups(s))
-	    {
-		if ( (type == CHROMIS  && (as->fish[j].type == CHROMIS2 ||
-					   as->fish[j].type == CHROMIS3)) ||
-		     (type == CHROMIS2 && (as->fish[j].type == CHROMIS  ||
-					   as->fish[j].type == CHROMIS3)) ||
-		     (type == CHROMIS3 && (as->fish[j].type == CHROMIS  ||
-					   as->fish[j].type == CHROMIS2)))
-		    factor = 1;
-	    }
+    schoolSimilarGroups = atlantisGetSchoolSimilarGroups (s);
 
-	    float xt = (as->fish[j].x - x);
-	    float yt = (as->fish[j].y - y);
-	    float zt = (as->fish[j].z - z);
-	    float d = sqrtf (xt * xt + yt * yt + zt * zt);
-
-	    float th = fmodf (atan2f (yt, xt) * toDegrees - psi, 360);
-	    if (th > 180)
-		th -= 360;
-	    if (th <- 180)
-		th += 360;
-
-	    if (fabsf (th) < 80 &&
-		fabsf (asinf (zt / d) * toDegrees - theta ) < 80)
-	    { /* in field of view of fish */
-
-		th = fmodf(as->fish[j].psi - psi, 360);
-		if (th <- 180)
-		    th += 360;
-		if (th > 180)
-		    th -= 360;
-
-		if (factor>0 && (fabsf (th) > 90 ||
-				 fabsf (as->fish[j].theta - theta) < 90))
-		{
-		    /* other friendly fish heading in near opposite direction
-		       the idea is to turn to form a group by taking the lead
-		       or sneaking behind */
-
-		    if (d > 50000 / 2)
-		    { /* varies as distance to power [1,2] after
-			 this distance */
-			d = powf(d, 1 + (d - 50000 / 2) /
-			         (2 * 50000 - 50000 / 2));
-		    }
+    if (atlantisGetSchoolGrid (s) && as->grid.nCells)
+    { /* consider other fish in the neighbouring grid cells */
+	FishGrid *grid = &as->grid;
 
-		    factor /= d;
-		    X += factor * cosf (as->fish[j].psi * toRadians) *
-			 cosf (as->fish[j].theta * toRadians);
-		    Y += factor * sinf (as->fish[j].psi * toRadians) *
-			 cosf (as->fish[j].theta * toRadians);
-		    Z += factor * sinf (as->fish[j].theta * toRadians);
-		}
-		else
+	float radius = atlantisGetSchoolRadius (s) * 100000;
+	int   cx = fishGridCoord (x, grid->minX, grid->cellSize, grid->nX);
+	int   cy = fishGridCoord (y, grid->minY, grid->cellSize, grid->nY);
+	int   cz = fishGridCoord (z, grid->minZ, grid->cellSize, grid->nZ);
+	int   gx, gy, gz, k;
+
+	for (gz = MAX (cz - 1, 0); gz <= MIN (cz + 1, grid->nZ - 1); gz++)
+	    for (gy = MAX (cy - 1, 0); gy <= MIN (cy + 1, grid->nY - 1); gy++)
+		for (gx = MAX (cx - 1, 0); gx <= MIN (cx + 1, grid->nX - 1);
+		     gx++)
 		{
-		    if (d > 50000 / 2)
-		    { /* varies as distance to power [1,2] after
-			 this distance */
-			d = powf (d, 2 + (d - 50000 / 2) /
-				  (2 * 50000 - 50000 / 2));
-		    }
-		    else
-		    { /* varies as distance */
-			d *= d;
-		    }
+		    int c = (gz * grid->nY + gy) * grid->nX + gx;
 
-		    /* note an extra factor of d due to
-		       normalizing (xt, yt, zt) */
+		    for (k = grid->cellStart[c]; k < grid->cellStart[c + 1];
+			 k++)
+		    {
+			float xt, yt, zt;
 
-		    factor /= d;
-		    X += factor * xt;
-		    Y += factor * yt;
-		    Z += factor * zt;
+			j = grid->cellFish[k];
+			if (j == i)
+			    continue;
+
+			xt = as->fish[j].x - x;
+			yt = as->fish[j].y - y;
+			zt = as->fish[j].z - z;
+
+			if (xt * xt + yt * yt + zt * zt > radius * radius)
+			    continue;
+
+			BoidsAddFish (&(as->fish[i]), &(as->fish[j]),
+			              schoolSimilarGroups, &X, &Y, &Z);
+		    }
 		}
-	    }
+    }
+    else
+    {
+	for (j = 0; j < as->numFish; j++)
+	{ /* consider other fish */
+	    if (j != i)
+		BoidsAddFish (&(as->fish[i]), &(as->fish[j]),
+		              schoolSimilarGroups, &X, &Y, &Z);
 	}
     }
 
@@ -35,6 +35,8 @@
  */
 
 
+#include <string.h>
+
 #include "atlantis-internal.h"
 #include "math.h"
 #include "atlantis_options.h"
@@ -219,6 +221,8 @@ updateRipple (Water *w,
 
     for (i = 0; i < w->nSVer; i++)
 	w->rippleFactor[i] = NRAND (1001) - 500;
+
+    w->vboValid = FALSE;
 }
 
 static Water *
@@ -277,6 +281,22 @@ genWater (int size,
     w->wave1 = 0.0;
     w->wave2 = 0.0;
 
+    w->phase      = NULL;
+    w->phaseValid = FALSE;
+    w->still      = FALSE;
+
+    w->vbo[0]        = 0;
+    w->vbo[1]        = 0;
+    w->vboValid      = FALSE;
+    w->deleteBuffers = NULL;
+
+    w->deformKeys      = NULL;
+    w->nDeformVertices = 0;
+    w->deformType      = -1;
+
+    w->heightTable    = NULL;
+    w->heightTableMax = 0.0f;
+
     w->vertices = calloc (1, sizeof (Vertex) * w->nVertices);
     if (!w->vertices)
     {
@@ -368,35 +388,42 @@ freeWater (Water *w)
 	free (w->indices2);
     if (w->rippleFactor)
 	free(w->rippleFactor);
+    if (w->phase)
+	free (w->phase);
+    if (w->vbo[0] && w->deleteBuffers)
+	(*w->deleteBuffers) (2, w->vbo);
+    if (w->deformKeys)
+	free (w->deformKeys);
+    if (w->heightTable)
+	free (w->heightTable);
 
     w->vertices     = NULL;
     w->vertices2    = NULL;
     w->indices      = NULL;
     w->indices2     = NULL;
     w->rippleFactor = NULL;
+    w->phase        = NULL;
+    w->vbo[0]       = 0;
+    w->vbo[1]       = 0;
+    w->deformKeys   = NULL;
+    w->heightTable  = NULL;
 }
 
+/*
+ * h and c are the height of the waves above bh and their slope along
+ * x * z at the vertex.
+ */
 static void
 setAmplitude (Vertex *v,
 	      float  bh,
-	      float  wt,
-	      float  swt,
-	      float  wa,
-	      float  swa,
-	      float  wf,
-	      float  swf,
+	      float  h,
+	      float  c,
 	      int ripple,
 	      int ripple2)
 {
-    float  dx, dz, d, c;
-
-    v->v[1] = bh + (wa  * sinf (wt  + wf  * v->v[0] * v->v[2])) +
-		   (swa * sinf (swt + swf * v->v[0] * v->v[2]));
-
-    v->v[1] = MIN (0.5, MAX (-0.5, v->v[1]));
+    float  dx, dz, d;
 
-    c =  wa  * cosf (wt  + wf  * v->v[0] * v->v[2]) * wf;
-    c += swa * cosf (swt + swf * v->v[0] * v->v[2]) * swf;
+    v->v[1] = MIN (0.5, MAX (-0.5, bh + h));
 
     dx = c * v->v[2];
     dz = c * v->v[0];
@@ -485,6 +512,10 @@ deformCylinder(CompScreen *s,
     if (w->size != size)
 	return;
 
+    w->phaseValid = FALSE;
+    w->still      = FALSE;
+    w->vboValid   = FALSE;
+
     subdiv = w->sDiv;
     nRow = (subdiv)?(2 << (subdiv - 1)) : 1;
     nVer = size * ((nRow * (nRow + 1)) / 2) + 1;
@@ -647,6 +678,10 @@ deformSphere(CompScreen *s,
     if (w->size != size)
 	return;
 
+    w->phaseValid = FALSE;
+    w->still      = FALSE;
+    w->vboValid   = FALSE;
+
     subdiv = w->sDiv;
     nRow = (subdiv)?(2 << (subdiv - 1)) : 1;
 
@@ -839,6 +874,192 @@ deformSphere(CompScreen *s,
     }
 }
 
+static Vertex *
+deformVertex (Water *w,
+              int   i)
+{
+    if (w->deformType == DeformationSphere && i >= w->nSVer)
+	return &w->vertices2[i - w->nSVer];
+
+    return &w->vertices[i];
+}
+
+/*
+ * Deform the mesh at progress key / DEFORM_CACHE_STEPS and keep the
+ * horizontal position and normal of every vertex the deformation moves.
+ */
+static Bool
+cacheDeformKey (CompScreen *s,
+                Water      *w,
+                int        key)
+{
+    float progress = (float) key / DEFORM_CACHE_STEPS;
+    float *k;
+    int   i, n;
+
+    if (w->deformKeyValid[key])
+	return TRUE;
+
+    if (w->deformType == DeformationSphere)
+    {
+	deformSphere (s, w, progress, -0.5, FALSE);
+	if (!w->vertices2)
+	    return FALSE;
+
+	n = w->nSVer + w->nWVer2;
+    }
+    else
+    {
+	deformCylinder (s, w, progress);
+	n = w->nVertices;
+    }
+
+    if (w->deformKeys && w->nDeformVertices != n)
+    {
+	free (w->deformKeys);
+	w->deformKeys = NULL;
+	memset (w->deformKeyValid, 0, sizeof (w->deformKeyValid));
+    }
+
+    if (!w->deformKeys)
+    {
+	w->deformKeys = malloc ((DEFORM_CACHE_STEPS + 1) * n * 5 *
+				sizeof (float));
+	if (!w->deformKeys)
+	    return FALSE;
+
+	w->nDeformVertices = n;
+    }
+
+    k = w->deformKeys + key * n * 5;
+
+    for (i = 0; i < n; i++, k += 5)
+    {
+	Vertex *v = deformVertex (w, i);
+
+	k[0] = v->v[0];
+	k[1] = v->v[2];
+	memcpy (k + 2, v->n, 3 * sizeof (float));
+    }
+
+    w->deformKeyValid[key] = TRUE;
+
+    return TRUE;
+}
+
+/*
+ * Both deformations only depend on the progress for a given grid, and the
+ * cylinder is linear in it, so instead of rebuilding the mesh on every
+ * frame of a rotation the meshes at a few progress steps are cached and
+ * blended.  Heights and normals of the waves are set by updateHeight
+ * afterwards as before.
+ */
+static void
+deformWater (CompScreen *s,
+             Water      *w,
+             int        deformation,
+             float      progress)
+{
+    ATLANTIS_SCREEN (s);
+
+    float *k1, *k2, t;
+    int   i, key;
+
+    if (!w || !w->vertices || w->size != as->hsize)
+	return;
+
+    if (deformation != DeformationSphere)
+	deformation = DeformationCylinder;
+
+    if (w->deformType != deformation ||
+	(deformation == DeformationSphere &&
+	 (w->deformBh != w->bh || w->deformRadius != as->radius)))
+    {
+	memset (w->deformKeyValid, 0, sizeof (w->deformKeyValid));
+
+	w->deformType   = deformation;
+	w->deformBh     = w->bh;
+	w->deformRadius = as->radius;
+    }
+
+    progress = MIN (1.0f, MAX (0.0f, progress));
+
+    t   = progress * DEFORM_CACHE_STEPS;
+    key = MIN ((int) t, DEFORM_CACHE_STEPS - 1);
+    t  -= key;
+
+    if (!cacheDeformKey (s, w, key) || !cacheDeformKey (s, w, key + 1))
+    {
+	if (deformation == DeformationSphere)
+	    deformSphere (s, w, progress, -0.5, FALSE);
+	else
+	    deformCylinder (s, w, progress);
+	return;
+    }
+
+    k1 = w->deformKeys + key * w->nDeformVertices * 5;
+    k2 = k1 + w->nDeformVertices * 5;
+
+    for (i = 0; i < w->nDeformVertices; i++, k1 += 5, k2 += 5)
+    {
+	Vertex *v = deformVertex (w, i);
+
+	v->v[0] = k1[0] + t * (k2[0] - k1[0]);
+	v->v[2] = k1[1] + t * (k2[1] - k1[1]);
+	v->n[0] = k1[2] + t * (k2[2] - k1[2]);
+	v->n[1] = k1[3] + t * (k2[3] - k1[3]);
+	v->n[2] = k1[4] + t * (k2[4] - k1[4]);
+    }
+
+    w->phaseValid = FALSE;
+    w->still      = FALSE;
+    w->vboValid   = FALSE;
+}
+
+/*
+ * Compute sin and cos of the phase offset of both waves at every vertex,
+ * these only change when the vertices are moved or the frequencies change.
+ */
+static Bool
+updatePhase (Water  *w,
+             Vertex *wall)
+{
+    int   i, n = w->nSVer + (w->nWVer / 2);
+    float xz, *p;
+
+    if (w->phaseValid && w->phaseWall == wall &&
+	w->phaseWf == w->wf && w->phaseSwf == w->swf)
+	return TRUE;
+
+    if (!w->phase)
+    {
+	w->phase = malloc (n * 4 * sizeof (float));
+	if (!w->phase)
+	    return FALSE;
+    }
+
+    p = w->phase;
+
+    for (i = 0; i < n; i++, p += 4)
+    {
+	Vertex *v = (i < w->nSVer) ? &w->vertices[i] : &wall[i];
+
+	xz = v->v[0] * v->v[2];
+
+	p[0] = sinf (w->wf * xz);
+	p[1] = cosf (w->wf * xz);
+	p[2] = sinf (w->swf * xz);
+	p[3] = cosf (w->swf * xz);
+    }
+
+    w->phaseWall  = wall;
+    w->phaseWf    = w->wf;
+    w->phaseSwf   = w->swf;
+    w->phaseValid = TRUE;
+
+    return TRUE;
+}
+
 void
 updateHeight (Water *w,
               Water *w2,
@@ -852,6 +1073,11 @@ updateHeight (Water *w,
 
     int i, j;
 
+    float sinWave1, cosWave1, sinWave2, cosWave2;
+    float h, c, s1, c1, s2, c2, *p;
+
+    Bool still;
+
     if (!w)
 	return;
 
@@ -862,16 +1088,58 @@ updateHeight (Water *w,
 			    w->vertices2);
     vertices = (useOtherWallVertices ? w->vertices2 - w->nSVer : w->vertices);
 
-    for (i = 0; i < w->nSVer; i++)
-	setAmplitude(&w->vertices[i], w->bh, w->wave1, w->wave2, w->wa,
-	             w->swa, w->wf, w->swf,
-	             (rippleEffect ? w->rippleFactor[i] : 0),
-	             (rippleEffect ? w->rippleFactor[(i + offset) % w->nSVer] :
-				     0));
+    /* without waves or ripples the heights only depend on bh */
+    still = (w->wa == 0.0f && w->swa == 0.0f && !rippleEffect);
 
-    for (i = w->nSVer; i < w->nSVer + (w->nWVer / 2); i++)
-        setAmplitude(&vertices[i], w->bh, w->wave1, w->wave2, w->wa,
-		     w->swa, w->wf, w->swf, 0, 0);
+    if (still && w->still && w->stillBh == w->bh &&
+	w->stillWall == vertices)
+	return;
+
+    if (still)
+    {
+	for (i = 0; i < w->nSVer; i++)
+	    setAmplitude (&w->vertices[i], w->bh, 0.0f, 0.0f, 0, 0);
+
+	for (i = w->nSVer; i < w->nSVer + (w->nWVer / 2); i++)
+	    setAmplitude (&vertices[i], w->bh, 0.0f, 0.0f, 0, 0);
+    }
+    else
+    {
+	if (!updatePhase (w, vertices))
+	    return;
+
+	sinWave1 = sinf (w->wave1);
+	cosWave1 = cosf (w->wave1);
+	sinWave2 = sinf (w->wave2);
+	cosWave2 = cosf (w->wave2);
+
+	p = w->phase;
+
+	for (i = 0; i < w->nSVer + (w->nWVer / 2); i++, p += 4)
+	{
+	    /* sin and cos of wave + wf * x * z by the angle sum identities */
+	    s1 = sinWave1 * p[1] + cosWave1 * p[0];
+	    c1 = cosWave1 * p[1] - sinWave1 * p[0];
+	    s2 = sinWave2 * p[3] + cosWave2 * p[2];
+	    c2 = cosWave2 * p[3] - sinWave2 * p[2];
+
+	    h = w->wa * s1 + w->swa * s2;
+	    c = w->wa * c1 * w->wf + w->swa * c2 * w->swf;
+
+	    if (i < w->nSVer)
+		setAmplitude (&w->vertices[i], w->bh, h, c,
+			      (rippleEffect ? w->rippleFactor[i] : 0),
+			      (rippleEffect ?
+			       w->rippleFactor[(i + offset) % w->nSVer] : 0));
+	    else
+		setAmplitude (&vertices[i], w->bh, h, c, 0, 0);
+	}
+    }
+
+    w->still     = still;
+    w->stillBh   = w->bh;
+    w->stillWall = vertices;
+    w->vboValid  = FALSE;
 
     if (useOtherWallVertices)
     {
@@ -949,31 +1217,15 @@ updateDeformation (CompScreen *s,
     {
 	if (atlantisGetShowWater (s) || atlantisGetShowWaterWire (s))
 	{
-	    switch (currentDeformation)
-	    {
-	    case DeformationNone :
-	    case DeformationCylinder :
-		deformCylinder(s, as->water, progress);
-		break;
-
-	    case DeformationSphere :
-		deformSphere(s, as->water, progress, -0.5, FALSE);
-	    }
+	    deformWater (s, as->water, currentDeformation, progress);
 	}
 
 	if (atlantisGetShowGround (s))
 	{
-	    switch (currentDeformation)
-	    {
-	    case DeformationNone :
+	    if (currentDeformation == DeformationNone)
 		progress = 0.0f;
-	    case DeformationCylinder :
-		deformCylinder (s, as->ground, progress);
-		break;
 
-	    case DeformationSphere :
-		deformSphere (s, as->ground, progress, -0.5, TRUE);
-	    }
+	    deformWater (s, as->ground, currentDeformation, progress);
 
 	    updateHeight (as->ground, NULL, FALSE, currentDeformation);
 	}
@@ -1086,6 +1338,7 @@ updateGround (CompScreen *s,
     as->ground->swf = 10.0;
 
     updateHeight (as->ground, NULL, FALSE, DeformationNone);
+    bakeHeight (as->ground);
 }
 
 void
@@ -1225,6 +1478,371 @@ drawGround (Water *w,
     glEnableClientState (GL_TEXTURE_COORD_ARRAY);
 }
 
+/*
+ * Wave heights and normals of the surface evaluated per vertex on the GPU.
+ * The vertex data only changes when the grid is deformed or the ripples
+ * change, so it is kept in a buffer object and every frame just sets the
+ * wave uniforms.  The maths is that of setAmplitude.
+ */
+static const char *waterVertexShader =
+    "uniform vec4 wave;      /* wave1, wave2, bh, displace */\n"
+    "uniform vec4 amplitude; /* wa, swa, wf, swf */\n"
+    "uniform vec3 mode;      /* lit, ripple */\n"
+    "attribute vec3 ripple;  /* wave vertex, ripple factors */\n"
+    "\n"
+    "void main ()\n"
+    "{\n"
+    "    vec4 v = gl_Vertex;\n"
+    "    vec3 n = gl_Normal;\n"
+    "\n"
+    "    if (ripple.x > 0.0)\n"
+    "    {\n"
+    "        float xz = v.x * v.z;\n"
+    "        float p1 = wave.x + amplitude.z * xz;\n"
+    "        float p2 = wave.y + amplitude.w * xz;\n"
+    "        float y  = clamp (wave.z + amplitude.x * sin (p1) +\n"
+    "                          amplitude.y * sin (p2), -0.5, 0.5);\n"
+    "        float c  = amplitude.x * cos (p1) * amplitude.z +\n"
+    "                   amplitude.y * cos (p2) * amplitude.w;\n"
+    "        float dx = c * v.z;\n"
+    "        float dz = c * v.x;\n"
+    "        vec2  r  = ripple.yz * mode.y;\n"
+    "\n"
+    "        n = vec3 (-0.2 * (y - wave.z), 5.0, -0.2 * (y - wave.z));\n"
+    "\n"
+    "        if (r.x != 0.0)\n"
+    "        {\n"
+    "            float f   = r.x / 1000.0;\n"
+    "            float sum = (abs (r.x) + abs (r.y)) / 2000.0;\n"
+    "\n"
+    "            n.x -= (2.0 * dx + 3.0) * f + 3.0 * dx;\n"
+    "            n.z -= (2.0 * dz + 3.0) * (r.y / 1000.0) + 3.0 * dz;\n"
+    "\n"
+    "            if (mod (abs (r.x), 2.0) < 0.5)\n"
+    "                f = r.y / 1000.0;\n"
+    "\n"
+    "            n.y *= 0.8 + 0.2 * (1.0 - sum) * 2.0 * abs (f);\n"
+    "        }\n"
+    "        else\n"
+    "        {\n"
+    "            n.x -= 5.0 * dx;\n"
+    "            n.z -= 5.0 * dz;\n"
+    "        }\n"
+    "\n"
+    "        n = normalize (n);\n"
+    "\n"
+    "        if (wave.w > 0.0)\n"
+    "            v.y = y;\n"
+    "    }\n"
+    "\n"
+    "    if (mode.x > 0.0)\n"
+    "        gl_FrontColor = light (normalize (gl_NormalMatrix * n),\n"
+    "                               gl_FrontMaterial.emission,\n"
+    "                               gl_FrontMaterial.ambient,\n"
+    "                               gl_FrontMaterial.diffuse,\n"
+    "                               gl_FrontMaterial.specular,\n"
+    "                               gl_FrontMaterial.shininess);\n"
+    "    else\n"
+    "        gl_FrontColor = gl_Color;\n"
+    "\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * v;\n"
+    "}\n";
+
+void
+initWaterShader (CompScreen *s)
+{
+    ATLANTIS_SCREEN (s);
+
+    WaterShader   *ws = &as->waterShader;
+    GLSLFunctions *glsl = &as->glsl;
+
+    const GLcharARB *source[2];
+
+    ws->supported = FALSE;
+    ws->shader    = 0;
+    ws->program   = 0;
+
+    if (!glsl->supported || !s->vertexBufferObject)
+	return;
+
+    source[0] = atlantisLightShader;
+    source[1] = waterVertexShader;
+
+    if (!loadVertexShader (glsl, "water", 2, source,
+			   &ws->shader, &ws->program))
+    {
+	finiWaterShader (s);
+	return;
+    }
+
+    ws->waveLoc      = (*glsl->getUniformLocation) (ws->program, "wave");
+    ws->amplitudeLoc = (*glsl->getUniformLocation) (ws->program, "amplitude");
+    ws->modeLoc      = (*glsl->getUniformLocation) (ws->program, "mode");
+    ws->rippleLoc    = (*glsl->getAttribLocation) (ws->program, "ripple");
+
+    if (ws->waveLoc < 0 || ws->amplitudeLoc < 0 || ws->modeLoc < 0 ||
+	ws->rippleLoc < 0)
+    {
+	finiWaterShader (s);
+	return;
+    }
+
+    ws->supported = TRUE;
+}
+
+void
+finiWaterShader (CompScreen *s)
+{
+    ATLANTIS_SCREEN (s);
+
+    WaterShader *ws = &as->waterShader;
+
+    deleteVertexShader (&as->glsl, ws->shader, ws->program);
+
+    ws->supported = FALSE;
+    ws->shader    = 0;
+    ws->program   = 0;
+}
+
+/*
+ * The shader replaces updateHeight and drawWater for the surface and the
+ * side walls.  The wireframe and the extra wall detail of the sphere
+ * deformation still use the vertices computed on the CPU.
+ */
+Bool
+useWaterShader (CompScreen *s,
+                int        currentDeformation)
+{
+    ATLANTIS_SCREEN (s);
+
+    return (as->waterShader.supported && atlantisGetWaterShader (s) &&
+	    currentDeformation != DeformationSphere &&
+	    !atlantisGetShowWaterWire (s));
+}
+
+/*
+ * Per vertex: position, normal, whether the waves move it and the two
+ * ripple factors setAmplitude is given for it.
+ */
+static Bool
+updateWaterBuffers (CompScreen *s,
+                    Water      *w)
+{
+    int   i, offset;
+    float *data, *d;
+
+    if (w->vboValid)
+	return TRUE;
+
+    data = malloc (w->nVertices * 9 * sizeof (float));
+    if (!data)
+	return FALSE;
+
+    if (!w->vbo[0])
+    {
+	(*s->genBuffers) (2, w->vbo);
+	w->deleteBuffers = s->deleteBuffers;
+    }
+
+    offset = w->nSVer / 2 + 1;
+
+    for (i = 0, d = data; i < w->nVertices; i++, d += 9)
+    {
+	memcpy (d, w->vertices[i].v, 3 * sizeof (float));
+	memcpy (d + 3, w->vertices[i].n, 3 * sizeof (float));
+
+	d[6] = (i < w->nSVer + (w->nWVer / 2)) ? 1.0f : 0.0f;
+	d[7] = 0.0f;
+	d[8] = 0.0f;
+
+	if (w->rippleFactor && i < w->nSVer)
+	{
+	    d[7] = w->rippleFactor[i];
+	    d[8] = w->rippleFactor[(i + offset) % w->nSVer];
+	}
+    }
+
+    (*s->bindBuffer) (GL_ARRAY_BUFFER_ARB, w->vbo[0]);
+    (*s->bufferData) (GL_ARRAY_BUFFER_ARB,
+		      w->nVertices * 9 * sizeof (float), data,
+		      GL_STATIC_DRAW_ARB);
+    (*s->bindBuffer) (GL_ARRAY_BUFFER_ARB, 0);
+
+    (*s->bindBuffer) (GL_ELEMENT_ARRAY_BUFFER_ARB, w->vbo[1]);
+    (*s->bufferData) (GL_ELEMENT_ARRAY_BUFFER_ARB,
+		      w->nIndices * sizeof (unsigned int), w->indices,
+		      GL_STATIC_DRAW_ARB);
+    (*s->bindBuffer) (GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+
+    free (data);
+
+    w->vboValid = TRUE;
+
+    return TRUE;
+}
+
+/*
+ * Positions come from w, normals and the waves from waves, which is how
+ * drawGround lights the ground with the normals of the water surface.
+ */
+static Bool
+bindWaterShader (CompScreen *s,
+                 Water      *w,
+                 Water      *waves,
+                 Bool       displace)
+{
+    ATLANTIS_SCREEN (s);
+
+    WaterShader   *ws = &as->waterShader;
+    GLSLFunctions *glsl = &as->glsl;
+
+    float wave[4], amplitude[4];
+
+    if (!updateWaterBuffers (s, w) || !updateWaterBuffers (s, waves))
+	return FALSE;
+
+    wave[0] = waves->wave1;
+    wave[1] = waves->wave2;
+    wave[2] = waves->bh;
+    wave[3] = displace ? 1.0f : 0.0f;
+
+    amplitude[0] = waves->wa;
+    amplitude[1] = waves->swa;
+    amplitude[2] = waves->wf;
+    amplitude[3] = waves->swf;
+
+    (*glsl->useProgramObject) (ws->program);
+    (*glsl->uniform4fv) (ws->waveLoc, 1, wave);
+    (*glsl->uniform4fv) (ws->amplitudeLoc, 1, amplitude);
+
+    glEnableClientState (GL_NORMAL_ARRAY);
+    (*glsl->enableVertexAttribArray) (ws->rippleLoc);
+
+    (*s->bindBuffer) (GL_ARRAY_BUFFER_ARB, waves->vbo[0]);
+    glNormalPointer (GL_FLOAT, 9 * sizeof (float),
+		     (GLvoid *) (3 * sizeof (float)));
+    (*glsl->vertexAttribPointer) (ws->rippleLoc, 3, GL_FLOAT, GL_FALSE,
+				  9 * sizeof (float),
+				  (GLvoid *) (6 * sizeof (float)));
+
+    (*s->bindBuffer) (GL_ARRAY_BUFFER_ARB, w->vbo[0]);
+    glVertexPointer (3, GL_FLOAT, 9 * sizeof (float), NULL);
+
+    (*s->bindBuffer) (GL_ELEMENT_ARRAY_BUFFER_ARB, w->vbo[1]);
+
+    return TRUE;
+}
+
+static void
+setWaterShaderMode (CompScreen *s,
+                    Bool       lit,
+                    Bool       ripple)
+{
+    ATLANTIS_SCREEN (s);
+
+    float mode[3];
+
+    mode[0] = lit ? 1.0f : 0.0f;
+    mode[1] = ripple ? 1.0f : 0.0f;
+    mode[2] = 0.0f;
+
+    (*as->glsl.uniform3fv) (as->waterShader.modeLoc, 1, mode);
+}
+
+static void
+unbindWaterShader (CompScreen *s)
+{
+    ATLANTIS_SCREEN (s);
+
+    (*s->bindBuffer) (GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+    (*s->bindBuffer) (GL_ARRAY_BUFFER_ARB, 0);
+
+    (*as->glsl.disableVertexAttribArray) (as->waterShader.rippleLoc);
+    glDisableClientState (GL_NORMAL_ARRAY);
+
+    (*as->glsl.useProgramObject) (0);
+}
+
+void
+drawWaterShader (CompScreen *s,
+                 Water      *w,
+                 Bool       rippleEffect)
+{
+    if (!w)
+	return;
+
+    rippleEffect = (rippleEffect && w->rippleFactor);
+
+    glDisable (GL_DEPTH_TEST);
+
+    glTexEnvi (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+    glEnable  (GL_LIGHTING);
+    glEnable  (GL_LIGHT1);
+    glDisable (GL_LIGHT0);
+
+    glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+
+    if (bindWaterShader (s, w, w, TRUE))
+    {
+	setWaterShaderMode (s, TRUE, rippleEffect);
+	glDrawElements (GL_TRIANGLES, w->nSIdx, GL_UNSIGNED_INT, NULL);
+
+	glDisable (GL_LIGHTING);
+	glEnable (GL_COLOR_MATERIAL);
+
+	setWaterShaderMode (s, FALSE, rippleEffect);
+	glDrawElements (GL_TRIANGLES, w->nWIdx, GL_UNSIGNED_INT,
+			(GLvoid *) (w->nSIdx * sizeof (unsigned int)));
+
+	unbindWaterShader (s);
+    }
+
+    glDisable (GL_LIGHTING);
+
+    glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+
+    glColor4usv (defaultColor);
+}
+
+void
+drawGroundShader (CompScreen *s,
+                  Water      *w,
+                  Water      *g)
+{
+    if (!g)
+	return;
+
+    if (!w || w->nVertices != g->nVertices)
+    {
+	drawGround (NULL, g, DeformationNone);
+	return;
+    }
+
+    glEnable  (GL_DEPTH_TEST);
+
+    glEnable  (GL_LIGHTING);
+    glEnable  (GL_LIGHT1);
+    glDisable (GL_LIGHT0);
+
+    glTexEnvi (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+    glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+
+    if (bindWaterShader (s, g, w, FALSE))
+    {
+	setWaterShaderMode (s, TRUE, FALSE);
+	glDrawElements (GL_TRIANGLES, g->nSIdx + g->nWIdx,
+			GL_UNSIGNED_INT, NULL);
+
+	unbindWaterShader (s);
+    }
+
+    glDisable (GL_LIGHTING);
+
+    glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+}
+
 static void fillBottom (Water *w,
                         float distance,
                         float bottom,
@@ -1353,6 +1971,61 @@ getHeight (Water *w,
 	   (w->swa * sinf (w->wave2 + w->swf * x * z));
 }
 
+/*
+ * The height only depends on x * z, so for a wave that does not move it
+ * is sampled once along x * z over the extent of the mesh.
+ */
+void
+bakeHeight (Water *w)
+{
+    float r, step;
+    int   i;
+
+    if (!w)
+	return;
+
+    if (!w->heightTable)
+    {
+	w->heightTable = malloc (HEIGHT_TABLE_SIZE * sizeof (float));
+	if (!w->heightTable)
+	    return;
+    }
+
+    /* |x * z| <= (x * x + z * z) / 2 inside the mesh */
+    r = w->distance / cosf (M_PI / w->size);
+    w->heightTableMax = r * r / 2;
+
+    step = 2 * w->heightTableMax / (HEIGHT_TABLE_SIZE - 1);
+
+    for (i = 0; i < HEIGHT_TABLE_SIZE; i++)
+	w->heightTable[i] = getHeight (w, -w->heightTableMax + i * step, 1.0f);
+}
+
+static float
+getBakedHeight (Water *w,
+                float x,
+                float z)
+{
+    float xz, t;
+    int   i;
+
+    if (!w || !w->heightTable)
+	return getHeight (w, x, z);
+
+    xz = x * z;
+
+    if (fabsf (xz) >= w->heightTableMax)
+	return getHeight (w, x, z);
+
+    t = (xz + w->heightTableMax) * (HEIGHT_TABLE_SIZE - 1) /
+	(2 * w->heightTableMax);
+    i = (int) t;
+    t -= i;
+
+    return w->heightTable[i] + t * (w->heightTable[i + 1] -
+				    w->heightTable[i]);
+}
+
 /* use other scale for creatures inside cube */
 float
 getGroundHeight (CompScreen *s,
@@ -1364,7 +2037,7 @@ getGroundHeight (CompScreen *s,
     Water *g = as->ground;
 
     if (atlantisGetShowGround(s))
-	return getHeight(g, x / (100000 * as->ratio),
-	                 z / (100000 * as->ratio)) * 100000;
+	return getBakedHeight(g, x / (100000 * as->ratio),
+	                      z / (100000 * as->ratio)) * 100000;
     return -0.5*100000;
 }
@@ -61,6 +61,18 @@ typedef struct _groupIndices
     Bool normal;
 } groupIndices;
 
+/* a run of groups drawn the same way, see buildDrawList */
+typedef struct _drawBatch
+{
+    GLenum cap;
+    int    start; /* into batchIndices */
+    int    count;
+
+    int  materialIndex;
+    Bool texture;
+    Bool normal;
+} drawBatch;
+
 typedef struct _mtlStruct
 {
     char *name;
@@ -88,7 +100,7 @@ typedef struct _CubemodelObject
 {
     pthread_t thread;
     Bool      threadRunning;
-    Bool      finishedLoading;
+    Bool      finishedLoading;  /* MODEL_PUBLISH / MODEL_LOADED */
     Bool      updateAttributes; /* after finished loading in thread, read in
 				   new attributes not read in before to avoid
 				   race condition*/
@@ -108,10 +120,15 @@ typedef struct _CubemodelObject
     float  color[4];
 
     int   fileCounter;
+    int   framesLoaded; /* first frames loaded so far, the rest are
+			   loaded in parallel - MODEL_PUBLISH / MODEL_LOADED */
     Bool  animation;
     int   fps;
     float time;
 
+    int   keyFrame[2];   /* frames shown and their blend, set on update */
+    float keyFrameBlend;
+
     vect3d **reorderedVertex;
     vect2d **reorderedTexture;
     vect3d **reorderedNormal;
@@ -119,6 +136,11 @@ typedef struct _CubemodelObject
     unsigned int *indices;
     groupIndices *group;
 
+    drawBatch    *batch; /* the groups sorted by material and merged */
+    int          nBatches;
+    unsigned int *batchIndices;
+    int          nBatchIndices;
+
     vect3d *reorderedVertexBuffer;
     vect2d *reorderedTextureBuffer;
     vect3d *reorderedNormalBuffer;
@@ -138,8 +160,39 @@ typedef struct _CubemodelObject
     unsigned int *texHeight;
 
     int nTex;
+
+    char **mtllib;   /* material libraries referenced by the model */
+    int  nMtllib;
+
+    char *cacheFile; /* binary cache of the parsed model, NULL for none */
+
+    GLuint              vbo[2]; /* vertex data and batchIndices */
+    int                 vboFrames;
+    Bool                vboFailed;
+    GLDeleteBuffersProc deleteBuffers;
 } CubemodelObject;
 
+/*
+ * Vertex buffer of a model: the texture coordinates, followed by the
+ * vertices and then the normals of each uploaded frame.
+ */
+#define MODEL_VBO_FRAME(data, fc) \
+    ((GLintptr) (data)->nUniqueIndices * \
+     (sizeof (vect2d) + (fc) * 2 * sizeof (vect3d)))
+#define MODEL_VBO_NORMALS(data, fc) \
+    (MODEL_VBO_FRAME (data, fc) + \
+     (GLintptr) (data)->nUniqueIndices * sizeof (vect3d))
+
+/*
+ * The loader threads hand framesLoaded, finishedLoading and
+ * updateAttributes over to the main thread with these. A frame written
+ * before MODEL_PUBLISH is complete once MODEL_LOADED sees the new value.
+ */
+#define MODEL_PUBLISH(field, value) \
+    __atomic_store_n (&(field), (value), __ATOMIC_RELEASE)
+#define MODEL_LOADED(field) \
+    __atomic_load_n (&(field), __ATOMIC_ACQUIRE)
+
 typedef struct _fileParser
 {
     FILE *fp;
@@ -151,6 +204,83 @@ typedef struct _fileParser
     int  tokenCount;
 } fileParser;
 
+/* a whole file in memory, see openMappedFile */
+typedef struct _mappedFile
+{
+    char       *data;
+    size_t     size;
+    Bool       mapped;  /* else data was read in */
+    const char *end;
+    const char *cp;     /* next character on the current line */
+    const char *lineEnd;
+} mappedFile;
+
+/* GLSL and buffer object entry points, see shader.c */
+typedef GLhandleARB (*GLCreateShaderObjectProc) (GLenum type);
+typedef void (*GLShaderSourceProc) (GLhandleARB shader,
+				    GLsizei     count,
+				    const GLcharARB **string,
+				    const GLint *length);
+typedef void (*GLCompileShaderProc) (GLhandleARB shader);
+typedef GLhandleARB (*GLCreateProgramObjectProc) (void);
+typedef void (*GLAttachObjectProc) (GLhandleARB program,
+				    GLhandleARB shader);
+typedef void (*GLLinkProgramProc) (GLhandleARB program);
+typedef void (*GLUseProgramObjectProc) (GLhandleARB program);
+typedef void (*GLGetObjectParameterivProc) (GLhandleARB object,
+					    GLenum      pname,
+					    GLint       *params);
+typedef void (*GLDeleteObjectProc) (GLhandleARB object);
+typedef GLint (*GLGetUniformLocationProc) (GLhandleARB     program,
+					   const GLcharARB *name);
+typedef GLint (*GLGetAttribLocationProc) (GLhandleARB     program,
+					  const GLcharARB *name);
+typedef void (*GLUniform4fvProc) (GLint         location,
+				  GLsizei       count,
+				  const GLfloat *value);
+typedef void (*GLVertexAttribPointerProc) (GLuint       index,
+					   GLint        size,
+					   GLenum       type,
+					   GLboolean    normalized,
+					   GLsizei      stride,
+					   const GLvoid *pointer);
+typedef void (*GLEnableVertexAttribArrayProc) (GLuint index);
+typedef void (*GLDisableVertexAttribArrayProc) (GLuint index);
+typedef void (*GLBufferSubDataProc) (GLenum       target,
+				     GLintptr     offset,
+				     GLsizeiptr   size,
+				     const GLvoid *data);
+
+typedef struct _AnimationShader
+{
+    Bool supported; /* vertex shaders and buffer objects are available */
+    Bool bound;     /* between cubemodelBindShader and cubemodelUnbindShader */
+
+    GLCreateShaderObjectProc       createShaderObject;
+    GLShaderSourceProc             shaderSource;
+    GLCompileShaderProc            compileShader;
+    GLCreateProgramObjectProc      createProgramObject;
+    GLAttachObjectProc             attachObject;
+    GLLinkProgramProc              linkProgram;
+    GLUseProgramObjectProc         useProgramObject;
+    GLGetObjectParameterivProc     getObjectParameteriv;
+    GLDeleteObjectProc             deleteObject;
+    GLGetUniformLocationProc       getUniformLocation;
+    GLGetAttribLocationProc        getAttribLocation;
+    GLUniform4fvProc               uniform4fv;
+    GLVertexAttribPointerProc      vertexAttribPointer;
+    GLEnableVertexAttribArrayProc  enableVertexAttribArray;
+    GLDisableVertexAttribArrayProc disableVertexAttribArray;
+
+    GLhandleARB shader;
+    GLhandleARB program;
+    GLint       stateLoc;
+    GLint       nextVertexLoc;
+    GLint       nextNormalLoc;
+
+    float blend; /* of the bound model */
+} AnimationShader;
+
 typedef struct _CubemodelDisplay
 {
     int screenPrivateIndex;
@@ -178,6 +308,10 @@ typedef struct _CubemodelScreen
     CubemodelObject **models;
     char            **modelFilename;
     int             numModels;
+
+    GLBufferSubDataProc bufferSubData;
+
+    AnimationShader animationShader;
 } CubemodelScreen;
 
 Bool
@@ -217,6 +351,26 @@ cubemodelDrawVBOModel (CompScreen      *s,
 		       float           *vertex,
 		       float           *normal);
 
+void
+cubemodelInitShader (CompScreen *s);
+
+void
+cubemodelFiniShader (CompScreen *s);
+
+Bool
+cubemodelUseShader (CompScreen      *s,
+		    CubemodelObject *data);
+
+void
+cubemodelBindShader (CompScreen      *s,
+		     CubemodelObject *data);
+
+void
+cubemodelSyncShader (CompScreen *s);
+
+void
+cubemodelUnbindShader (CompScreen *s);
+
 fileParser *
 initFileParser (FILE *fp,
                 int bufferSize);
@@ -243,4 +397,22 @@ skipLine (fileParser *);
 char *
 strsep2 (char **strPtr, const char *delim);
 
+mappedFile *
+openMappedFile (const char *filename);
+
+void
+closeMappedFile (mappedFile *);
+
+Bool
+nextMappedLine (mappedFile *);
+
+const char *
+nextMappedToken (mappedFile *, int *len);
+
+Bool
+tokenIs (const char *token, int len, const char *word);
+
+float
+tokenToFloat (const char *token, int len);
+
 #endif
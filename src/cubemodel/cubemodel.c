@@ -82,7 +82,8 @@ updateModel (CompScreen *s,
 
     for (i = start; i< end; i++)
     {
-	if (!cms->models[i] || !cms->models[i]->finishedLoading)
+	if (!cms->models[i] ||
+	    !MODEL_LOADED (cms->models[i]->finishedLoading))
 	    continue;
 
 	if (modelScale->nValue > i)
@@ -571,10 +572,10 @@ cubemodelPreparePaintScreen (CompScreen *s,
 
     for (i = 0; i < cms->numModels; i++)
     {
-	if (!cms->models[i]->finishedLoading)
+	if (!MODEL_LOADED (cms->models[i]->finishedLoading))
 	    continue;
 
-	if (cms->models[i]->updateAttributes)
+	if (MODEL_LOADED (cms->models[i]->updateAttributes))
 	{
 	    updateModel (s, i, i + 1);
 	    cms->models[i]->updateAttributes = FALSE;
@@ -668,6 +669,12 @@ cubemodelInitScreen (CompPlugin *p,
     glLightfv (GL_LIGHT1, GL_DIFFUSE, diffuse);
     glLightfv (GL_LIGHT1, GL_SPECULAR, specular);
 
+    cms->bufferSubData = NULL;
+    if (s->vertexBufferObject)
+	cms->bufferSubData = (GLBufferSubDataProc)
+	    (*s->getProcAddress) ((GLubyte *) "glBufferSubDataARB");
+
+    cubemodelInitShader (s);
     initCubemodel (s);
 
     cubemodelSetModelFilenameNotify      (s, cubemodelLoadingOptionChange);
@@ -698,6 +705,7 @@ cubemodelFiniScreen (CompPlugin *p,
     CUBE_SCREEN (s);
 
     freeCubemodel (s);
+    cubemodelFiniShader (s);
 
     UNWRAP (cms, s, donePaintScreen);
     UNWRAP (cms, s, preparePaintScreen);
@@ -30,6 +30,10 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "cubemodel-internal.h"
 
 fileParser *
@@ -521,3 +525,235 @@ strsep2 (char       **strPtr,
 
     return tmpStr;
 }
+
+/************************************************************
+ * openMappedFile:                                          *
+ * Maps a whole file into memory for tokenising in place.   *
+ * Files that can not be mapped are read in instead.        *
+ ***********************************************************/
+
+mappedFile *
+openMappedFile (const char *filename)
+{
+    mappedFile  *mf;
+    struct stat st;
+    int         fd;
+
+    fd = open (filename, O_RDONLY);
+    if (fd < 0)
+	return NULL;
+
+    if (fstat (fd, &st) < 0)
+    {
+	close (fd);
+	return NULL;
+    }
+
+    mf = calloc (1, sizeof (mappedFile));
+    if (!mf)
+    {
+	close (fd);
+	return NULL;
+    }
+
+    mf->size = st.st_size;
+
+    if (mf->size > 0)
+    {
+	mf->data = mmap (NULL, mf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mf->data != MAP_FAILED)
+	{
+	    mf->mapped = TRUE;
+	    madvise (mf->data, mf->size, MADV_SEQUENTIAL);
+	}
+	else
+	{
+	    size_t done = 0;
+	    ssize_t n = 0;
+
+	    mf->data = malloc (mf->size);
+	    while (mf->data && done < mf->size &&
+		   (n = read (fd, mf->data + done, mf->size - done)) > 0)
+		done += n;
+
+	    if (!mf->data || done < mf->size)
+	    {
+		if (mf->data)
+		    free (mf->data);
+		free (mf);
+		close (fd);
+		return NULL;
+	    }
+	}
+    }
+
+    close (fd);
+
+    mf->end     = mf->data + mf->size;
+    mf->cp      = mf->data;
+    mf->lineEnd = mf->data;
+
+    return mf;
+}
+
+void
+closeMappedFile (mappedFile *mf)
+{
+    if (!mf)
+	return;
+
+    if (mf->mapped)
+	munmap (mf->data, mf->size);
+    else if (mf->data)
+	free (mf->data);
+
+    free (mf);
+}
+
+/**********************************************
+ * nextMappedLine:                            *
+ * Moves on to the next non empty line,       *
+ * returns FALSE at the end of the file.      *
+ *********************************************/
+
+Bool
+nextMappedLine (mappedFile *mf)
+{
+    const char *p = mf->lineEnd;
+    const char *cr;
+
+    while (p < mf->end && (*p == '\n' || *p == '\r'))
+	p++;
+
+    if (p >= mf->end)
+	return FALSE;
+
+    mf->cp      = p;
+    mf->lineEnd = memchr (p, '\n', mf->end - p);
+    if (!mf->lineEnd)
+	mf->lineEnd = mf->end;
+
+    /* also ends lines at carriage returns, like getLine */
+    cr = memchr (p, '\r', mf->lineEnd - p);
+    if (cr)
+	mf->lineEnd = cr;
+
+    return TRUE;
+}
+
+/*************************************************
+ * nextMappedToken:                              *
+ * Returns the next token (separated by spaces   *
+ * and tabs) on the current line and its length, *
+ * or NULL if there are no more on the line.     *
+ * Tokens are not NUL terminated.                *
+ ************************************************/
+
+const char *
+nextMappedToken (mappedFile *mf,
+		 int        *len)
+{
+    const char *p = mf->cp;
+    const char *start;
+
+    while (p < mf->lineEnd && (*p == ' ' || *p == '\t'))
+	p++;
+
+    if (p >= mf->lineEnd)
+    {
+	mf->cp = p;
+	return NULL;
+    }
+
+    start = p;
+    while (p < mf->lineEnd && *p != ' ' && *p != '\t')
+	p++;
+
+    mf->cp = p;
+    *len   = p - start;
+
+    return start;
+}
+
+Bool
+tokenIs (const char *token,
+	 int        len,
+	 const char *word)
+{
+    return strlen (word) == len && !memcmp (token, word, len);
+}
+
+/*****************************************************
+ * tokenToFloat:                                     *
+ * Like atof on a token that is not NUL terminated.  *
+ * Plain decimal numbers are converted directly, any *
+ * other form is left to strtod.                     *
+ ****************************************************/
+
+float
+tokenToFloat (const char *token,
+	      int        len)
+{
+    static const double powers[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+	1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+	1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char *p = token, *end = token + len;
+    double     value = 0;
+    int        sign = 1, exponent = 0, digits = 0;
+
+    if (p < end && (*p == '-' || *p == '+'))
+	sign = (*p++ == '-') ? -1 : 1;
+
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+	value = value * 10 + (*p - '0');
+
+    if (p < end && *p == '.')
+    {
+	for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+	{
+	    value = value * 10 + (*p - '0');
+	    exponent--;
+	}
+    }
+
+    if (digits && digits < 16 && p < end && (*p == 'e' || *p == 'E'))
+    {
+	int e = 0, eSign = 1;
+
+	p++;
+	if (p < end && (*p == '-' || *p == '+'))
+	    eSign = (*p++ == '-') ? -1 : 1;
+
+	if (p == end)
+	    digits = 0;
+
+	for (; p < end && *p >= '0' && *p <= '9' && e < 1000; p++)
+	    e = e * 10 + (*p - '0');
+
+	exponent += eSign * e;
+    }
+
+    if (digits && digits < 16 && p == end &&
+	exponent >= -22 && exponent <= 22)
+    {
+	if (exponent < 0)
+	    value /= powers[-exponent];
+	else
+	    value *= powers[exponent];
+
+	return sign * value;
+    }
+    else
+    {
+	char buf[64];
+
+	len = MIN (len, (int) sizeof (buf) - 1);
+	memcpy (buf, token, len);
+	buf[len] = '\0';
+
+	return strtod (buf, NULL);
+    }
+}
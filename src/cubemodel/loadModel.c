@@ -36,6 +36,8 @@
 
 #include <errno.h>
 #include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <string.h>
 #include <unistd.h>
@@ -45,6 +47,9 @@
 #include "cubemodel-internal.h"
 #include "cubemodel_options.h"
 
+/* threads loading the frames of an animation */
+#define MAX_LOADER_THREADS 8
+
 
 /**************************
 * Gets path from object   *
@@ -169,7 +174,8 @@ static Bool
 compileDList (CompScreen      *s,
 	      CubemodelObject *data)
 {
-    if (!data->animation && data->finishedLoading && !data->compiledDList)
+    if (!data->animation && MODEL_LOADED (data->finishedLoading) &&
+	!data->compiledDList)
     {
 	data->dList = glGenLists (1);
 	glNewList (data->dList, GL_COMPILE);
@@ -478,644 +484,1834 @@ loadMaterials (CompScreen      *s,
     *nMat = nMaterial;
 }
 
+/* the file name of frame fc, formatted in place in modelData->filename */
+static char *
+frameFilename (CubemodelObject *modelData,
+	       int             fc)
+{
+    if (modelData->animation)
+	modelData->size = addNumToString (&modelData->filename,
+					  modelData->size,
+					  modelData->lenBaseFilename,
+					  modelData->post,
+					  modelData->startFileNum + fc,
+					  modelData->maxNumZeros);
+
+    return modelData->filename;
+}
+
+/* the file name of frame fc, in a new string - safe
+   to use from the loader thread */
+static char *
+newFrameFilename (CubemodelObject *modelData,
+		  int             fc)
+{
+    char *filename = strdup (modelData->filename);
+
+    if (filename && modelData->animation)
+	addNumToString (&filename, strlen (filename) + 1,
+			modelData->lenBaseFilename, modelData->post,
+			modelData->startFileNum + fc, modelData->maxNumZeros);
+
+    return filename;
+}
+
+/* scale texture coordinates as per the 1st loaded texture of the material
+   they were read with (1st frame) */
+static void
+scaleModelTextures (CubemodelObject *modelData,
+		    const int       *texMaterial)
+{
+    vect2d *texture = modelData->reorderedTexture[0];
+    int    i;
+
+    if (!modelData->tex || !texture)
+	return;
+
+    for (i = 0; i < modelData->nUniqueIndices; i++)
+    {
+	mtlStruct  *currentMaterial;
+	CompMatrix *ct;
+
+	if (texMaterial[i] < 0 || texMaterial[i] >= modelData->nMaterial[0])
+	    continue;
+
+	currentMaterial = &(modelData->material[0][texMaterial[i]]);
+	if (currentMaterial->map_params < 0)
+	    continue;
+
+	ct = &((&(modelData->tex[currentMaterial->map_params]))->matrix);
+
+	texture[i].r[0] = COMP_TEX_COORD_X (ct, (currentMaterial->width - 1) *
+					    (texture[i].r[0]));
+	texture[i].r[1] = COMP_TEX_COORD_Y (ct, (currentMaterial->height - 1) *
+					    (1 - texture[i].r[1]));
+    }
+}
+
+/* the primitive faces of a group are drawn with, GL_POLYGON for fans */
+static GLenum
+groupCap (const groupIndices *group)
+{
+    GLenum cap = GL_QUADS;
+
+    if (group->polyCount == 3)
+	cap = GL_TRIANGLES;
+    if (group->polyCount == 2 || group->complexity == 1)
+	cap = GL_LINE_LOOP;
+    if (group->polyCount == 1 || group->complexity == 0)
+	cap = GL_POINTS;
+
+    if (cap == GL_QUADS || group->polyCount >= 5)
+	cap = GL_POLYGON;
+
+    return cap;
+}
+
 static Bool
-initLoadModelObject (CompScreen      *s,
-		     CubemodelObject *modelData)
+groupTransparent (CubemodelObject    *modelData,
+		  const groupIndices *group)
 {
-    char *filename = modelData->filename;
-    char *post     = modelData->post;
+    mtlStruct *material;
 
-    int size            = modelData->size;
-    int lenBaseFilename = modelData->lenBaseFilename;
-    int startFileNum    = modelData->startFileNum;
-    int maxNumZeros     = modelData->maxNumZeros;
+    if (group->materialIndex < 0 ||
+	group->materialIndex >= modelData->nMaterial[0])
+	return FALSE;
 
-    /* getLine stuff */
-    char *strline    = NULL;
-    int tempBufferSize = 4 * 1024; /* get character data from files
-				      in these size chunks */
-    fileParser *fParser = NULL;
+    material = &(modelData->material[0][group->materialIndex]);
 
-    int nVertex = 0;
-    int nNormal = 0;
-    int nTexture = 0;
-    int nIndices = 0;
+    return (material->Kd[3] < 1 || (group->texture && material->map_d >= 0));
+}
 
-    FILE *fp;
+typedef struct _groupOrder
+{
+    int    group;
+    Bool   transparent;
+    int    materialIndex;
+    Bool   texture;
+    Bool   normal;
+    GLenum cap; /* as in the draw list */
+} groupOrder;
 
-    modelData->nMaterial[0] = 0;
-    modelData->material[0] = NULL;
+static int
+compareGroupOrder (const void *a,
+		   const void *b)
+{
+    const groupOrder *ga = a;
+    const groupOrder *gb = b;
 
-    /* First pass - count how much data we need to store and
-     *		  - load the materials from any mtllib references.
-     */
+    if (ga->transparent != gb->transparent)
+	return ga->transparent - gb->transparent;
 
-    if (modelData->animation)
-	size = addNumToString (&filename, size, lenBaseFilename, post,
-	                       startFileNum, maxNumZeros);
+    /* blended groups keep the order of the file */
+    if (!ga->transparent)
+    {
+	if (ga->materialIndex != gb->materialIndex)
+	    return ga->materialIndex - gb->materialIndex;
+	if (ga->texture != gb->texture)
+	    return ga->texture - gb->texture;
+	if (ga->normal != gb->normal)
+	    return ga->normal - gb->normal;
+	if (ga->cap != gb->cap)
+	    return (int) ga->cap - (int) gb->cap;
+    }
 
-    fp = fopen (filename, "r");
-    if (!fp)
+    return ga->group - gb->group;
+}
+
+/*
+ * Sort the groups by material, texture and normals, turn quads and
+ * polygons into triangles and merge the groups then drawn the same way,
+ * so models that switch materials every few faces still only need a few
+ * state changes and draw calls.  Groups without a material come first
+ * like in the file, and blended groups last.
+ */
+static Bool
+buildDrawList (CubemodelObject *modelData)
+{
+    groupOrder   *order;
+    drawBatch    *batch, *b = NULL;
+    unsigned int *indices, *out;
+    int          i, j, k, nBatches = 0, nIndices = 0;
+    int          nGroups = modelData->nGroups;
+
+    order = malloc (sizeof (groupOrder) * MAX (nGroups, 1));
+    if (!order)
+	return FALSE;
+
+    for (i = 0; i < nGroups; i++)
     {
-	compLogMessage ("cubemodel", CompLogLevelWarn,
-	                "Failed to open model file - %s", filename);
+	groupIndices *group = &(modelData->group[i]);
+	GLenum       cap = groupCap (group);
+
+	order[i].group         = i;
+	order[i].transparent   = groupTransparent (modelData, group);
+	order[i].materialIndex = group->materialIndex;
+	order[i].texture       = group->texture;
+	order[i].normal        = group->normal;
+	order[i].cap           = (cap == GL_POLYGON) ? GL_TRIANGLES : cap;
+
+	if (group->polyCount < 1 || group->numV < 1)
+	    continue;
+
+	if (cap == GL_POLYGON)
+	    nIndices += (group->numV / group->polyCount) *
+			(group->polyCount - 2) * 3;
+	else
+	    nIndices += group->numV;
+    }
+
+    qsort (order, nGroups, sizeof (groupOrder), compareGroupOrder);
+
+    batch   = malloc (sizeof (drawBatch) * MAX (nGroups, 1));
+    indices = malloc (sizeof (unsigned int) * MAX (nIndices, 1));
+    if (!batch || !indices)
+    {
+	if (batch)
+	    free (batch);
+	if (indices)
+	    free (indices);
+	free (order);
+
 	return FALSE;
     }
 
-    fParser = initFileParser (fp, tempBufferSize);
+    out = indices;
 
-    while ((strline = getLineToken2 (fParser, FALSE)))
+    for (i = 0; i < nGroups; i++)
     {
-	if (strline[0] == '\0')
+	groupIndices *group = &(modelData->group[order[i].group]);
+	unsigned int *in = modelData->indices + group->startV;
+
+	if (group->polyCount < 1 || group->numV < 1)
 	    continue;
 
-	if (!strcmp (strline, "v"))
-	    nVertex++;
-	else if (!strcmp (strline, "vn"))
-	    nNormal++;
-	else if (!strcmp (strline, "vt"))
-	    nTexture++;
-	else if (!strcmp (strline, "f") || !strcmp (strline, "fo") ||
-		 !strcmp (strline, "p") || !strcmp (strline, "l") )
+	/* a line loop joins all the vertices of its group */
+	if (!b || b->cap == GL_LINE_LOOP || b->cap != order[i].cap ||
+	    b->materialIndex != order[i].materialIndex ||
+	    b->texture != order[i].texture || b->normal != order[i].normal)
 	{
-	    while (getLineToken2 (fParser, TRUE))
-		nIndices++;
+	    b = &batch[nBatches++];
+
+	    b->cap           = order[i].cap;
+	    b->start         = out - indices;
+	    b->materialIndex = order[i].materialIndex;
+	    b->texture       = order[i].texture;
+	    b->normal        = order[i].normal;
 	}
-	else if (!strcmp (strline, "mtllib"))
+
+	if (groupCap (group) == GL_POLYGON)
 	{
-	    while ((strline = getLineToken2 (fParser, TRUE)))
+	    for (j = 0; j < group->numV / group->polyCount; j++)
 	    {
-		loadMaterials (s, modelData, filename, strline,
-		               &(modelData->material[0]),
-		               &(modelData->nMaterial[0]));
+		for (k = 2; k < group->polyCount; k++)
+		{
+		    *out++ = in[0];
+		    *out++ = in[k - 1];
+		    *out++ = in[k];
+		}
+		in += group->polyCount;
 	    }
 	}
+	else
+	{
+	    memcpy (out, in, sizeof (unsigned int) * group->numV);
+	    out += group->numV;
+	}
 
-	if (!fParser->lastTokenOnLine)
-	    skipLine (fParser);
+	b->count = (out - indices) - b->start;
     }
 
-    modelData->reorderedVertex[0]  = malloc (sizeof (vect3d) * nIndices);
-    modelData->reorderedTexture[0] = malloc (sizeof (vect2d) * nIndices);
-    modelData->reorderedNormal[0]  = malloc (sizeof (vect3d) * nIndices);
+    free (order);
+
+    modelData->batch         = batch;
+    modelData->nBatches      = nBatches;
+    modelData->batchIndices  = indices;
+    modelData->nBatchIndices = out - indices;
+
+    return TRUE;
+}
+
+/*
+ * Binary model cache
+ *
+ * A parsed model is stored in $HOME/.compiz/cubemodel/<hash>.cmbin, keyed
+ * on the path of its first frame and the size and mtime of every frame.
+ * Layout, every part padded to 8 bytes:
+ *
+ *   modelCacheHeader
+ *   size and mtime of every frame    long long [2 * fileCounter]
+ *   path of the first frame          char [pathLength]
+ *   mtllib and material names        char [stringsSize], NUL separated
+ *   groups                           int [MODEL_CACHE_GROUP_INTS * nGroups]
+ *   indices                          unsigned int [nIndices]
+ *   material of each texture coord   int [nUniqueIndices]
+ *   unscaled texture coordinates     vect2d [nUniqueIndices]
+ *   vertices, normals of each frame  vect3d [2 * nUniqueIndices]
+ *
+ * Material indices refer to the names stored in the cache and are mapped
+ * to the materials actually loaded, texture coordinates are only kept for
+ * the first frame as the other frames do not display textures.
+ */
+
+#define MODEL_CACHE_MAGIC   0x4e49424d /* "MBIN", also catches byte order */
+#define MODEL_CACHE_VERSION 1
+
+#define MODEL_CACHE_GROUP_INTS 7
+
+#define MODEL_CACHE_ALIGN(n) (((n) + 7) & ~((size_t) 7))
 
-    modelData->indices = malloc (sizeof (unsigned int *) * nIndices);
-    modelData->reorderedVertexBuffer  = malloc (sizeof (vect3d) * nIndices);
-    modelData->reorderedTextureBuffer = malloc (sizeof (vect2d) * nIndices);
-    modelData->reorderedNormalBuffer  = malloc (sizeof (vect3d) * nIndices);
+typedef struct _modelCacheHeader
+{
+    unsigned int magic;
+    unsigned int version;
+
+    int fileCounter;
+    int nVertex;
+    int nTexture;
+    int nNormal;
+    int nIndices;
+    int nUniqueIndices;
+    int nGroups;
+    int nMtllib;
+    int nMaterial;
+    int pathLength;  /* including the terminating NUL */
+    int stringsSize;
+    int reserved;
+} modelCacheHeader;
+
+/* byte offsets of the parts of a cache file, see above */
+typedef struct _modelCacheLayout
+{
+    size_t stamps;
+    size_t path;
+    size_t strings;
+    size_t groups;
+    size_t indices;
+    size_t texMaterial;
+    size_t texture;
+    size_t frames;
+    size_t frameSize;
+    size_t size;
+} modelCacheLayout;
 
-    modelData->nVertex  = nVertex;
-    modelData->nNormal  = nNormal;
-    modelData->nTexture = nTexture;
-    modelData->nIndices = nIndices;
+static Bool
+modelCacheLayoutFor (const modelCacheHeader *h,
+		     modelCacheLayout       *l)
+{
+    if (h->fileCounter <= 0 || h->nIndices < 0 || h->nUniqueIndices < 0 ||
+	h->nGroups < 0 || h->nMtllib < 0 || h->nMaterial < 0 ||
+	h->pathLength <= 0 || h->stringsSize < 0)
+	return FALSE;
 
-    freeFileParser (fParser);
+    l->stamps      = MODEL_CACHE_ALIGN (sizeof (modelCacheHeader));
+    l->path        = l->stamps + MODEL_CACHE_ALIGN (2 * sizeof (long long) *
+						    h->fileCounter);
+    l->strings     = l->path + MODEL_CACHE_ALIGN (h->pathLength);
+    l->groups      = l->strings + MODEL_CACHE_ALIGN (h->stringsSize);
+    l->indices     = l->groups + MODEL_CACHE_ALIGN (MODEL_CACHE_GROUP_INTS *
+						    sizeof (int) *
+						    (size_t) h->nGroups);
+    l->texMaterial = l->indices + MODEL_CACHE_ALIGN (sizeof (unsigned int) *
+						     (size_t) h->nIndices);
+    l->texture     = l->texMaterial + MODEL_CACHE_ALIGN (sizeof (int) *
+							 (size_t)
+							 h->nUniqueIndices);
+    l->frames      = l->texture + MODEL_CACHE_ALIGN (sizeof (vect2d) *
+						     (size_t)
+						     h->nUniqueIndices);
+    l->frameSize   = MODEL_CACHE_ALIGN (2 * sizeof (vect3d) *
+					(size_t) h->nUniqueIndices);
+    l->size        = l->frames + l->frameSize * h->fileCounter;
 
     return TRUE;
 }
 
+/* cache file name for the model whose first frame is filename */
+static char *
+modelCacheFilename (const char *filename)
+{
+    const char   *home = getenv ("HOME");
+    char         *path, *cacheFile;
+    unsigned int hash = 2166136261u;
+    int          len;
+    const char   *c;
+
+    if (!home)
+	return NULL;
+
+    path = realpath (filename, NULL);
+    if (!path)
+	return NULL;
+
+    for (c = path; *c; c++)
+    {
+	hash ^= (unsigned char) *c;
+	hash *= 16777619u;
+    }
+
+    free (path);
+
+    len = strlen (home) + strlen ("/.compiz/cubemodel/") + 8 +
+	  strlen (".cmbin") + 1;
+
+    cacheFile = malloc (len);
+    if (!cacheFile)
+	return NULL;
+
+    snprintf (cacheFile, len, "%s/.compiz/cubemodel/%08x.cmbin", home, hash);
+
+    return cacheFile;
+}
+
+/* size and mtime of every frame, FALSE if one of them is gone */
 static Bool
-loadModelObject (CubemodelObject *modelData)
+statModelFrames (CubemodelObject *modelData,
+		 long long       *stamps)
 {
-    int i, j;
+    struct stat st;
+    char        *filename;
+    int         fc, ret;
 
-    char *filename = modelData->filename;
-    char *post     = modelData->post;
+    for (fc = 0; fc < modelData->fileCounter; fc++)
+    {
+	filename = newFrameFilename (modelData, fc);
+	if (!filename)
+	    return FALSE;
 
-    int size            = modelData->size;
-    int lenBaseFilename = modelData->lenBaseFilename;
-    int startFileNum    = modelData->startFileNum;
-    int maxNumZeros     = modelData->maxNumZeros;
+	ret = stat (filename, &st);
+	free (filename);
 
-    /* getLine stuff */
-    char *strline    = NULL;
-    int tempBufferSize = 4 * 1024; /* get character data from files
-				      in these size chunks */
-    fileParser *fParser = NULL;
+	if (ret < 0)
+	    return FALSE;
 
-    int fileCounter = modelData->fileCounter;
+	stamps[2 * fc]     = st.st_size;
+	stamps[2 * fc + 1] = st.st_mtime;
+    }
 
-    int nVertex=0;
-    int nNormal=0;
-    int nTexture=0;
-    int nIndices=0;
-    int nUniqueIndices = 0;
+    return TRUE;
+}
 
-    unsigned int **tmpIndices = NULL; /* reorder indices per vertex
-					 (store alternating corresponding
-					 textures/normals) */
-    vect3d *vertex  = NULL;
-    vect3d *normal  = NULL;
-    vect2d *texture = NULL;
+/* find the n strings following str in a block of NUL separated strings */
+static Bool
+modelCacheStrings (const char *str,
+		   const char *end,
+		   int        n,
+		   const char **strings)
+{
+    int i;
 
-    FILE *fp;
+    for (i = 0; i < n; i++)
+    {
+	const char *c = memchr (str, '\0', end - str);
 
-    int nGroups  = 0;
+	if (!c)
+	    return FALSE;
 
-    int oldPolyCount = 0;
-    Bool oldUsingNormal = FALSE;
-    Bool oldUsingTexture = FALSE;
+	strings[i] = str;
+	str = c + 1;
+    }
 
-    /* store size of each array */
-    int sVertex = 0;
-    int sTexture = 0;
-    int sNormal = 0;
-    int sIndices = 0;
+    return TRUE;
+}
 
-    int fc;
+/* drop the materials, mtllib names and textures of the 1st frame again */
+static void
+freeModelMaterials (CompScreen      *s,
+		    CubemodelObject *modelData)
+{
+    int i;
+
+    for (i = 0; i < modelData->nMaterial[0]; i++)
+    {
+	if (modelData->material[0][i].name)
+	    free (modelData->material[0][i].name);
+    }
 
-    fParser = initFileParser (NULL, tempBufferSize);
+    if (modelData->material[0])
+	free (modelData->material[0]);
+
+    modelData->material[0]  = NULL;
+    modelData->nMaterial[0] = 0;
 
-    for (fc = 0; fc < fileCounter; fc++)
+    if (modelData->mtllib)
     {
-	int lastLoadedMaterial = -1;
-	int prevLoadedMaterial = -1;
+	for (i = 0; i < modelData->nMtllib; i++)
+	    free (modelData->mtllib[i]);
+	free (modelData->mtllib);
+    }
 
-	if (modelData->animation)
-	    size = addNumToString (&filename, size, lenBaseFilename,
-	                           post, startFileNum+fc, maxNumZeros);
+    modelData->mtllib  = NULL;
+    modelData->nMtllib = 0;
+
+    if (modelData->tex)
+    {
+	for (i = 0; i < modelData->nTex; i++)
+	    finiTexture (s, &(modelData->tex[i]));
+	free (modelData->tex);
+    }
 
-	fp = fopen(filename, "r");
-	if (!fp)
+    if (modelData->texName)
+    {
+	for (i = 0; i < modelData->nTex; i++)
 	{
-	    compLogMessage ("cubemodel", CompLogLevelWarn,
-	                    "Failed to open model file - %s", filename);
-	    free (normal);
-	    free (tmpIndices);
-	    free (texture);
-	    free (vertex);
-	    freeFileParser (fParser);
-	    return FALSE;
+	    if (modelData->texName[i])
+		free (modelData->texName[i]);
 	}
+	free (modelData->texName);
+    }
 
-	updateFileParser (fParser, fp);
+    if (modelData->texWidth)
+	free (modelData->texWidth);
+    if (modelData->texHeight)
+	free (modelData->texHeight);
 
-	if (fc == 0)
-	{
-	    nVertex  = modelData->nVertex;
-	    nTexture = modelData->nTexture;
-	    nNormal  = modelData->nNormal;
-	    nIndices = modelData->nIndices;
-
-	    sVertex  = nVertex;
-	    sTexture = nTexture;
-	    sNormal  = nNormal;
-	    sIndices = nIndices;
-	}
-	else
-	{
-	    sIndices = modelData->nIndices;
-	}
+    modelData->tex       = NULL;
+    modelData->texName   = NULL;
+    modelData->texWidth  = NULL;
+    modelData->texHeight = NULL;
+    modelData->nTex      = 0;
+}
 
-	modelData->reorderedVertex[fc]  = malloc (sizeof (vect3d) * sIndices);
-	modelData->reorderedTexture[fc] = malloc (sizeof (vect2d) * sIndices);
-	modelData->reorderedNormal[fc]  = malloc (sizeof (vect3d) * sIndices);
+/*
+ * Load the model from its cache file, together with its materials.
+ * Returns FALSE, with nothing loaded, if there is no valid cache.
+ */
+static Bool
+readModelCache (CompScreen      *s,
+		CubemodelObject *modelData)
+{
+    mappedFile             *mf;
+    const modelCacheHeader *h;
+    modelCacheLayout       l;
+    const char             *data, *path;
+    const char             **strings = NULL;
+    const int              *groups, *texMaterial;
+    const unsigned int     *indices;
+    long long              *stamps = NULL;
+    int                    *materialMap = NULL;
+    int                    *texMap = NULL;
+    char                   *realPath = NULL;
+    int                    i, fc, n;
+    Bool                   valid = FALSE;
+
+    mf = openMappedFile (modelData->cacheFile);
+    if (!mf)
+	return FALSE;
 
-	if (fc == 0)
-	{
-	    vertex  = malloc (sizeof (vect3d) * nVertex);
-	    texture = malloc (sizeof (vect2d) * nTexture);
-	    normal  = malloc (sizeof (vect3d) * nNormal);
-
-	    modelData->indices = malloc (sizeof (unsigned int *) * nIndices);
-	    modelData->reorderedVertexBuffer  = malloc (sizeof (vect3d) *
-	                                                nIndices);
-	    modelData->reorderedTextureBuffer = malloc (sizeof (vect2d) *
-	                                                nIndices);
-	    modelData->reorderedNormalBuffer  = malloc (sizeof (vect3d) *
-	                                                nIndices);
-
-	    modelData->nVertex  = nVertex;
-	    modelData->nNormal  = nNormal;
-	    modelData->nTexture = nTexture;
-	    modelData->nIndices = nIndices;
-
-	    tmpIndices = malloc (sizeof (unsigned int **) * sVertex);
-	    for (i = 0; i < sVertex; i++)
-		tmpIndices[i] = NULL;
-	}
+    data = mf->data;
+    h = (const modelCacheHeader *) data;
+
+    if (mf->size < sizeof (modelCacheHeader)     ||
+	h->magic != MODEL_CACHE_MAGIC            ||
+	h->version != MODEL_CACHE_VERSION        ||
+	h->fileCounter != modelData->fileCounter ||
+	!modelCacheLayoutFor (h, &l)             ||
+	l.size != mf->size)
+	goto out;
+
+    /* the key - path of the first frame, size and mtime of all frames */
+    path = data + l.path;
+    realPath = realpath (frameFilename (modelData, 0), NULL);
+    if (!realPath || path[h->pathLength - 1] != '\0' || strcmp (path, realPath))
+	goto out;
+
+    stamps = malloc (2 * sizeof (long long) * h->fileCounter);
+    if (!stamps || !statModelFrames (modelData, stamps) ||
+	memcmp (stamps, data + l.stamps, 2 * sizeof (long long) * h->fileCounter))
+	goto out;
+
+    /* everything else has to make sense before anything is loaded */
+    n = h->nMtllib + h->nMaterial;
+    strings = malloc (sizeof (char *) * MAX (n, 1));
+    if (!strings ||
+	!modelCacheStrings (data + l.strings, data + l.groups, n, strings))
+	goto out;
+
+    groups = (const int *) (data + l.groups);
+    for (i = 0; i < h->nGroups; i++)
+    {
+	const int *g = groups + i * MODEL_CACHE_GROUP_INTS;
+
+	if (g[2] < 0 || g[3] < 0 || g[2] + g[3] > h->nIndices ||
+	    g[4] >= h->nMaterial)
+	    goto out;
+    }
+
+    indices = (const unsigned int *) (data + l.indices);
+    for (i = 0; i < h->nIndices; i++)
+	if (indices[i] >= (unsigned int) h->nUniqueIndices)
+	    goto out;
+
+    texMaterial = (const int *) (data + l.texMaterial);
+    for (i = 0; i < h->nUniqueIndices; i++)
+	if (texMaterial[i] >= h->nMaterial)
+	    goto out;
+
+    n = MAX (h->nUniqueIndices, 1);
+
+    modelData->indices = malloc (sizeof (unsigned int) * MAX (h->nIndices, 1));
+    modelData->group   = malloc (sizeof (groupIndices) * MAX (h->nGroups, 1));
+    modelData->reorderedTexture[0]    = malloc (sizeof (vect2d) * n);
+    modelData->reorderedVertexBuffer  = malloc (sizeof (vect3d) * n);
+    modelData->reorderedTextureBuffer = malloc (sizeof (vect2d) * n);
+    modelData->reorderedNormalBuffer  = malloc (sizeof (vect3d) * n);
+    materialMap = malloc (sizeof (int) * MAX (h->nMaterial, 1));
+    texMap      = malloc (sizeof (int) * n);
+
+    if (!modelData->indices || !modelData->group ||
+	!modelData->reorderedTexture[0] || !modelData->reorderedVertexBuffer ||
+	!modelData->reorderedTextureBuffer ||
+	!modelData->reorderedNormalBuffer || !materialMap || !texMap)
+	goto out;
+
+    for (fc = 0; fc < h->fileCounter; fc++)
+    {
+	const vect3d *frame = (const vect3d *)
+	    (data + l.frames + l.frameSize * fc);
+
+	modelData->reorderedVertex[fc] = malloc (sizeof (vect3d) * n);
+	modelData->reorderedNormal[fc] = malloc (sizeof (vect3d) * n);
+	if (!modelData->reorderedVertex[fc] || !modelData->reorderedNormal[fc])
+	    goto out;
+
+	memcpy (modelData->reorderedVertex[fc], frame,
+		sizeof (vect3d) * h->nUniqueIndices);
+	memcpy (modelData->reorderedNormal[fc], frame + h->nUniqueIndices,
+		sizeof (vect3d) * h->nUniqueIndices);
+    }
+
+    /* load the materials, they are dropped again if the cache is refused */
+    modelData->mtllib = malloc (sizeof (char *) * MAX (h->nMtllib, 1));
+    modelData->nMtllib = 0;
+
+    for (i = 0; i < h->nMtllib; i++)
+    {
+	char *mtlFilename = strdup (strings[i]);
+
+	if (!mtlFilename)
+	    continue;
+
+	loadMaterials (s, modelData, frameFilename (modelData, 0), mtlFilename,
+		       &(modelData->material[0]), &(modelData->nMaterial[0]));
+
+	if (modelData->mtllib)
+	    modelData->mtllib[modelData->nMtllib++] = mtlFilename;
 	else
+	    free (mtlFilename);
+    }
+
+    /* materials that have gone from their mtl file are left out */
+    for (i = 0; i < h->nMaterial; i++)
+    {
+	materialMap[i] = -1;
+
+	for (n = 0; n < modelData->nMaterial[0]; n++)
 	{
-	    for (i = 0; i < sVertex; i++)
+	    if (!strcmp (modelData->material[0][n].name,
+			 strings[h->nMtllib + i]))
 	    {
-		if (tmpIndices[i])
-		    tmpIndices[i][0] = 0; /* set length to 0 */
+		materialMap[i] = n;
+		break;
 	    }
 	}
+    }
+
+    for (i = 0; i < h->nGroups; i++)
+    {
+	const int    *g = groups + i * MODEL_CACHE_GROUP_INTS;
+	groupIndices *group = &modelData->group[i];
+
+	memset (group, 0, sizeof (groupIndices));
+
+	group->polyCount     = g[0];
+	group->complexity    = g[1];
+	group->startV        = g[2];
+	group->numV          = g[3];
+	group->materialIndex = (g[4] >= 0) ? materialMap[g[4]] : -1;
+	group->texture       = g[5];
+	group->normal        = g[6];
+    }
+
+    memcpy (modelData->indices, indices, sizeof (unsigned int) * h->nIndices);
+    memcpy (modelData->reorderedTexture[0], data + l.texture,
+	    sizeof (vect2d) * h->nUniqueIndices);
+
+    modelData->nVertex        = h->nVertex;
+    modelData->nTexture       = h->nTexture;
+    modelData->nNormal        = h->nNormal;
+    modelData->nIndices       = h->nIndices;
+    modelData->nUniqueIndices = h->nUniqueIndices;
+    modelData->nGroups        = h->nGroups;
+
+    for (i = 0; i < h->nUniqueIndices; i++)
+	texMap[i] = (texMaterial[i] >= 0) ? materialMap[texMaterial[i]] : -1;
+    scaleModelTextures (modelData, texMap);
 
-	nVertex  = 0;
-	nNormal  = 0;
-	nTexture = 0;
-	nIndices = 0;
-	nUniqueIndices = 0;
+    if (!buildDrawList (modelData))
+	goto out;
 
-	/* Second pass - fill arrays
-	 * 	       - reorder data and store into vertex/normal/texture
-	 * 		 buffers
-	 */
+    if (modelData->animation)
+    {
+	memcpy (modelData->reorderedVertexBuffer, modelData->reorderedVertex[0],
+		sizeof (vect3d) * h->nUniqueIndices);
+	memcpy (modelData->reorderedNormalBuffer, modelData->reorderedNormal[0],
+		sizeof (vect3d) * h->nUniqueIndices);
+    }
+
+    modelData->framesLoaded    = h->fileCounter;
+    modelData->finishedLoading = TRUE;
+    valid = TRUE;
+
+out:
+    if (!valid)
+    {
+	/* leave everything as the text loader expects to find it */
+	freeModelMaterials (s, modelData);
 
-	while ((strline = getLineToken2 (fParser, FALSE)))
+	for (fc = 0; fc < modelData->fileCounter; fc++)
 	{
-	    int complexity = 0;
-	    int polyCount  = 0;
-	    Bool updateGroup  = FALSE;
-	    Bool usingNormal  = FALSE;
-	    Bool usingTexture = FALSE;
+	    if (modelData->reorderedVertex[fc])
+		free (modelData->reorderedVertex[fc]);
+	    if (modelData->reorderedNormal[fc])
+		free (modelData->reorderedNormal[fc]);
 
-	    if (strline[0] == '\0')
-		continue;
+	    modelData->reorderedVertex[fc] = NULL;
+	    modelData->reorderedNormal[fc] = NULL;
+	}
+
+	if (modelData->reorderedTexture[0])
+	    free (modelData->reorderedTexture[0]);
+	modelData->reorderedTexture[0] = NULL;
+
+	if (modelData->indices)
+	    free (modelData->indices);
+	modelData->indices = NULL;
+
+	if (modelData->group)
+	    free (modelData->group);
+	modelData->group = NULL;
+
+	if (modelData->reorderedVertexBuffer)
+	    free (modelData->reorderedVertexBuffer);
+	if (modelData->reorderedTextureBuffer)
+	    free (modelData->reorderedTextureBuffer);
+	if (modelData->reorderedNormalBuffer)
+	    free (modelData->reorderedNormalBuffer);
+
+	modelData->reorderedVertexBuffer  = NULL;
+	modelData->reorderedTextureBuffer = NULL;
+	modelData->reorderedNormalBuffer  = NULL;
+    }
+
+    if (materialMap)
+	free (materialMap);
+    if (texMap)
+	free (texMap);
+    if (strings)
+	free (strings);
+    if (stamps)
+	free (stamps);
+    if (realPath)
+	free (realPath);
+
+    closeMappedFile (mf);
+
+    return valid;
+}
+
+static Bool
+writeModelCacheData (FILE       *fp,
+		     const void *data,
+		     size_t     size)
+{
+    static const char zeros[8];
+    size_t            pad = MODEL_CACHE_ALIGN (size) - size;
+
+    if (size && fwrite (data, size, 1, fp) != 1)
+	return FALSE;
+
+    return !pad || fwrite (zeros, pad, 1, fp) == 1;
+}
+
+/*
+ * Store the loaded model, with texture the unscaled coordinates of the
+ * first frame and texMaterial the material each of them was read with. Can run in the
+ * loader thread, failure only means the next start parses the text again.
+ */
+static void
+writeModelCache (CubemodelObject *modelData,
+		 const long long *stamps,
+		 const int       *texMaterial,
+		 const vect2d    *texture)
+{
+    modelCacheHeader h;
+    modelCacheLayout l;
+    FILE             *fp;
+    char             *path, *tmpFile, *dir, *strings, *c;
+    int              *groups;
+    int              i, fc, len;
+    Bool             ok;
+
+    /* runs on the loader thread, so modelData->filename is left alone */
+    path = newFrameFilename (modelData, 0);
+    if (!path)
+	return;
+
+    c = realpath (path, NULL);
+    free (path);
+
+    path = c;
+    if (!path)
+	return;
+
+    memset (&h, 0, sizeof (modelCacheHeader));
+
+    h.magic          = MODEL_CACHE_MAGIC;
+    h.version        = MODEL_CACHE_VERSION;
+    h.fileCounter    = modelData->fileCounter;
+    h.nVertex        = modelData->nVertex;
+    h.nTexture       = modelData->nTexture;
+    h.nNormal        = modelData->nNormal;
+    h.nIndices       = modelData->nIndices;
+    h.nUniqueIndices = modelData->nUniqueIndices;
+    h.nGroups        = modelData->nGroups;
+    h.nMtllib        = modelData->nMtllib;
+    h.nMaterial      = modelData->nMaterial[0];
+    h.pathLength     = strlen (path) + 1;
+
+    for (i = 0; i < h.nMtllib; i++)
+	h.stringsSize += strlen (modelData->mtllib[i]) + 1;
+    for (i = 0; i < h.nMaterial; i++)
+	h.stringsSize += strlen (modelData->material[0][i].name) + 1;
+
+    modelCacheLayoutFor (&h, &l);
+
+    groups  = malloc (MODEL_CACHE_GROUP_INTS * sizeof (int) *
+		      MAX (h.nGroups, 1));
+    strings = malloc (MAX (h.stringsSize, 1));
+
+    /* write to a temporary file and rename it, never leave half a cache */
+    len = strlen (modelData->cacheFile) + 16;
+    tmpFile = malloc (len);
+
+    if (!groups || !strings || !tmpFile)
+    {
+	if (groups)
+	    free (groups);
+	if (strings)
+	    free (strings);
+	if (tmpFile)
+	    free (tmpFile);
+	free (path);
+	return;
+    }
+
+    c = strings;
+    for (i = 0; i < h.nMtllib; i++)
+	c = stpcpy (c, modelData->mtllib[i]) + 1;
+    for (i = 0; i < h.nMaterial; i++)
+	c = stpcpy (c, modelData->material[0][i].name) + 1;
+
+    for (i = 0; i < h.nGroups; i++)
+    {
+	int          *g = groups + i * MODEL_CACHE_GROUP_INTS;
+	groupIndices *group = &modelData->group[i];
+
+	g[0] = group->polyCount;
+	g[1] = group->complexity;
+	g[2] = group->startV;
+	g[3] = group->numV;
+	g[4] = group->materialIndex;
+	g[5] = group->texture;
+	g[6] = group->normal;
+    }
+
+    /* make sure $HOME/.compiz/cubemodel exists */
+    dir = strdup (modelData->cacheFile);
+    if (dir)
+    {
+	*strrchr (dir, '/') = '\0';
+	*strrchr (dir, '/') = '\0';
+	mkdir (dir, 0755);
+	strcat (dir, "/cubemodel");
+	mkdir (dir, 0755);
+	free (dir);
+    }
+
+    snprintf (tmpFile, len, "%s.%d", modelData->cacheFile, (int) getpid ());
+
+    fp = fopen (tmpFile, "wb");
+    if (!fp)
+    {
+	free (groups);
+	free (strings);
+	free (tmpFile);
+	free (path);
+	return;
+    }
+
+    ok = writeModelCacheData (fp, &h, sizeof (modelCacheHeader)) &&
+	 writeModelCacheData (fp, stamps,
+			      2 * sizeof (long long) * h.fileCounter) &&
+	 writeModelCacheData (fp, path, h.pathLength) &&
+	 writeModelCacheData (fp, strings, h.stringsSize) &&
+	 writeModelCacheData (fp, groups, MODEL_CACHE_GROUP_INTS *
+			      sizeof (int) * h.nGroups) &&
+	 writeModelCacheData (fp, modelData->indices,
+			      sizeof (unsigned int) * h.nIndices) &&
+	 writeModelCacheData (fp, texMaterial, sizeof (int) * h.nUniqueIndices) &&
+	 writeModelCacheData (fp, texture, sizeof (vect2d) * h.nUniqueIndices);
+
+    /* 2 * sizeof (vect3d) is a multiple of 8, frames need no padding */
+    for (fc = 0; ok && fc < h.fileCounter && h.nUniqueIndices; fc++)
+	ok = fwrite (modelData->reorderedVertex[fc], sizeof (vect3d),
+		     h.nUniqueIndices, fp) == (size_t) h.nUniqueIndices &&
+	     fwrite (modelData->reorderedNormal[fc], sizeof (vect3d),
+		     h.nUniqueIndices, fp) == (size_t) h.nUniqueIndices;
+
+    if (fclose (fp) != 0)
+	ok = FALSE;
+
+    if (!ok || rename (tmpFile, modelData->cacheFile) < 0)
+	unlink (tmpFile);
+
+    free (groups);
+    free (strings);
+    free (tmpFile);
+    free (path);
+}
+
+static Bool
+initLoadModelObject (CompScreen      *s,
+		     CubemodelObject *modelData)
+{
+    char       *filename;
+    char       **mtllib;
+    mappedFile *mf;
+    const char *token;
+    int        len;
+
+    modelData->nMaterial[0] = 0;
+    modelData->material[0] = NULL;
+
+    if (cubemodelGetModelCache (s))
+    {
+	modelData->cacheFile = modelCacheFilename (frameFilename (modelData,
+								  0));
+	if (modelData->cacheFile && readModelCache (s, modelData))
+	    return TRUE;
+    }
+
+    /* Load the materials from any mtllib references. Their textures have
+     * to be created here rather than in the loader thread, everything
+     * else is read by loadModelObject in a single pass.
+     */
+
+    filename = frameFilename (modelData, 0);
+
+    mf = openMappedFile (filename);
+    if (!mf)
+    {
+	compLogMessage ("cubemodel", CompLogLevelWarn,
+	                "Failed to open model file - %s", filename);
+	return FALSE;
+    }
+
+    while (nextMappedLine (mf))
+    {
+	token = nextMappedToken (mf, &len);
+	if (!token || !tokenIs (token, len, "mtllib"))
+	    continue;
+
+	while ((token = nextMappedToken (mf, &len)))
+	{
+	    char *mtlFilename = strndup (token, len);
+
+	    if (!mtlFilename)
+		continue;
+
+	    loadMaterials (s, modelData, filename, mtlFilename,
+	                   &(modelData->material[0]),
+	                   &(modelData->nMaterial[0]));
+
+	    /* kept for the model cache */
+	    mtllib = realloc (modelData->mtllib,
+			      sizeof (char *) * (modelData->nMtllib + 1));
+	    if (mtllib)
+	    {
+		modelData->mtllib = mtllib;
+		modelData->mtllib[modelData->nMtllib++] = mtlFilename;
+	    }
+	    else
+		free (mtlFilename);
+	}
+    }
+
+    closeMappedFile (mf);
+
+    return TRUE;
+}
+
+/**********************************************
+* growArray:                                  *
+* Returns array grown to at least n elements, *
+* doubling its size to keep appends cheap,    *
+* or NULL (array is left alone).              *
+**********************************************/
+
+static void *
+growArray (void   *array,
+	   int    *size,
+	   int    n,
+	   size_t elemSize)
+{
+    void *tmp;
+    int  newSize;
+
+    if (n <= *size)
+	return array;
+
+    newSize = MAX (n, MAX (*size * 2, 256));
+
+    tmp = realloc (array, newSize * elemSize);
+    if (!tmp)
+	return NULL;
+
+    *size = newSize;
+
+    return tmp;
+}
+
+/* grow the reordered arrays of frame fc together */
+static Bool
+growReordered (CubemodelObject *modelData,
+	       int             fc,
+	       int             *size,
+	       int             n)
+{
+    void *tmp;
+    int  s;
+
+    if (n <= *size)
+	return TRUE;
+
+    s = *size;
+    tmp = growArray (modelData->reorderedVertex[fc], &s, n, sizeof (vect3d));
+    if (!tmp)
+	return FALSE;
+    modelData->reorderedVertex[fc] = tmp;
+
+    s = *size;
+    tmp = growArray (modelData->reorderedTexture[fc], &s, n, sizeof (vect2d));
+    if (!tmp)
+	return FALSE;
+    modelData->reorderedTexture[fc] = tmp;
+
+    s = *size;
+    tmp = growArray (modelData->reorderedNormal[fc], &s, n, sizeof (vect3d));
+    if (!tmp)
+	return FALSE;
+    modelData->reorderedNormal[fc] = tmp;
+
+    *size = s;
+
+    return TRUE;
+}
+
+/****************************************************
+* tokenToIndex:                                     *
+* atoi of the part of a v/vt/vn face token at *ptr. *
+* *ptr is moved past the next '/', or set to NULL   *
+* if there is none.                                 *
+****************************************************/
+
+static int
+tokenToIndex (const char **ptr,
+	      const char *end)
+{
+    const char *p = *ptr;
+    int        sign = 1, value = 0;
+
+    if (p < end && (*p == '-' || *p == '+'))
+	sign = (*p++ == '-') ? -1 : 1;
+
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+	value = value * 10 + (*p - '0');
+
+    while (p < end && *p != '/')
+	p++;
+
+    *ptr = (p < end) ? p + 1 : NULL;
+
+    return sign * value;
+}
+
+/*
+ * Parse frame fc into reorderedVertex/Texture/Normal[fc]. The first frame
+ * also sets up the indices and groups and returns the material of each
+ * texture coordinate in texMaterialReturn, later frames must have the same
+ * topology. Frames can be loaded in parallel once the first one is done.
+ * stamp, if not NULL, gets the size and mtime of the file (-1 if unknown).
+ */
+static Bool
+loadModelFrame (CubemodelObject *modelData,
+		int             fc,
+		long long       *stamp,
+		int             **texMaterialReturn)
+{
+    int i, j;
+
+    char        *filename;
+    struct stat st;
+
+    mappedFile *mf;
+    const char *token;
+    int        len;
+
+    int nVertex=0;
+    int nNormal=0;
+    int nTexture=0;
+    int nIndices=0;
+    int nUniqueIndices = 0;
+
+    unsigned int **tmpIndices = NULL; /* reorder indices per vertex
+					 (store alternating corresponding
+					 textures/normals) */
+    vect3d *vertex  = NULL;
+    vect3d *normal  = NULL;
+    vect2d *texture = NULL;
+    int    *texMaterial = NULL; /* material each texture coordinate
+				   is scaled as per, 1st frame only */
+    void   *tmp;
+
+    int nGroups  = 0;
+
+    int oldPolyCount = 0;
+    Bool oldUsingNormal = FALSE;
+    Bool oldUsingTexture = FALSE;
+
+    int lastLoadedMaterial = -1;
+    int prevLoadedMaterial = -1;
+
+    /* store size of each array, they grow geometrically */
+    int sVertex = 0;
+    int sTmpIndices = 0;
+    int sTexture = 0;
+    int sNormal = 0;
+    int sIndices = 0;
+    int sUnique = 0;
+    int sGroups = 0;
+    int sTexMaterial = 0;
+
+    Bool failed   = FALSE;
+    Bool mismatch = FALSE;
+
+    filename = newFrameFilename (modelData, fc);
+    if (!filename)
+	return FALSE;
+
+    if (stamp)
+    {
+	if (stat (filename, &st) == 0)
+	{
+	    stamp[0] = st.st_size;
+	    stamp[1] = st.st_mtime;
+	}
+	else
+	    stamp[0] = stamp[1] = -1;
+    }
+
+    mf = openMappedFile (filename);
+    if (!mf)
+    {
+	compLogMessage ("cubemodel", CompLogLevelWarn,
+	                "Failed to open model file - %s", filename);
+	free (filename);
+	return FALSE;
+    }
+
+    /* later frames have as many unique vertices as the first */
+    if (fc > 0 && !growReordered (modelData, fc, &sUnique,
+				  modelData->nUniqueIndices))
+	failed = TRUE;
+
+    /* Single pass - fill arrays
+     * 	           - reorder data and store into vertex/normal/texture
+     * 		     buffers
+     */
+
+    while (!failed && nextMappedLine (mf))
+    {
+	int complexity = 0;
+	int polyCount  = 0;
+	Bool updateGroup  = FALSE;
+	Bool usingNormal  = FALSE;
+	Bool usingTexture = FALSE;
+
+	token = nextMappedToken (mf, &len);
+	if (!token)
+	    continue;
+
+	if (tokenIs (token, len, "v"))
+	{
+	    if (nVertex >= sVertex)
+	    {
+		tmp = growArray (vertex, &sVertex, nVertex + 1,
+				 sizeof (vect3d));
+		if (!tmp)
+		{
+		    failed = TRUE;
+		    break;
+		}
+		vertex = tmp;
+	    }
+
+	    if (nVertex >= sTmpIndices)
+	    {
+		int oldSize = sTmpIndices;
+
+		tmp = growArray (tmpIndices, &sTmpIndices, nVertex + 1,
+				 sizeof (unsigned int *));
+		if (!tmp)
+		{
+		    failed = TRUE;
+		    break;
+		}
+		tmpIndices = tmp;
+
+		for (i = oldSize; i < sTmpIndices; i++)
+		    tmpIndices[i] = NULL;
+	    }
+
+	    for (i = 0; i < 3; i++)
+	    {
+		token = nextMappedToken (mf, &len);
+
+		if (!token)
+		{
+		    vertex[nVertex].r[0] = 0;
+		    vertex[nVertex].r[1] = 0;
+		    vertex[nVertex].r[2] = 0;
+		    break;
+		}
+		vertex[nVertex].r[i] = tokenToFloat (token, len);
+	    }
+	    nVertex++;
+	}
+	else if (tokenIs (token, len, "vn"))
+	{
+	    if (nNormal >= sNormal)
+	    {
+		tmp = growArray (normal, &sNormal, nNormal + 1,
+				 sizeof (vect3d));
+		if (!tmp)
+		{
+		    failed = TRUE;
+		    break;
+		}
+		normal = tmp;
+	    }
+
+	    for (i = 0; i < 3; i++)
+	    {
+		token = nextMappedToken (mf, &len);
+
+		if (!token)
+		{
+		    normal[nNormal].r[0] = 0;
+		    normal[nNormal].r[1] = 0;
+		    normal[nNormal].r[2] = 1;
+		    break;
+		}
+		normal[nNormal].r[i] = tokenToFloat (token, len);
+	    }
+	    nNormal++;
+	}
+	else if (tokenIs (token, len, "vt"))
+	{
+	    if (nTexture >= sTexture)
+	    {
+		tmp = growArray (texture, &sTexture, nTexture + 1,
+				 sizeof (vect2d));
+		if (!tmp)
+		{
+		    failed = TRUE;
+		    break;
+		}
+		texture = tmp;
+	    }
+
+	    /* load the 1D/2D coordinates for textures */
+	    for (i = 0; i < 2; i++)
+	    {
+		token = nextMappedToken (mf, &len);
+		if (!token)
+		{
+		    if (i == 0)
+			texture[nTexture].r[0] = 0;
+
+		    texture[nTexture].r[1] = 0;
+		    break;
+		}
+		texture[nTexture].r[i] = tokenToFloat (token, len);
+	    }
+	    nTexture++;
+	}
+	else if (tokenIs (token, len, "usemtl") && fc == 0)
+	{
+	    /* load specified material, parsed from the mtl file(s) */
+	    token = nextMappedToken (mf, &len);
+	    if (!token)
+		continue;
+
+	    for (j = 0; j < modelData->nMaterial[fc]; j++)
+	    {
+		if (tokenIs (token, len, modelData->material[fc][j].name))
+		{
+		    lastLoadedMaterial = j;
+		    updateGroup = TRUE;
+		    break;
+		}
+	    }
+	}
+	else if (tokenIs (token, len, "f") || tokenIs (token, len, "fo") ||
+		 tokenIs (token, len, "p") || tokenIs (token, len, "l"))
+	{
+	    if (tokenIs (token, len, "l"))
+		complexity = 1;
+	    else if (tokenIs (token, len, "f") || tokenIs (token, len, "fo"))
+		complexity = 2;
+
+	    while ((token = nextMappedToken (mf, &len)))
+	    {
+		const char *c   = token; /* to check value of
+					    vertex/texture/normal */
+		const char *end = token + len;
+
+		int vertexIndex  = -1;
+		int textureIndex = -1;
+		int normalIndex  = -1;
+		int tmpInd;
+
+		vertexIndex = tokenToIndex (&c, end);
+		if (vertexIndex > 0)
+		{
+		    /* skip vertex index past last read in obj file */
+		    if (vertexIndex > nVertex)
+			break;
+		    vertexIndex--;
+		}
+		else if (vertexIndex < 0)
+		{
+		    vertexIndex += nVertex;
+
+		    /* skip vertex index < 0 in obj file */
+		    if (vertexIndex < 0)
+			break;
+		}
+		else /* skip vertex index of 0 in obj file */
+		    break;
+
+		if (c && complexity != 0)
+		{
+		    /* texture */
+
+		    if (c < end && *c != '/')
+		    {
+			textureIndex = tokenToIndex (&c, end);
+
+			if (textureIndex > 0)
+			{
+			    /* skip texture index past last read in obj
+			       file */
+			    if (textureIndex > nTexture)
+				break;
+			    textureIndex--;
+			}
+			else if (textureIndex < 0)
+			{
+			    textureIndex += nTexture;
+
+			    /* skip texture index < 0 in obj file */
+			    if (textureIndex < 0)
+				break;
+			}
+			else /* skip texture index of 0 in obj file */
+			    break;
+
+			usingTexture = TRUE;
+		    }
+		    else
+			c = (c < end) ? c + 1 : NULL;
+
+		    if (c && c < end && *c != '/' && complexity == 2)
+		    {
+			/* normal */
+
+			normalIndex = tokenToIndex (&c, end);
+
+			if (normalIndex > 0)
+			{
+			    /* skip normal index past last read in obj
+			       file */
+			    if (normalIndex > nNormal)
+				break;
+			    normalIndex--;
+			}
+			else if (normalIndex < 0)
+			{
+			    normalIndex += nNormal;
+
+			    /* skip normal index < 0 in obj file */
+			    if (normalIndex < 0)
+				break;
+			}
+			else /* skip normal index of 0 in obj file */
+			    break;
+
+			usingNormal = TRUE;
+		    }
+		}
+
+		if (fc == 0 && nIndices >= sIndices)
+		{
+		    tmp = growArray (modelData->indices, &sIndices,
+				     nIndices + 1, sizeof (unsigned int));
+		    if (!tmp)
+		    {
+			failed = TRUE;
+			break;
+		    }
+		    modelData->indices = tmp;
+		}
+
+		/* reorder vertices/textures/normals */
+
+		tmpInd = addVertex (&tmpIndices[vertexIndex],
+				    nUniqueIndices, textureIndex,
+				    normalIndex);
+
+		/* later frames must have the topology of the first */
+		if (fc > 0 &&
+		    (nIndices >= modelData->nIndices ||
+		     (int) modelData->indices[nIndices] !=
+		     ((tmpInd < 0) ? nUniqueIndices : tmpInd)))
+		{
+		    mismatch = TRUE;
+		    failed = TRUE;
+		    break;
+		}
+
+		if (tmpInd < 0)
+		{
+		    if (!growReordered (modelData, fc, &sUnique,
+					nUniqueIndices + 1))
+		    {
+			failed = TRUE;
+			break;
+		    }
+
+		    if (fc == 0 && nUniqueIndices >= sTexMaterial)
+		    {
+			tmp = growArray (texMaterial, &sTexMaterial,
+					 nUniqueIndices + 1, sizeof (int));
+			if (!tmp)
+			{
+			    failed = TRUE;
+			    break;
+			}
+			texMaterial = tmp;
+		    }
+
+		    memcpy (modelData->reorderedVertex[fc]
+			    [nUniqueIndices].r,
+			    vertex[vertexIndex].r,
+			    3 * sizeof (float));
+
+		    if (fc == 0)
+			texMaterial[nUniqueIndices] =
+			    (textureIndex >= 0) ? lastLoadedMaterial : -1;
+
+		    if (textureIndex >= 0)
+		    {
+			/* scaled by scaleModelTextures once loaded */
+			memcpy (modelData->reorderedTexture[fc]
+				[nUniqueIndices].r,
+				texture[textureIndex].r,
+				2 * sizeof (float));
+		    }
+		    else
+		    {
+			modelData->reorderedTexture[fc]
+			[nUniqueIndices].r[0] = 0;
+			modelData->reorderedTexture[fc]
+			[nUniqueIndices].r[1] = 0;
+		    }
+
+		    if (normalIndex >= 0)
+			memcpy (modelData->reorderedNormal[fc]
+				[nUniqueIndices].r,
+				normal[normalIndex].r,
+				3 * sizeof (float));
+		    else
+		    {
+			modelData->reorderedNormal[fc]
+			    [nUniqueIndices].r[0] = 0;
+			modelData->reorderedNormal[fc]
+			    [nUniqueIndices].r[1] = 0;
+			modelData->reorderedNormal[fc]
+			    [nUniqueIndices].r[2] = 1;
+		    }
+
+		    if (fc == 0)
+			modelData->indices[nIndices] = nUniqueIndices;
+		    nUniqueIndices++;
+		}
+		else if (fc == 0)
+		    modelData->indices[nIndices] = tmpInd;
+
+		nIndices++;
+		polyCount++;
+	    }
+
+	    updateGroup = TRUE;
+	}
+
+	if (updateGroup && fc == 0 && !failed)
+	{
+	    if (polyCount !=0 &&
+		(polyCount != oldPolyCount       ||
+		 usingNormal != oldUsingNormal   ||
+		 usingTexture != oldUsingTexture ||
+		 lastLoadedMaterial != prevLoadedMaterial))
+	    {
+		oldPolyCount = polyCount;
+		oldUsingTexture = usingTexture;
+		oldUsingNormal  = usingNormal;
+		prevLoadedMaterial = lastLoadedMaterial;
+
+		tmp = growArray (modelData->group, &sGroups, nGroups + 1,
+				 sizeof (groupIndices));
+		if (!tmp)
+		{
+		    failed = TRUE;
+		    break;
+		}
+		modelData->group = tmp;
+
+		modelData->group[nGroups].polyCount = polyCount;
+		modelData->group[nGroups].complexity = complexity;
+		modelData->group[nGroups].startV = nIndices - polyCount;
+
+		modelData->group[nGroups].materialIndex =
+		    lastLoadedMaterial;
+
+		if (nGroups > 0)
+		    modelData->group[nGroups - 1].numV = nIndices -
+			polyCount - modelData->group[nGroups - 1].startV;
+
+		modelData->group[nGroups].texture = usingTexture;
+		modelData->group[nGroups].normal  = usingNormal;
+
+		nGroups++;
+	    }
+	}
+    }
+
+
+    closeMappedFile (mf);
+
+    if (!failed && fc > 0 &&
+	(nIndices != modelData->nIndices ||
+	 nUniqueIndices != modelData->nUniqueIndices))
+	mismatch = failed = TRUE;
+
+    if (mismatch)
+	compLogMessage ("cubemodel", CompLogLevelWarn,
+	                "Model file does not match the first frame - %s",
+	                filename);
+    else if (failed)
+	compLogMessage ("cubemodel", CompLogLevelWarn,
+	                "Not enough memory to load model file - %s",
+	                filename);
+
+    if (vertex)
+	free (vertex);
+    if (normal)
+	free (normal);
+    if (texture)
+	free (texture);
+
+    if (tmpIndices)
+    {
+	for (i = 0; i < sTmpIndices; i++)
+	    if (tmpIndices[i])
+		free (tmpIndices[i]);
+	free (tmpIndices);
+    }
 
-	    if (!strcmp (strline, "v"))
-	    {
-		if (sVertex <= nVertex)
-		{
-		    sVertex++;
-		    vertex     = realloc (vertex, sizeof (vect3d) * sVertex);
-		    tmpIndices = realloc (tmpIndices,
-					  sizeof (vect3d) * sVertex);
-		    tmpIndices[sVertex - 1] = NULL;
-		}
+    free (filename);
 
-		for (i = 0; i < 3; i++)
-		{
-		    strline = getLineToken2 (fParser, TRUE);
+    if (!failed && fc == 0)
+    {
+	if (nGroups != 0)
+	    modelData->group[nGroups - 1].numV = nIndices -
+		modelData->group[nGroups - 1].startV;
 
-		    if (!strline)
-		    {
-			vertex[nVertex].r[0] = 0;
-			vertex[nVertex].r[1] = 0;
-			vertex[nVertex].r[2] = 0;
-			break;
-		    }
-		    vertex[nVertex].r[i] = atof (strline);
-		}
-		nVertex++;
-	    }
-	    else if (!strcmp (strline, "vn"))
-	    {
-		if (sNormal <= nNormal)
-		{
-		    sNormal++;
-		    normal = realloc (normal, sizeof (vect3d) * sNormal);
-		}
+	modelData->nVertex  = nVertex;
+	modelData->nNormal  = nNormal;
+	modelData->nTexture = nTexture;
+	modelData->nIndices = nIndices;
+	modelData->nUniqueIndices = nUniqueIndices;
+	modelData->nGroups  = nGroups;
+
+	modelData->reorderedVertexBuffer  = malloc (sizeof (vect3d) *
+						    MAX (nUniqueIndices, 1));
+	modelData->reorderedTextureBuffer = malloc (sizeof (vect2d) *
+						    MAX (nUniqueIndices, 1));
+	modelData->reorderedNormalBuffer  = malloc (sizeof (vect3d) *
+						    MAX (nUniqueIndices, 1));
+
+	if (!modelData->reorderedVertexBuffer  ||
+	    !modelData->reorderedTextureBuffer ||
+	    !modelData->reorderedNormalBuffer)
+	    failed = TRUE;
+    }
 
-		for (i = 0; i < 3; i++)
-		{
-		    strline = getLineToken2 (fParser, TRUE);
+    if (failed)
+    {
+	if (texMaterial)
+	    free (texMaterial);
 
-		    if (!strline)
-		    {
-			normal[nNormal].r[0] = 0;
-			normal[nNormal].r[1] = 0;
-			normal[nNormal].r[2] = 1;
-			break;
-		    }
-		    normal[nNormal].r[i] = atof(strline);
-		}
-		nNormal++;
-	    }
-	    else if (!strcmp (strline, "vt"))
-	    {
-		if (sTexture <= nTexture)
-		{
-		    sVertex++;
-		    texture = realloc (texture, sizeof (vect3d) * sTexture);
-		}
+	return FALSE;
+    }
 
-		/* load the 1D/2D coordinates for textures */
-		for (i = 0; i < 2; i++)
-		{
-		    strline = getLineToken2 (fParser, TRUE);
-		    if (!strline)
-		    {
-			if (i == 0)
-			    texture[nTexture].r[0] = 0;
+    if (fc == 0)
+	*texMaterialReturn = texMaterial;
 
-			texture[nTexture].r[1] = 0;
-			break;
-		    }
-		    texture[nTexture].r[i] = atof (strline);
-		}
-		nTexture++;
-	    }
-	    else if (!strcmp (strline, "usemtl") && fc == 0)
-	    {
-		/* parse mtl file(s) and load specified material */
-		strline = getLineToken2 (fParser, TRUE);
-		if (!strline)
-		    continue;
+    return TRUE;
+}
 
-		for (j = 0; j < modelData->nMaterial[fc]; j++)
-		{
-		    if (!strcmp (strline, modelData->material[fc][j].name))
-		    {
-			lastLoadedMaterial = j;
-			updateGroup = TRUE;
-			break;
-		    }
-		}
-	    }
-	    else if (!strcmp (strline, "f") || !strcmp (strline, "fo") ||
-		     !strcmp (strline, "p") || !strcmp (strline, "l"))
-	    {
-		char *tmpPtr; /* used to check value of vertex/texture/normal */
+/* animation frames after the first, loaded by a small pool of threads */
+typedef struct _frameQueue
+{
+    CubemodelObject *modelData;
 
-		if (!strcmp (strline, "l"))
-		    complexity = 1;
-		else if (!strcmp (strline, "f") || !strcmp (strline, "fo"))
-		    complexity = 2;
+    pthread_mutex_t mutex;
+    int             nextFrame;
+    Bool            *loaded;
 
-		while ((strline = getLineToken2 (fParser, TRUE)))
-		{
-		    int vertexIndex  = -1;
-		    int textureIndex = -1;
-		    int normalIndex  = -1;
-		    int tmpInd;
+    long long *stamps;    /* NULL if the model is not cached */
+    Bool      cacheable;
+} frameQueue;
 
+/* frames needed before an animation starts playing, a second of it */
+static int
+playableFrames (CubemodelObject *modelData)
+{
+    return MIN (modelData->fileCounter, MAX (modelData->fps, 1));
+}
 
-		    tmpPtr = strsep (&strline, "/");
-		    if (tmpPtr)
-		    {
-			vertexIndex = atoi (tmpPtr);
-			if (vertexIndex > 0)
-			{
-			    /* skip vertex index past last in obj file */
-			    if (vertexIndex > modelData->nVertex)
-				break;
-			    vertexIndex--;
-			}
-			else if (vertexIndex < 0)
-			{
-			    vertexIndex += nVertex;
+/* stand in for a frame that could not be loaded */
+static Bool
+copyFirstFrame (CubemodelObject *modelData,
+		int             fc)
+{
+    int sUnique = 0;
 
-			    /* skip vertex index < 0 in obj file */
-			    if (vertexIndex < 0)
-				break;
-			}
-			else /* skip vertex index of 0 in obj file */
-			    break;
-		    }
-		    else
-			break;
+    if (!growReordered (modelData, fc, &sUnique, modelData->nUniqueIndices))
+	return FALSE;
 
-		    tmpPtr = strsep (&strline, "/");
-		    if (tmpPtr && complexity != 0)
-		    {
-			/* texture */
+    memcpy (modelData->reorderedVertex[fc], modelData->reorderedVertex[0],
+	    sizeof (vect3d) * modelData->nUniqueIndices);
+    memcpy (modelData->reorderedNormal[fc], modelData->reorderedNormal[0],
+	    sizeof (vect3d) * modelData->nUniqueIndices);
+    memcpy (modelData->reorderedTexture[fc], modelData->reorderedTexture[0],
+	    sizeof (vect2d) * modelData->nUniqueIndices);
 
-			if (tmpPtr[0] != '\0')
-			{
-			    textureIndex = atoi (tmpPtr);
-
-			    if (textureIndex > 0)
-			    {
-				 /* skip normal index past last in obj file */
-				if (textureIndex > modelData->nTexture)
-				    break;
-				textureIndex--;
-			    }
-			    else if (textureIndex < 0)
-			    {
-				textureIndex += nTexture;
-
-				/* skip texture index < 0 in obj file */
-				if (textureIndex < 0)
-				    break;
-			    }
-			    else /* skip texture index of 0 in obj file */
-				break;
+    return TRUE;
+}
 
-			    usingTexture = TRUE;
-			}
+static void *
+loadFramesThread (void *ptr)
+{
+    frameQueue      *q = (frameQueue *) ptr;
+    CubemodelObject *modelData = q->modelData;
 
-			tmpPtr = strsep (&strline, "/");
-			if (tmpPtr)
-			{
-			    if (tmpPtr[0]!='\0' && complexity == 2)
-			    {
-				/* normal */
-
-				normalIndex = atoi (tmpPtr);
-
-				if (normalIndex > 0)
-				{
-				    /* skip normal index past last in obj file */
-				    if (normalIndex > modelData->nNormal)
-					break;
-				    normalIndex--;
-				}
-				else if (normalIndex < 0)
-				{
-				    normalIndex += nNormal;
-
-				    /* skip normal index < 0 in obj file */
-				    if (normalIndex < 0)
-					break;
-				}
-				else /* skip normal index of 0 in obj file */
-				    break;
-
-				usingNormal = TRUE;
-			    }
-			}
-		    }
+    for (;;)
+    {
+	Bool parsed, ok;
+	int  fc, loaded;
 
-		    /* reorder vertices/textures/normals */
+	pthread_mutex_lock (&q->mutex);
+	fc = q->nextFrame++;
+	pthread_mutex_unlock (&q->mutex);
 
-		    tmpInd = addVertex (&tmpIndices[vertexIndex],
-					nUniqueIndices, textureIndex,
-					normalIndex);
-		    if (tmpInd < 0)
-		    {
-			if (nUniqueIndices >= sIndices)
-			{
-			    sIndices++;
-			    modelData->reorderedVertex[fc]  =
-				realloc (modelData->reorderedVertex[fc],
-				         sizeof (vect3d) * sIndices);
-			    modelData->reorderedTexture[fc] =
-				realloc (modelData->reorderedTexture[fc],
-				         sizeof (vect2d) * sIndices);
-			    modelData->reorderedNormal[fc]  =
-				realloc (modelData->reorderedNormal[fc],
-				         sizeof (vect3d) * sIndices);
-			}
+	if (fc >= modelData->fileCounter)
+	    break;
 
-			if (vertexIndex < nVertex)
-			{
-			    memcpy (modelData->reorderedVertex[fc]
-				    [nUniqueIndices].r,
-				    vertex[vertexIndex].r,
-				    3 * sizeof (float));
-			}
-			else
-			{
-			    for (i = 0; i < 3; i++)
-				modelData->reorderedVertex[fc]
-				    [nUniqueIndices].r[i] = 0;
-			}
+	parsed = loadModelFrame (modelData, fc,
+				 q->stamps ? q->stamps + 2 * fc : NULL, NULL);
+	ok = parsed || copyFirstFrame (modelData, fc);
 
-			if (textureIndex >= 0 && textureIndex < nTexture)
-			{
-			    memcpy (modelData->reorderedTexture[fc]
-				    [nUniqueIndices].r,
-				    texture[textureIndex].r,
-				    2 * sizeof (float));
-
-
-			    /* scale as per 1st loaded texture for
-			     * that material (1st frame)*/
-
-			    if (lastLoadedMaterial >=0 && modelData->tex)
-			    {
-				mtlStruct *currentMaterial =
-				    &(modelData->material[fc]
-				      [lastLoadedMaterial]);
-
-				if (currentMaterial->map_params >= 0)
-				{
-				    CompMatrix *ct =
-					&((&(modelData->tex
-					[currentMaterial->map_params]))->
-					matrix);
-
-				    modelData->reorderedTexture[fc]
-				    [nUniqueIndices].r[0] =
-					COMP_TEX_COORD_X (ct,
-					(currentMaterial->width - 1) *
-					(texture[textureIndex].r[0]));
-				    modelData->reorderedTexture[fc]
-				    [nUniqueIndices].r[1] =
-					COMP_TEX_COORD_Y (ct,
-					(currentMaterial->height - 1) *
-					(1 - texture[textureIndex].r[1]));
-				}
-			    }
-			}
-			else
-			{
-			    modelData->reorderedTexture[fc]
-			    [nUniqueIndices].r[0] = 0;
-			    modelData->reorderedTexture[fc]
-			    [nUniqueIndices].r[1] = 0;
-			}
+	/* the animation plays the frames loaded so far without a gap */
+	pthread_mutex_lock (&q->mutex);
 
-			if (normalIndex >= 0 && normalIndex < nNormal)
-			    memcpy (modelData->reorderedNormal[fc]
-				    [nUniqueIndices].r,
-				    normal[normalIndex].r,
-				    3 * sizeof (float));
-			else
-			{
-			    modelData->reorderedNormal[fc]
-				[nUniqueIndices].r[0] = 0;
-			    modelData->reorderedNormal[fc]
-				[nUniqueIndices].r[1] = 0;
-			    modelData->reorderedNormal[fc]
-				[nUniqueIndices].r[2] = 1;
-			}
+	if (!parsed || (q->stamps && q->stamps[2 * fc] < 0))
+	    q->cacheable = FALSE;
 
-			modelData->indices[nIndices] = nUniqueIndices;
-			nUniqueIndices++;
-		    }
-		    else
-			modelData->indices[nIndices] = tmpInd;
+	q->loaded[fc] = ok;
 
-		    nIndices++;
-		    polyCount++;
-		}
+	loaded = modelData->framesLoaded;
+	while (loaded < modelData->fileCounter && q->loaded[loaded])
+	    loaded++;
 
-		updateGroup = TRUE;
-	    }
+	MODEL_PUBLISH (modelData->framesLoaded, loaded);
+	if (loaded >= playableFrames (modelData))
+	    MODEL_PUBLISH (modelData->finishedLoading, TRUE);
 
-	    if (!fParser->lastTokenOnLine)
-		skipLine (fParser);
+	pthread_mutex_unlock (&q->mutex);
+    }
 
-	    if (updateGroup && fc == 0)
-	    {
-		if (polyCount !=0 &&
-		    (polyCount != oldPolyCount       ||
-		     usingNormal != oldUsingNormal   ||
-		     usingTexture != oldUsingTexture ||
-		     lastLoadedMaterial != prevLoadedMaterial))
-		{
-		    oldPolyCount = polyCount;
-		    oldUsingTexture = usingTexture;
-		    oldUsingNormal  = usingNormal;
-		    prevLoadedMaterial = lastLoadedMaterial;
+    return NULL;
+}
 
-		    modelData->group = realloc (modelData->group,
-						(nGroups + 1) *
-						sizeof (groupIndices));
+/*
+ * Load the first frame, then the others with up to nThreads threads
+ * (including this one). Animations start playing as soon as enough of
+ * their first frames are loaded.
+ */
+static Bool
+loadModelObject (CubemodelObject *modelData,
+		 int             nThreads)
+{
+    frameQueue q;
+    pthread_t  *threads = NULL;
+    vect2d     *rawTexture = NULL;
+    int        *texMaterial = NULL;
+    int        i, j, nStarted = 0;
+
+    q.modelData = modelData;
+    q.loaded    = NULL;
+    q.stamps    = NULL;
+    q.cacheable = FALSE;
+
+    if (modelData->cacheFile)
+    {
+	q.stamps = malloc (2 * sizeof (long long) * modelData->fileCounter);
+	q.cacheable = (q.stamps != NULL);
+    }
 
-		    modelData->group[nGroups].polyCount = polyCount;
-		    modelData->group[nGroups].complexity = complexity;
-		    modelData->group[nGroups].startV = nIndices - polyCount;
+    if (!loadModelFrame (modelData, 0, q.stamps, &texMaterial))
+    {
+	if (q.stamps)
+	    free (q.stamps);
 
-		    modelData->group[nGroups].materialIndex =
-			lastLoadedMaterial;
+	return FALSE;
+    }
 
-		    if (nGroups > 0)
-			modelData->group[nGroups - 1].numV = nIndices -
-			    polyCount - modelData->group[nGroups - 1].startV;
+    if (q.stamps && q.stamps[0] < 0)
+	q.cacheable = FALSE;
 
-		    modelData->group[nGroups].texture = usingTexture;
-		    modelData->group[nGroups].normal  = usingNormal;
+    /* the cache keeps texture coordinates unscaled */
+    if (q.cacheable)
+    {
+	rawTexture = malloc (sizeof (vect2d) *
+			     MAX (modelData->nUniqueIndices, 1));
+	if (rawTexture)
+	    memcpy (rawTexture, modelData->reorderedTexture[0],
+		    sizeof (vect2d) * modelData->nUniqueIndices);
+	else
+	    q.cacheable = FALSE;
+    }
 
-		    nGroups++;
-		}
-	    }
-	}
+    scaleModelTextures (modelData, texMaterial);
 
-	if (nGroups != 0 && fc == 0)
-	    modelData->group[nGroups - 1].numV = nIndices -
-		modelData->group[nGroups - 1].startV;
+    if (!buildDrawList (modelData))
+    {
+	compLogMessage ("cubemodel", CompLogLevelWarn,
+			"Not enough memory to load model file - %s",
+			modelData->filename);
 
-	if (fc == 0)
-	    modelData->nUniqueIndices = nUniqueIndices;
+	if (q.stamps)
+	    free (q.stamps);
+	if (rawTexture)
+	    free (rawTexture);
+	if (texMaterial)
+	    free (texMaterial);
 
-	fclose (fp);
+	return FALSE;
+    }
 
-	if (fc == 0 && modelData->animation)
-	{ /* set up 1st frame for display */
-	    vect3d *reorderedVertex  = modelData->reorderedVertex[0];
-	    vect3d *reorderedNormal  = modelData->reorderedNormal[0];
+    if (modelData->animation)
+    { /* set up 1st frame for display */
+	vect3d *reorderedVertex  = modelData->reorderedVertex[0];
+	vect3d *reorderedNormal  = modelData->reorderedNormal[0];
 
-	    for (i = 0; i < modelData->nUniqueIndices; i++)
+	for (i = 0; i < modelData->nUniqueIndices; i++)
+	{
+	    for (j = 0; j < 3; j++)
 	    {
-		for (j = 0; j < 3; j++)
-		{
-		    modelData->reorderedVertexBuffer[i].r[j] =
-			reorderedVertex[i].r[j];
-		    modelData->reorderedNormalBuffer[i].r[j] =
-			reorderedNormal[i].r[j];
-		}
+		modelData->reorderedVertexBuffer[i].r[j] =
+		    reorderedVertex[i].r[j];
+		modelData->reorderedNormalBuffer[i].r[j] =
+		    reorderedNormal[i].r[j];
 	    }
 	}
-
     }
 
-    modelData->nGroups = nGroups;
+    MODEL_PUBLISH (modelData->framesLoaded, 1);
+    if (playableFrames (modelData) <= 1)
+	MODEL_PUBLISH (modelData->finishedLoading, TRUE);
 
-    if (vertex)
-	free (vertex);
-    if (normal)
-	free (normal);
-    if (texture)
-	free (texture);
+    if (modelData->fileCounter > 1)
+    {
+	q.loaded    = calloc (modelData->fileCounter, sizeof (Bool));
+	q.nextFrame = 1;
 
+	if (q.loaded)
+	{
+	    pthread_mutex_init (&q.mutex, NULL);
 
-    if (tmpIndices)
-    {
-	for (i = 0; i < sVertex; i++)
-	    if (tmpIndices[i])
-		free (tmpIndices[i]);
-	free (tmpIndices);
+	    nThreads = MIN (nThreads, modelData->fileCounter - 1);
+	    if (nThreads > 1)
+		threads = malloc (sizeof (pthread_t) * (nThreads - 1));
+
+	    for (i = 0; threads && i < nThreads - 1; i++)
+		if (!pthread_create (&threads[nStarted], NULL,
+				     loadFramesThread, &q))
+		    nStarted++;
+
+	    /* this thread works through the queue as well */
+	    loadFramesThread (&q);
+
+	    for (i = 0; i < nStarted; i++)
+		pthread_join (threads[i], NULL);
+
+	    pthread_mutex_destroy (&q.mutex);
+	}
+	else
+	    compLogMessage ("cubemodel", CompLogLevelWarn,
+			    "Not enough memory to load model file - %s",
+			    modelData->filename);
     }
 
-    freeFileParser (fParser);
+    if (q.cacheable && modelData->framesLoaded == modelData->fileCounter)
+	writeModelCache (modelData, q.stamps, texMaterial, rawTexture);
 
-    modelData->finishedLoading = TRUE;
+    if (threads)
+	free (threads);
+    if (q.loaded)
+	free (q.loaded);
+    if (q.stamps)
+	free (q.stamps);
+    if (rawTexture)
+	free (rawTexture);
+    if (texMaterial)
+	free (texMaterial);
+
+    MODEL_PUBLISH (modelData->finishedLoading, TRUE);
 
     return TRUE;
 }
@@ -1124,11 +2320,13 @@ static void *
 loadModelObjectThread (void *ptr)
 {
     CubemodelObject *modelData = (CubemodelObject *) ptr;
+    long            nCpus = sysconf (_SC_NPROCESSORS_ONLN);
+
     modelData->threadRunning = TRUE;
 
-    loadModelObject (modelData);
+    loadModelObject (modelData, MAX (1, MIN (nCpus, MAX_LOADER_THREADS)));
 
-    modelData->updateAttributes = TRUE;
+    MODEL_PUBLISH (modelData->updateAttributes, TRUE);
     modelData->threadRunning = FALSE;
 
     pthread_exit (NULL);
@@ -1212,10 +2410,29 @@ cubemodelAddModelObject (CompScreen      *s,
     modelData->reorderedNormalBuffer  = NULL;
     modelData->indices 		      = NULL;
     modelData->group                  = NULL;
+    modelData->mtllib                 = NULL;
+    modelData->nMtllib                = 0;
+    modelData->cacheFile              = NULL;
 
 
     modelData->compiledDList = FALSE;
     modelData->finishedLoading = FALSE;
+    modelData->framesLoaded = 0;
+
+    modelData->keyFrame[0]   = 0;
+    modelData->keyFrame[1]   = 0;
+    modelData->keyFrameBlend = 0;
+
+    modelData->batch         = NULL;
+    modelData->nBatches      = 0;
+    modelData->batchIndices  = NULL;
+    modelData->nBatchIndices = 0;
+
+    modelData->vbo[0]        = 0;
+    modelData->vbo[1]        = 0;
+    modelData->vboFrames     = 0;
+    modelData->vboFailed     = FALSE;
+    modelData->deleteBuffers = NULL;
 
     modelData->threadRunning = FALSE;
 
@@ -1339,6 +2556,10 @@ cubemodelAddModelObject (CompScreen      *s,
 
     for (i = 0; i < fileCounter; i++)
     {
+	modelData->reorderedVertex[i]  = NULL;
+	modelData->reorderedTexture[i] = NULL;
+	modelData->reorderedNormal[i]  = NULL;
+
 	modelData->material[i]  = 0;
 	modelData->nMaterial[i] = 0;
     }
@@ -1359,7 +2580,8 @@ cubemodelAddModelObject (CompScreen      *s,
 
     flag = initLoadModelObject (s, modelData);
 
-    if (flag)
+    /* nothing left to do if the model came from its cache */
+    if (flag && !modelData->finishedLoading)
     {
 	if  (cubemodelGetConcurrentLoad (s))
 	{
@@ -1379,7 +2601,7 @@ cubemodelAddModelObject (CompScreen      *s,
 	    modelData->threadRunning = FALSE;
 	}
 
-	flag = loadModelObject (modelData);
+	flag = loadModelObject (modelData, 1);
     }
 
     return flag;
@@ -1488,6 +2710,131 @@ cubemodelDeleteModelObject (CompScreen      *s,
     if (data->group)
 	free (data->group);
 
+    if (data->mtllib)
+    {
+	for (i = 0; i < data->nMtllib; i++)
+	    free (data->mtllib[i]);
+	free (data->mtllib);
+    }
+    if (data->cacheFile)
+	free (data->cacheFile);
+
+    if (data->batch)
+	free (data->batch);
+    if (data->batchIndices)
+	free (data->batchIndices);
+
+    if (data->vbo[0] && data->deleteBuffers)
+	(*data->deleteBuffers) (2, data->vbo);
+
+    return TRUE;
+}
+
+static void
+interpolateFrames (CubemodelObject *data)
+{
+    int    i, j;
+    float  dt  = data->keyFrameBlend;
+    float  dt2 = 1 - dt;
+    vect3d *reorderedVertex, *reorderedVertex2;
+    vect3d *reorderedNormal, *reorderedNormal2;
+
+    reorderedVertex  = data->reorderedVertex[data->keyFrame[0]];
+    reorderedVertex2 = data->reorderedVertex[data->keyFrame[1]];
+    reorderedNormal  = data->reorderedNormal[data->keyFrame[0]];
+    reorderedNormal2 = data->reorderedNormal[data->keyFrame[1]];
+
+    for (i = 0; i < data->nUniqueIndices; i++)
+    {
+	for (j = 0; j < 3; j++)
+	{
+	    data->reorderedVertexBuffer[i].r[j] =
+		dt2 * (reorderedVertex[i].r[j]) +
+		dt  * (reorderedVertex2[i].r[j]);
+	    data->reorderedNormalBuffer[i].r[j] =
+		dt2 * (reorderedNormal[i].r[j]) +
+		dt  * (reorderedNormal2[i].r[j]);
+	}
+    }
+}
+
+/*
+ * Keep the draw list and texture coordinates of a model in buffer objects,
+ * along with its first nFrames frames: the only one of a model without
+ * animation, all of them for the animation shader and none while the
+ * frames are interpolated on the CPU.
+ */
+static Bool
+uploadModelBuffers (CompScreen      *s,
+		    CubemodelObject *data,
+		    int             nFrames)
+{
+    CUBEMODEL_SCREEN (s);
+
+    GLsizeiptr size = data->nUniqueIndices * sizeof (vect3d);
+    int        fc;
+
+    if (data->vboFailed || !cms->bufferSubData || !data->batchIndices)
+	return FALSE;
+
+    if (data->vbo[0] && data->vboFrames >= nFrames)
+	return TRUE;
+
+    while (glGetError () != GL_NO_ERROR)
+	;
+
+    if (!data->vbo[0])
+    {
+	(*s->genBuffers) (2, data->vbo);
+	data->deleteBuffers = s->deleteBuffers;
+
+	(*s->bindBuffer) (GL_ELEMENT_ARRAY_BUFFER_ARB, data->vbo[1]);
+	(*s->bufferData) (GL_ELEMENT_ARRAY_BUFFER_ARB,
+			  data->nBatchIndices * sizeof (unsigned int),
+			  data->batchIndices, GL_STATIC_DRAW_ARB);
+	(*s->bindBuffer) (GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+    }
+
+    (*s->bindBuffer) (GL_ARRAY_BUFFER_ARB, data->vbo[0]);
+    (*s->bufferData) (GL_ARRAY_BUFFER_ARB, MODEL_VBO_FRAME (data, nFrames),
+		      NULL, GL_STATIC_DRAW_ARB);
+
+    if (glGetError () == GL_NO_ERROR)
+    {
+	(*cms->bufferSubData) (GL_ARRAY_BUFFER_ARB, 0,
+			       data->nUniqueIndices * sizeof (vect2d),
+			       data->reorderedTexture[0]);
+
+	for (fc = 0; fc < nFrames; fc++)
+	{
+	    (*cms->bufferSubData) (GL_ARRAY_BUFFER_ARB,
+				   MODEL_VBO_FRAME (data, fc), size,
+				   data->reorderedVertex[fc]);
+	    (*cms->bufferSubData) (GL_ARRAY_BUFFER_ARB,
+				   MODEL_VBO_NORMALS (data, fc), size,
+				   data->reorderedNormal[fc]);
+	}
+    }
+
+    (*s->bindBuffer) (GL_ARRAY_BUFFER_ARB, 0);
+
+    if (glGetError () != GL_NO_ERROR)
+    {
+	compLogMessage ("cubemodel", CompLogLevelWarn,
+			"Could not upload model to graphics memory: %s",
+			data->filename);
+
+	(*data->deleteBuffers) (2, data->vbo);
+	data->vbo[0]    = 0;
+	data->vbo[1]    = 0;
+	data->vboFrames = 0;
+	data->vboFailed = TRUE;
+
+	return FALSE;
+    }
+
+    data->vboFrames = nFrames;
+
     return TRUE;
 }
 
@@ -1496,12 +2843,9 @@ cubemodelDrawModelObject (CompScreen      *s,
 			  CubemodelObject *data,
 			  float           scale)
 {
-    if (!data->fileCounter || !data->finishedLoading)
+    if (!data->fileCounter || !MODEL_LOADED (data->finishedLoading))
 	return FALSE;
 
-    if (!data->animation && !data->compiledDList)
-	compileDList (s, data);
-
     /* Rotate, translate and scale  */
 
     glTranslatef (data->translate[0], data->translate[2], data->translate[1]);
@@ -1524,12 +2868,35 @@ cubemodelDrawModelObject (CompScreen      *s,
 
     if (data->animation)
     {
-	cubemodelDrawVBOModel (s, data,
-	                       (float *) data->reorderedVertexBuffer,
-	                       (float *) data->reorderedNormalBuffer);
+	Bool shader = cubemodelUseShader (s, data);
+
+	if (shader && uploadModelBuffers (s, data, data->fileCounter))
+	{
+	    cubemodelBindShader (s, data);
+	    cubemodelDrawVBOModel (s, data, NULL, NULL);
+	    cubemodelUnbindShader (s);
+	}
+	else
+	{
+	    if (shader)
+		interpolateFrames (data); /* skipped on update */
+
+	    uploadModelBuffers (s, data, 0);
+	    cubemodelDrawVBOModel (s, data,
+				   (float *) data->reorderedVertexBuffer,
+				   (float *) data->reorderedNormalBuffer);
+	}
+    }
+    else if (uploadModelBuffers (s, data, 1))
+    {
+	glDisable (GL_COLOR_MATERIAL); /* like the display list */
+	cubemodelDrawVBOModel (s, data, NULL, NULL);
     }
     else
     {
+	if (!data->compiledDList)
+	    compileDList (s, data);
+
 	glCallList (data->dList);
     }
 
@@ -1541,53 +2908,37 @@ cubemodelUpdateModelObject (CompScreen      *s,
 			    CubemodelObject *data,
 			    float           time)
 {
-    int i, j;
-
-    if (!data->fileCounter || !data->finishedLoading)
+    if (!data->fileCounter || !MODEL_LOADED (data->finishedLoading))
 	return FALSE;
 
-    if (!data->animation && !data->compiledDList)
-	compileDList (s, data);
-
     data->rotate[0] += 360 * time * data->rotateSpeed;
     data->rotate[0] = fmodf (data->rotate[0], 360.0f);
 
     if (data->animation && data->fps)
     {
-	float  t, dt, dt2;
-	int    ti, ti2;
-	vect3d *reorderedVertex, *reorderedVertex2;
-	vect3d *reorderedNormal, *reorderedNormal2;
+	float t;
+	int   ti;
+	/* less while still loading */
+	int   nFrames = MODEL_LOADED (data->framesLoaded);
 
 	data->time += time * data->fps;
-	data->time = fmodf (data->time, (float) data->fileCounter);
+	data->time = fmodf (data->time, (float) nFrames);
 
 	t = data->time;
 	if (t < 0)
-	    t += (float) data->fileCounter;
+	    t += (float) nFrames;
 
-	ti  = (int) t;
-	ti2 = (ti + 1) % data->fileCounter;
-	dt  = t - ti;
-	dt2 = 1 - dt;
+	ti = (int) t;
+	if (ti >= nFrames) /* rounding of t just below nFrames */
+	    ti = nFrames - 1;
 
-	reorderedVertex  = data->reorderedVertex[ti];
-	reorderedVertex2 = data->reorderedVertex[ti2];
-	reorderedNormal  = data->reorderedNormal[ti];
-	reorderedNormal2 = data->reorderedNormal[ti2];
+	data->keyFrame[0]   = ti;
+	data->keyFrame[1]   = (ti + 1) % nFrames;
+	data->keyFrameBlend = t - ti;
 
-	for (i = 0; i < data->nUniqueIndices; i++)
-	{
-	    for (j = 0; j < 3; j++)
-	    {
-		data->reorderedVertexBuffer[i].r[j] =
-		    dt2 * (reorderedVertex[i].r[j]) +
-		    dt  * (reorderedVertex2[i].r[j]);
-		data->reorderedNormalBuffer[i].r[j] =
-		    dt2 * (reorderedNormal[i].r[j]) +
-		    dt  * (reorderedNormal2[i].r[j]);
-	    }
-	}
+	/* the shader blends the key frames itself when drawing */
+	if (!cubemodelUseShader (s, data))
+	    interpolateFrames (data);
     }
 
     return TRUE;
@@ -1607,14 +2958,30 @@ setMaterial (const float *shininess,
     glMaterialfv (GL_FRONT_AND_BACK, GL_SPECULAR, specular);
 }
 
+static void
+drawModelBatch (CubemodelObject *data,
+		drawBatch       *batch)
+{
+    if (data->vbo[1])
+	glDrawElements (batch->cap, batch->count, GL_UNSIGNED_INT,
+			(GLvoid *) (batch->start * sizeof (unsigned int)));
+    else
+	glDrawElements (batch->cap, batch->count, GL_UNSIGNED_INT,
+			data->batchIndices + batch->start);
+}
+
+/*
+ * Draw the batches of the draw list.  Without vertex and normal arrays,
+ * they are taken from the key frame in the vertex buffer object.
+ */
 Bool
 cubemodelDrawVBOModel (CompScreen      *s,
 		       CubemodelObject *data,
 		       float           *vertex,
 		       float           *normal)
 {
-    groupIndices *group;
-    int          i, j;
+    drawBatch *batch;
+    int       i;
 
     static const float white[4] = { 1.0, 1.0, 1.0, 1.0 };
     static const float black[4] = { 0.0, 0.0, 0.0, 0.0 };
@@ -1640,60 +3007,72 @@ cubemodelDrawVBOModel (CompScreen      *s,
     const float *specular  = white;
     const float *shininess = defaultShininess;
 
-    glVertexPointer (3, GL_FLOAT, 0, v);
-    glNormalPointer (GL_FLOAT, 0, n);
-    glTexCoordPointer (2, GL_FLOAT, 0, t);
+    if (data->vbo[0])
+    {
+	(*s->bindBuffer) (GL_ARRAY_BUFFER_ARB, data->vbo[0]);
+
+	glTexCoordPointer (2, GL_FLOAT, 0, NULL);
+	if (!v)
+	{
+	    glVertexPointer (3, GL_FLOAT, 0, (GLvoid *)
+			     MODEL_VBO_FRAME (data, data->keyFrame[0]));
+	    glNormalPointer (GL_FLOAT, 0, (GLvoid *)
+			     MODEL_VBO_NORMALS (data, data->keyFrame[0]));
+	}
+
+	(*s->bindBuffer) (GL_ARRAY_BUFFER_ARB, 0);
+    }
+    else
+	glTexCoordPointer (2, GL_FLOAT, 0, t);
+
+    if (v)
+    {
+	glVertexPointer (3, GL_FLOAT, 0, v);
+	glNormalPointer (GL_FLOAT, 0, n);
+    }
+
+    if (data->vbo[1])
+	(*s->bindBuffer) (GL_ELEMENT_ARRAY_BUFFER_ARB, data->vbo[1]);
 
     glEnableClientState (GL_VERTEX_ARRAY);
     glEnableClientState (GL_NORMAL_ARRAY);
     glDisableClientState (GL_TEXTURE_COORD_ARRAY);
     glDisable (GL_TEXTURE_2D);
 
-    for (i = 0; i < data->nGroups; i++)
+    for (i = 0; i < data->nBatches; i++)
     {
-	GLenum cap = GL_QUADS;
-
-	group = &(data->group[i]);
-	if (group->polyCount < 1)
-	    continue;
-
-	if (group->polyCount == 3)
-	    cap = GL_TRIANGLES;
-	if (group->polyCount == 2 || group->complexity == 1)
-	    cap = GL_LINE_LOOP;
-	if (group->polyCount == 1 || group->complexity == 0)
-	    cap = GL_POINTS;
+	batch = &(data->batch[i]);
 
-	if (group->normal && !prevNormal)
+	if (batch->normal && !prevNormal)
 	{
 	    glEnableClientState (GL_NORMAL_ARRAY);
 	    prevNormal = TRUE;
 	}
-	else if (!group->normal && prevNormal)
+	else if (!batch->normal && prevNormal)
 	{
 	    glDisableClientState (GL_NORMAL_ARRAY);
 	    prevNormal = FALSE;
 	}
 
-	if (group->materialIndex >= 0)
+	if (batch->materialIndex >= 0)
 	{
-	    if (group->materialIndex != prevMaterialIndex)
+	    if (batch->materialIndex != prevMaterialIndex)
 	    {
 		glDisable (GL_COLOR_MATERIAL);
 
 		diffuseTextureIndex     =
-		    data->material[0][group->materialIndex].map_Kd;
+		    data->material[0][batch->materialIndex].map_Kd;
 		transparentTextureIndex =
-		    data->material[0][group->materialIndex].map_d;
+		    data->material[0][batch->materialIndex].map_d;
 
-		ambient   = data->material[0][group->materialIndex].Ka;
-		diffuse   = data->material[0][group->materialIndex].Kd;
-		specular  = data->material[0][group->materialIndex].Ks;
-		shininess = data->material[0][group->materialIndex].Ns;
+		ambient   = data->material[0][batch->materialIndex].Ka;
+		diffuse   = data->material[0][batch->materialIndex].Kd;
+		specular  = data->material[0][batch->materialIndex].Ks;
+		shininess = data->material[0][batch->materialIndex].Ns;
 
 		setMaterial (shininess, ambient, diffuse, specular);
 
-		switch (data->material[0][group->materialIndex].illum) {
+		switch (data->material[0][batch->materialIndex].illum) {
 		case 0:
 		    glDisable (GL_LIGHTING);
 		    break;
@@ -1703,12 +3082,14 @@ cubemodelDrawVBOModel (CompScreen      *s,
 		    glEnable (GL_LIGHTING);
 		}
 	    }
-	    prevMaterialIndex = group->materialIndex;
+	    prevMaterialIndex = batch->materialIndex;
 	}
 
+	cubemodelSyncShader (s);
+
 	glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	if (group->texture && transparentTextureIndex >= 0)
+	if (batch->texture && transparentTextureIndex >= 0)
 	{
 	    if (!prevTexture)
 	    {
@@ -1738,27 +3119,14 @@ cubemodelDrawVBOModel (CompScreen      *s,
 		glBlendFunc (GL_SRC_ALPHA, GL_ONE);
 		setMaterial (shininess, white, white, white);
 
-		if (data->group[i].polyCount < 5)
-		    glDrawElements (cap, group->numV, GL_UNSIGNED_INT,
-				    data->indices + group->startV);
-		else
-		{
-		    for (j = 0; j < group->numV / group->polyCount; j++)
-		    {
-			glDrawElements (GL_POLYGON,
-					group->polyCount,
-					GL_UNSIGNED_INT,
-					data->indices + group->startV +
-					j * group->polyCount);
-		    }
-		}
+		drawModelBatch (data, batch);
 
 		glBlendFunc (GL_ONE_MINUS_DST_ALPHA, GL_SRC_COLOR);
 		setMaterial (shininess, ambient, diffuse, specular);
 	    }
 	}
 
-	if (group->texture && diffuseTextureIndex >= 0)
+	if (batch->texture && diffuseTextureIndex >= 0)
 	{
 	    if (!prevTexture)
 	    {
@@ -1795,20 +3163,12 @@ cubemodelDrawVBOModel (CompScreen      *s,
 	    glMaterialfv (GL_FRONT_AND_BACK, GL_DIFFUSE, diffuse);
 	}
 
-	if (data->group[i].polyCount < 5)
-	    glDrawElements (cap, group->numV, GL_UNSIGNED_INT,
-			    data->indices + group->startV);
-	else
-	{
-	    for (j = 0; j < group->numV/group->polyCount; j++)
-	    {
-		glDrawElements (GL_POLYGON, group->polyCount, GL_UNSIGNED_INT,
-				data->indices + group->startV +
-				j * group->polyCount);
-	    }
-	}
+	drawModelBatch (data, batch);
     }
 
+    if (data->vbo[1])
+	(*s->bindBuffer) (GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+
     if (currentTexture)
 	disableTexture (s, currentTexture);
 
@@ -0,0 +1,339 @@
+/*
+ * Compiz cube model plugin
+ *
+ * shader.c
+ *
+ * This plugin displays wavefront (.obj) 3D mesh models inside of
+ * the transparent cube.
+ *
+ * Copyright : (C) 2008 by David Mikos
+ * E-mail    : infiniteloopcounter@gmail.com
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Keyframe animation on the GPU.  Every frame of an animated model is
+ * uploaded once into its vertex buffer object, and each draw points the
+ * vertex and normal arrays at the two frames being shown and blends them
+ * in a vertex shader, so cubemodelUpdateModelObject no longer touches
+ * every vertex.
+ */
+
+#include <string.h>
+#include <stdio.h>
+
+#include "cubemodel-internal.h"
+#include "cubemodel_options.h"
+
+/*
+ * Fixed function lighting of GL_LIGHT1 with a non-local viewer, which is
+ * how cubemodelPaintInside lights the models.  Materials are always set
+ * for both faces, so the back faces only differ in their normal.
+ */
+static const char *animationVertexShader =
+    "uniform vec4 state;      /* blend, lit, colour material, normals */\n"
+    "attribute vec3 nextVertex;\n"
+    "attribute vec3 nextNormal;\n"
+    "\n"
+    "vec4 light (vec3 n, vec4 ambient, vec4 diffuse)\n"
+    "{\n"
+    "    float nl = dot (n, normalize (gl_LightSource[1].position.xyz));\n"
+    "    vec4  c  = gl_FrontMaterial.emission +\n"
+    "               ambient * (gl_LightModel.ambient +\n"
+    "                          gl_LightSource[1].ambient);\n"
+    "\n"
+    "    if (nl > 0.0)\n"
+    "    {\n"
+    "        float nh = max (dot (n, gl_LightSource[1].halfVector.xyz),\n"
+    "                        0.0);\n"
+    "\n"
+    "        c += nl * diffuse * gl_LightSource[1].diffuse;\n"
+    "        c += pow (nh, gl_FrontMaterial.shininess) *\n"
+    "             gl_FrontMaterial.specular * gl_LightSource[1].specular;\n"
+    "    }\n"
+    "\n"
+    "    c.a = diffuse.a;\n"
+    "    return clamp (c, 0.0, 1.0);\n"
+    "}\n"
+    "\n"
+    "void main ()\n"
+    "{\n"
+    "    vec4 v = vec4 (mix (gl_Vertex.xyz, nextVertex, state.x), 1.0);\n"
+    "\n"
+    "    if (state.y > 0.0)\n"
+    "    {\n"
+    "        vec3 n       = gl_Normal;\n"
+    "        vec4 ambient = gl_FrontMaterial.ambient;\n"
+    "        vec4 diffuse = gl_FrontMaterial.diffuse;\n"
+    "\n"
+    "        if (state.w > 0.0)\n"
+    "            n = mix (n, nextNormal, state.x);\n"
+    "\n"
+    "        n = normalize (gl_NormalMatrix * n);\n"
+    "\n"
+    "        if (state.z > 0.0)\n"
+    "        {\n"
+    "            ambient = gl_Color;\n"
+    "            diffuse = gl_Color;\n"
+    "        }\n"
+    "\n"
+    "        gl_FrontColor = light (n, ambient, diffuse);\n"
+    "        gl_BackColor  = light (-n, ambient, diffuse);\n"
+    "    }\n"
+    "    else\n"
+    "    {\n"
+    "        gl_FrontColor = gl_Color;\n"
+    "        gl_BackColor  = gl_Color;\n"
+    "    }\n"
+    "\n"
+    "    gl_TexCoord[0] = gl_TextureMatrix[0] * gl_MultiTexCoord0;\n"
+    "    gl_Position    = gl_ModelViewProjectionMatrix * v;\n"
+    "}\n";
+
+static Bool
+hasGLExtension (const char *name)
+{
+    const char *extensions, *e;
+    int        len = strlen (name);
+
+    extensions = (const char *) glGetString (GL_EXTENSIONS);
+    if (!extensions)
+	return FALSE;
+
+    e = extensions;
+
+    while ((e = strstr (e, name)))
+    {
+	if ((e == extensions || e[-1] == ' ') &&
+	    (e[len] == ' ' || e[len] == '\0'))
+	    return TRUE;
+
+	e += len;
+    }
+
+    return FALSE;
+}
+
+static Bool
+loadAnimationShader (AnimationShader *as)
+{
+    GLint status;
+
+    as->shader = (*as->createShaderObject) (GL_VERTEX_SHADER_ARB);
+    (*as->shaderSource) (as->shader, 1, &animationVertexShader, NULL);
+    (*as->compileShader) (as->shader);
+
+    (*as->getObjectParameteriv) (as->shader, GL_OBJECT_COMPILE_STATUS_ARB,
+				 &status);
+    if (!status)
+    {
+	compLogMessage ("cubemodel", CompLogLevelWarn,
+			"Failed to compile animation vertex shader");
+	return FALSE;
+    }
+
+    as->program = (*as->createProgramObject) ();
+    (*as->attachObject) (as->program, as->shader);
+    (*as->linkProgram) (as->program);
+
+    (*as->getObjectParameteriv) (as->program, GL_OBJECT_LINK_STATUS_ARB,
+				 &status);
+    if (!status)
+    {
+	compLogMessage ("cubemodel", CompLogLevelWarn,
+			"Failed to link animation shader program");
+	return FALSE;
+    }
+
+    as->stateLoc      = (*as->getUniformLocation) (as->program, "state");
+    as->nextVertexLoc = (*as->getAttribLocation) (as->program, "nextVertex");
+    as->nextNormalLoc = (*as->getAttribLocation) (as->program, "nextNormal");
+
+    return (as->stateLoc >= 0 && as->nextVertexLoc >= 0 &&
+	    as->nextNormalLoc >= 0);
+}
+
+void
+cubemodelInitShader (CompScreen *s)
+{
+    CUBEMODEL_SCREEN (s);
+
+    AnimationShader *as = &cms->animationShader;
+
+    memset (as, 0, sizeof (AnimationShader));
+
+    if (!cms->bufferSubData ||
+	!hasGLExtension ("GL_ARB_shader_objects") ||
+	!hasGLExtension ("GL_ARB_vertex_shader"))
+	return;
+
+    as->createShaderObject = (GLCreateShaderObjectProc)
+	(*s->getProcAddress) ((GLubyte *) "glCreateShaderObjectARB");
+    as->shaderSource = (GLShaderSourceProc)
+	(*s->getProcAddress) ((GLubyte *) "glShaderSourceARB");
+    as->compileShader = (GLCompileShaderProc)
+	(*s->getProcAddress) ((GLubyte *) "glCompileShaderARB");
+    as->createProgramObject = (GLCreateProgramObjectProc)
+	(*s->getProcAddress) ((GLubyte *) "glCreateProgramObjectARB");
+    as->attachObject = (GLAttachObjectProc)
+	(*s->getProcAddress) ((GLubyte *) "glAttachObjectARB");
+    as->linkProgram = (GLLinkProgramProc)
+	(*s->getProcAddress) ((GLubyte *) "glLinkProgramARB");
+    as->useProgramObject = (GLUseProgramObjectProc)
+	(*s->getProcAddress) ((GLubyte *) "glUseProgramObjectARB");
+    as->getObjectParameteriv = (GLGetObjectParameterivProc)
+	(*s->getProcAddress) ((GLubyte *) "glGetObjectParameterivARB");
+    as->deleteObject = (GLDeleteObjectProc)
+	(*s->getProcAddress) ((GLubyte *) "glDeleteObjectARB");
+    as->getUniformLocation = (GLGetUniformLocationProc)
+	(*s->getProcAddress) ((GLubyte *) "glGetUniformLocationARB");
+    as->getAttribLocation = (GLGetAttribLocationProc)
+	(*s->getProcAddress) ((GLubyte *) "glGetAttribLocationARB");
+    as->uniform4fv = (GLUniform4fvProc)
+	(*s->getProcAddress) ((GLubyte *) "glUniform4fvARB");
+    as->vertexAttribPointer = (GLVertexAttribPointerProc)
+	(*s->getProcAddress) ((GLubyte *) "glVertexAttribPointerARB");
+    as->enableVertexAttribArray = (GLEnableVertexAttribArrayProc)
+	(*s->getProcAddress) ((GLubyte *) "glEnableVertexAttribArrayARB");
+    as->disableVertexAttribArray = (GLDisableVertexAttribArrayProc)
+	(*s->getProcAddress) ((GLubyte *) "glDisableVertexAttribArrayARB");
+
+    if (!as->createShaderObject || !as->shaderSource ||
+	!as->compileShader || !as->createProgramObject ||
+	!as->attachObject || !as->linkProgram || !as->useProgramObject ||
+	!as->getObjectParameteriv || !as->deleteObject ||
+	!as->getUniformLocation || !as->getAttribLocation ||
+	!as->uniform4fv || !as->vertexAttribPointer ||
+	!as->enableVertexAttribArray || !as->disableVertexAttribArray)
+	return;
+
+    if (!loadAnimationShader (as))
+    {
+	cubemodelFiniShader (s);
+	return;
+    }
+
+    as->supported = TRUE;
+}
+
+void
+cubemodelFiniShader (CompScreen *s)
+{
+    CUBEMODEL_SCREEN (s);
+
+    AnimationShader *as = &cms->animationShader;
+
+    if (as->program)
+	(*as->deleteObject) (as->program);
+    if (as->shader)
+	(*as->deleteObject) (as->shader);
+
+    as->supported = FALSE;
+    as->shader    = 0;
+    as->program   = 0;
+}
+
+/*
+ * The shader needs every frame in the buffer, so animations still being
+ * loaded are interpolated on the CPU until their last frame is in.
+ */
+Bool
+cubemodelUseShader (CompScreen      *s,
+		    CubemodelObject *data)
+{
+    CUBEMODEL_SCREEN (s);
+
+    return (cms->animationShader.supported &&
+	    cubemodelGetAnimationShader (s) &&
+	    data->animation && !data->vboFailed &&
+	    MODEL_LOADED (data->framesLoaded) == data->fileCounter);
+}
+
+/*
+ * Points the shader attributes at the frame after the key frame of data.
+ * cubemodelDrawVBOModel takes the key frame itself, the texture
+ * coordinates and the draw list from the buffer objects of the model,
+ * which must hold every frame.
+ */
+void
+cubemodelBindShader (CompScreen      *s,
+		     CubemodelObject *data)
+{
+    CUBEMODEL_SCREEN (s);
+
+    AnimationShader *as = &cms->animationShader;
+
+    (*as->useProgramObject) (as->program);
+
+    as->bound = TRUE;
+    as->blend = data->keyFrameBlend;
+
+    (*s->bindBuffer) (GL_ARRAY_BUFFER_ARB, data->vbo[0]);
+
+    (*as->vertexAttribPointer) (as->nextVertexLoc, 3, GL_FLOAT, GL_FALSE, 0,
+				(GLvoid *)
+				MODEL_VBO_FRAME (data, data->keyFrame[1]));
+    (*as->vertexAttribPointer) (as->nextNormalLoc, 3, GL_FLOAT, GL_FALSE, 0,
+				(GLvoid *)
+				MODEL_VBO_NORMALS (data, data->keyFrame[1]));
+
+    (*s->bindBuffer) (GL_ARRAY_BUFFER_ARB, 0);
+
+    (*as->enableVertexAttribArray) (as->nextVertexLoc);
+    (*as->enableVertexAttribArray) (as->nextNormalLoc);
+
+    if (cubemodelGetRenderFrontAndBack (s))
+	glEnable (GL_VERTEX_PROGRAM_TWO_SIDE_ARB);
+}
+
+/*
+ * Hands the lighting state the fixed function pipeline would have used to
+ * the shader.  To be called before drawing a group of the bound model.
+ */
+void
+cubemodelSyncShader (CompScreen *s)
+{
+    CUBEMODEL_SCREEN (s);
+
+    AnimationShader *as = &cms->animationShader;
+
+    float state[4];
+
+    if (!as->bound)
+	return;
+
+    state[0] = as->blend;
+    state[1] = glIsEnabled (GL_LIGHTING) ? 1.0f : 0.0f;
+    state[2] = glIsEnabled (GL_COLOR_MATERIAL) ? 1.0f : 0.0f;
+    state[3] = glIsEnabled (GL_NORMAL_ARRAY) ? 1.0f : 0.0f;
+
+    (*as->uniform4fv) (as->stateLoc, 1, state);
+}
+
+void
+cubemodelUnbindShader (CompScreen *s)
+{
+    CUBEMODEL_SCREEN (s);
+
+    AnimationShader *as = &cms->animationShader;
+
+    glDisable (GL_VERTEX_PROGRAM_TWO_SIDE_ARB);
+
+    (*as->disableVertexAttribArray) (as->nextVertexLoc);
+    (*as->disableVertexAttribArray) (as->nextNormalLoc);
+
+    (*as->useProgramObject) (0);
+
+    as->bound = FALSE;
+}
@@ -49,7 +49,11 @@
 
 
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <compiz-core.h>
+#include <compiz-particles.h>
+#include <compiz-sprite-atlas.h>
 #include "elements_options.h"
 #define GET_DISPLAY(d)                            \
 	((eDisplay *) (d)->base.privates[displayPrivateIndex].ptr)
@@ -65,10 +69,13 @@
 
 #define GLOW_STAGES		5
 #define MAX_AUTUMN_AGE		100
+#define DAMAGE_TILES		4			/* Elements are damaged as the bounding boxes of a grid of tiles per output */
+#define Z_NEAR			0.1f			/* Near plane of the core projection, elements closer to the camera are clipped */
 #define BIG_NUMBER		20000			/* This is the number used to make sure that elements don't get all created in one place. 									Bigger number, more distance. Possibly fixable later.*/
 
 static float glowCurve[GLOW_STAGES][4] = { { 0.0, 0.5, 0.5, 1.0 }, { 1.0, 1.0, 0.5, 0.75 }, { 0.75, 0.3, 1.2, 1.0 }, { 1.0, 0.7, 1.5, 1.0 }, { 1.0, 0.5, 0.5, 0.0 } };
 static int displayPrivateIndex = 0;
+static ParticleBezierTable bezierTable;
 
 typedef struct _eDisplay 			//This structure holds all the textures selected from the Compiz window
 {
@@ -77,19 +84,10 @@ typedef struct _eDisplay 			//This structure holds all the textures selected fro
 	CompOptionValue *texFiles[5];
 } eDisplay;
 
-typedef struct _texture
-{
-	CompTexture tex;
-	unsigned int width;
-	unsigned int height;
-	Bool loaded;
-	GLuint dList;
-} texture;
-
+#define NUM_ELEMENT_TYPES	5			/* Follows the usual pattern, alphabetic except for bubbles, which is 4. */
 
 typedef struct _element
 {
-	int type;				//Follows the usual pattern, alphabetic except for bubbles, which is 4.
 	float x, y, z;
 	float dx[4], dy[4], dz[4];		//matrix only used for Fireflies
 	int autumnAge[2];			//Used by both Autumn and Bubbles. Determines which part of the autumnFloat matrix the Element is in
@@ -102,34 +100,61 @@ typedef struct _element
 	float age;
 	float lifecycle;
 	float glowAlpha;
-	texture *eTex;
+	SpriteAtlasSprite *eTex;
 } element;
 
+typedef struct _elementPool			//All elements of one type
+{
+	element *elements;
+	int numElements;
+} elementPool;
+
+typedef struct _elementParams			//Options read every frame, refreshed by elementsDisplayOptionChanged
+{
+	float globalSpeed;
+	float minZ;				//Elements behind this are recreated
+	Bool  overWindows;
+	Bool  applyTransform;
+	float autumnSpeed;
+	float ffSpeed;
+	float snowSpeed;
+	float starsSpeed;
+	float bubblesSpeed;
+	Bool  rotate[NUM_ELEMENT_TYPES];
+	float size[NUM_ELEMENT_TYPES];
+	int   updateDelay;
+} elementParams;
+
 typedef struct _screen
 {
 	CompScreen *cScreen;
 	Bool isActive[5];
 	Bool useKeys;
-	PreparePaintScreenProc preparePaintScreen;
-	DonePaintScreenProc donePaintScreen;
 	PaintOutputProc paintOutput;
 	DrawWindowProc  drawWindow;
 	CompWindow *topWindow;
-	texture *textu;
-	int numElements;
+	SpriteAtlas atlas;			//The textures of all types, the files of type t start at sprite firstTex[t]
+	int firstTex[NUM_ELEMENT_TYPES + 1];
 	int numTexLoaded[5];
+	GLfloat *vertices;			//Quads of all elements
+	GLfloat *texCoords;
+	int arraySize;
 	GLuint displayList;
 	Bool   needUpdate;
-	element *allElements;
+	elementPool pools[NUM_ELEMENT_TYPES];
+	elementParams params;
+	CompTimeoutHandle timeoutHandle;
+	BoxPtr damageTiles;
+	int nDamageTiles;
 } screen;
 
-static void initiateElement (screen *eScreen, element *ele);
-static void elementMove (CompDisplay *d, element *ele, int elapsed);
-static void setElementTexture (screen *eScreen, element  *ele);
-static void updateElementTextures (CompScreen *s, Bool changeTextures);
+typedef void (*elementMoveProc) (const elementParams *p, elementPool *pool, int ms);
+
+static void initiateElement (screen *eScreen, int type, element *ele);
+static void setElementTexture (screen *eScreen, int type, element  *ele);
+static void updateElementTextures (CompScreen *s);
 static inline float mmRand(int  min, int max, float divisor);
 static void elementsDisplayOptionChanged (CompDisplay *d, CompOption *opt, ElementsDisplayOptions num);
-float bezierCurve(float p[4], float time, int type);
 static void createAll(CompDisplay *d);
 
 static inline int
@@ -148,20 +173,11 @@ mmRand (int   min,
 };
 
 
-float bezierCurve(float p[4], float time, int type) {				//Used for Fireflies and Stars to move.
-	float out = 0.0f;
-	if (type == 3)
-		out = p[0] * (time+0.01) * 10;
-	else if (type == 1)
-	{
-		float a = p[0];
-		float b = p[0] + p[1];
-		float c = p[3] + p[2];
-		float d = p[3];
-		float e = 1.0 - time; 
-		out = (a*(e*e*e)) + (3.0*b*(e*e)*time) + (3.0*c*e*(time*time)) + (d*(time*time*time));
-	}
-    return out;
+static inline float
+bezierCurve (const float p[4], const float *w)		//Used for Fireflies to move. w are the Bernstein weights from bezierTable.
+{
+	return w[0] * p[0] + w[1] * (p[0] + p[1]) +
+	       w[2] * (p[3] + p[2]) + w[3] * p[3];
 }
 
 static Bool
@@ -179,31 +195,34 @@ elementActive (CompScreen *s)
 }
 
 static void
-elementTestCreate ( screen *currentScreen, element *ele, int elapsed)		//If the Element is outside of screen boxing, it is recreated. Else, it's moved.
+elementsRespawn (screen *eScreen, int type)		//Elements outside of the screen boxing are recreated.
 {
-	if (ele->y >= currentScreen->cScreen->height + 200|| ele->x <= -200|| ele->x >= currentScreen->cScreen->width + 200||
-	ele->y >= currentScreen->cScreen->height + 200||
-	ele->z <= -((float) elementsGetScreenDepth (currentScreen->cScreen->display) / 500.0) ||
-	ele->z >= 1 || ele->y <= -200)			// Screen boxing has been replaced by a hard-coded number. It is 200, in this case.
+	CompScreen *s = eScreen->cScreen;
+	elementPool *pool = &eScreen->pools[type];
+	element *ele = pool->elements;
+	float minZ = eScreen->params.minZ;
+	int i;
+
+	for (i = 0; i < pool->numElements; i++, ele++)
 	{
-		initiateElement(currentScreen, ele);
+		if (ele->x <= -200 || ele->x >= s->width + 200 ||
+		ele->y <= -200 || ele->y >= s->height + 200 ||
+		ele->z <= minZ || ele->z >= 1)			// Screen boxing has been replaced by a hard-coded number. It is 200, in this case.
+		{
+			initiateElement(eScreen, type, ele);
+		}
 	}
-
-		elementMove(currentScreen->cScreen->display, ele, elapsed);
 }
 
 static void
-elementMove (CompDisplay *display, element *ele, int ms)
+autumnMove (const elementParams *p, elementPool *pool, int ms)
 {
+	float autumnSpeed = p->autumnSpeed;
+	float globalSpeed = p->globalSpeed * ms;
+	element *ele = pool->elements;
+	int i;
 
-	float autumnSpeed = elementsGetAutumnSpeed (display)/30.0f;
-	float ffSpeed = elementsGetFireflySpeed (display) / 700.0f;
-	float snowSpeed = elementsGetSnowSpeed (display) / 500.0f;
-	float starsSpeed = elementsGetStarsSpeed (display) / 500.0f;
-	float bubblesSpeed = (100.0 - elementsGetViscosity (display))/30.0f;
-	float globalSpeed = elementsGetGlobalSpeed (display) * ms;
-
-	if (ele->type == 0)
+	for (i = 0; i < pool->numElements; i++, ele++)
 	{
 		ele->x += (ele->autumnFloat[0][ele->autumnAge[0]] * (float) globalSpeed) * 0.0125;
 		ele->y += (ele->autumnFloat[1][ele->autumnAge[1]] * (float) globalSpeed) * 0.0125 + autumnSpeed;
@@ -225,39 +244,79 @@ elementMove (CompDisplay *display, element *ele, int ms)
 			ele->autumnAge[0] = 0;
 			ele->autumnChange = 1;
 		}
-
 	}
-	else if (ele->type == 1)
+}
+
+static void
+fireflyMove (const elementParams *p, elementPool *pool, int ms)
+{
+	float ffSpeed = p->ffSpeed;
+	float globalSpeed = p->globalSpeed * ms;
+	element *ele = pool->elements;
+	int i;
+
+	for (i = 0; i < pool->numElements; i++, ele++)
 	{
 	  	ele->age += 0.01;
 		ele->lifecycle = (ele->age / 10) / ele->lifespan * (ffSpeed * 70);
 		int glowStage = (ele->lifecycle * GLOW_STAGES);
-		ele->glowAlpha = bezierCurve(glowCurve[glowStage], ele->lifecycle, ele->type);
-		float xs = bezierCurve(ele->dx, ele->lifecycle, ele->type); 
-		float ys = bezierCurve(ele->dy, ele->lifecycle, ele->type); 
-		float zs = bezierCurve(ele->dz, ele->lifecycle, ele->type); 
+		const float *w = particlesBezierLookup (&bezierTable, ele->lifecycle);	//One lookup for the glow and all three axes
+		ele->glowAlpha = bezierCurve(glowCurve[glowStage], w);
+		float xs = bezierCurve(ele->dx, w);
+		float ys = bezierCurve(ele->dy, w);
+		float zs = bezierCurve(ele->dz, w);
 		ele->x += (float)(xs * (double)globalSpeed) * ffSpeed;
 		ele->y += (float)(ys * (double)globalSpeed) * ffSpeed;
 		ele->z += (float)(zs * (double)globalSpeed) * ffSpeed;
 	}
-	else if (ele->type == 2)
+}
+
+static void
+snowMove (const elementParams *p, elementPool *pool, int ms)
+{
+	float snowSpeed = p->snowSpeed;
+	element *ele = pool->elements;
+	int i;
+
+	for (i = 0; i < pool->numElements; i++, ele++)
 	{
 		ele->x += (ele->dx[0] * (float) ms) * snowSpeed;
 		ele->y += (ele->dy[0] * (float) ms) * snowSpeed;
 		ele->z += (ele->dz[0] * (float) ms) * snowSpeed;
 		ele->rAngle += ((float) ms) / (10.1f - ele->rSpeed);
 	}
-	else if (ele->type == 3)
+}
+
+static void
+starsMove (const elementParams *p, elementPool *pool, int ms)
+{
+	float starsSpeed = p->starsSpeed;
+	float globalSpeed = p->globalSpeed * ms;
+	float tmp = 1.0f / (100.0f - starsSpeed);
+	float speed = (tmp + 0.01) * 10;		//The speed curve of the stars is linear
+	element *ele = pool->elements;
+	int i;
+
+	for (i = 0; i < pool->numElements; i++, ele++)
 	{
-		float tmp = 1.0f / (100.0f - starsSpeed);
-		float xs = bezierCurve(ele->dx, tmp, ele->type); 
-		float ys = bezierCurve(ele->dy, tmp, ele->type); 
-		float zs = bezierCurve(ele->dz, tmp, ele->type); 
+		float xs = ele->dx[0] * speed;
+		float ys = ele->dy[0] * speed;
+		float zs = ele->dz[0] * speed;
 		ele->x += (float)(xs * (double)globalSpeed) * starsSpeed;
 		ele->y += (float)(ys * (double)globalSpeed) * starsSpeed;
 		ele->z += (float)(zs * (double)globalSpeed) * starsSpeed;
 	}
-	else if (ele->type == 4)
+}
+
+static void
+bubblesMove (const elementParams *p, elementPool *pool, int ms)
+{
+	float bubblesSpeed = p->bubblesSpeed;
+	float globalSpeed = p->globalSpeed * ms;
+	element *ele = pool->elements;
+	int i;
+
+	for (i = 0; i < pool->numElements; i++, ele++)
 	{
 		ele->x += (ele->autumnFloat[0][ele->autumnAge[0]] * (float) globalSpeed) * 0.125;
 		ele->y += (ele->dy[0] * (float) globalSpeed) * bubblesSpeed;
@@ -274,15 +333,62 @@ elementMove (CompDisplay *display, element *ele, int ms)
 			ele->autumnAge[0] = 0;
 			ele->autumnChange = 9;
 		}
-
 	}
-	else
+}
+
+static const elementMoveProc elementMoveProcs[NUM_ELEMENT_TYPES] = {
+	autumnMove, fireflyMove, snowMove, starsMove, bubblesMove
+};
+
+static int
+numElementsOfType (CompDisplay *d, int type)
+{
+	switch (type)
 	{
-		compLogMessage ("Elements", CompLogLevelWarn,
-			    "Not a valid element type");
+		case 0:
+			return elementsGetNumLeaves (d);
+		case 1:
+			return elementsGetNumFireflies (d);
+		case 2:
+			return elementsGetNumSnowflakes (d);
+		case 3:
+			return elementsGetNumStars (d);
+		case 4:
+			return elementsGetNumBubbles (d);
+		default:
+			return 0;
 	}
 }
 
+static void
+updateElementParams (CompScreen *s)
+{
+	CompDisplay *d = s->display;
+
+	E_SCREEN (s);
+
+	eScreen->params.globalSpeed = elementsGetGlobalSpeed (d);
+	eScreen->params.minZ = -((float) elementsGetScreenDepth (d) / 500.0);
+	eScreen->params.overWindows = elementsGetOverWindows (d);
+	eScreen->params.applyTransform = elementsGetApplyTransform (d);
+	eScreen->params.autumnSpeed = elementsGetAutumnSpeed (d) / 30.0f;
+	eScreen->params.ffSpeed = elementsGetFireflySpeed (d) / 700.0f;
+	eScreen->params.snowSpeed = elementsGetSnowSpeed (d) / 500.0f;
+	eScreen->params.starsSpeed = elementsGetStarsSpeed (d) / 500.0f;
+	eScreen->params.bubblesSpeed = (100.0 - elementsGetViscosity (d)) / 30.0f;
+	eScreen->params.rotate[0] = elementsGetAutumnRotate (d);
+	eScreen->params.rotate[1] = elementsGetFirefliesRotate (d);
+	eScreen->params.rotate[2] = elementsGetSnowRotate (d);
+	eScreen->params.rotate[3] = elementsGetStarsRotate (d);
+	eScreen->params.rotate[4] = elementsGetBubblesRotate (d);
+	eScreen->params.size[0] = elementsGetLeafSize (d);
+	eScreen->params.size[1] = elementsGetFireflySize (d);
+	eScreen->params.size[2] = elementsGetSnowSize (d);
+	eScreen->params.size[3] = elementsGetStarsSize (d);
+	eScreen->params.size[4] = elementsGetBubblesSize (d);
+	eScreen->params.updateDelay = elementsGetUpdateDelay (d);
+}
+
 static Bool
 isNormalWin (CompWindow *w)
 {
@@ -299,58 +405,203 @@ isNormalWin (CompWindow *w)
 }
 
 static Bool
-stepPositions(CompScreen *s, int elapsed)
+getElementBox (element *ele, CompOutput *output, float radius, BoxPtr box)	//Screen box covered by an element, drawn with the perspective of the output
 {
-	int i, numSnow, numAutumn, numStars, numFf, numBubbles, numTmp;
-	element *ele;
-	Bool onTopOfWindows;
-	Bool active = elementActive(s);
+	float cx, cy, k, x1, y1, x2, y2;
+	float d = DEFAULT_Z_CAMERA - ele->z;
+
+	if (d <= Z_NEAR)
+		return FALSE;
+
+	k  = DEFAULT_Z_CAMERA / d;
+	cx = output->region.extents.x1 + output->width / 2.0f;
+	cy = output->region.extents.y1 + output->height / 2.0f;
+
+	x1 = MAX (cx + (ele->x - radius - cx) * k - 1, output->region.extents.x1);	//A pixel of slack for rounding of the rasterizer
+	y1 = MAX (cy + (ele->y - radius - cy) * k - 1, output->region.extents.y1);
+	x2 = MIN (cx + (ele->x + radius - cx) * k + 1, output->region.extents.x2);
+	y2 = MIN (cy + (ele->y + radius - cy) * k + 1, output->region.extents.y2);
+
+	if (x1 >= x2 || y1 >= y2)
+		return FALSE;
+
+	box->x1 = floorf (x1);
+	box->y1 = floorf (y1);
+	box->x2 = ceilf (x2);
+	box->y2 = ceilf (y2);
+
+	return TRUE;
+}
+
+static void
+addElementDamage (screen *eScreen, element *ele, float size)
+{
+	CompScreen *s = eScreen->cScreen;
+	float aspect = 1.0f, radius;
+	int i;
+
+	if (!ele->eTex)
+		return;
+
+	aspect = (float) ele->eTex->height / ele->eTex->width;
+	radius = size * sqrtf (1.0f + aspect * aspect);		//The quad has a corner at the element and may be rotated about it
+
+	for (i = 0; i < s->nOutputDev; i++)
+	{
+		CompOutput *output = &s->outputDev[i];
+		BoxPtr tile;
+		BoxRec box;
+		int tx, ty;
+
+		if (!getElementBox (ele, output, radius, &box))
+			continue;
+
+		tx = ((box.x1 + box.x2) / 2 - output->region.extents.x1) * DAMAGE_TILES / MAX (output->width, 1);
+		ty = ((box.y1 + box.y2) / 2 - output->region.extents.y1) * DAMAGE_TILES / MAX (output->height, 1);
+		tx = MIN (MAX (tx, 0), DAMAGE_TILES - 1);
+		ty = MIN (MAX (ty, 0), DAMAGE_TILES - 1);
+
+		tile = &eScreen->damageTiles[(i * DAMAGE_TILES + ty) * DAMAGE_TILES + tx];
+		if (tile->x1 >= tile->x2)
+		{
+			*tile = box;
+		}
+		else
+		{
+			tile->x1 = MIN (tile->x1, box.x1);
+			tile->y1 = MIN (tile->y1, box.y1);
+			tile->x2 = MAX (tile->x2, box.x2);
+			tile->y2 = MAX (tile->y2, box.y2);
+		}
+	}
+}
+
+static void
+addAllElementsDamage (screen *eScreen)
+{
+	int t, i;
+
+	for (t = 0; t < NUM_ELEMENT_TYPES; t++)
+	{
+		elementPool *pool = &eScreen->pools[t];
+
+		for (i = 0; i < pool->numElements; i++)
+			addElementDamage (eScreen, &pool->elements[i], eScreen->params.size[t]);
+	}
+}
+
+static Bool
+clearDamageTiles (screen *eScreen)		//Returns FALSE if there is no memory for the tiles
+{
+	CompScreen *s = eScreen->cScreen;
+	int nTiles = s->nOutputDev * DAMAGE_TILES * DAMAGE_TILES;
+
+	if (nTiles > eScreen->nDamageTiles)
+	{
+		BoxPtr tiles = realloc (eScreen->damageTiles, nTiles * sizeof (BoxRec));
+
+		if (!tiles)
+			return FALSE;
+		eScreen->damageTiles = tiles;
+	}
+	eScreen->nDamageTiles = nTiles;
+
+	memset (eScreen->damageTiles, 0, nTiles * sizeof (BoxRec));
+
+	return TRUE;
+}
+
+static void
+damageElementTiles (screen *eScreen)
+{
+	CompScreen *s = eScreen->cScreen;
+	Region region;
+	int i;
+
+	region = XCreateRegion ();
+	if (!region)
+	{
+		damageScreen (s);
+		return;
+	}
+
+	for (i = 0; i < eScreen->nDamageTiles; i++)
+	{
+		BoxPtr tile = &eScreen->damageTiles[i];
+		XRectangle rect;
+
+		if (tile->x1 >= tile->x2)
+			continue;
+
+		rect.x = tile->x1;
+		rect.y = tile->y1;
+		rect.width = tile->x2 - tile->x1;
+		rect.height = tile->y2 - tile->y1;
+
+		XUnionRectWithRegion (&rect, region, region);
+	}
+
+	if (!eScreen->params.overWindows)		//Below windows the elements are only drawn on the desktop
+	{
+		Region desktop = XCreateRegion ();
+		CompWindow *w;
+
+		if (desktop)
+		{
+			for (w = s->windows; w; w = w->next)
+				if (w->type & CompWindowTypeDesktopMask)
+					XUnionRegion (desktop, w->region, desktop);
+
+			XIntersectRegion (region, desktop, region);
+			XDestroyRegion (desktop);
+		}
+	}
+
+	damageScreenRegion (s, region);
+	XDestroyRegion (region);
+}
+
+static Bool
+stepPositions (void *closure)
+{
+	CompScreen *s = closure;
+	int t;
+	Bool damageTiles;
 
 	E_SCREEN(s);
 
-	if (!active)
+	if (!elementActive(s))
 		return TRUE;
 
-	ele = eScreen->allElements;
+	damageTiles = clearDamageTiles (eScreen);
+	if (damageTiles)
+		addAllElementsDamage (eScreen);		//Damage where each element was drawn and where it will be drawn next
 
-	if (eScreen->isActive[0])
-		numAutumn = elementsGetNumLeaves (s->display);
-	else
-		numAutumn = 0;
-	if (eScreen->isActive[1])
-		numFf = elementsGetNumFireflies (s->display);
-	else
-		numFf = 0;
-	if (eScreen->isActive[2])
-		numSnow = elementsGetNumSnowflakes (s->display);
-	else
-		numSnow = 0;
-	if (eScreen->isActive[3])
-		numStars = elementsGetNumStars (s->display);
-	else
-		numStars = 0;
-	if (eScreen->isActive[4])
-		numBubbles = elementsGetNumBubbles (s->display);
-	else
-		numBubbles = 0;
+	for (t = 0; t < NUM_ELEMENT_TYPES; t++)
+	{
+		if (!eScreen->pools[t].numElements)
+			continue;
 
-	numTmp = numAutumn + numFf + numSnow + numStars + numBubbles;
-	onTopOfWindows = elementsGetOverWindows (s->display);
-	for (i = 0; i < numTmp; i++)
-		elementTestCreate(eScreen, ele++, elapsed);
-	if (active)
+		elementsRespawn (eScreen, t);
+		(*elementMoveProcs[t]) (&eScreen->params, &eScreen->pools[t], eScreen->params.updateDelay);
+	}
+
+	if (eScreen->params.overWindows)
 	{
 		CompWindow *w;
+
 		for (w = s->windows; w; w = w->next)
-		{
-			if (!onTopOfWindows && (w->type & CompWindowTypeDesktopMask))
-				addWindowDamage (w);
-			else if (onTopOfWindows && isNormalWin(w)) {
+			if (isNormalWin(w))
 				eScreen->topWindow = w;
-				addWindowDamage (w);
-			}
-		}
+	}
 
+	if (damageTiles)
+	{
+		addAllElementsDamage (eScreen);
+		damageElementTiles (eScreen);
+	}
+	else
+	{
 		damageScreen (s);
 	}
 
@@ -507,27 +758,44 @@ setupDisplayList (screen *eScreen)
 	glEndList ();
 }
 
-static void
-elementsPreparePaintScreen (CompScreen *s,
-                            int elapsed)
+static Bool
+ensureElementArrays (screen *eScreen)
 {
-	E_SCREEN (s);
+	GLfloat *vertices, *texCoords;
+	int t, num = 0;
 
-	if (elementActive(s))
-		stepPositions (s, elapsed);
+	for (t = 0; t < NUM_ELEMENT_TYPES; t++)
+		num += eScreen->pools[t].numElements;
 
-    UNWRAP (eScreen, s, preparePaintScreen);
-    (*s->preparePaintScreen) (s, elapsed);
-    WRAP (eScreen, s, preparePaintScreen, elementsPreparePaintScreen);
+	if (num <= eScreen->arraySize)
+		return TRUE;
+
+	vertices = realloc (eScreen->vertices, num * 12 * sizeof (GLfloat));
+	if (!vertices)
+		return FALSE;
+	eScreen->vertices = vertices;
+
+	texCoords = realloc (eScreen->texCoords, num * 8 * sizeof (GLfloat));
+	if (!texCoords)
+		return FALSE;
+	eScreen->texCoords = texCoords;
+
+	eScreen->arraySize = num;
+
+	return TRUE;
 }
 
 static void
 beginRendering (CompScreen *s)
 {
-	int j;
+	int t, i, n = 0;
+	const Bool *rotate;
 
 	E_SCREEN (s);
 
+	if (!eScreen->atlas.nLoaded || !ensureElementArrays (eScreen))
+		return;
+
 	glEnable (GL_BLEND);
 	glTexEnvf (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 
@@ -537,74 +805,39 @@ beginRendering (CompScreen *s)
 		eScreen->needUpdate = FALSE;
 	}
 
-	glColor4f (1.0, 1.0, 1.0, 1.0);
-	for (j = 0; j < eScreen->numElements; j++)
+	rotate = eScreen->params.rotate;
+
+	for (t = 0; t < NUM_ELEMENT_TYPES; t++)		//All textures are in one atlas, so every element is drawn with a single call
+	{
+		elementPool *pool = &eScreen->pools[t];
+		element *ele = pool->elements;
+		float size = eScreen->params.size[t];
+
+		for (i = 0; i < pool->numElements; i++, ele++)
 		{
-			element *ele = eScreen->allElements;
-			int i, numAutumn, numFf, numSnow, numStars, numBubbles;
-			if (eScreen->isActive[0])
-				numAutumn = elementsGetNumLeaves (s->display);
-			else
-				numAutumn = 0;
-			if (eScreen->isActive[1])
-				numFf = elementsGetNumFireflies (s->display);
-			else
-				numFf = 0;
-			if (eScreen->isActive[2])
-				numSnow = elementsGetNumSnowflakes (s->display);
-			else
-				numSnow = 0;
-			if (eScreen->isActive[3])
-				numStars = elementsGetNumStars (s->display);
-			else
-				numStars = 0;
-			if (eScreen->isActive[4])
-				numBubbles = elementsGetNumBubbles (s->display);
-			else
-				numBubbles = 0;
-
-			int numTmp = numAutumn + numFf + numSnow + numStars + numBubbles;
-			Bool autumnRotate = elementsGetAutumnRotate (s->display);
-			Bool snowRotate = elementsGetSnowRotate (s->display);
-			Bool ffRotate = elementsGetFirefliesRotate (s->display);
-			Bool starsRotate = elementsGetStarsRotate (s->display);
-			Bool bubblesRotate = elementsGetBubblesRotate (s->display);
-
-			enableTexture (eScreen->cScreen, &eScreen->textu[j].tex,
-			   COMP_TEXTURE_FILTER_GOOD);
-
-			for (i = 0; i < numTmp; i++)
-			{
-				if (ele->eTex == &eScreen->textu[j])
-				{
-					glTranslatef (ele->x, ele->y, ele->z);
-					if (autumnRotate && ele->type == 0)
-						glRotatef (ele->rAngle, 0, 0, 1);
-					if (ffRotate && ele->type == 1)
-						glRotatef (ele->rAngle, 0, 0, 1);
-					if (snowRotate && ele->type == 2)
-						glRotatef (ele->rAngle, 0, 0, 1);
-					if (starsRotate && ele->type == 3)
-						glRotatef (ele->rAngle, 0, 0, 1);
-					if (bubblesRotate && ele->type == 4)
-						glRotatef (ele->rAngle, 0, 0, 1);
-					glCallList (eScreen->textu[j].dList);
-					if (autumnRotate && ele->type == 0)
-						glRotatef (-ele->rAngle, 0, 0, 1);
-					if (ffRotate && ele->type == 1)
-						glRotatef (-ele->rAngle, 0, 0, 1);
-					if (snowRotate && ele->type == 2)
-						glRotatef (-ele->rAngle, 0, 0, 1);
-					if (starsRotate && ele->type == 3)
-						glRotatef (-ele->rAngle, 0, 0, 1);
-					if (bubblesRotate && ele->type == 4)
-						glRotatef (-ele->rAngle, 0, 0, 1);
-					glTranslatef (-ele->x, -ele->y, -ele->z);
-				}
-				ele++;
-			}
-			disableTexture (eScreen->cScreen, &eScreen->textu[j].tex);
+			SpriteAtlasSprite *sprite = ele->eTex;
+
+			if (!sprite)
+				continue;
+
+			spriteQuad (eScreen->vertices + n * 12, ele->x, ele->y, ele->z,
+				    size, size * sprite->height / sprite->width,
+				    rotate[t] ? ele->rAngle : 0.0f);
+			memcpy (eScreen->texCoords + n * 8, sprite->texCoords,
+				sizeof (sprite->texCoords));
+			n++;
+		}
 	}
+
+	glColor4f (1.0, 1.0, 1.0, 1.0);
+	glVertexPointer (3, GL_FLOAT, 0, eScreen->vertices);
+	glTexCoordPointer (2, GL_FLOAT, 0, eScreen->texCoords);
+
+	enableTexture (eScreen->cScreen, &eScreen->atlas.texture,
+		       COMP_TEXTURE_FILTER_GOOD);
+	glDrawArrays (GL_QUADS, 0, n * 4);
+	disableTexture (eScreen->cScreen, &eScreen->atlas.texture);
+
 	glTexEnvf (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 	glDisable (GL_BLEND);
 	glBlendFunc (GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
@@ -619,7 +852,6 @@ elementsPaintOutput (CompScreen              *s,
 		 CompOutput              *output,
 		 unsigned int            mask)
 {
-	CompDisplay *d = s->display;
 	Bool status;
 	Bool active = elementActive(s);
 
@@ -629,10 +861,10 @@ elementsPaintOutput (CompScreen              *s,
 	status = (*s->paintOutput) (s, sa, transform, region, output, mask);
 	WRAP (eScreen, s, paintOutput, elementsPaintOutput);
 
-	if(elementsGetApplyTransform (d))
+	if(eScreen->params.applyTransform)
 		return status;
 
-	if (active && elementsGetOverWindows (d))
+	if (active && eScreen->params.overWindows)
 	{
 		CompTransform sTransform = *transform;
 		transformToScreenSpace (s, output, -DEFAULT_Z_CAMERA, &sTransform);
@@ -653,15 +885,14 @@ elementsDrawWindow (CompWindow           *w,
 		unsigned int         mask)
 {
 	CompScreen *s = w->screen;
-	CompDisplay *d = s->display;
 	Bool active = elementActive(s);
 	Bool status = FALSE;
 
 	E_SCREEN (s);
 
 	if (active) {
-		Bool applyTransform = elementsGetApplyTransform (d);
-		Bool onTop = elementsGetOverWindows (d);
+		Bool applyTransform = eScreen->params.applyTransform;
+		Bool onTop = eScreen->params.overWindows;
 		Bool isDesktop = (w->type & CompWindowTypeDesktopMask) && !onTop;
 		Bool isTopMost = w && (w == eScreen->topWindow) && onTop;
 
@@ -689,26 +920,14 @@ elementsDrawWindow (CompWindow           *w,
 	return status;
 }
 
-static void
-elementsDonePaintScreen (CompScreen *s)
-{
-	E_SCREEN (s);
-
-	if (elementActive(s))
-		damageScreen (s);
-
-	UNWRAP (eScreen, s, donePaintScreen);
-	(*s->donePaintScreen) (s);
-	WRAP (eScreen, s, donePaintScreen, elementsDonePaintScreen);
-}
-
 static void
 initiateElement (screen *eScreen,
+		   int      type,
 		   element  *ele)
 {
 	int i, iii;
 
-	if (ele->type == 4)
+	if (type == 4)
 	{
 		float temp = mmRand(elementsGetViscosity( eScreen->cScreen->display)/2.0,elementsGetViscosity( eScreen->cScreen->display),50.0);
 		float xSway = 1.0 - temp*temp * 1.0 / 4.0;
@@ -725,7 +944,7 @@ initiateElement (screen *eScreen,
 		ele->y = mmRand (eScreen->cScreen->height+100, eScreen->cScreen->height+ BIG_NUMBER,1);
 		ele->dy[0] = mmRand (-2, -1, 5);
 	}
-	if (ele->type == 0)
+	if (type == 0)
 	{
 		float xSway = mmRand(elementsGetAutumnSway( eScreen->cScreen->display)/2,elementsGetAutumnSway( eScreen->cScreen->display),2.0);
 		float ySway = elementsGetAutumnSpeed(eScreen->cScreen->display) / 20.0;
@@ -752,7 +971,7 @@ initiateElement (screen *eScreen,
 
 
 
-	if (ele->type == 2)
+	if (type == 2)
 	{
 		int snowSway = elementsGetSnowSway (eScreen->cScreen->display);
 		switch (elementsGetWindDirection (eScreen->cScreen->display))
@@ -791,7 +1010,7 @@ initiateElement (screen *eScreen,
 	ele->rAngle = mmRand (-1000, 1000, 50);
 	ele->rSpeed = mmRand (-2100, 2100, 700);
 
-	if (ele->type == 1)
+	if (type == 1)
 	{
 		ele->x = mmRand(0, eScreen->cScreen->width, 1);
 		ele->y = mmRand(0, eScreen->cScreen->height, 1);
@@ -804,7 +1023,7 @@ initiateElement (screen *eScreen,
 			ele->dz[i] = mmRand(-1000, 1000, 500000);
 		}
 	}
-	if (ele->type == 3)
+	if (type == 3)
 	{
 	   	float init;
 		ele->dx[0] = mmRand(-50000, 50000, 5000);
@@ -821,321 +1040,74 @@ initiateElement (screen *eScreen,
 
 static void
 setElementTexture (screen *eScreen,
+		     int      type,
 		     element  *ele)
 {
-	if (eScreen->numTexLoaded[0] && ele->type == 0)
-		ele->eTex = &eScreen->textu[rand () % eScreen->numTexLoaded[0]];
-	else if (eScreen->numTexLoaded[1] && ele->type == 1)
-		ele->eTex = &eScreen->textu[eScreen->numTexLoaded[0] + (rand () % eScreen->numTexLoaded[1])];
-	else if (eScreen->numTexLoaded[2] && ele->type == 2)
-		ele->eTex = &eScreen->textu[eScreen->numTexLoaded[0] + eScreen->numTexLoaded[1] + (rand () % eScreen->numTexLoaded[2])];
-	else if (eScreen->numTexLoaded[3] && ele->type == 3)
-		ele->eTex = &eScreen->textu[eScreen->numTexLoaded[0] + eScreen->numTexLoaded[1] + eScreen->numTexLoaded[2] + (rand () % eScreen->numTexLoaded[3])];
-	else if (eScreen->numTexLoaded[4] && ele->type == 4)
-		ele->eTex = &eScreen->textu[eScreen->numTexLoaded[0] + eScreen->numTexLoaded[1] + eScreen->numTexLoaded[2] + eScreen->numTexLoaded[3] + (rand () % eScreen->numTexLoaded[4])];
+	if (eScreen->numTexLoaded[type])
+		ele->eTex = spriteAtlasGetLoaded (&eScreen->atlas, eScreen->firstTex[type],
+						  eScreen->firstTex[type + 1] - eScreen->firstTex[type],
+						  rand () % eScreen->numTexLoaded[type]);
 	else
 		ele->eTex = NULL;
-	
 }
 
 static void
-updateElementTextures (CompScreen *s, Bool changeTextures)
+elementTexturesLoaded (CompScreen *s)		//Gives every element a texture of the new atlas, which holds the files of all types in order
 {
-	int       i, count = 0;
-	float     autumnSize = elementsGetLeafSize(s->display);
-	float     ffSize = elementsGetFireflySize(s->display);
-	float     snowSize = elementsGetSnowSize(s->display);
-	float     starsSize = elementsGetStarsSize(s->display);
-	float     bubblesSize = elementsGetBubblesSize(s->display);
-	element *ele;
+	int i, t, numFiles = 0;
 
 	E_SCREEN (s);
 	E_DISPLAY (s->display);
-	int numAutumn, numFf, numSnow, numStars, numBubbles;
 
-	if (eScreen->isActive[0])
-		numAutumn = elementsGetNumLeaves (s->display);
-	else
-		numAutumn = 0;
-	if (eScreen->isActive[1])
-		numFf = elementsGetNumFireflies (s->display);
-	else
-		numFf = 0;
-	if (eScreen->isActive[2])
-		numSnow = elementsGetNumSnowflakes (s->display);
-	else
-		numSnow = 0;
-	if (eScreen->isActive[3])
-		numStars = elementsGetNumStars (s->display);
-	else
-		numStars = 0;
-	if (eScreen->isActive[4])
-		numBubbles = elementsGetNumBubbles (s->display);
-	else
-		numBubbles = 0;
-	ele = eScreen->allElements;
-	if (changeTextures)
+	for (t = 0; t < NUM_ELEMENT_TYPES; t++)
 	{
-	for (i = 0; i < eScreen->numElements; i++)
-	{
-		finiTexture (s, &eScreen->textu[i].tex);
-		glDeleteLists (eScreen->textu[i].dList, 1);
+		eScreen->firstTex[t] = numFiles;
+		numFiles += ed->numTex[t];
 	}
+	eScreen->firstTex[NUM_ELEMENT_TYPES] = numFiles;
 
-	if (eScreen->textu)
-		free (eScreen->textu);
-	eScreen->numElements = 0;
-	eScreen->numTexLoaded[0] = 0;
-	eScreen->numTexLoaded[1] = 0;
-	eScreen->numTexLoaded[2] = 0;
-	eScreen->numTexLoaded[3] = 0;
-	eScreen->numTexLoaded[4] = 0;
-	eScreen->textu = calloc (1, sizeof (texture) * (ed->numTex[0] + ed->numTex[1] + ed->numTex[2] + ed->numTex[3] + ed->numTex[4]));
-	}
-	for (i = 0; i < ed->numTex[0]; i++)
-	{
-		CompMatrix  *mat;
-		texture *aTex;
-	if (changeTextures)
-	{
-		eScreen->textu[count].loaded =
-		    readImageToTexture (s, &eScreen->textu[count].tex,
-					ed->texFiles[0][i].s,
-					&eScreen->textu[count].width,
-					&eScreen->textu[count].height);
-		if (!eScreen->textu[count].loaded)
-		{
-		    compLogMessage ("Elements", CompLogLevelWarn,
-			    "Texture (Autumn) not found : %s", ed->texFiles[0][i].s);
-		    continue;
-		}
-		compLogMessage ("Elements", CompLogLevelInfo,
-			"Loaded Texture (Autumn)%s", ed->texFiles[0][i].s);
-		}
-		mat = &eScreen->textu[count].tex.matrix;
-		aTex = &eScreen->textu[count];
-		aTex->dList = glGenLists (1);
-		glNewList (aTex->dList, GL_COMPILE);
-
-		glBegin (GL_QUADS);
-
-		glTexCoord2f (COMP_TEX_COORD_X (mat, 0), COMP_TEX_COORD_Y (mat, 0));
-		glVertex2f (0, 0);
-		glTexCoord2f (COMP_TEX_COORD_X (mat, 0),
-			      COMP_TEX_COORD_Y (mat, aTex->height));
-		glVertex2f (0, autumnSize * aTex->height / aTex->width);
-		glTexCoord2f (COMP_TEX_COORD_X (mat, aTex->width),
-			      COMP_TEX_COORD_Y (mat, aTex->height));
-		glVertex2f (autumnSize, autumnSize * aTex->height / aTex->width);
-		glTexCoord2f (COMP_TEX_COORD_X (mat, aTex->width),
-			      COMP_TEX_COORD_Y (mat, 0));
-		glVertex2f (autumnSize, 0);
-
-		glEnd ();
-		glEndList ();
-
-		count++;
-	}
-	if (changeTextures)
-		eScreen->numTexLoaded[0] = count;
-	for (i = 0; i < ed->numTex[1]; i++)
-	{
-		CompMatrix  *mat;
-		texture *aTex;
-		if (changeTextures)
-		{
-		eScreen->textu[count].loaded =
-		readImageToTexture (s, &eScreen->textu[count].tex,
-				ed->texFiles[1][i].s,
-				&eScreen->textu[count].width,
-				&eScreen->textu[count].height);
-		if (!eScreen->textu[count].loaded)
-		{
-		    compLogMessage ("Elements", CompLogLevelWarn,
-			    "Texture (Firefly) not found : %s", ed->texFiles[1][i].s);
-		    continue;
-		}
-		compLogMessage ("Elements", CompLogLevelInfo,
-			"Loaded Texture (Firefly) %s", ed->texFiles[1][i].s);
-		}
-		mat = &eScreen->textu[count].tex.matrix;
-		aTex = &eScreen->textu[count];
-
-		aTex->dList = glGenLists (1);
-		glNewList (aTex->dList, GL_COMPILE);
-
-		glBegin (GL_QUADS);
-
-		glTexCoord2f (COMP_TEX_COORD_X (mat, 0), COMP_TEX_COORD_Y (mat, 0));
-		glVertex2f (0, 0);
-		glTexCoord2f (COMP_TEX_COORD_X (mat, 0),
-		      COMP_TEX_COORD_Y (mat, aTex->height));
-		glVertex2f (0, ffSize * aTex->height / aTex->width);
-		glTexCoord2f (COMP_TEX_COORD_X (mat, aTex->width),
-			      COMP_TEX_COORD_Y (mat, aTex->height));
-		glVertex2f (ffSize, ffSize * aTex->height / aTex->width);
-		glTexCoord2f (COMP_TEX_COORD_X (mat, aTex->width),
-			      COMP_TEX_COORD_Y (mat, 0));
-		glVertex2f (ffSize, 0);
-
-		glEnd ();
-		glEndList ();
-
-		count++;
-	}
-	if (changeTextures)
-	eScreen->numTexLoaded[1] = count - eScreen->numTexLoaded[0];
-	for (i = 0; i < ed->numTex[2]; i++)
+	for (t = 0; t < NUM_ELEMENT_TYPES; t++)
 	{
-		CompMatrix  *mat;
-		texture *aTex;
-	if (changeTextures)
-	{
-		eScreen->textu[count].loaded =
-		readImageToTexture (s, &eScreen->textu[count].tex,
-				ed->texFiles[2][i].s,
-				&eScreen->textu[count].width,
-				&eScreen->textu[count].height);
-		if (!eScreen->textu[count].loaded)
-		{
-			compLogMessage ("Elements", CompLogLevelWarn,
-			    "Texture (snow) not found : %s", ed->texFiles[2][i].s);
-			continue;
-		}
-		compLogMessage ("Elements", CompLogLevelInfo,
-			"Loaded Texture (snow) %s", ed->texFiles[2][i].s);
-	}
-		mat = &eScreen->textu[count].tex.matrix;
-		aTex = &eScreen->textu[count];
-
-		aTex->dList = glGenLists (1);
-		glNewList (aTex->dList, GL_COMPILE);
-
-		glBegin (GL_QUADS);
-
-		glTexCoord2f (COMP_TEX_COORD_X (mat, 0), COMP_TEX_COORD_Y (mat, 0));
-		glVertex2f (0, 0);
-		glTexCoord2f (COMP_TEX_COORD_X (mat, 0),
-		      COMP_TEX_COORD_Y (mat, aTex->height));
-		glVertex2f (0, snowSize * aTex->height / aTex->width);
-		glTexCoord2f (COMP_TEX_COORD_X (mat, aTex->width),
-		      COMP_TEX_COORD_Y (mat, aTex->height));
-		glVertex2f (snowSize, snowSize * aTex->height / aTex->width);
-		glTexCoord2f (COMP_TEX_COORD_X (mat, aTex->width),
-		      COMP_TEX_COORD_Y (mat, 0));
-		glVertex2f (snowSize, 0);
-
-		glEnd ();
-		glEndList ();
-
-		count++;
+		elementPool *pool = &eScreen->pools[t];
+
+		eScreen->numTexLoaded[t] = spriteAtlasCountLoaded (&eScreen->atlas, eScreen->firstTex[t],
+								   ed->numTex[t]);
+
+		for (i = 0; i < pool->numElements; i++)
+			setElementTexture (eScreen, t, &pool->elements[i]);
 	}
-	if (changeTextures)
-	eScreen->numTexLoaded[2] = count - eScreen->numTexLoaded[0] -eScreen->numTexLoaded[1];
-	for (i = 0; i < ed->numTex[3]; i++)
-	{
-		CompMatrix  *mat;
-		texture *aTex;
-	if (changeTextures)
+
+	damageScreen (s);
+}
+
+static void
+updateElementTextures (CompScreen *s)		//Loads the textures of all types into the atlas, elementTexturesLoaded is called once they are uploaded
+{
+	CompOptionValue *files;
+	int t, numFiles = 0;
+
+	E_SCREEN (s);
+	E_DISPLAY (s->display);
+
+	for (t = 0; t < NUM_ELEMENT_TYPES; t++)
+		numFiles += ed->numTex[t];
+
+	files = malloc (MAX (numFiles, 1) * sizeof (CompOptionValue));
+	if (!files)
 	{
-		eScreen->textu[count].loaded =
-		readImageToTexture (s, &eScreen->textu[count].tex,
-				ed->texFiles[3][i].s,
-				&eScreen->textu[count].width,
-				&eScreen->textu[count].height);
-		if (!eScreen->textu[count].loaded)
-		{
-			compLogMessage ("Elements", CompLogLevelWarn,
-			    "Texture (stars) not found : %s", ed->texFiles[3][i].s);
-			continue;
-		}
-		compLogMessage ("Elements", CompLogLevelInfo,
-			"Loaded Texture (stars)%s", ed->texFiles[3][i].s);
-	}
-		mat = &eScreen->textu[count].tex.matrix;
-		aTex = &eScreen->textu[count];
-
-		aTex->dList = glGenLists (1);
-		glNewList (aTex->dList, GL_COMPILE);
-
-		glBegin (GL_QUADS);
-
-		glTexCoord2f (COMP_TEX_COORD_X (mat, 0), COMP_TEX_COORD_Y (mat, 0));
-		glVertex2f (0, 0);
-		glTexCoord2f (COMP_TEX_COORD_X (mat, 0),
-		      COMP_TEX_COORD_Y (mat, aTex->height));
-		glVertex2f (0, starsSize * aTex->height / aTex->width);
-		glTexCoord2f (COMP_TEX_COORD_X (mat, aTex->width),
-		      COMP_TEX_COORD_Y (mat, aTex->height));
-		glVertex2f (starsSize, starsSize * aTex->height / aTex->width);
-		glTexCoord2f (COMP_TEX_COORD_X (mat, aTex->width),
-		      COMP_TEX_COORD_Y (mat, 0));
-		glVertex2f (starsSize, 0);
-
-		glEnd ();
-		glEndList ();
-
-		count++;
+		compLogMessage ("Elements", CompLogLevelError, "Not enough memory to load the textures");
+		return;
 	}
-	if (changeTextures)
-	eScreen->numTexLoaded[3] = count - eScreen->numTexLoaded[0] - eScreen->numTexLoaded[1] - eScreen->numTexLoaded[2];
-	for (i = 0; i < ed->numTex[4]; i++)
-	{
-		CompMatrix  *mat;
-		texture *aTex;
-	if (changeTextures)
+
+	for (t = 0, numFiles = 0; t < NUM_ELEMENT_TYPES; t++)
 	{
-		eScreen->textu[count].loaded =
-		readImageToTexture (s, &eScreen->textu[count].tex,
-				ed->texFiles[4][i].s,
-				&eScreen->textu[count].width,
-				&eScreen->textu[count].height);
-		if (!eScreen->textu[count].loaded)
-		{
-			compLogMessage ("Elements", CompLogLevelWarn,
-			    "Texture (bubbles) not found : %s", ed->texFiles[4][i].s);
-			continue;
-		}
-		compLogMessage ("Elements", CompLogLevelInfo,
-			"Loaded Texture (bubbles)%s", ed->texFiles[4][i].s);
+		memcpy (files + numFiles, ed->texFiles[t],
+			ed->numTex[t] * sizeof (CompOptionValue));
+		numFiles += ed->numTex[t];
 	}
-		mat = &eScreen->textu[count].tex.matrix;
-		aTex = &eScreen->textu[count];
-
-		aTex->dList = glGenLists (1);
-		glNewList (aTex->dList, GL_COMPILE);
-
-		glBegin (GL_QUADS);
-
-		glTexCoord2f (COMP_TEX_COORD_X (mat, 0), COMP_TEX_COORD_Y (mat, 0));
-		glVertex2f (0, 0);
-		glTexCoord2f (COMP_TEX_COORD_X (mat, 0),
-		      COMP_TEX_COORD_Y (mat, aTex->height));
-		glVertex2f (0, bubblesSize * aTex->height / aTex->width);
-		glTexCoord2f (COMP_TEX_COORD_X (mat, aTex->width),
-		      COMP_TEX_COORD_Y (mat, aTex->height));
-		glVertex2f (bubblesSize, bubblesSize * aTex->height / aTex->width);
-		glTexCoord2f (COMP_TEX_COORD_X (mat, aTex->width),
-		      COMP_TEX_COORD_Y (mat, 0));
-		glVertex2f (bubblesSize, 0);
-
-		glEnd ();
-		glEndList ();
-
-		count++;
-	}
-	if (changeTextures)
-	{
-	eScreen->numTexLoaded[4] = count - eScreen->numTexLoaded[0] - eScreen->numTexLoaded[1] - eScreen->numTexLoaded[2] - eScreen->numTexLoaded[3];
-
-//	if (count < (ed->numTex[0] + ed->numTex[1] + ed->numTex[2] + ed->numTex[3] + ed->numTex[4]))
-		eScreen->textu = realloc (eScreen->textu, sizeof (texture) * count);
-
-	eScreen->numElements = count;
 
-	for (i = 0; i < (numAutumn + numFf + numSnow + numStars + numBubbles); i++)
-		setElementTexture (eScreen, ele++);
-	}
+	spriteAtlasLoad (&eScreen->atlas, files, numFiles);
+	free (files);
 }
 
 static Bool
@@ -1148,11 +1120,14 @@ elementsInitScreen (CompPlugin *p,
 	eScreen = calloc (1, sizeof(screen));
 	s->base.privates[ed->privateIndex].ptr = eScreen;
 	eScreen->cScreen = s;
-	eScreen->numElements = 0;
-	eScreen->textu = NULL;
+	spriteAtlasInit (s, &eScreen->atlas, "Elements", elementTexturesLoaded);
+	eScreen->vertices = NULL;
+	eScreen->texCoords = NULL;
+	eScreen->arraySize = 0;
 	eScreen->needUpdate = FALSE;
 	eScreen->useKeys = elementsGetToggle (s->display);
 	eScreen->topWindow = NULL;
+	updateElementParams (s);
 
 	if (!eScreen->useKeys)
 	{
@@ -1172,13 +1147,15 @@ elementsInitScreen (CompPlugin *p,
 	}
 
 	createAll( s->display);
-	updateElementTextures (s, TRUE);
+	updateElementTextures (s);
 	setupDisplayList (eScreen);
-	WRAP (eScreen, s, preparePaintScreen, elementsPreparePaintScreen);
-	WRAP (eScreen, s, donePaintScreen, elementsDonePaintScreen);
 	WRAP (eScreen, s, paintOutput, elementsPaintOutput);
 	WRAP (eScreen, s, drawWindow, elementsDrawWindow);
 
+	eScreen->timeoutHandle = compAddTimeout (eScreen->params.updateDelay,
+						 (float) eScreen->params.updateDelay * 1.2,
+						 stepPositions, s);
+
 	return TRUE;
 }
 
@@ -1190,17 +1167,23 @@ elementsFiniScreen (CompPlugin *p,
 
 	E_SCREEN (s);
 
-	for (i = 0; i < eScreen->numElements; i++)
-	{
-		finiTexture (s, &eScreen->textu[i].tex);
-		glDeleteLists (eScreen->textu[i].dList, 1);
-	}
+	spriteAtlasFini (s, &eScreen->atlas);
+
+	if (eScreen->vertices)
+		free (eScreen->vertices);
+	if (eScreen->texCoords)
+		free (eScreen->texCoords);
 
-	if (eScreen->textu)
-		free (eScreen->textu);
+	for (i = 0; i < NUM_ELEMENT_TYPES; i++)
+		if (eScreen->pools[i].elements)
+			free (eScreen->pools[i].elements);
+
+	if (eScreen->damageTiles)
+		free (eScreen->damageTiles);
+
+	if (eScreen->timeoutHandle)
+		compRemoveTimeout (eScreen->timeoutHandle);
 
-	UNWRAP (eScreen, s, preparePaintScreen);
-	UNWRAP (eScreen, s, donePaintScreen);
 	UNWRAP (eScreen, s, paintOutput);
 	UNWRAP (eScreen, s, drawWindow);
 	free (eScreen);
@@ -1210,72 +1193,39 @@ static void
 createAll( CompDisplay *d )
 {
 	CompScreen *s;
-	int  i, ii, iii, iv ,v, numAutumn, numFf, numSnow, numStars, numBubbles, numTmp;
-	element  *ele;
+	int  i, t;
 
 	for (s = d->screens; s; s = s->next)
 	{
 		E_SCREEN (s);
-		if (eScreen->isActive[0])
-			numAutumn = elementsGetNumLeaves (s->display);
-		else
-			numAutumn = 0;
-		if (eScreen->isActive[1])
-			numFf = elementsGetNumFireflies (s->display);
-		else
-			numFf = 0;
-		if (eScreen->isActive[2])
-			numSnow = elementsGetNumSnowflakes (s->display);
-		else
-			numSnow = 0;
-		if (eScreen->isActive[3])
-			numStars = elementsGetNumStars (s->display);
-		else
-			numStars = 0;
-		if (eScreen->isActive[4])
-			numBubbles = elementsGetNumBubbles (s->display);
-		else
-			numBubbles = 0;
+		for (t = 0; t < NUM_ELEMENT_TYPES; t++)
+		{
+			elementPool *pool = &eScreen->pools[t];
+			int num = 0;
 
-		numTmp = (numAutumn + numFf + numSnow + numStars + numBubbles);
-		eScreen->allElements = ele = realloc (eScreen->allElements,
-				 numTmp * sizeof (element));
-		ele = eScreen->allElements;
+			if (eScreen->isActive[t])
+				num = numElementsOfType (d, t);
 
-		for (i = 0; i < numAutumn; i++)
-		{
-			ele->type = 0;
-			initiateElement (eScreen, ele);
-				setElementTexture (eScreen, ele);
-			ele++;
-		}
-		for (ii = 0; ii < numFf; ii++)
-		{
-			ele->type = 1;
-			initiateElement (eScreen, ele);
-			setElementTexture (eScreen, ele);
-			ele++;
-		}
-		for (iii = 0; iii < numSnow; iii++)
-		{
-			ele->type = 2;
-			initiateElement (eScreen, ele);
-			setElementTexture (eScreen, ele);
-			ele++;
-		}
-		for (iv = 0; iv < numStars; iv++)
-		{
-			ele->type = 3;
-			initiateElement (eScreen, ele);
-			setElementTexture (eScreen, ele);
-			ele++;
-		}
-		for (v = 0; v < numBubbles; v++)
-		{
-			ele->type = 4;
-			initiateElement (eScreen, ele);
-			setElementTexture (eScreen, ele);
-			ele++;
+			if (num != pool->numElements)
+			{
+				element *ele = realloc (pool->elements,
+							num * sizeof (element));
+				if (num && !ele)
+				{
+					compLogMessage ("Elements", CompLogLevelError,
+							"Not enough memory for %d elements", num);
+					num = 0;
+				}
+				else
+					pool->elements = ele;
+				pool->numElements = num;
+			}
+
+			for (i = 0; i < num; i++)
+			{
+				initiateElement (eScreen, t, &pool->elements[i]);
+				setElementTexture (eScreen, t, &pool->elements[i]);
+			}
 		}
 	}
 }
@@ -1285,7 +1235,16 @@ elementsDisplayOptionChanged (CompDisplay        *d,
 			  CompOption         *opt,
 			  ElementsDisplayOptions num)
 {
+	CompScreen *screens;
+
 	E_DISPLAY (d);
+
+	for (screens = d->screens; screens; screens = screens->next)
+	{
+		updateElementParams (screens);
+		damageScreen (screens);		//Steps only damage where the elements are now, not what they looked like before
+	}
+
 	switch (num)
 	{
 		case ElementsDisplayOptionToggleAutumnCheck:
@@ -1412,7 +1371,6 @@ elementsDisplayOptionChanged (CompDisplay        *d,
 			{
 				E_SCREEN (s);
 				eScreen->needUpdate = TRUE;
-				updateElementTextures (s, FALSE);
 			}
 		}
 		break;
@@ -1424,7 +1382,6 @@ elementsDisplayOptionChanged (CompDisplay        *d,
 			{
 				E_SCREEN (s);
 				eScreen->needUpdate = TRUE;
-				updateElementTextures (s, FALSE);
 			}
 		}
 
@@ -1437,7 +1394,6 @@ elementsDisplayOptionChanged (CompDisplay        *d,
 			{
 				E_SCREEN (s);
 				eScreen->needUpdate = TRUE;
-				updateElementTextures (s, FALSE);
 			}
 		}
 		break;
@@ -1454,7 +1410,6 @@ elementsDisplayOptionChanged (CompDisplay        *d,
 			{
 				E_SCREEN (s);
 				eScreen->needUpdate = TRUE;
-				updateElementTextures (s, FALSE);
 			}
 		}
 		break;
@@ -1465,7 +1420,6 @@ elementsDisplayOptionChanged (CompDisplay        *d,
 			{
 				E_SCREEN (s);
 				eScreen->needUpdate = TRUE;
-				updateElementTextures (s, FALSE);
 			}
 		}
 		break;
@@ -1508,7 +1462,7 @@ elementsDisplayOptionChanged (CompDisplay        *d,
 			ed->texFiles[0] = texAutOpt->value.list.value;
 			ed->numTex[0] = texAutOpt->value.list.nValue;
 			for (s = d->screens; s; s = s->next)
-				updateElementTextures (s, TRUE);
+				updateElementTextures (s);
 		}
 		break;
 		case ElementsDisplayOptionBubblesTextures:
@@ -1519,7 +1473,7 @@ elementsDisplayOptionChanged (CompDisplay        *d,
 			ed->texFiles[4] = texBubblesOpt->value.list.value;
 			ed->numTex[4] = texBubblesOpt->value.list.nValue;
 			for (s = d->screens; s; s = s->next)
-				updateElementTextures (s, TRUE);
+				updateElementTextures (s);
 		}
 		break;
 		case ElementsDisplayOptionFirefliesTextures:
@@ -1533,7 +1487,7 @@ elementsDisplayOptionChanged (CompDisplay        *d,
 			ed->numTex[1] = texFfOpt->value.list.nValue;
 
 			for (s = d->screens; s; s = s->next)
-				updateElementTextures (s, TRUE);
+				updateElementTextures (s);
 		}
 		break;
 		case ElementsDisplayOptionSnowTextures:
@@ -1547,7 +1501,7 @@ elementsDisplayOptionChanged (CompDisplay        *d,
 			ed->numTex[2] = texSnowOpt->value.list.nValue;
 
 			for (s = d->screens; s; s = s->next)
-				updateElementTextures (s, TRUE);
+				updateElementTextures (s);
 		}
 		break;
 		case ElementsDisplayOptionStarsTextures:
@@ -1560,8 +1514,24 @@ elementsDisplayOptionChanged (CompDisplay        *d,
 			ed->numTex[3] = texStarsOpt->value.list.nValue;
 
 			for (s = d->screens; s; s = s->next)
-				updateElementTextures (s, TRUE);
+				updateElementTextures (s);
+
+		}
+		break;
+		case ElementsDisplayOptionUpdateDelay:
+		{
+			CompScreen *s;
+
+			for (s = d->screens; s; s = s->next)
+			{
+				E_SCREEN (s);
 
+				if (eScreen->timeoutHandle)
+					compRemoveTimeout (eScreen->timeoutHandle);
+				eScreen->timeoutHandle = compAddTimeout (eScreen->params.updateDelay,
+									 (float) eScreen->params.updateDelay * 1.2,
+									 stepPositions, s);
+			}
 		}
 		break;
 		default:
@@ -1615,6 +1585,21 @@ elementsInitDisplay (CompPlugin  *p,
 	elementsSetSnowTexturesNotify (d, elementsDisplayOptionChanged);
 	elementsSetStarsTexturesNotify (d, elementsDisplayOptionChanged);
 	elementsSetBubblesTexturesNotify (d, elementsDisplayOptionChanged);
+	elementsSetGlobalSpeedNotify (d, elementsDisplayOptionChanged);
+	elementsSetScreenDepthNotify (d, elementsDisplayOptionChanged);
+	elementsSetOverWindowsNotify (d, elementsDisplayOptionChanged);
+	elementsSetApplyTransformNotify (d, elementsDisplayOptionChanged);
+	elementsSetAutumnSpeedNotify (d, elementsDisplayOptionChanged);
+	elementsSetFireflySpeedNotify (d, elementsDisplayOptionChanged);
+	elementsSetSnowSpeedNotify (d, elementsDisplayOptionChanged);
+	elementsSetStarsSpeedNotify (d, elementsDisplayOptionChanged);
+	elementsSetViscosityNotify (d, elementsDisplayOptionChanged);
+	elementsSetAutumnRotateNotify (d, elementsDisplayOptionChanged);
+	elementsSetFirefliesRotateNotify (d, elementsDisplayOptionChanged);
+	elementsSetSnowRotateNotify (d, elementsDisplayOptionChanged);
+	elementsSetStarsRotateNotify (d, elementsDisplayOptionChanged);
+	elementsSetBubblesRotateNotify (d, elementsDisplayOptionChanged);
+	elementsSetUpdateDelayNotify (d, elementsDisplayOptionChanged);
 
 	texAutOpt = elementsGetLeafTexturesOption (d);
 	texFfOpt = elementsGetFirefliesTexturesOption (d);
@@ -1654,6 +1639,8 @@ elementsInit (CompPlugin *p)
 	if (displayPrivateIndex < 0)
 		return FALSE;
 
+	particlesInitBezierTable (&bezierTable);
+
 	return TRUE;
 }
 
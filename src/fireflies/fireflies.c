@@ -28,9 +28,12 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include <compiz-core.h>
+#include <compiz-particles.h>
+#include <compiz-sprite-atlas.h>
 #include "fireflies_options.h"
 
 #define GET_SNOW_DISPLAY(d)                            \
@@ -48,6 +51,7 @@
 #define GLOW_STAGES		5
 
 static int displayPrivateIndex = 0;
+static ParticleBezierTable bezierTable;
 static float glowCurve[GLOW_STAGES][4] = { { 0.0, 0.5, 0.5, 1.0 }, { 1.0, 1.0, 0.5, 0.75 }, { 0.75, 0.3, 1.2, 1.0 }, { 1.0, 0.7, 1.5, 1.0 }, { 1.0, 0.5, 0.5, 0.0 } };
 
 /* -------------------  STRUCTS ----------------------------- */
@@ -61,30 +65,13 @@ typedef struct _SnowDisplay
     CompOptionValue *snowTexFiles;
 } SnowDisplay;
 
-typedef struct _SnowTexture
-{
-    CompTexture tex;
-
-    unsigned int width;
-    unsigned int height;
-
-    Bool   loaded;
-    GLuint dList;
-} SnowTexture;
-
+/* position, rotation, age and speed curves of a fly live in the
+   particle system */
 typedef struct _SnowFlake
 {
-    float x, y, z;
-    float xs[4], ys[4], zs[4];
-    float ra; /* rotation angle */
-    float rs; /* rotation speed */
-
-    float lifespan;		// age when fly will "die"
-    float age;			// age in time
-    float lifecycle;	// 0.0 to 1.0 over lifespan
     float glowAlpha;	// alpha, given life from tables
 
-    SnowTexture *tex;
+    SpriteAtlasSprite *tex;
 } SnowFlake;
 
 typedef struct _SnowScreen
@@ -98,18 +85,23 @@ typedef struct _SnowScreen
     PaintOutputProc paintOutput;
     DrawWindowProc  drawWindow;
 
-    SnowTexture *snowTex;
-    int         snowTexturesLoaded;
+    SpriteAtlas atlas;  /* all fly textures */
+
+    GLfloat *vertices;  /* quads of all flies */
+    GLfloat *texCoords;
+    GLfloat *colors;
+    int     arraySize;  /* flies the arrays have room for */
 
     GLuint displayList;
     Bool   displayListNeedsUpdate;
 
-    SnowFlake *allSnowFlakes;
+    SnowFlake      *allSnowFlakes;
+    ParticleSystem particles;
+    ParticleCurves curves; /* time is the lifecycle, 0.0 to 1.0 */
 } SnowScreen;
 
 /* some forward declarations */
-static void initiateSnowFlake (SnowScreen * ss, SnowFlake * sf);
-static void snowMove (CompDisplay *d, SnowFlake * sf);
+static void initiateSnowFlake (SnowScreen * ss, int i);
 
 /* --------------------  HELPER FUNCTIONS ------------------------ */
 
@@ -125,85 +117,68 @@ float mmrand(int  min, int max, float divisor)
 	return ((float)GetRand(min, max)) / divisor;
 };
 
-float bezierCurve(float p[4], float time);
-float bezierCurve(float p[4], float time) {
-	float a = p[0];
-	float b = p[0] + p[1];
-	float c = p[3] + p[2];
-	float d = p[3];
-
-    float h = time;
-    float i = 1.0 - time;
-
-    float out = (a*(i*i*i)) + (3.0*b*(i*i)*h) + (3.0*c*i*(h*h)) + (d*(h*h*h));
-    return out;
-}
-
-static void
-snowThink (SnowScreen *ss,
-	   SnowFlake  *sf)
+/* curves are given as the end points and the offsets of the inner points
+   from them, w are the Bernstein weights */
+static inline float
+bezierCurve (const float p[4],
+	     const float *w)
 {
-    int boxing;
-
-    boxing = firefliesGetScreenBoxing (ss->s->display);
-
-    sf->age += 0.01;
-	sf->lifecycle = (sf->age / 10) / sf->lifespan * (firefliesGetSnowSpeed(ss->s->display) / 10);
-
-	int glowStage = (sf->lifecycle * GLOW_STAGES);
-	sf->glowAlpha = bezierCurve(glowCurve[glowStage], sf->lifecycle);
-	//if (sf->glowAlpha > 1.0)
-	//	sf->glowAlpha = 1.0;
-
-	if (	sf->y <= -boxing
-			||  sf->y >= ss->s->height + boxing
-			|| 	sf->x <= -boxing
-			|| 	sf->x >= ss->s->width + boxing
-			|| 	sf->z <= -((float) firefliesGetScreenDepth (ss->s->display))
-			|| 	sf->z >= 1
-			||  sf->age > sf->lifespan)
-
-	{
-		initiateSnowFlake(ss,sf);
-	}
-	snowMove(ss->s->display, sf);
-}
-
-static void
-snowMove (CompDisplay *d,
-	  SnowFlake   *sf)
-{
-    float fireFlySpeed = firefliesGetSnowSpeed (d);
-    int   snowUpdateDelay = firefliesGetSnowUpdateDelay (d);
-
-	float xs = bezierCurve(sf->xs, sf->lifecycle);
-	float ys = bezierCurve(sf->ys, sf->lifecycle);
-	float zs = bezierCurve(sf->zs, sf->lifecycle);
-
-	sf->x += (float)(xs * (double)snowUpdateDelay) / (100 - fireFlySpeed);
-	sf->y += (float)(ys * (double)snowUpdateDelay) / (100 - fireFlySpeed);
-	sf->z += (float)(zs * (double)snowUpdateDelay) / (100 - fireFlySpeed);
+    return w[0] * p[0] + w[1] * (p[0] + p[1]) +
+	   w[2] * (p[3] + p[2]) + w[3] * p[3];
 }
 
 static Bool
 stepSnowPositions (void *closure)
 {
-    CompScreen *s = closure;
-    int        i, numFlakes;
-    SnowFlake  *snowFlake;
-    Bool       onTop;
+    CompScreen     *s = closure;
+    ParticleSystem *ps;
+    ParticleCurves *pc;
+    ParticleBounds bounds;
+    int            i, nDead, boxing, snowUpdateDelay;
+    float          fireFlySpeed;
+    SnowFlake      *snowFlake;
+    Bool           onTop;
 
     SNOW_SCREEN (s);
 
     if (!ss->active)
 	return TRUE;
 
-    snowFlake = ss->allSnowFlakes;
-    numFlakes = firefliesGetNumSnowflakes (s->display);
+    ps = &ss->particles;
+    pc = &ss->curves;
     onTop = firefliesGetSnowOverWindows (s->display);
+    boxing = firefliesGetScreenBoxing (s->display);
+    fireFlySpeed = firefliesGetSnowSpeed (s->display);
+    snowUpdateDelay = firefliesGetSnowUpdateDelay (s->display);
+
+    bounds.x1 = -boxing;
+    bounds.x2 = s->width + boxing;
+    bounds.y1 = -boxing;
+    bounds.y2 = s->height + boxing;
+    bounds.z1 = -((float) firefliesGetScreenDepth (s->display));
+    bounds.z2 = 1.0f;
 
-    for (i = 0; i < numFlakes; i++)
-	snowThink(ss, snowFlake++);
+    nDead = particlesFindDead (ps, &bounds);
+    for (i = 0; i < nDead; i++)
+	initiateSnowFlake (ss, ps->dead[i]);
+
+    snowFlake = ss->allSnowFlakes;
+    for (i = 0; i < ps->numParticles; i++, snowFlake++)
+    {
+	float lifecycle = (ps->age[i] / 10) / ps->lifespan[i] *
+			  (fireFlySpeed / 10);
+	int   glowStage = (lifecycle * GLOW_STAGES);
+
+	pc->t[i] = lifecycle;
+	snowFlake->glowAlpha =
+	    bezierCurve (glowCurve[glowStage],
+			 particlesBezierLookup (&bezierTable, lifecycle));
+    }
+
+    particlesEvalCurves (ps, pc, &bezierTable);
+
+    particlesIntegrate (ps, (float) snowUpdateDelay / (100 - fireFlySpeed),
+			0.0f, 0.01f);
 
     if (ss->active && !onTop)
     {
@@ -270,6 +245,35 @@ setupDisplayList (SnowScreen *ss)
     glEndList ();
 }
 
+static Bool
+ensureSnowArrays (SnowScreen *ss,
+		  int        numFlakes)
+{
+    GLfloat *vertices, *texCoords, *colors;
+
+    if (numFlakes <= ss->arraySize)
+	return TRUE;
+
+    vertices = realloc (ss->vertices, numFlakes * 12 * sizeof (GLfloat));
+    if (!vertices)
+	return FALSE;
+    ss->vertices = vertices;
+
+    texCoords = realloc (ss->texCoords, numFlakes * 8 * sizeof (GLfloat));
+    if (!texCoords)
+	return FALSE;
+    ss->texCoords = texCoords;
+
+    colors = realloc (ss->colors, numFlakes * 16 * sizeof (GLfloat));
+    if (!colors)
+	return FALSE;
+    ss->colors = colors;
+
+    ss->arraySize = numFlakes;
+
+    return TRUE;
+}
+
 static void
 beginRendering (SnowScreen *ss,
 		CompScreen *s)
@@ -286,50 +290,61 @@ beginRendering (SnowScreen *ss,
     }
 
     glColor4f (1.0, 1.0, 1.0, 1.0);
-    if (ss->snowTexturesLoaded && firefliesGetUseTextures (s->display))
+    if (ss->atlas.nLoaded && firefliesGetUseTextures (s->display) &&
+	ensureSnowArrays (ss, ss->particles.numParticles))
     {
-	int j;
+	/* one draw for all flies, they glow through their vertex colors */
+	ParticleSystem *ps = &ss->particles;
+	SnowFlake      *snowFlake = ss->allSnowFlakes;
+	float          snowSize = firefliesGetSnowSize (s->display);
+	int            i, j, n = 0;
 
-	for (j = 0; j < ss->snowTexturesLoaded; j++)
+	for (i = 0; i < ps->numParticles; i++, snowFlake++)
 	{
-	    SnowFlake *snowFlake = ss->allSnowFlakes;
-	    int       i, numFlakes = firefliesGetNumSnowflakes (s->display);
-	   // Bool      snowRotate = firefliesGetSnowRotation (s->display);
+	    SpriteAtlasSprite *sprite = snowFlake->tex;
+	    GLfloat           *color = ss->colors + n * 16;
+
+	    if (!sprite)
+		continue;
 
-	    enableTexture (ss->s, &ss->snowTex[j].tex,
-			   COMP_TEXTURE_FILTER_GOOD);
+	    spriteQuad (ss->vertices + n * 12, ps->x[i], ps->y[i], ps->z[i],
+			snowSize, snowSize * sprite->height / sprite->width,
+			0.0f);
+	    memcpy (ss->texCoords + n * 8, sprite->texCoords,
+		    sizeof (sprite->texCoords));
 
-	    for (i = 0; i < numFlakes; i++)
+	    for (j = 0; j < 4; j++, color += 4)
 	    {
-		glColor4f (1.0, 1.0, 1.0, ss->allSnowFlakes[i].glowAlpha);
-		if (snowFlake->tex == &ss->snowTex[j])
-		{
-		    glTranslatef (snowFlake->x, snowFlake->y, snowFlake->z);
-		    //if (snowRotate)
-			//glRotatef (snowFlake->ra, 0, 0, 1);
-		    glCallList (ss->snowTex[j].dList);
-		    //if (snowRotate)
-			//glRotatef (-snowFlake->ra, 0, 0, 1);
-		    glTranslatef (-snowFlake->x, -snowFlake->y, -snowFlake->z);
-		}
-		snowFlake++;
+		color[0] = color[1] = color[2] = 1.0f;
+		color[3] = snowFlake->glowAlpha;
 	    }
-	    disableTexture (ss->s, &ss->snowTex[j].tex);
+	    n++;
 	}
+
+	glEnableClientState (GL_COLOR_ARRAY);
+	glVertexPointer (3, GL_FLOAT, 0, ss->vertices);
+	glTexCoordPointer (2, GL_FLOAT, 0, ss->texCoords);
+	glColorPointer (4, GL_FLOAT, 0, ss->colors);
+
+	enableTexture (ss->s, &ss->atlas.texture, COMP_TEXTURE_FILTER_GOOD);
+	glDrawArrays (GL_QUADS, 0, n * 4);
+	disableTexture (ss->s, &ss->atlas.texture);
+
+	glDisableClientState (GL_COLOR_ARRAY);
+	glColor4f (1.0, 1.0, 1.0, 1.0);
     }
     else
     {
-	SnowFlake *snowFlake = ss->allSnowFlakes;
-	int       i, numFlakes = firefliesGetNumSnowflakes (s->display);
+	ParticleSystem *ps = &ss->particles;
+	int            i;
 
-	for (i = 0; i < numFlakes; i++)
+	for (i = 0; i < ps->numParticles; i++)
 	{
-	    glTranslatef (snowFlake->x, snowFlake->y, snowFlake->z);
-	    glRotatef (snowFlake->ra, 0, 0, 1);
+	    glTranslatef (ps->x[i], ps->y[i], ps->z[i]);
+	    glRotatef (ps->ra[i], 0, 0, 1);
 	    glCallList (ss->displayList);
-	    glRotatef (-snowFlake->ra, 0, 0, 1);
-	    glTranslatef (-snowFlake->x, -snowFlake->y, -snowFlake->z);
-	    snowFlake++;
+	    glRotatef (-ps->ra[i], 0, 0, 1);
+	    glTranslatef (-ps->x[i], -ps->y[i], -ps->z[i]);
 	}
     }
 
@@ -405,25 +420,36 @@ snowDrawWindow (CompWindow           *w,
 
 static void
 initiateSnowFlake (SnowScreen *ss,
-		   SnowFlake  *sf)
+		   int        n)
 {
     /* TODO: possibly place snowflakes based on FOV, instead of a cube. */
-    int boxing = firefliesGetScreenBoxing (ss->s->display);
+    ParticleSystem *ps = &ss->particles;
+    ParticleCurves *pc = &ss->curves;
+    int            boxing = firefliesGetScreenBoxing (ss->s->display);
 
-    sf->x = mmrand(-boxing, ss->s->width + boxing, 1);
-	sf->y = mmrand(-boxing, ss->s->height + boxing, 1);
-	sf->z = mmrand(-firefliesGetScreenDepth (ss->s->display), 0.1, 5000);
+    ps->x[n] = mmrand(-boxing, ss->s->width + boxing, 1);
+	ps->y[n] = mmrand(-boxing, ss->s->height + boxing, 1);
+	ps->z[n] = mmrand(-firefliesGetScreenDepth (ss->s->display), 0.1, 5000);
+	ps->ra[n] = 0.0;
+	ps->rs[n] = 0.0;
 
-	sf->lifespan = mmrand(50,1000, 100);
-	sf->age = 0.0;
+	ps->lifespan[n] = mmrand(50,1000, 100);
+	ps->age[n] = 0.0;
 
 	// speed of firefly
-	int i = 0;
+	int a, i = 0;
 	for (i = 0; i < 4; i++)
 	{
-		sf->xs[i] = mmrand(-3000, 3000, 1000);
-		sf->ys[i] = mmrand(-3000, 3000, 1000);
-		sf->zs[i] = mmrand(-1000, 1000, 500000);
+		pc->p[0][i][n] = mmrand(-3000, 3000, 1000);
+		pc->p[1][i][n] = mmrand(-3000, 3000, 1000);
+		pc->p[2][i][n] = mmrand(-1000, 1000, 500000);
+	}
+
+	// inner control points were drawn as offsets from the ends
+	for (a = 0; a < 3; a++)
+	{
+		pc->p[a][1][n] += pc->p[a][0][n];
+		pc->p[a][2][n] += pc->p[a][3][n];
 	}
 }
 
@@ -431,86 +457,37 @@ static void
 setSnowflakeTexture (SnowScreen *ss,
 		     SnowFlake  *sf)
 {
-    if (ss->snowTexturesLoaded)
-	sf->tex = &ss->snowTex[rand () % ss->snowTexturesLoaded];
+    if (ss->atlas.nLoaded)
+	sf->tex = spriteAtlasGetLoaded (&ss->atlas, 0, ss->atlas.nSprites,
+					rand () % ss->atlas.nLoaded);
+    else
+	sf->tex = NULL;
 }
 
+/* gives every fly a texture of the new atlas */
 static void
-updateSnowTextures (CompScreen *s)
+snowTexturesLoaded (CompScreen *s)
 {
-    int       i, count = 0;
-    float     snowSize = firefliesGetSnowSize(s->display);
-    int       numFlakes = firefliesGetNumSnowflakes(s->display);
+    int       i;
     SnowFlake *snowFlake;
 
     SNOW_SCREEN (s);
-    SNOW_DISPLAY (s->display);
 
     snowFlake = ss->allSnowFlakes;
 
-    for (i = 0; i < ss->snowTexturesLoaded; i++)
-    {
-	finiTexture (s, &ss->snowTex[i].tex);
-	glDeleteLists (ss->snowTex[i].dList, 1);
-    }
-
-    if (ss->snowTex)
-	free (ss->snowTex);
-    ss->snowTexturesLoaded = 0;
-
-    ss->snowTex = calloc (1, sizeof (SnowTexture) * sd->snowTexNFiles);
-
-    for (i = 0; i < sd->snowTexNFiles; i++)
-    {
-	CompMatrix  *mat;
-	SnowTexture *sTex;
-
-	ss->snowTex[count].loaded =
-	    readImageToTexture (s, &ss->snowTex[count].tex,
-				sd->snowTexFiles[i].s,
-				&ss->snowTex[count].width,
-				&ss->snowTex[count].height);
-	if (!ss->snowTex[count].loaded)
-	{
-	    compLogMessage ("firefly", CompLogLevelWarn,
-			    "Texture not found : %s", sd->snowTexFiles[i].s);
-	    continue;
-	}
-	compLogMessage ("firefly", CompLogLevelInfo,
-			"Loaded Texture %s", sd->snowTexFiles[i].s);
-
-	mat = &ss->snowTex[count].tex.matrix;
-	sTex = &ss->snowTex[count];
-
-	sTex->dList = glGenLists (1);
-	glNewList (sTex->dList, GL_COMPILE);
-
-	glBegin (GL_QUADS);
-
-	glTexCoord2f (COMP_TEX_COORD_X (mat, 0), COMP_TEX_COORD_Y (mat, 0));
-	glVertex2f (0, 0);
-	glTexCoord2f (COMP_TEX_COORD_X (mat, 0),
-		      COMP_TEX_COORD_Y (mat, sTex->height));
-	glVertex2f (0, snowSize * sTex->height / sTex->width);
-	glTexCoord2f (COMP_TEX_COORD_X (mat, sTex->width),
-		      COMP_TEX_COORD_Y (mat, sTex->height));
-	glVertex2f (snowSize, snowSize * sTex->height / sTex->width);
-	glTexCoord2f (COMP_TEX_COORD_X (mat, sTex->width),
-		      COMP_TEX_COORD_Y (mat, 0));
-	glVertex2f (snowSize, 0);
-
-	glEnd ();
-	glEndList ();
+    for (i = 0; i < ss->particles.numParticles; i++)
+	setSnowflakeTexture (ss, snowFlake++);
 
-	count++;
-    }
+    damageScreen (s);
+}
 
-    ss->snowTexturesLoaded = count;
-    if (count < sd->snowTexNFiles)
-	ss->snowTex = realloc (ss->snowTex, sizeof (SnowTexture) * count);
+static void
+updateSnowTextures (CompScreen *s)
+{
+    SNOW_SCREEN (s);
+    SNOW_DISPLAY (s->display);
 
-    for (i = 0; i < numFlakes; i++)
-	setSnowflakeTexture (ss, snowFlake++);
+    spriteAtlasLoad (&ss->atlas, sd->snowTexFiles, sd->snowTexNFiles);
 }
 
 static Bool
@@ -528,16 +505,25 @@ snowInitScreen (CompPlugin *p,
     s->base.privates[sd->screenPrivateIndex].ptr = ss;
 
     ss->s = s;
-    ss->snowTexturesLoaded = 0;
-    ss->snowTex = NULL;
+    spriteAtlasInit (s, &ss->atlas, "firefly", snowTexturesLoaded);
+    ss->vertices = NULL;
+    ss->texCoords = NULL;
+    ss->colors = NULL;
+    ss->arraySize = 0;
     ss->active = FALSE;
     ss->displayListNeedsUpdate = FALSE;
 
+    particlesInit (&ss->particles);
+    particleCurvesInit (&ss->curves);
+
     ss->allSnowFlakes = snowFlake = malloc (numFlakes * sizeof (SnowFlake));
+    if (!snowFlake || !particlesResize (&ss->particles, numFlakes) ||
+	!particleCurvesResize (&ss->curves, numFlakes))
+	particlesResize (&ss->particles, 0);
 
-    for (i = 0; i < numFlakes; i++)
+    for (i = 0; i < ss->particles.numParticles; i++)
     {
-	initiateSnowFlake (ss, snowFlake);
+	initiateSnowFlake (ss, i);
 	setSnowflakeTexture (ss, snowFlake);
 	snowFlake++;
     }
@@ -558,24 +544,24 @@ static void
 snowFiniScreen (CompPlugin *p,
 		CompScreen *s)
 {
-    int i;
-
     SNOW_SCREEN (s);
 
     if (ss->timeoutHandle)
 	compRemoveTimeout (ss->timeoutHandle);
 
-    for (i = 0; i < ss->snowTexturesLoaded; i++)
-    {
-	finiTexture (s, &ss->snowTex[i].tex);
-	glDeleteLists (ss->snowTex[i].dList, 1);
-    }
+    spriteAtlasFini (s, &ss->atlas);
 
-    if (ss->snowTex)
-	free (ss->snowTex);
+    if (ss->vertices)
+	free (ss->vertices);
+    if (ss->texCoords)
+	free (ss->texCoords);
+    if (ss->colors)
+	free (ss->colors);
 
     if (ss->allSnowFlakes)
 	free (ss->allSnowFlakes);
+    particlesFini (&ss->particles);
+    particleCurvesFini (&ss->curves);
 
     UNWRAP (ss, s, paintOutput);
     UNWRAP (ss, s, drawWindow);
@@ -600,7 +586,7 @@ snowDisplayOptionChanged (CompDisplay        *d,
 	    {
 		SNOW_SCREEN (s);
 		ss->displayListNeedsUpdate = TRUE;
-		updateSnowTextures (s);
+		damageScreen (s);
 	    }
 	}
 	break;
@@ -632,11 +618,16 @@ snowDisplayOptionChanged (CompDisplay        *d,
 		SNOW_SCREEN (s);
 		ss->allSnowFlakes = realloc (ss->allSnowFlakes,
 					     numFlakes * sizeof (SnowFlake));
+		if (!ss->allSnowFlakes ||
+		    !particlesResize (&ss->particles, numFlakes) ||
+		    !particleCurvesResize (&ss->curves, numFlakes))
+		    particlesResize (&ss->particles, 0);
+
 		snowFlake = ss->allSnowFlakes;
 
-		for (i = 0; i < numFlakes; i++)
+		for (i = 0; i < ss->particles.numParticles; i++)
 		{
-		    initiateSnowFlake (ss, snowFlake);
+		    initiateSnowFlake (ss, i);
 		    setSnowflakeTexture (ss, snowFlake);
 		    snowFlake++;
 		}
@@ -752,6 +743,8 @@ snowInit (CompPlugin *p)
     if (displayPrivateIndex < 0)
 	return FALSE;
 
+    particlesInitBezierTable (&bezierTable);
+
     return TRUE;
 }
 
@@ -28,9 +28,12 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include <compiz-core.h>
+#include <compiz-particles.h>
+#include <compiz-sprite-atlas.h>
 #include "snow_options.h"
 
 #define GET_SNOW_DISPLAY(d)                            \
@@ -45,6 +48,12 @@
 #define SNOW_SCREEN(s)                                 \
     SnowScreen *ss = GET_SNOW_SCREEN (s, GET_SNOW_DISPLAY (s->display))
 
+/* flakes are damaged as the bounding boxes of a grid of tiles per output */
+#define SNOW_DAMAGE_TILES 4
+
+/* near plane of the core projection, flakes closer to the camera are clipped */
+#define SNOW_Z_NEAR 0.1f
+
 static int displayPrivateIndex = 0;
 
 /* -------------------  STRUCTS ----------------------------- */
@@ -58,25 +67,10 @@ typedef struct _SnowDisplay
     CompOptionValue *snowTexFiles;
 } SnowDisplay;
 
-typedef struct _SnowTexture
-{
-    CompTexture tex;
-
-    unsigned int width;
-    unsigned int height;
-
-    Bool   loaded;
-    GLuint dList;
-} SnowTexture;
-
+/* position and speed of a flake live in the particle system */
 typedef struct _SnowFlake
 {
-    float x, y, z;
-    float xs, ys, zs;
-    float ra; /* rotation angle */
-    float rs; /* rotation speed */
-
-    SnowTexture *tex;
+    SpriteAtlasSprite *tex;
 } SnowFlake;
 
 typedef struct _SnowScreen
@@ -90,83 +84,248 @@ typedef struct _SnowScreen
     PaintOutputProc paintOutput;
     DrawWindowProc  drawWindow;
 
-    SnowTexture *snowTex;
-    int         snowTexturesLoaded;
+    SpriteAtlas atlas;  /* all flake textures */
+
+    GLfloat *vertices;  /* quads of all flakes */
+    GLfloat *texCoords;
+    int     arraySize;  /* flakes the arrays have room for */
 
-    GLuint displayList;
-    Bool   displayListNeedsUpdate;
+    BoxPtr damageTiles;
+    int    nDamageTiles;
 
-    SnowFlake *allSnowFlakes;
+    SnowFlake      *allSnowFlakes;
+    ParticleSystem particles;
 } SnowScreen;
 
 /* some forward declarations */
-static void initiateSnowFlake (SnowScreen * ss, SnowFlake * sf);
-static void snowMove (CompDisplay *d, SnowFlake * sf);
+static void initiateSnowFlake (SnowScreen * ss, int i);
+
+/*
+ * Screen box covered by a flake on an output.  Flakes are drawn with the
+ * perspective of the output, so anything off the z = 0 plane is scaled
+ * about the output centre.
+ */
+static Bool
+getSnowFlakeBox (ParticleSystem *ps,
+		 int            i,
+		 CompOutput     *output,
+		 float          radius,
+		 BoxPtr         box)
+{
+    float cx, cy, k, x1, y1, x2, y2;
+    float d = DEFAULT_Z_CAMERA - ps->z[i];
+
+    if (d <= SNOW_Z_NEAR)
+	return FALSE;
+
+    k  = DEFAULT_Z_CAMERA / d;
+    cx = output->region.extents.x1 + output->width / 2.0f;
+    cy = output->region.extents.y1 + output->height / 2.0f;
+
+    /* a pixel of slack for rounding of the rasterizer */
+    x1 = MAX (cx + (ps->x[i] - radius - cx) * k - 1,
+	      output->region.extents.x1);
+    y1 = MAX (cy + (ps->y[i] - radius - cy) * k - 1,
+	      output->region.extents.y1);
+    x2 = MIN (cx + (ps->x[i] + radius - cx) * k + 1,
+	      output->region.extents.x2);
+    y2 = MIN (cy + (ps->y[i] + radius - cy) * k + 1,
+	      output->region.extents.y2);
+
+    if (x1 >= x2 || y1 >= y2)
+	return FALSE;
+
+    box->x1 = floorf (x1);
+    box->y1 = floorf (y1);
+    box->x2 = ceilf (x2);
+    box->y2 = ceilf (y2);
+
+    return TRUE;
+}
 
 static void
-snowThink (SnowScreen *ss,
-	   SnowFlake  *sf)
+addSnowFlakeDamage (SnowScreen *ss,
+		    int        n,
+		    float      snowSize,
+		    Bool       textured)
 {
-    int boxing;
+    CompScreen *s = ss->s;
+    SnowFlake  *sf = &ss->allSnowFlakes[n];
+    float      aspect = 1.0f, radius;
+    int        i;
+
+    if (textured && sf->tex)
+	aspect = (float) sf->tex->height / sf->tex->width;
 
-    boxing = snowGetScreenBoxing (ss->s->display);
+    /* the quad has a corner at the flake and may be rotated about it */
+    radius = snowSize * sqrtf (1.0f + aspect * aspect);
 
-    if (sf->y >= ss->s->height + boxing ||
-	sf->x <= -boxing ||
-	sf->y >= ss->s->width + boxing ||
-	sf->z <= -((float) snowGetScreenDepth (ss->s->display) / 500.0) ||
-	sf->z >= 1)
+    for (i = 0; i < s->nOutputDev; i++)
     {
-	initiateSnowFlake (ss, sf);
+	CompOutput *output = &s->outputDev[i];
+	BoxPtr     tile;
+	BoxRec     box;
+	int        tx, ty;
+
+	if (!getSnowFlakeBox (&ss->particles, n, output, radius, &box))
+	    continue;
+
+	tx = ((box.x1 + box.x2) / 2 - output->region.extents.x1) *
+	     SNOW_DAMAGE_TILES / MAX (output->width, 1);
+	ty = ((box.y1 + box.y2) / 2 - output->region.extents.y1) *
+	     SNOW_DAMAGE_TILES / MAX (output->height, 1);
+	tx = MIN (MAX (tx, 0), SNOW_DAMAGE_TILES - 1);
+	ty = MIN (MAX (ty, 0), SNOW_DAMAGE_TILES - 1);
+
+	tile = &ss->damageTiles[(i * SNOW_DAMAGE_TILES + ty) *
+				SNOW_DAMAGE_TILES + tx];
+
+	if (tile->x1 >= tile->x2)
+	{
+	    *tile = box;
+	}
+	else
+	{
+	    tile->x1 = MIN (tile->x1, box.x1);
+	    tile->y1 = MIN (tile->y1, box.y1);
+	    tile->x2 = MAX (tile->x2, box.x2);
+	    tile->y2 = MAX (tile->y2, box.y2);
+	}
     }
-    snowMove (ss->s->display, sf);
 }
 
 static void
-snowMove (CompDisplay *d,
-	  SnowFlake   *sf)
+damageSnowTiles (SnowScreen *ss,
+		 Bool       onTop)
 {
-    float tmp = 1.0f / (101.0f - snowGetSnowSpeed (d));
-    int   snowUpdateDelay = snowGetSnowUpdateDelay (d);
+    CompScreen *s = ss->s;
+    Region     region;
+    int        i;
+
+    region = XCreateRegion ();
+    if (!region)
+    {
+	damageScreen (s);
+	return;
+    }
+
+    for (i = 0; i < ss->nDamageTiles; i++)
+    {
+	BoxPtr     tile = &ss->damageTiles[i];
+	XRectangle rect;
 
-    sf->x += (sf->xs * (float) snowUpdateDelay) * tmp;
-    sf->y += (sf->ys * (float) snowUpdateDelay) * tmp;
-    sf->z += (sf->zs * (float) snowUpdateDelay) * tmp;
-    sf->ra += ((float) snowUpdateDelay) / (10.0f - sf->rs);
+	if (tile->x1 >= tile->x2)
+	    continue;
+
+	rect.x      = tile->x1;
+	rect.y      = tile->y1;
+	rect.width  = tile->x2 - tile->x1;
+	rect.height = tile->y2 - tile->y1;
+
+	XUnionRectWithRegion (&rect, region, region);
+    }
+
+    /* below windows the flakes are only drawn on the desktop */
+    if (!onTop)
+    {
+	Region     desktop = XCreateRegion ();
+	CompWindow *w;
+
+	if (desktop)
+	{
+	    for (w = s->windows; w; w = w->next)
+	    {
+		if (w->type & CompWindowTypeDesktopMask)
+		    XUnionRegion (desktop, w->region, desktop);
+	    }
+
+	    XIntersectRegion (region, desktop, region);
+	    XDestroyRegion (desktop);
+	}
+    }
+
+    damageScreenRegion (s, region);
+    XDestroyRegion (region);
 }
 
 static Bool
 stepSnowPositions (void *closure)
 {
-    CompScreen *s = closure;
-    int        i, numFlakes;
-    SnowFlake  *snowFlake;
-    Bool       onTop;
+    CompScreen     *s = closure;
+    ParticleSystem *ps;
+    ParticleBounds bounds;
+    int            i, nDead, nTiles, boxing, snowUpdateDelay;
+    Bool           onTop, textured, damageTiles = TRUE;
+    float          snowSize;
 
     SNOW_SCREEN (s);
 
     if (!ss->active)
 	return TRUE;
 
-    snowFlake = ss->allSnowFlakes;
-    numFlakes = snowGetNumSnowflakes (s->display);
+    ps = &ss->particles;
     onTop = snowGetSnowOverWindows (s->display);
+    snowSize = snowGetSnowSize (s->display);
+    textured = ss->atlas.nLoaded && snowGetUseTextures (s->display);
+    boxing = snowGetScreenBoxing (s->display);
+    snowUpdateDelay = snowGetSnowUpdateDelay (s->display);
 
-    for (i = 0; i < numFlakes; i++)
-	snowThink(ss, snowFlake++);
-
-    if (ss->active && !onTop)
+    nTiles = s->nOutputDev * SNOW_DAMAGE_TILES * SNOW_DAMAGE_TILES;
+    if (nTiles > ss->nDamageTiles)
     {
-	CompWindow *w;
+	BoxPtr tiles = realloc (ss->damageTiles, nTiles * sizeof (BoxRec));
 
-	for (w = s->windows; w; w = w->next)
+	if (tiles)
+	{
+	    ss->damageTiles = tiles;
+	    ss->nDamageTiles = nTiles;
+	}
+	else
 	{
-	    if (w->type & CompWindowTypeDesktopMask)
-		addWindowDamage (w);
+	    damageTiles = FALSE;
 	}
     }
-    else if (ss->active)
+    else
+    {
+	ss->nDamageTiles = nTiles;
+    }
+
+    /* damage where each flake was drawn and where it will be drawn next */
+    if (damageTiles)
+    {
+	memset (ss->damageTiles, 0, nTiles * sizeof (BoxRec));
+
+	for (i = 0; i < ps->numParticles; i++)
+	    addSnowFlakeDamage (ss, i, snowSize, textured);
+    }
+
+    bounds.x1 = -boxing;
+    bounds.x2 = FLT_MAX;
+    bounds.y1 = -FLT_MAX;
+    bounds.y2 = MIN (s->height, s->width) + boxing;
+    bounds.z1 = -((float) snowGetScreenDepth (s->display) / 500.0);
+    bounds.z2 = 1.0f;
+
+    nDead = particlesFindDead (ps, &bounds);
+    for (i = 0; i < nDead; i++)
+	initiateSnowFlake (ss, ps->dead[i]);
+
+    particlesIntegrate (ps,
+			(float) snowUpdateDelay /
+			(101.0f - snowGetSnowSpeed (s->display)),
+			snowUpdateDelay, 0.0f);
+
+    if (damageTiles)
+    {
+	for (i = 0; i < ps->numParticles; i++)
+	    addSnowFlakeDamage (ss, i, snowSize, textured);
+
+	damageSnowTiles (ss, onTop);
+    }
+    else
+    {
 	damageScreen (s);
+    }
 
     return TRUE;
 }
@@ -213,89 +372,90 @@ mmRand (int   min,
 };
 
 /* --------------------------- RENDERING ------------------------- */
-static void
-setupDisplayList (SnowScreen *ss)
+static Bool
+ensureSnowArrays (SnowScreen *ss,
+		  int        numFlakes)
 {
-    float snowSize = snowGetSnowSize (ss->s->display);
+    GLfloat *vertices, *texCoords;
 
-    ss->displayList = glGenLists (1);
+    if (numFlakes <= ss->arraySize)
+	return TRUE;
 
-    glNewList (ss->displayList, GL_COMPILE);
-    glBegin (GL_QUADS);
+    vertices = realloc (ss->vertices, numFlakes * 12 * sizeof (GLfloat));
+    if (!vertices)
+	return FALSE;
+    ss->vertices = vertices;
 
-    glColor4f (1.0, 1.0, 1.0, 1.0);
-    glVertex3f (0, 0, -0.0);
-    glColor4f (1.0, 1.0, 1.0, 1.0);
-    glVertex3f (0, snowSize, -0.0);
-    glColor4f (1.0, 1.0, 1.0, 1.0);
-    glVertex3f (snowSize, snowSize, -0.0);
-    glColor4f (1.0, 1.0, 1.0, 1.0);
-    glVertex3f (snowSize, 0, -0.0);
+    texCoords = realloc (ss->texCoords, numFlakes * 8 * sizeof (GLfloat));
+    if (!texCoords)
+	return FALSE;
+    ss->texCoords = texCoords;
+
+    ss->arraySize = numFlakes;
 
-    glEnd ();
-    glEndList ();
+    return TRUE;
 }
 
+/*
+ * Build the quads of all flakes in one array and draw them with a single
+ * call, all flake textures are in one atlas.
+ */
 static void
 beginRendering (SnowScreen *ss,
 		CompScreen *s)
 {
+    ParticleSystem *ps = &ss->particles;
+    SnowFlake      *snowFlake;
+    int            i, numFlakes = ps->numParticles;
+    float          snowSize = snowGetSnowSize (s->display);
+
+    if (!ensureSnowArrays (ss, numFlakes))
+	return;
+
     if (snowGetUseBlending (s->display))
 	glEnable (GL_BLEND);
 
     glTexEnvf (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 
-    if (ss->displayListNeedsUpdate)
-    {
-	setupDisplayList (ss);
-	ss->displayListNeedsUpdate = FALSE;
-    }
-
     glColor4f (1.0, 1.0, 1.0, 1.0);
-    if (ss->snowTexturesLoaded && snowGetUseTextures (s->display))
+    if (ss->atlas.nLoaded && snowGetUseTextures (s->display))
     {
-	int j;
+	Bool snowRotate = snowGetSnowRotation (s->display);
+	int  n = 0;
 
-	for (j = 0; j < ss->snowTexturesLoaded; j++)
+	snowFlake = ss->allSnowFlakes;
+	for (i = 0; i < numFlakes; i++, snowFlake++)
 	{
-	    SnowFlake *snowFlake = ss->allSnowFlakes;
-	    int       i, numFlakes = snowGetNumSnowflakes (s->display);
-	    Bool      snowRotate = snowGetSnowRotation (s->display);
+	    SpriteAtlasSprite *sprite = snowFlake->tex;
 
-	    enableTexture (ss->s, &ss->snowTex[j].tex,
-			   COMP_TEXTURE_FILTER_GOOD);
+	    if (!sprite)
+		continue;
 
-	    for (i = 0; i < numFlakes; i++)
-	    {
-		if (snowFlake->tex == &ss->snowTex[j])
-		{
-		    glTranslatef (snowFlake->x, snowFlake->y, snowFlake->z);
-		    if (snowRotate)
-			glRotatef (snowFlake->ra, 0, 0, 1);
-		    glCallList (ss->snowTex[j].dList);
-		    if (snowRotate)
-			glRotatef (-snowFlake->ra, 0, 0, 1);
-		    glTranslatef (-snowFlake->x, -snowFlake->y, -snowFlake->z);
-		}
-		snowFlake++;
-	    }
-	    disableTexture (ss->s, &ss->snowTex[j].tex);
+	    spriteQuad (ss->vertices + n * 12, ps->x[i], ps->y[i], ps->z[i],
+			snowSize, snowSize * sprite->height / sprite->width,
+			snowRotate ? ps->ra[i] : 0.0f);
+	    memcpy (ss->texCoords + n * 8, sprite->texCoords,
+		    sizeof (sprite->texCoords));
+	    n++;
 	}
+
+	glVertexPointer (3, GL_FLOAT, 0, ss->vertices);
+	glTexCoordPointer (2, GL_FLOAT, 0, ss->texCoords);
+
+	enableTexture (ss->s, &ss->atlas.texture, COMP_TEXTURE_FILTER_GOOD);
+	glDrawArrays (GL_QUADS, 0, n * 4);
+	disableTexture (ss->s, &ss->atlas.texture);
     }
     else
     {
-	SnowFlake *snowFlake = ss->allSnowFlakes;
-	int       i, numFlakes = snowGetNumSnowflakes (s->display);
-
 	for (i = 0; i < numFlakes; i++)
-	{
-	    glTranslatef (snowFlake->x, snowFlake->y, snowFlake->z);
-	    glRotatef (snowFlake->ra, 0, 0, 1);
-	    glCallList (ss->displayList);
-	    glRotatef (-snowFlake->ra, 0, 0, 1);
-	    glTranslatef (-snowFlake->x, -snowFlake->y, -snowFlake->z);
-	    snowFlake++;
-	}
+	    spriteQuad (ss->vertices + i * 12, ps->x[i], ps->y[i], ps->z[i],
+			snowSize, snowSize, ps->ra[i]);
+
+	glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer (3, GL_FLOAT, 0, ss->vertices);
+	glDrawArrays (GL_QUADS, 0, numFlakes * 4);
+	glEnableClientState (GL_TEXTURE_COORD_ARRAY);
     }
 
     glTexEnvf (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
@@ -370,131 +530,87 @@ snowDrawWindow (CompWindow           *w,
 
 static void
 initiateSnowFlake (SnowScreen *ss,
-		   SnowFlake  *sf)
+		   int        i)
 {
     /* TODO: possibly place snowflakes based on FOV, instead of a cube. */
-    int boxing = snowGetScreenBoxing (ss->s->display);
+    ParticleSystem *ps = &ss->particles;
+    int            boxing = snowGetScreenBoxing (ss->s->display);
 
     switch (snowGetSnowDirection (ss->s->display))
     {
     case SnowDirectionTopToBottom:
-	sf->x  = mmRand (-boxing, ss->s->width + boxing, 1);
-	sf->xs = mmRand (-1, 1, 500);
-	sf->y  = mmRand (-300, 0, 1);
-	sf->ys = mmRand (1, 3, 1);
+	ps->x[i]  = mmRand (-boxing, ss->s->width + boxing, 1);
+	ps->xs[i] = mmRand (-1, 1, 500);
+	ps->y[i]  = mmRand (-300, 0, 1);
+	ps->ys[i] = mmRand (1, 3, 1);
 	break;
     case SnowDirectionBottomToTop:
-	sf->x  = mmRand (-boxing, ss->s->width + boxing, 1);
-	sf->xs = mmRand (-1, 1, 500);
-	sf->y  = mmRand (ss->s->height, ss->s->height + 300, 1);
-	sf->ys = -mmRand (1, 3, 1);
+	ps->x[i]  = mmRand (-boxing, ss->s->width + boxing, 1);
+	ps->xs[i] = mmRand (-1, 1, 500);
+	ps->y[i]  = mmRand (ss->s->height, ss->s->height + 300, 1);
+	ps->ys[i] = -mmRand (1, 3, 1);
 	break;
     case SnowDirectionRightToLeft:
-	sf->x  = mmRand (ss->s->width, ss->s->width + 300, 1);
-	sf->xs = -mmRand (1, 3, 1);
-	sf->y  = mmRand (-boxing, ss->s->height + boxing, 1);
-	sf->ys = mmRand (-1, 1, 500);
+	ps->x[i]  = mmRand (ss->s->width, ss->s->width + 300, 1);
+	ps->xs[i] = -mmRand (1, 3, 1);
+	ps->y[i]  = mmRand (-boxing, ss->s->height + boxing, 1);
+	ps->ys[i] = mmRand (-1, 1, 500);
 	break;
     case SnowDirectionLeftToRight:
-	sf->x  = mmRand (-300, 0, 1);
-	sf->xs = mmRand (1, 3, 1);
-	sf->y  = mmRand (-boxing, ss->s->height + boxing, 1);
-	sf->ys = mmRand (-1, 1, 500);
+	ps->x[i]  = mmRand (-300, 0, 1);
+	ps->xs[i] = mmRand (1, 3, 1);
+	ps->y[i]  = mmRand (-boxing, ss->s->height + boxing, 1);
+	ps->ys[i] = mmRand (-1, 1, 500);
 	break;
     default:
 	break;
     }
 
-    sf->z  = mmRand (-snowGetScreenDepth (ss->s->display), 0.1, 5000);
-    sf->zs = mmRand (-1000, 1000, 500000);
-    sf->ra = mmRand (-1000, 1000, 50);
-    sf->rs = mmRand (-1000, 1000, 1000);
+    ps->z[i]  = mmRand (-snowGetScreenDepth (ss->s->display), 0.1, 5000);
+    ps->zs[i] = mmRand (-1000, 1000, 500000);
+    ps->ra[i] = mmRand (-1000, 1000, 50);
+    ps->rs[i] = 1.0f / (10.0f - mmRand (-1000, 1000, 1000));
+
+    ps->age[i]      = 0.0f;
+    ps->lifespan[i] = FLT_MAX;
 }
 
 static void
 setSnowflakeTexture (SnowScreen *ss,
 		     SnowFlake  *sf)
 {
-    if (ss->snowTexturesLoaded)
-	sf->tex = &ss->snowTex[rand () % ss->snowTexturesLoaded];
+    if (ss->atlas.nLoaded)
+	sf->tex = spriteAtlasGetLoaded (&ss->atlas, 0, ss->atlas.nSprites,
+					rand () % ss->atlas.nLoaded);
+    else
+	sf->tex = NULL;
 }
 
+/* gives every flake a texture of the new atlas */
 static void
-updateSnowTextures (CompScreen *s)
+snowTexturesLoaded (CompScreen *s)
 {
-    int       i, count = 0;
-    float     snowSize = snowGetSnowSize(s->display);
-    int       numFlakes = snowGetNumSnowflakes(s->display);
+    int       i;
     SnowFlake *snowFlake;
 
     SNOW_SCREEN (s);
-    SNOW_DISPLAY (s->display);
 
     snowFlake = ss->allSnowFlakes;
 
-    for (i = 0; i < ss->snowTexturesLoaded; i++)
-    {
-	finiTexture (s, &ss->snowTex[i].tex);
-	glDeleteLists (ss->snowTex[i].dList, 1);
-    }
-
-    if (ss->snowTex)
-	free (ss->snowTex);
-    ss->snowTexturesLoaded = 0;
-
-    ss->snowTex = calloc (1, sizeof (SnowTexture) * sd->snowTexNFiles);
-
-    for (i = 0; i < sd->snowTexNFiles; i++)
-    {
-	CompMatrix  *mat;
-	SnowTexture *sTex;
-
-	ss->snowTex[count].loaded =
-	    readImageToTexture (s, &ss->snowTex[count].tex,
-				sd->snowTexFiles[i].s,
-				&ss->snowTex[count].width,
-				&ss->snowTex[count].height);
-	if (!ss->snowTex[count].loaded)
-	{
-	    compLogMessage ("snow", CompLogLevelWarn,
-			    "Texture not found : %s", sd->snowTexFiles[i].s);
-	    continue;
-	}
-	compLogMessage ("snow", CompLogLevelInfo,
-			"Loaded Texture %s", sd->snowTexFiles[i].s);
-
-	mat = &ss->snowTex[count].tex.matrix;
-	sTex = &ss->snowTex[count];
-
-	sTex->dList = glGenLists (1);
-	glNewList (sTex->dList, GL_COMPILE);
-
-	glBegin (GL_QUADS);
-
-	glTexCoord2f (COMP_TEX_COORD_X (mat, 0), COMP_TEX_COORD_Y (mat, 0));
-	glVertex2f (0, 0);
-	glTexCoord2f (COMP_TEX_COORD_X (mat, 0),
-		      COMP_TEX_COORD_Y (mat, sTex->height));
-	glVertex2f (0, snowSize * sTex->height / sTex->width);
-	glTexCoord2f (COMP_TEX_COORD_X (mat, sTex->width),
-		      COMP_TEX_COORD_Y (mat, sTex->height));
-	glVertex2f (snowSize, snowSize * sTex->height / sTex->width);
-	glTexCoord2f (COMP_TEX_COORD_X (mat, sTex->width),
-		      COMP_TEX_COORD_Y (mat, 0));
-	glVertex2f (snowSize, 0);
-
-	glEnd ();
-	glEndList ();
+    for (i = 0; i < ss->particles.numParticles; i++)
+	setSnowflakeTexture (ss, snowFlake++);
 
-	count++;
-    }
+    /* flakes may have changed size, stepping only damages the new ones */
+    damageScreen (s);
+}
 
-    ss->snowTexturesLoaded = count;
-    if (count < sd->snowTexNFiles)
-	ss->snowTex = realloc (ss->snowTex, sizeof (SnowTexture) * count);
+static void
+updateSnowTextures (CompScreen *s)
+{
+    SNOW_SCREEN (s);
+    SNOW_DISPLAY (s->display);
 
-    for (i = 0; i < numFlakes; i++)
-	setSnowflakeTexture (ss, snowFlake++);
+    spriteAtlasLoad (&ss->atlas, sd->snowTexFiles, sd->snowTexNFiles);
 }
 
 static Bool
@@ -514,27 +630,33 @@ snowInitScreen (CompPlugin *p,
     s->base.privates[sd->screenPrivateIndex].ptr = ss;
 
     ss->s = s;
-    ss->snowTexturesLoaded = 0;
-    ss->snowTex = NULL;
+    spriteAtlasInit (s, &ss->atlas, "snow", snowTexturesLoaded);
     ss->active = FALSE;
-    ss->displayListNeedsUpdate = FALSE;
+    ss->vertices = NULL;
+    ss->texCoords = NULL;
+    ss->arraySize = 0;
+    ss->damageTiles = NULL;
+    ss->nDamageTiles = 0;
+
+    particlesInit (&ss->particles);
 
     ss->allSnowFlakes = snowFlake = malloc (numFlakes * sizeof (SnowFlake));
-    if (!snowFlake)
+    if (!snowFlake || !particlesResize (&ss->particles, numFlakes))
     {
+	if (snowFlake)
+	    free (snowFlake);
 	free (ss);
 	return FALSE;
     }
 
     for (i = 0; i < numFlakes; i++)
     {
-	initiateSnowFlake (ss, snowFlake);
+	initiateSnowFlake (ss, i);
 	setSnowflakeTexture (ss, snowFlake);
 	snowFlake++;
     }
 
     updateSnowTextures (s);
-    setupDisplayList (ss);
 
     WRAP (ss, s, paintOutput, snowPaintOutput);
     WRAP (ss, s, drawWindow, snowDrawWindow);
@@ -552,24 +674,24 @@ static void
 snowFiniScreen (CompPlugin *p,
 		CompScreen *s)
 {
-    int i;
-
     SNOW_SCREEN (s);
 
     if (ss->timeoutHandle)
 	compRemoveTimeout (ss->timeoutHandle);
 
-    for (i = 0; i < ss->snowTexturesLoaded; i++)
-    {
-	finiTexture (s, &ss->snowTex[i].tex);
-	glDeleteLists (ss->snowTex[i].dList, 1);
-    }
-
-    if (ss->snowTex)
-	free (ss->snowTex);
+    spriteAtlasFini (s, &ss->atlas);
 
     if (ss->allSnowFlakes)
 	free (ss->allSnowFlakes);
+    particlesFini (&ss->particles);
+
+    if (ss->vertices)
+	free (ss->vertices);
+    if (ss->texCoords)
+	free (ss->texCoords);
+
+    if (ss->damageTiles)
+	free (ss->damageTiles);
 
     UNWRAP (ss, s, paintOutput);
     UNWRAP (ss, s, drawWindow);
@@ -590,12 +712,9 @@ snowDisplayOptionChanged (CompDisplay        *d,
 	{
 	    CompScreen *s;
 
+	    /* the flakes are sized when drawn, the atlas stays as it is */
 	    for (s = d->screens; s; s = s->next)
-	    {
-		SNOW_SCREEN (s);
-		ss->displayListNeedsUpdate = TRUE;
-		updateSnowTextures (s);
-	    }
+		damageScreen (s);
 	}
 	break;
     case SnowDisplayOptionSnowUpdateDelay:
@@ -627,14 +746,20 @@ snowDisplayOptionChanged (CompDisplay        *d,
 		SNOW_SCREEN (s);
 		ss->allSnowFlakes = realloc (ss->allSnowFlakes,
 					     numFlakes * sizeof (SnowFlake));
+		if (!ss->allSnowFlakes ||
+		    !particlesResize (&ss->particles, numFlakes))
+		    particlesResize (&ss->particles, 0);
+
 		snowFlake = ss->allSnowFlakes;
 
-		for (i = 0; i < numFlakes; i++)
+		for (i = 0; i < ss->particles.numParticles; i++)
 		{
-		    initiateSnowFlake (ss, snowFlake);
+		    initiateSnowFlake (ss, i);
 		    setSnowflakeTexture (ss, snowFlake);
 		    snowFlake++;
 		}
+
+		damageScreen (s);
 	    }
 	}
 	break;
@@ -659,7 +784,6 @@ snowDisplayOptionChanged (CompDisplay        *d,
 	    {
 		SNOW_SCREEN (s);
 		ss->active = snowGetDefaultEnabled(s->display);
-		ss->displayListNeedsUpdate = TRUE;
 		damageScreen (s);
 	    }
 	}
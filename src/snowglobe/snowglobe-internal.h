@@ -77,6 +77,9 @@ typedef struct _Water
 
     float    wave1;
     float    wave2;
+
+    Bool     still;   /* heights and normals are set for still water */
+    float    stillBh;
 }
 Water;
 
@@ -209,6 +209,8 @@ genWater (int size, int sDiv, float distance, float bottom)
     w->wave1 = 0.0;
     w->wave2 = 0.0;
 
+    w->still = FALSE;
+
     w->vertices = calloc (1,sizeof (Vertex) * w->nVertices);
     if (!w->vertices)
     {
@@ -310,14 +312,24 @@ setAmplitude (Vertex *v,
 void
 updateHeight (Water  *w)
 {
-    int i;
+    int  i;
+    Bool still;
 
     if (!w)
 	return;
 
+    /* without waves the heights only depend on bh */
+    still = (w->wa == 0.0f && w->swa == 0.0f);
+
+    if (still && w->still && w->stillBh == w->bh)
+	return;
+
     for (i = 0; i < w->nSVer + (w->nWVer / 2); i++)
         setAmplitude(&w->vertices[i], w->bh, w->wave1, w->wave2, w->wa,
 		     w->swa, w->wf, w->swf);
+
+    w->still   = still;
+    w->stillBh = w->bh;
 }
 
 void
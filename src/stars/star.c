@@ -39,9 +39,12 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include <compiz-core.h>
+#include <compiz-particles.h>
+#include <compiz-sprite-atlas.h>
 #include "star_options.h"
 
 #define GET_SNOW_DISPLAY(d)                            \
@@ -69,25 +72,10 @@ typedef struct _SnowDisplay
     CompOptionValue *snowTexFiles;
 } SnowDisplay;
 
-typedef struct _SnowTexture
-{
-    CompTexture tex;
-
-    unsigned int width;
-    unsigned int height;
-
-    Bool   loaded;
-    GLuint dList;
-} SnowTexture;
-
+/* position and speed of a star live in the particle system */
 typedef struct _SnowFlake
 {
-    float x, y, z;
-    float xs, ys, zs;
-    float ra; /* rotation angle */
-    float rs; /* rotation speed */
-
-    SnowTexture *tex;
+    SpriteAtlasSprite *tex;
 } SnowFlake;
 
 typedef struct _SnowScreen
@@ -101,18 +89,21 @@ typedef struct _SnowScreen
     PaintOutputProc paintOutput;
     DrawWindowProc  drawWindow;
 
-    SnowTexture *snowTex;
-    int         snowTexturesLoaded;
+    SpriteAtlas atlas;  /* all star textures */
+
+    GLfloat *vertices;  /* quads of all stars */
+    GLfloat *texCoords;
+    int     arraySize;  /* stars the arrays have room for */
 
     GLuint displayList;
     Bool   displayListNeedsUpdate;
 
-    SnowFlake *allSnowFlakes;
+    SnowFlake      *allSnowFlakes;
+    ParticleSystem particles;
 } SnowScreen;
 
 /* some forward declarations */
-static void initiateSnowFlake (SnowScreen * ss, SnowFlake * sf);
-static void snowMove (CompDisplay *d, SnowFlake * sf);
+static void initiateSnowFlake (SnowScreen * ss, int i);
 
 int GetRand(int min, int max);
 int GetRand(int min, int max)
@@ -131,61 +122,41 @@ float bezierCurve(float p, float time) {
     return out;
 }
 
-static void
-snowThink (SnowScreen *ss,
-	   SnowFlake  *sf)
-{
-    int boxing;
-
-    boxing = starGetScreenBoxing (ss->s->display);
-
-    if (sf->y >= ss->s->height + boxing ||
-	sf->x <= -boxing ||
-	sf->y >= ss->s->width + boxing ||
-	sf->z <= -((float) starGetScreenDepth (ss->s->display) / 500.0) ||
-	sf->z >= 1)
-    {
-	initiateSnowFlake (ss, sf);
-    }
-    snowMove (ss->s->display, sf);
-}
-
-static void
-snowMove (CompDisplay *d,
-	  SnowFlake   *sf)
-{
-    float tmp = 1.0f / (100.0f - starGetSnowSpeed (d));
-    int   snowUpdateDelay = starGetSnowUpdateDelay (d);
-
-    float xs = bezierCurve(sf->xs, tmp);
-    float ys = bezierCurve(sf->ys, tmp);
-    float zs = bezierCurve(sf->zs, tmp);
-
-    sf->x += (float)(xs * (double)snowUpdateDelay) / (100 - (tmp + 0.5));
-    sf->y += (float)(ys * (double)snowUpdateDelay) / (100 - (tmp + 0.5));
-    sf->z += (float)(zs * (double)snowUpdateDelay) / (100 - (tmp + 0.5));
-
-}
-
 static Bool
 stepSnowPositions (void *closure)
 {
-    CompScreen *s = closure;
-    int        i, numFlakes;
-    SnowFlake  *snowFlake;
-    Bool       onTop;
+    CompScreen     *s = closure;
+    ParticleSystem *ps;
+    ParticleBounds bounds;
+    int            i, nDead, boxing, snowUpdateDelay;
+    float          tmp;
+    Bool           onTop;
 
     SNOW_SCREEN (s);
 
     if (!ss->active)
 	return TRUE;
 
-    snowFlake = ss->allSnowFlakes;
-    numFlakes = starGetNumSnowflakes (s->display);
+    ps = &ss->particles;
     onTop = starGetSnowOverWindows (s->display);
+    boxing = starGetScreenBoxing (s->display);
+    snowUpdateDelay = starGetSnowUpdateDelay (s->display);
+    tmp = 1.0f / (100.0f - starGetSnowSpeed (s->display));
+
+    bounds.x1 = -boxing;
+    bounds.x2 = FLT_MAX;
+    bounds.y1 = -FLT_MAX;
+    bounds.y2 = MIN (s->height, s->width) + boxing;
+    bounds.z1 = -((float) starGetScreenDepth (s->display) / 500.0);
+    bounds.z2 = 1.0f;
 
-    for (i = 0; i < numFlakes; i++)
-	snowThink(ss, snowFlake++);
+    nDead = particlesFindDead (ps, &bounds);
+    for (i = 0; i < nDead; i++)
+	initiateSnowFlake (ss, ps->dead[i]);
+
+    /* the speed curve scales linearly, so it is folded into the step */
+    particlesIntegrate (ps, bezierCurve (1.0f, tmp) * snowUpdateDelay /
+			(100 - (tmp + 0.5)), 0.0f, 0.0f);
 
     if (ss->active && !onTop)
     {
@@ -253,6 +224,30 @@ setupDisplayList (SnowScreen *ss)
     glEndList ();
 }
 
+static Bool
+ensureSnowArrays (SnowScreen *ss,
+		  int        numFlakes)
+{
+    GLfloat *vertices, *texCoords;
+
+    if (numFlakes <= ss->arraySize)
+	return TRUE;
+
+    vertices = realloc (ss->vertices, numFlakes * 12 * sizeof (GLfloat));
+    if (!vertices)
+	return FALSE;
+    ss->vertices = vertices;
+
+    texCoords = realloc (ss->texCoords, numFlakes * 8 * sizeof (GLfloat));
+    if (!texCoords)
+	return FALSE;
+    ss->texCoords = texCoords;
+
+    ss->arraySize = numFlakes;
+
+    return TRUE;
+}
+
 static void
 beginRendering (SnowScreen *ss,
 		CompScreen *s)
@@ -269,71 +264,49 @@ beginRendering (SnowScreen *ss,
     }
 
     glColor4f (1.0, 1.0, 1.0, 1.0);
-    if (ss->snowTexturesLoaded && starGetUseTextures (s->display))
+    if (ss->atlas.nLoaded && starGetUseTextures (s->display) &&
+	ensureSnowArrays (ss, ss->particles.numParticles))
     {
+	/* all star textures are in one atlas, so this is a single draw */
+	ParticleSystem *ps = &ss->particles;
+	SnowFlake      *snowFlake = ss->allSnowFlakes;
+	float          snowSize = starGetSnowSize (s->display);
+	int            i, n = 0;
 
-		int j = 0;
+	for (i = 0; i < ps->numParticles; i++, snowFlake++)
+	{
+	    SpriteAtlasSprite *sprite = snowFlake->tex;
 
-		for (j = 0; j < ss->snowTexturesLoaded; j++)
-		{
+	    if (!sprite)
+		continue;
 
-			int i, numFlakes = starGetNumSnowflakes (s->display);
-			SnowFlake *snowFlake = ss->allSnowFlakes;
-			enableTexture (ss->s, &ss->snowTex[j].tex, COMP_TEXTURE_FILTER_GOOD);
-
-			for (i = 0; i < numFlakes; i++)
-			{
-				if (snowFlake->tex == &ss->snowTex[j])
-				{
-					glTranslatef(snowFlake->x, snowFlake->y, snowFlake->z);
-					glCallList(ss->snowTex[j].dList);
-					glTranslatef(-snowFlake->x, -snowFlake->y, -snowFlake->z);
-				}
-				snowFlake++;
-			}
-			disableTexture (ss->s, &ss->snowTex[j].tex);
-		}
-	/*int j;
-
-	for (j = 0; j < ss->snowTexturesLoaded; j++)
-	{
-	    SnowFlake *snowFlake = ss->allSnowFlakes;
-	    int       i, numFlakes = snowGetNumSnowflakes (s->display);
-	    Bool      snowRotate = snowGetSnowRotation (s->display);
+	    spriteQuad (ss->vertices + n * 12, ps->x[i], ps->y[i], ps->z[i],
+			snowSize, snowSize * sprite->height / sprite->width,
+			0.0f);
+	    memcpy (ss->texCoords + n * 8, sprite->texCoords,
+		    sizeof (sprite->texCoords));
+	    n++;
+	}
 
-	    enableTexture (ss->s, &ss->snowTex[j].tex,
-			   COMP_TEXTURE_FILTER_GOOD);
+	glVertexPointer (3, GL_FLOAT, 0, ss->vertices);
+	glTexCoordPointer (2, GL_FLOAT, 0, ss->texCoords);
 
-	    for (i = 0; i < numFlakes; i++)
-	    {
-		if (snowFlake->tex == &ss->snowTex[j])
-		{
-		    glTranslatef (snowFlake->x, snowFlake->y, snowFlake->z);
-		    if (snowRotate)
-			glRotatef (snowFlake->ra, 0, 0, 1);
-		    glCallList (ss->snowTex[j].dList);
-		    if (snowRotate)
-			glRotatef (-snowFlake->ra, 0, 0, 1);
-		    glTranslatef (-snowFlake->x, -snowFlake->y, -snowFlake->z);
-		}
-		snowFlake++;
-	    }
-	    disableTexture (ss->s, &ss->snowTex[j].tex);
-	}*/
+	enableTexture (ss->s, &ss->atlas.texture, COMP_TEXTURE_FILTER_GOOD);
+	glDrawArrays (GL_QUADS, 0, n * 4);
+	disableTexture (ss->s, &ss->atlas.texture);
     }
     else
     {
-	SnowFlake *snowFlake = ss->allSnowFlakes;
-	int       i, numFlakes = starGetNumSnowflakes (s->display);
+	ParticleSystem *ps = &ss->particles;
+	int            i;
 
-	for (i = 0; i < numFlakes; i++)
+	for (i = 0; i < ps->numParticles; i++)
 	{
-	    glTranslatef (snowFlake->x, snowFlake->y, snowFlake->z);
-	    glRotatef (snowFlake->ra, 0, 0, 1);
+	    glTranslatef (ps->x[i], ps->y[i], ps->z[i]);
+	    glRotatef (ps->ra[i], 0, 0, 1);
 	    glCallList (ss->displayList);
-	    glRotatef (-snowFlake->ra, 0, 0, 1);
-	    glTranslatef (-snowFlake->x, -snowFlake->y, -snowFlake->z);
-	    snowFlake++;
+	    glRotatef (-ps->ra[i], 0, 0, 1);
+	    glTranslatef (-ps->x[i], -ps->y[i], -ps->z[i]);
 	}
     }
 
@@ -409,25 +382,31 @@ snowDrawWindow (CompWindow           *w,
 
 static void
 initiateSnowFlake (SnowScreen *ss,
-		   SnowFlake  *sf)
+		   int        i)
 {
     /* TODO: possibly place snowflakes based on FOV, instead of a cube. */
     //int boxing = starGetScreenBoxing (ss->s->display);
-    float init;
+    ParticleSystem *ps = &ss->particles;
+    float          init;
 
 	// speed of star
-	sf->xs = mmrand(-50000, 50000, 5000);
-	sf->ys = mmrand(-50000, 50000, 5000);
-	sf->zs = mmrand(000, 200, 2000);
+	ps->xs[i] = mmrand(-50000, 50000, 5000);
+	ps->ys[i] = mmrand(-50000, 50000, 5000);
+	ps->zs[i] = mmrand(000, 200, 2000);
 
 	//TODO: possibly place stars based on FOV, instead of a cube.
-	sf->x = ss->s->width * .5 + starGetStarOffsetX (ss->s->display); // X Offset
-	sf->y = ss->s->height * .5 + starGetStarOffsetY (ss->s->display); // Y Offset
-	sf->z = mmrand(000, 0.1, 5000);
+	ps->x[i] = ss->s->width * .5 + starGetStarOffsetX (ss->s->display); // X Offset
+	ps->y[i] = ss->s->height * .5 + starGetStarOffsetY (ss->s->display); // Y Offset
+	ps->z[i] = mmrand(000, 0.1, 5000);
 	init = mmrand(0,100, 1); //init = distance to center of the screen
 
-	sf->x += init * sf->xs;
-	sf->y += init * sf->ys;
+	ps->x[i] += init * ps->xs[i];
+	ps->y[i] += init * ps->ys[i];
+
+	ps->ra[i] = 0.0;
+	ps->rs[i] = 0.0;
+	ps->age[i] = 0.0;
+	ps->lifespan[i] = FLT_MAX;
 
    /* switch (snowGetSnowDirection (ss->s->display))
     {
@@ -469,86 +448,37 @@ static void
 setSnowflakeTexture (SnowScreen *ss,
 		     SnowFlake  *sf)
 {
-    if (ss->snowTexturesLoaded)
-	sf->tex = &ss->snowTex[rand () % ss->snowTexturesLoaded];
+    if (ss->atlas.nLoaded)
+	sf->tex = spriteAtlasGetLoaded (&ss->atlas, 0, ss->atlas.nSprites,
+					rand () % ss->atlas.nLoaded);
+    else
+	sf->tex = NULL;
 }
 
+/* gives every star a texture of the new atlas */
 static void
-updateSnowTextures (CompScreen *s)
+snowTexturesLoaded (CompScreen *s)
 {
-    int       i, count = 0;
-    float     snowSize = starGetSnowSize(s->display);
-    int       numFlakes = starGetNumSnowflakes(s->display);
+    int       i;
     SnowFlake *snowFlake;
 
     SNOW_SCREEN (s);
-    SNOW_DISPLAY (s->display);
 
     snowFlake = ss->allSnowFlakes;
 
-    for (i = 0; i < ss->snowTexturesLoaded; i++)
-    {
-	finiTexture (s, &ss->snowTex[i].tex);
-	glDeleteLists (ss->snowTex[i].dList, 1);
-    }
-
-    if (ss->snowTex)
-	free (ss->snowTex);
-    ss->snowTexturesLoaded = 0;
-
-    ss->snowTex = calloc (1, sizeof (SnowTexture) * sd->snowTexNFiles);
-
-    for (i = 0; i < sd->snowTexNFiles; i++)
-    {
-	CompMatrix  *mat;
-	SnowTexture *sTex;
-
-	ss->snowTex[count].loaded =
-	    readImageToTexture (s, &ss->snowTex[count].tex,
-				sd->snowTexFiles[i].s,
-				&ss->snowTex[count].width,
-				&ss->snowTex[count].height);
-	if (!ss->snowTex[count].loaded)
-	{
-	    compLogMessage ("snow", CompLogLevelWarn,
-			    "Texture not found : %s", sd->snowTexFiles[i].s);
-	    continue;
-	}
-	compLogMessage ("snow", CompLogLevelInfo,
-			"Loaded Texture %s", sd->snowTexFiles[i].s);
-
-	mat = &ss->snowTex[count].tex.matrix;
-	sTex = &ss->snowTex[count];
-
-	sTex->dList = glGenLists (1);
-	glNewList (sTex->dList, GL_COMPILE);
-
-	glBegin (GL_QUADS);
-
-	glTexCoord2f (COMP_TEX_COORD_X (mat, 0), COMP_TEX_COORD_Y (mat, 0));
-	glVertex2f (0, 0);
-	glTexCoord2f (COMP_TEX_COORD_X (mat, 0),
-		      COMP_TEX_COORD_Y (mat, sTex->height));
-	glVertex2f (0, snowSize * sTex->height / sTex->width);
-	glTexCoord2f (COMP_TEX_COORD_X (mat, sTex->width),
-		      COMP_TEX_COORD_Y (mat, sTex->height));
-	glVertex2f (snowSize, snowSize * sTex->height / sTex->width);
-	glTexCoord2f (COMP_TEX_COORD_X (mat, sTex->width),
-		      COMP_TEX_COORD_Y (mat, 0));
-	glVertex2f (snowSize, 0);
-
-	glEnd ();
-	glEndList ();
+    for (i = 0; i < ss->particles.numParticles; i++)
+	setSnowflakeTexture (ss, snowFlake++);
 
-	count++;
-    }
+    damageScreen (s);
+}
 
-    ss->snowTexturesLoaded = count;
-    if (count < sd->snowTexNFiles)
-	ss->snowTex = realloc (ss->snowTex, sizeof (SnowTexture) * count);
+static void
+updateSnowTextures (CompScreen *s)
+{
+    SNOW_SCREEN (s);
+    SNOW_DISPLAY (s->display);
 
-    for (i = 0; i < numFlakes; i++)
-	setSnowflakeTexture (ss, snowFlake++);
+    spriteAtlasLoad (&ss->atlas, sd->snowTexFiles, sd->snowTexNFiles);
 }
 
 static Bool
@@ -566,16 +496,22 @@ snowInitScreen (CompPlugin *p,
     s->base.privates[sd->screenPrivateIndex].ptr = ss;
 
     ss->s = s;
-    ss->snowTexturesLoaded = 0;
-    ss->snowTex = NULL;
+    spriteAtlasInit (s, &ss->atlas, "star", snowTexturesLoaded);
+    ss->vertices = NULL;
+    ss->texCoords = NULL;
+    ss->arraySize = 0;
     ss->active = FALSE;
     ss->displayListNeedsUpdate = FALSE;
 
+    particlesInit (&ss->particles);
+
     ss->allSnowFlakes = snowFlake = malloc (numFlakes * sizeof (SnowFlake));
+    if (!snowFlake || !particlesResize (&ss->particles, numFlakes))
+	particlesResize (&ss->particles, 0);
 
-    for (i = 0; i < numFlakes; i++)
+    for (i = 0; i < ss->particles.numParticles; i++)
     {
-	initiateSnowFlake (ss, snowFlake);
+	initiateSnowFlake (ss, i);
 	setSnowflakeTexture (ss, snowFlake);
 	snowFlake++;
     }
@@ -596,24 +532,21 @@ static void
 snowFiniScreen (CompPlugin *p,
 		CompScreen *s)
 {
-    int i;
-
     SNOW_SCREEN (s);
 
     if (ss->timeoutHandle)
 	compRemoveTimeout (ss->timeoutHandle);
 
-    for (i = 0; i < ss->snowTexturesLoaded; i++)
-    {
-	finiTexture (s, &ss->snowTex[i].tex);
-	glDeleteLists (ss->snowTex[i].dList, 1);
-    }
+    spriteAtlasFini (s, &ss->atlas);
 
-    if (ss->snowTex)
-	free (ss->snowTex);
+    if (ss->vertices)
+	free (ss->vertices);
+    if (ss->texCoords)
+	free (ss->texCoords);
 
     if (ss->allSnowFlakes)
 	free (ss->allSnowFlakes);
+    particlesFini (&ss->particles);
 
     UNWRAP (ss, s, paintOutput);
     UNWRAP (ss, s, drawWindow);
@@ -638,7 +571,7 @@ snowDisplayOptionChanged (CompDisplay        *d,
 	    {
 		SNOW_SCREEN (s);
 		ss->displayListNeedsUpdate = TRUE;
-		updateSnowTextures (s);
+		damageScreen (s);
 	    }
 	}
 	break;
@@ -670,11 +603,15 @@ snowDisplayOptionChanged (CompDisplay        *d,
 		SNOW_SCREEN (s);
 		ss->allSnowFlakes = realloc (ss->allSnowFlakes,
 					     numFlakes * sizeof (SnowFlake));
+		if (!ss->allSnowFlakes ||
+		    !particlesResize (&ss->particles, numFlakes))
+		    particlesResize (&ss->particles, 0);
+
 		snowFlake = ss->allSnowFlakes;
 
-		for (i = 0; i < numFlakes; i++)
+		for (i = 0; i < ss->particles.numParticles; i++)
 		{
-		    initiateSnowFlake (ss, snowFlake);
+		    initiateSnowFlake (ss, i);
 		    setSnowflakeTexture (ss, snowFlake);
 		    snowFlake++;
 		}
@@ -92,6 +92,30 @@ typedef struct _Particle
     float g;			// Gravity from this particle
 } Particle;
 
+typedef struct _GSource
+{
+    float x;			// X position
+    float y;			// Y position
+    float m;			// Gravity of the particle, scaled by its age
+} GSource;
+
+// Square of the Barnes-Hut tree over the particles that have gravity
+typedef struct _GNode
+{
+    float x;			// X position of the lower left corner
+    float y;			// Y position of the lower left corner
+    float size;			// Side of the square
+    float m[2];			// Summed attracting (0) and repulsing (1) gravity
+    float cx[2];		// X position of their centers
+    float cy[2];		// Y position of their centers
+    int   first;		// First source in the square
+    int   count;		// Number of sources in the square
+    int   child;		// First of the four child squares, -1 for leaves
+} GNode;
+
+#define GTREE_LEAF_SIZE 8	// Sources in a square that is not divided
+#define GTREE_MAX_DEPTH 16	// Also ends division of coincident sources
+
 typedef struct _Emitter
 {
     Bool  set_active;		// Set to active in the settings
@@ -136,10 +160,12 @@ typedef struct _ParticleSystem
     int      hardLimit;		// Not to be exceeded
     int      softLimit;		// If exceeded, old particles age faster
     int      lastCount;		// Living particle count to evaluate softLimit
+    int      numAlive;		// Living particles, kept at the front
     float    tnew;		// Particle is new if t > tnew
     float    told;		// Particle is old if t < told
     float    gx;		// Global gravity x
     float    gy;		// Global gravity y
+    float    gtheta;		// Opening angle of particle gravity squares
     Particle *particles;	// The actual particles
     GLuint   tex;		// Particle Texture
     Bool     active;
@@ -158,6 +184,12 @@ typedef struct _ParticleSystem
     int     color_cache_count;
     GLfloat *dcolors_cache;
     int     dcolors_cache_count;
+
+    GSource *gsources;		// Particles that have gravity, tree order
+    int     gsource_count;
+    GNode   *gnodes;		// Squares of the tree, the first is the root
+    int     gnode_count;
+    int     gnode_used;
 } ParticleSystem;
 
 static int displayPrivateIndex = 0;
@@ -194,6 +226,7 @@ initParticles (int hardLimit, int softLimit, ParticleSystem * ps)
     ps->softLimit    = softLimit;
     ps->active       = FALSE;
     ps->lastCount    = 0;
+    ps->numAlive     = 0;
 
     // Initialize cache
     ps->vertices_cache      = NULL;
@@ -205,6 +238,12 @@ initParticles (int hardLimit, int softLimit, ParticleSystem * ps)
     ps->coords_cache_count  = 0;
     ps->dcolors_cache_count = 0;
 
+    ps->gsources      = NULL;
+    ps->gnodes        = NULL;
+    ps->gsource_count = 0;
+    ps->gnode_count   = 0;
+    ps->gnode_used    = 0;
+
     Particle *part = ps->particles;
     int i;
     for (i = 0; i < hardLimit; i++, part++)
@@ -496,76 +535,73 @@ drawParticles (CompScreen * s, ParticleSystem * ps)
 
     Particle *part = ps->particles;
     int i;
-    for (i = 0; i < ps->hardLimit; i++, part++)
+    for (i = 0; i < ps->numAlive; i++, part++)
     {
-	if (part->t > 0.0f)
-	{
-	    numActive += 4;
+	numActive += 4;
 
-	    float cOff = part->s / 2.;		//Corner offset from center
+	float cOff = part->s / 2.;		//Corner offset from center
 
-	    if (part->t > ps->tnew)		//New particles start larger
-		cOff += (part->snew - part->s) * (part->t - ps->tnew)
-			/ (1. - ps->tnew) / 2.;
-	    else if (part->t < ps->told)	//Old particles shrink
-		cOff -= part->s * (ps->told - part->t) / ps->told / 2.;
+	if (part->t > ps->tnew)		//New particles start larger
+	    cOff += (part->snew - part->s) * (part->t - ps->tnew)
+		    / (1. - ps->tnew) / 2.;
+	else if (part->t < ps->told)	//Old particles shrink
+	    cOff -= part->s * (ps->told - part->t) / ps->told / 2.;
 
-	    //Offsets after rotation of Texture
-	    float offA = cOff * (cos (part->phi) - sin (part->phi));
-	    float offB = cOff * (cos (part->phi) + sin (part->phi));
+	//Offsets after rotation of Texture
+	float offA = cOff * (cos (part->phi) - sin (part->phi));
+	float offB = cOff * (cos (part->phi) + sin (part->phi));
 
-	    vertices[0] = part->x - offB;
-	    vertices[1] = part->y - offA;
-	    vertices[2] = 0;
+	vertices[0] = part->x - offB;
+	vertices[1] = part->y - offA;
+	vertices[2] = 0;
 
-	    vertices[3] = part->x - offA;
-	    vertices[4] = part->y + offB;
-	    vertices[5] = 0;
+	vertices[3] = part->x - offA;
+	vertices[4] = part->y + offB;
+	vertices[5] = 0;
 
-	    vertices[6] = part->x + offB;
-	    vertices[7] = part->y + offA;
-	    vertices[8] = 0;
+	vertices[6] = part->x + offB;
+	vertices[7] = part->y + offA;
+	vertices[8] = 0;
 
-	    vertices[9]  = part->x + offA;
-	    vertices[10] = part->y - offB;
-	    vertices[11] = 0;
+	vertices[9]  = part->x + offA;
+	vertices[10] = part->y - offB;
+	vertices[11] = 0;
 
-	    vertices += 12;
+	vertices += 12;
 
-	    memcpy (coords, cornerCoords, cornersSize);
+	memcpy (coords, cornerCoords, cornersSize);
 
-	    coords += 8;
+	coords += 8;
 
-	    colors[0] = part->c[0];
-	    colors[1] = part->c[1];
-	    colors[2] = part->c[2];
+	colors[0] = part->c[0];
+	colors[1] = part->c[1];
+	colors[2] = part->c[2];
 
-	    if (part->t > ps->tnew)		//New particles start at a == 1
-		colors[3] = part->a + (1. - part->a) * (part->t - ps->tnew)
-					/ (1. - ps->tnew);
-	    else if (part->t < ps->told)	//Old particles fade to a = 0
-		colors[3] = part->a * part->t / ps->told;
-	    else				//The others have their own a
-		colors[3] = part->a;
+	if (part->t > ps->tnew)		//New particles start at a == 1
+	    colors[3] = part->a + (1. - part->a) * (part->t - ps->tnew)
+				    / (1. - ps->tnew);
+	else if (part->t < ps->told)	//Old particles fade to a = 0
+	    colors[3] = part->a * part->t / ps->told;
+	else				//The others have their own a
+	    colors[3] = part->a;
 
-	    memcpy (colors + 4, colors, colorSize);
-	    memcpy (colors + 8, colors, colorSize);
-	    memcpy (colors + 12, colors, colorSize);
+	memcpy (colors + 4, colors, colorSize);
+	memcpy (colors + 8, colors, colorSize);
+	memcpy (colors + 12, colors, colorSize);
 
-	    colors += 16;
+	colors += 16;
 
-	    if (ps->darken > 0)
-	    {
-		dcolors[0] = colors[0];
-		dcolors[1] = colors[1];
-		dcolors[2] = colors[2];
-		dcolors[3] = colors[3] * ps->darken;
-		memcpy (dcolors + 4, dcolors, colorSize);
-		memcpy (dcolors + 8, dcolors, colorSize);
-		memcpy (dcolors + 12, dcolors, colorSize);
-
-		dcolors += 16;
-	    }
+	if (ps->darken > 0)
+	{
+	    dcolors[0] = colors[0];
+	    dcolors[1] = colors[1];
+	    dcolors[2] = colors[2];
+	    dcolors[3] = colors[3] * ps->darken;
+	    memcpy (dcolors + 4, dcolors, colorSize);
+	    memcpy (dcolors + 8, dcolors, colorSize);
+	    memcpy (dcolors + 12, dcolors, colorSize);
+
+	    dcolors += 16;
 	}
     }
 
@@ -598,6 +634,178 @@ drawParticles (CompScreen * s, ParticleSystem * ps)
     glDisable (GL_BLEND);
 }
 
+// Returns the first of count new squares, or -1
+static int
+newGNodes (ParticleSystem *ps, int count)
+{
+    int n = ps->gnode_used;
+
+    if (n + count > ps->gnode_count)
+    {
+	int   size = MAX (ps->gnode_count * 2, n + count + 256);
+	GNode *nodes = realloc (ps->gnodes, size * sizeof (GNode));
+
+	if (!nodes)
+	    return -1;
+
+	ps->gnodes      = nodes;
+	ps->gnode_count = size;
+    }
+
+    ps->gnode_used += count;
+
+    return n;
+}
+
+// Moves the sources below split on the axis (0 x, 1 y) to the front
+static int
+partitionGSources (GSource *src, int count, int axis, float split)
+{
+    GSource tmp;
+    int     i = 0, j = count - 1;
+
+    while (i <= j)
+    {
+	if ((axis ? src[i].y : src[i].x) < split)
+	{
+	    i++;
+	}
+	else
+	{
+	    tmp    = src[i];
+	    src[i] = src[j];
+	    src[j] = tmp;
+	    j--;
+	}
+    }
+
+    return i;
+}
+
+static void
+buildGTree (ParticleSystem *ps, int n, int depth)
+{
+    GNode   *node = &ps->gnodes[n];
+    GSource *src = ps->gsources + node->first;
+    float   x = node->x, y = node->y, half = node->size / 2;
+    int     i, k, c, below, split[5];
+
+    for (k = 0; k < 2; k++)
+	node->m[k] = node->cx[k] = node->cy[k] = 0.0f;
+
+    for (i = 0; i < node->count; i++)
+    {
+	k = src[i].m < 0.0f;
+	node->m[k]  += src[i].m;
+	node->cx[k] += src[i].m * src[i].x;
+	node->cy[k] += src[i].m * src[i].y;
+    }
+
+    for (k = 0; k < 2; k++)
+    {
+	if (node->m[k] != 0.0f)
+	{
+	    node->cx[k] /= node->m[k];
+	    node->cy[k] /= node->m[k];
+	}
+    }
+
+    node->child = -1;
+    if (node->count <= GTREE_LEAF_SIZE || depth >= GTREE_MAX_DEPTH)
+	return;
+
+    // Quadrants are ordered lower left, lower right, upper left, upper right
+    below    = partitionGSources (src, node->count, 1, y + half);
+    split[0] = 0;
+    split[1] = partitionGSources (src, below, 0, x + half);
+    split[2] = below;
+    split[3] = below + partitionGSources (src + below, node->count - below,
+					  0, x + half);
+    split[4] = node->count;
+
+    c = newGNodes (ps, 4);
+    if (c < 0)
+	return;			// Stays a leaf, which is exact
+
+    node = &ps->gnodes[n];
+    node->child = c;
+
+    for (i = 0; i < 4; i++)
+    {
+	GNode *child = &ps->gnodes[c + i];
+
+	child->x     = x + (i & 1) * half;
+	child->y     = y + (i >> 1) * half;
+	child->size  = half;
+	child->first = node->first + split[i];
+	child->count = split[i + 1] - split[i];
+    }
+
+    for (i = 0; i < 4; i++)
+	if (ps->gnodes[c + i].count)
+	    buildGTree (ps, c + i, depth + 1);
+}
+
+static inline void
+addGravity (Particle *part, float x, float y, float m, float *ax, float *ay)
+{
+    float dx = x - part->x;
+    float dy = y - part->y;
+    float d2 = dx * dx + dy * dy;
+
+    // Strength m / dist towards (x, y), i.e. m / dist^2 times (dx, dy)
+    if (d2 > 1 && m != 0)
+    {
+	*ax += m * dx / d2;
+	*ay += m * dy / d2;
+    }
+}
+
+// Gravity of all sources on part, squares that are small enough from
+// where part is are taken as their centers
+static void
+applyGTree (ParticleSystem *ps, Particle *part, float time)
+{
+    int   stack[4 * GTREE_MAX_DEPTH + 4];
+    int   i, sp = 0;
+    float ax = 0.0f, ay = 0.0f;
+    float theta2 = ps->gtheta * ps->gtheta;
+
+    stack[sp++] = 0;
+    while (sp)
+    {
+	GNode *node = &ps->gnodes[stack[--sp]];
+
+	if (node->child >= 0)
+	{
+	    float dx = node->x + node->size / 2 - part->x;
+	    float dy = node->y + node->size / 2 - part->y;
+
+	    if (node->size * node->size < theta2 * (dx * dx + dy * dy))
+	    {
+		addGravity (part, node->cx[0], node->cy[0], node->m[0], &ax, &ay);
+		addGravity (part, node->cx[1], node->cy[1], node->m[1], &ax, &ay);
+	    }
+	    else
+	    {
+		for (i = 0; i < 4; i++)
+		    if (ps->gnodes[node->child + i].count)
+			stack[sp++] = node->child + i;
+	    }
+	}
+	else
+	{
+	    GSource *src = ps->gsources + node->first;
+
+	    for (i = 0; i < node->count; i++, src++)
+		addGravity (part, src->x, src->y, src->m, &ax, &ay);
+	}
+    }
+
+    part->vx += ax * time;
+    part->vy += ay * time;
+}
+
 static void
 updateParticles (ParticleSystem * ps, float time)
 {
@@ -605,79 +813,121 @@ updateParticles (ParticleSystem * ps, float time)
     int newCount = 0;
     Particle *part;
     GPoint *gi;
-    float gdist, gangle;
+    float gdx, gdy, gdist2;
     ps->active = FALSE;
 
-    part = ps->particles;
-    for (i = 0; i < ps->hardLimit; i++, part++)
+    for (i = 0; i < ps->numAlive;)
     {
-	if (part->t > 0.0f)
+	part = &ps->particles[i];
+
+	// move particle
+	part->x += part->vx * time;
+	part->y += part->vy * time;
+
+	// Rotation
+	part->phi += part->vphi*time;
+
+	//Aging of particles
+	part->t += part->vt * time;
+	//Additional aging of particles increases if softLimit is exceeded
+	if (ps->lastCount > ps->softLimit)
+	    part->t += part->vt * time * (ps->lastCount - ps->softLimit)
+				    / (ps->hardLimit - ps->softLimit);
+
+	//Global gravity
+	part->vx += ps->gx * time;
+	part->vy += ps->gy * time;
+
+	//GPoint gravity
+	gi = ps->g;
+	for (j = 0; j < ps->ng; j++, gi++)
 	{
-	    // move particle
-	    part->x += part->vx * time;
-	    part->y += part->vy * time;
-
-	    // Rotation
-	    part->phi += part->vphi*time;
-
-	    //Aging of particles
-	    part->t += part->vt * time;
-	    //Additional aging of particles increases if softLimit is exceeded
-	    if (ps->lastCount > ps->softLimit)
-		part->t += part->vt * time * (ps->lastCount - ps->softLimit)
-					/ (ps->hardLimit - ps->softLimit);
-
-	    //Global gravity
-	    part->vx += ps->gx * time;
-	    part->vy += ps->gy * time;
-
-	    //GPoint gravity
-	    gi = ps->g;
-	    for (j = 0; j < ps->ng; j++, gi++)
+	    if (gi->strength != 0)
 	    {
-		if (gi->strength != 0)
+		gdx = gi->x - part->x;
+		gdy = gi->y - part->y;
+		gdist2 = gdx * gdx + gdy * gdy;
+		if (gdist2 > 1)
 		{
-		    gdist = sqrt ((part->x-gi->x)*(part->x-gi->x)
-				    + (part->y-gi->y)*(part->y-gi->y));
-		    if (gdist > 1)
-		    {
-			gangle = atan2 (gi->y-part->y, gi->x-part->x);
-			part->vx += gi->strength / gdist * cos (gangle) * time;
-			part->vy += gi->strength / gdist * sin (gangle) * time;
-		    }
+		    part->vx += gi->strength * gdx / gdist2 * time;
+		    part->vy += gi->strength * gdy / gdist2 * time;
 		}
 	    }
+	}
+
+	ps->active  = TRUE;
+	newCount++;
 
-	    ps->active  = TRUE;
-	    newCount++;
+	//Dead particles are replaced by the last living one
+	if (part->t <= 0.0f)
+	{
+	    *part = ps->particles[--ps->numAlive];
+	    ps->particles[ps->numAlive].t = 0.0f;
 	}
+	else
+	    i++;
     }
     ps->lastCount = newCount;
 
     //Particle gravity
-    Particle *gpart;
+    if (ps->gsource_count < ps->hardLimit)
+    {
+	GSource *sources = realloc (ps->gsources,
+				    ps->hardLimit * sizeof (GSource));
+	if (!sources)
+	    return;
+	ps->gsources      = sources;
+	ps->gsource_count = ps->hardLimit;
+    }
+
+    GNode *root;
+    float x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+    int   n = 0;
+
     part = ps->particles;
-    for (i = 0; i < ps->hardLimit; i++, part++)
+    for (i = 0; i < ps->numAlive; i++, part++)
     {
-	if (part->t > 0.0f && part->g != 0)
+	if (part->g != 0)
 	{
-	    gpart = ps->particles;
-	    for (j = 0; j < ps->hardLimit; j++, gpart++)
+	    GSource *src = &ps->gsources[n];
+
+	    src->x = part->x;
+	    src->y = part->y;
+	    src->m = part->g * part->t;
+
+	    if (!n)
 	    {
-		if (gpart->t > 0.0f)
-		{
-		    gdist = sqrt ((part->x-gpart->x)*(part->x-gpart->x)
-				    + (part->y-gpart->y)*(part->y-gpart->y));
-		    if (gdist > 1)
-		    {
-			gangle = atan2 (part->y-gpart->y, part->x-gpart->x);
-			gpart->vx += part->g/gdist* cos (gangle) * part->t*time;
-			gpart->vy += part->g/gdist* sin (gangle) * part->t*time;
-		    }
-		}
+		x1 = x2 = src->x;
+		y1 = y2 = src->y;
 	    }
+	    x1 = MIN (x1, src->x);
+	    y1 = MIN (y1, src->y);
+	    x2 = MAX (x2, src->x);
+	    y2 = MAX (y2, src->y);
+
+	    n++;
 	}
     }
+
+    if (!n)
+	return;
+
+    ps->gnode_used = 0;
+    if (newGNodes (ps, 1) < 0)
+	return;
+
+    root = &ps->gnodes[0];
+    root->x     = x1;
+    root->y     = y1;
+    root->size  = MAX (MAX (x2 - x1, y2 - y1), 1.0f);
+    root->first = 0;
+    root->count = n;
+
+    buildGTree (ps, 0, 0);
+
+    part = ps->particles;
+    for (i = 0; i < ps->numAlive; i++, part++)
+	applyGTree (ps, part, time);
 }
 
 static void
@@ -696,6 +946,11 @@ finiParticles (ParticleSystem * ps)
 	free (ps->coords_cache);
     if (ps->dcolors_cache)
 	free (ps->dcolors_cache);
+
+    if (ps->gsources)
+	free (ps->gsources);
+    if (ps->gnodes)
+	free (ps->gnodes);
 }
 
 static void
@@ -705,93 +960,91 @@ genNewParticles (ParticleSystem *ps, Emitter *e)
     float q, p, t, h, l;
     int count = e->count;
 
-    Particle *part = ps->particles;
-    int i, j;
+    // Dead particles are behind the living ones
+    Particle *part = ps->particles + ps->numAlive;
+    int j;
 
     t = 0.0f;
 
-    for (i = 0; i < ps->hardLimit && count > 0; i++, part++)
+    for (; ps->numAlive < ps->hardLimit && count > 0; ps->numAlive++, part++)
     {
-	if (part->t <= 0.0f)
+	//Position
+	part->x = rRange (e->x, e->dx);		// X Position
+	part->y = rRange (e->y, e->dy);		// Y Position
+	if ((q = rRange (e->dcirc/2.,e->dcirc/2.)) > 0)
 	{
-	    //Position
-	    part->x = rRange (e->x, e->dx);		// X Position
-	    part->y = rRange (e->y, e->dy);		// Y Position
-	    if ((q = rRange (e->dcirc/2.,e->dcirc/2.)) > 0)
-	    {
-		p = rRange (0, M_PI);
-		part->x += q * cos (p);
-		part->y += q * sin (p);
-	    }
+	    p = rRange (0, M_PI);
+	    part->x += q * cos (p);
+	    part->y += q * sin (p);
+	}
 
-	    //Speed
-	    part->vx = rRange (e->vx, e->dvx);		// X Speed
-	    part->vy = rRange (e->vy, e->dvy);		// Y Speed
-	    if ((q = rRange (e->dvcirc/2.,e->dvcirc/2.)) > 0)
-	    {
-		p = rRange (0, M_PI);
-		part->vx += q * cos (p);
-		part->vy += q * sin (p);
-	    }
-	    part->vt = rRange (e->vt, e->dvt);		// Aging speed
-	    if (part->vt > -0.0001)
-		part->vt = -0.0001;
-
-	    //Size, Gravity and Rotation
-	    part->s = rRange (e->s, e->ds);		// Particle size
-	    part->snew = rRange (e->snew, e->dsnew);	// Particle start size
-	    if (e->gp > (float)(random () & 0xffff) / 65535.)
-		part->g = rRange (e->g, e->dg);		// Particle gravity
+	//Speed
+	part->vx = rRange (e->vx, e->dvx);		// X Speed
+	part->vy = rRange (e->vy, e->dvy);		// Y Speed
+	if ((q = rRange (e->dvcirc/2.,e->dvcirc/2.)) > 0)
+	{
+	    p = rRange (0, M_PI);
+	    part->vx += q * cos (p);
+	    part->vy += q * sin (p);
+	}
+	part->vt = rRange (e->vt, e->dvt);		// Aging speed
+	if (part->vt > -0.0001)
+	    part->vt = -0.0001;
+
+	//Size, Gravity and Rotation
+	part->s = rRange (e->s, e->ds);		// Particle size
+	part->snew = rRange (e->snew, e->dsnew);	// Particle start size
+	if (e->gp > (float)(random () & 0xffff) / 65535.)
+	    part->g = rRange (e->g, e->dg);		// Particle gravity
+	else
+	    part->g = 0.;
+	part->phi = rRange (0, M_PI);		// Random orientation
+	part->vphi = rRange (e->vphi, e->dvphi);	// Rotation speed
+
+	//Alpha
+	part->a = rRange (e->a, e->da);		// Alpha
+	if (part->a > 1)
+	    part->a = 1.;
+	else if (part->a < 0)
+	    part->a = 0.;
+
+	//HSL to RGB conversion from Wikipedia simplified by S = 1
+	h = rRange (e->h, e->dh); //Random hue within range
+	if (h < 0)
+	    h += 1.;
+	else if (t > 1)
+	    h -= 1.;
+	l = rRange (e->l, e->dl); //Random lightness ...
+	if (l > 1)
+	    l = 1.;
+	else if (l < 0)
+	    l = 0.;
+	q = e->l * 2;
+	if (q > 1)
+	    q = 1.;
+	p = 2 * e->l - q;
+	for (j = 0; j < 3; j++)
+	{
+	    t = h + (1-j)/3.;
+	    if (t < 0)
+		t += 1.;
+	    else if (t > 1)
+		t -= 1.;
+	    if (t < 1/6.)
+		part->c[j] = p + ((q-p)*6*t);
+	    else if (t < .5)
+		part->c[j] = q;
+	    else if (t < 2/3.)
+		part->c[j] = p + ((q-p)*6*(2/3.-t));
 	    else
-		part->g = 0.;
-	    part->phi = rRange (0, M_PI);		// Random orientation
-	    part->vphi = rRange (e->vphi, e->dvphi);	// Rotation speed
-
-	    //Alpha
-	    part->a = rRange (e->a, e->da);		// Alpha
-	    if (part->a > 1)
-		part->a = 1.;
-	    else if (part->a < 0)
-		part->a = 0.;
-
-	    //HSL to RGB conversion from Wikipedia simplified by S = 1
-            h = rRange (e->h, e->dh); //Random hue within range
-	    if (h < 0)
-		h += 1.;
-            else if (t > 1)
-		h -= 1.;
-            l = rRange (e->l, e->dl); //Random lightness ...
-	    if (l > 1)
-		l = 1.;
-	    else if (l < 0)
-		l = 0.;
-	    q = e->l * 2;
-	    if (q > 1)
-		q = 1.;
-	    p = 2 * e->l - q;
-	    for (j = 0; j < 3; j++)
-	    {
-		t = h + (1-j)/3.;
-                if (t < 0)
-		    t += 1.;
-                else if (t > 1)
-		    t -= 1.;
-		if (t < 1/6.)
-		    part->c[j] = p + ((q-p)*6*t);
-		else if (t < .5)
-		    part->c[j] = q;
-		else if (t < 2/3.)
-		    part->c[j] = p + ((q-p)*6*(2/3.-t));
-		else
-		    part->c[j] = p;
-	    }
+		part->c[j] = p;
+	}
 
-	    // give new life
-	    part->t = 1.;
+	// give new life
+	part->t = 1.;
 
-	    ps->active = TRUE;
-	    count -= 1;
-	}
+	ps->active = TRUE;
+	count -= 1;
     }
 }
 
@@ -825,7 +1078,7 @@ damageRegion (CompScreen *s)
 
     p = ws->ps->particles;
 
-    for (i = 0; i < ws->ps->hardLimit; i++, p++)
+    for (i = 0; i < ws->ps->numAlive; i++, p++)
     {
 	cOff = p->s / 2;
 	if (p->t > ws->ps->tnew)
@@ -919,6 +1172,7 @@ wizardPreparePaintScreen (CompScreen *s, int time)
 	ws->ps->told = wizardGetTold (s);
 	ws->ps->gx = wizardGetGx (s);
 	ws->ps->gy = wizardGetGy (s);
+	ws->ps->gtheta = wizardGetGTheta (s);
 
 	glGenTextures (1, &ws->ps->tex);
 	glBindTexture (GL_TEXTURE_2D, ws->ps->tex);